@@ -0,0 +1,296 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/cbor.h>
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* CBOR major types */
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT     3
+#define CBOR_ARRAY    4
+#define CBOR_MAP      5
+#define CBOR_TAG      6
+
+/* Simple values and special encodings */
+#define CBOR_FALSE      0xf4
+#define CBOR_TRUE       0xf5
+#define CBOR_NULL       0xf6
+#define CBOR_FLOAT32    0xfa
+#define CBOR_FLOAT64    0xfb
+#define CBOR_BREAK      0xff
+#define CBOR_MAP_INDEFINITE ((CBOR_MAP << 5) | 31)
+
+/* Tags */
+#define CBOR_TAG_STRINGREF 25
+#define CBOR_TAG_STRINGREF_NAMESPACE 256
+#define CBOR_TAG_SELF_DESCRIBED 55799
+
+/* String seen before, identified by its index in the stringref table */
+struct nw_cbor_string {
+  const char *str;
+  uint32_t length;
+  uint32_t index;
+};
+
+struct nw_cbor_encoder {
+  struct nw_cbor_buffer *buffer;
+  /* Open addressing table of strings added to the stringref table */
+  struct nw_cbor_string *strings;
+  size_t strings_size;
+  uint32_t strings_count;
+  bool error;
+};
+
+static void nw_cbor_put(struct nw_cbor_encoder *enc, const void *data, size_t length)
+{
+  struct nw_cbor_buffer *buffer = enc->buffer;
+  if (enc->error)
+    return;
+
+  if (buffer->length + length > buffer->size) {
+    size_t size = buffer->size ? buffer->size : 4096;
+    while (size < buffer->length + length)
+      size *= 2;
+
+    uint8_t *data = realloc(buffer->data, size);
+    if (!data) {
+      enc->error = true;
+      return;
+    }
+
+    buffer->data = data;
+    buffer->size = size;
+  }
+
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static void nw_cbor_put_head(struct nw_cbor_encoder *enc, uint8_t major, uint64_t value)
+{
+  uint8_t head[9];
+  size_t length;
+
+  major <<= 5;
+  if (value < 24) {
+    head[0] = major | value;
+    length = 1;
+  } else if (value <= UINT8_MAX) {
+    head[0] = major | 24;
+    length = 2;
+  } else if (value <= UINT16_MAX) {
+    head[0] = major | 25;
+    length = 3;
+  } else if (value <= UINT32_MAX) {
+    head[0] = major | 26;
+    length = 5;
+  } else {
+    head[0] = major | 27;
+    length = 9;
+  }
+
+  /* Arguments are stored in network byte order */
+  for (size_t i = length - 1; i > 0; i--, value >>= 8)
+    head[i] = value & 0xff;
+
+  nw_cbor_put(enc, head, length);
+}
+
+static void nw_cbor_put_byte(struct nw_cbor_encoder *enc, uint8_t value)
+{
+  nw_cbor_put(enc, &value, 1);
+}
+
+static void nw_cbor_put_double(struct nw_cbor_encoder *enc, double value)
+{
+  uint8_t data[9];
+  size_t length;
+
+  /* Use single precision when no precision is lost */
+  float single = (value >= -FLT_MAX && value <= FLT_MAX) ? (float) value : 0;
+  if ((double) single == value) {
+    uint32_t bits;
+    memcpy(&bits, &single, sizeof(bits));
+    data[0] = CBOR_FLOAT32;
+    for (int i = 4; i > 0; i--, bits >>= 8)
+      data[i] = bits & 0xff;
+    length = 5;
+  } else {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    data[0] = CBOR_FLOAT64;
+    for (int i = 8; i > 0; i--, bits >>= 8)
+      data[i] = bits & 0xff;
+    length = 9;
+  }
+
+  nw_cbor_put(enc, data, length);
+}
+
+/**
+ * Returns the minimum length of a string to be added to a stringref
+ * table currently holding the given number of strings.
+ */
+static uint32_t nw_cbor_stringref_min_length(uint32_t count)
+{
+  if (count < 24)
+    return 3;
+  else if (count < 256)
+    return 4;
+  else if (count < 65536)
+    return 5;
+  return 7;
+}
+
+static struct nw_cbor_string *nw_cbor_string_slot(struct nw_cbor_string *table,
+                                                  size_t size,
+                                                  const char *str,
+                                                  uint32_t length)
+{
+  /* FNV-1a over the string. */
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < length; i++)
+    hash = (hash ^ (uint8_t) str[i]) * 16777619u;
+
+  size_t mask = size - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    if (!table[i].str || (table[i].length == length && !memcmp(table[i].str, str, length)))
+      return &table[i];
+  }
+}
+
+static void nw_cbor_put_string(struct nw_cbor_encoder *enc, const char *str, uint32_t length)
+{
+  if (length < 3) {
+    /* Too short to ever be added to the stringref table. */
+    nw_cbor_put_head(enc, CBOR_TEXT, length);
+    nw_cbor_put(enc, str, length);
+    return;
+  }
+
+  /* Keep the table at most half full. */
+  if ((enc->strings_count + 1) * 2 > enc->strings_size) {
+    size_t size = enc->strings_size ? enc->strings_size * 2 : 256;
+    struct nw_cbor_string *table = calloc(size, sizeof(struct nw_cbor_string));
+    if (!table) {
+      enc->error = true;
+      return;
+    }
+
+    for (size_t i = 0; i < enc->strings_size; i++) {
+      struct nw_cbor_string *string = &enc->strings[i];
+      if (string->str)
+        *nw_cbor_string_slot(table, size, string->str, string->length) = *string;
+    }
+
+    free(enc->strings);
+    enc->strings = table;
+    enc->strings_size = size;
+  }
+
+  struct nw_cbor_string *string = nw_cbor_string_slot(enc->strings, enc->strings_size, str, length);
+  if (string->str) {
+    nw_cbor_put_head(enc, CBOR_TAG, CBOR_TAG_STRINGREF);
+    nw_cbor_put_head(enc, CBOR_UNSIGNED, string->index);
+    return;
+  }
+
+  /* Decoders add every literal string that is long enough, so must we. */
+  if (length >= nw_cbor_stringref_min_length(enc->strings_count)) {
+    string->str = str;
+    string->length = length;
+    string->index = enc->strings_count++;
+  }
+
+  nw_cbor_put_head(enc, CBOR_TEXT, length);
+  nw_cbor_put(enc, str, length);
+}
+
+static void nw_cbor_encode_value(struct nw_cbor_encoder *enc, json_object *object)
+{
+  switch (json_object_get_type(object)) {
+    case json_type_null: nw_cbor_put_byte(enc, CBOR_NULL); break;
+    case json_type_boolean: {
+      nw_cbor_put_byte(enc, json_object_get_boolean(object) ? CBOR_TRUE : CBOR_FALSE);
+      break;
+    }
+    case json_type_int: {
+      int64_t value = json_object_get_int64(object);
+      if (value >= 0)
+        nw_cbor_put_head(enc, CBOR_UNSIGNED, (uint64_t) value);
+      else
+        nw_cbor_put_head(enc, CBOR_NEGATIVE, (uint64_t) (-1 - value));
+      break;
+    }
+    case json_type_double: nw_cbor_put_double(enc, json_object_get_double(object)); break;
+    case json_type_string: {
+      nw_cbor_put_string(enc, json_object_get_string(object), json_object_get_string_len(object));
+      break;
+    }
+    case json_type_array: {
+      int length = json_object_array_length(object);
+      nw_cbor_put_head(enc, CBOR_ARRAY, length);
+      for (int i = 0; i < length; i++)
+        nw_cbor_encode_value(enc, json_object_array_get_idx(object, i));
+      break;
+    }
+    case json_type_object: {
+      /* Maps are emitted with indefinite length, so members need not be counted. */
+      nw_cbor_put_byte(enc, CBOR_MAP_INDEFINITE);
+      json_object_object_foreach(object, key, value) {
+        nw_cbor_put_string(enc, key, strlen(key));
+        nw_cbor_encode_value(enc, value);
+      }
+      nw_cbor_put_byte(enc, CBOR_BREAK);
+      break;
+    }
+    default: nw_cbor_put_byte(enc, CBOR_NULL); break;
+  }
+}
+
+int nw_cbor_encode(json_object *object, struct nw_cbor_buffer *buffer)
+{
+  struct nw_cbor_encoder enc;
+  memset(&enc, 0, sizeof(enc));
+  enc.buffer = buffer;
+  buffer->length = 0;
+
+  nw_cbor_put_head(&enc, CBOR_TAG, CBOR_TAG_SELF_DESCRIBED);
+  nw_cbor_put_head(&enc, CBOR_TAG, CBOR_TAG_STRINGREF_NAMESPACE);
+  nw_cbor_encode_value(&enc, object);
+
+  free(enc.strings);
+  if (enc.error) {
+    buffer->length = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void nw_cbor_buffer_free(struct nw_cbor_buffer *buffer)
+{
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->size = 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/client_id.h>
+#include <nodewatcher-agent/utils.h>
+
+#include <libubox/md5.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define NW_CLIENT_ID_SALT "nw-client-c3U0XX"
+#define NW_CLIENT_ID_SALT_LENGTH 16
+
+/* Maximum number of cached client identifiers */
+#define NW_CLIENT_ID_CACHE_SIZE 1024
+/* Number of hash buckets (must be a power of two) */
+#define NW_CLIENT_ID_CACHE_BUCKETS 2048
+
+/* Cached client identifier; links are entry positions + 1 (zero for none) */
+struct nw_client_id_entry {
+  /* Raw MAC address */
+  uint8_t mac[6];
+  /* Encoded client identifier */
+  char client_id[NW_CLIENT_ID_LENGTH + 1];
+  /* Next entry in the same hash bucket */
+  int hash_next;
+  /* Neighbouring entries in recently used order */
+  int lru_prev;
+  int lru_next;
+};
+
+/* Cache entries and hash buckets */
+static struct nw_client_id_entry cache_entries[NW_CLIENT_ID_CACHE_SIZE];
+static int cache_buckets[NW_CLIENT_ID_CACHE_BUCKETS];
+static int cache_count = 0;
+/* Most and least recently used entries */
+static int lru_head = 0;
+static int lru_tail = 0;
+
+/* MD5 context with the salt already hashed in */
+static md5_ctx_t salted_ctx;
+static bool salted_ctx_ready = false;
+
+/* Cache statistics */
+static unsigned int cache_hits = 0;
+static unsigned int cache_misses = 0;
+
+static unsigned int nw_client_id_hash(const uint8_t *mac)
+{
+  /* The last bytes of a MAC address are the most random ones */
+  unsigned int hash = mac[5] | (mac[4] << 8) | (mac[3] << 16);
+  hash ^= mac[2] * 31 + mac[1] * 7 + mac[0];
+  return hash & (NW_CLIENT_ID_CACHE_BUCKETS - 1);
+}
+
+static void nw_client_id_lru_unlink(int position)
+{
+  struct nw_client_id_entry *entry = &cache_entries[position - 1];
+  if (entry->lru_prev)
+    cache_entries[entry->lru_prev - 1].lru_next = entry->lru_next;
+  else
+    lru_head = entry->lru_next;
+
+  if (entry->lru_next)
+    cache_entries[entry->lru_next - 1].lru_prev = entry->lru_prev;
+  else
+    lru_tail = entry->lru_prev;
+}
+
+static void nw_client_id_lru_push(int position)
+{
+  struct nw_client_id_entry *entry = &cache_entries[position - 1];
+  entry->lru_prev = 0;
+  entry->lru_next = lru_head;
+  if (lru_head)
+    cache_entries[lru_head - 1].lru_prev = position;
+  else
+    lru_tail = position;
+  lru_head = position;
+}
+
+static void nw_client_id_bucket_remove(int position)
+{
+  struct nw_client_id_entry *entry = &cache_entries[position - 1];
+  int *link = &cache_buckets[nw_client_id_hash(entry->mac)];
+  while (*link && *link != position)
+    link = &cache_entries[*link - 1].hash_next;
+  if (*link)
+    *link = entry->hash_next;
+}
+
+static int nw_client_id_compute(const uint8_t *mac, char *client_id)
+{
+  static const char hex[] = "0123456789abcdef";
+  char mac_address[17];
+  uint8_t raw_mac_id[16];
+
+  if (!salted_ctx_ready) {
+    md5_begin(&salted_ctx);
+    md5_hash(NW_CLIENT_ID_SALT, NW_CLIENT_ID_SALT_LENGTH, &salted_ctx);
+    salted_ctx_ready = true;
+  }
+
+  /* Format the MAC address the same way as it is stored in DHCP leases */
+  for (int i = 0; i < 6; i++) {
+    mac_address[i * 3] = hex[mac[i] >> 4];
+    mac_address[i * 3 + 1] = hex[mac[i] & 0x0f];
+    if (i < 5)
+      mac_address[i * 3 + 2] = ':';
+  }
+
+  /* Compute salted hash of MAC address */
+  md5_ctx_t ctx = salted_ctx;
+  md5_hash(mac_address, sizeof(mac_address), &ctx);
+  md5_end(raw_mac_id, &ctx);
+
+  /* Base64 encode the hash so it is more compact */
+  return nw_base64_encode(raw_mac_id, sizeof(raw_mac_id), client_id, NW_CLIENT_ID_LENGTH + 1);
+}
+
+int nw_client_id_from_mac(const uint8_t *mac, char *client_id)
+{
+  unsigned int bucket = nw_client_id_hash(mac);
+  int position;
+
+  for (position = cache_buckets[bucket]; position; position = cache_entries[position - 1].hash_next) {
+    struct nw_client_id_entry *entry = &cache_entries[position - 1];
+    if (memcmp(entry->mac, mac, sizeof(entry->mac)) != 0)
+      continue;
+
+    /* Mark entry as most recently used */
+    if (lru_head != position) {
+      nw_client_id_lru_unlink(position);
+      nw_client_id_lru_push(position);
+    }
+
+    memcpy(client_id, entry->client_id, NW_CLIENT_ID_LENGTH + 1);
+    cache_hits++;
+    return 0;
+  }
+
+  cache_misses++;
+  if (nw_client_id_compute(mac, client_id) != 0)
+    return -1;
+
+  /* Reuse the least recently used entry when the cache is full */
+  if (cache_count < NW_CLIENT_ID_CACHE_SIZE) {
+    position = ++cache_count;
+  } else {
+    position = lru_tail;
+    nw_client_id_lru_unlink(position);
+    nw_client_id_bucket_remove(position);
+  }
+
+  struct nw_client_id_entry *entry = &cache_entries[position - 1];
+  memcpy(entry->mac, mac, sizeof(entry->mac));
+  memcpy(entry->client_id, client_id, NW_CLIENT_ID_LENGTH + 1);
+  entry->hash_next = cache_buckets[bucket];
+  cache_buckets[bucket] = position;
+  nw_client_id_lru_push(position);
+  return 0;
+}
+
+static int nw_client_id_hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+int nw_client_id_parse_mac(const char *mac, uint8_t *raw_mac)
+{
+  for (int i = 0; i < 6; i++, mac += 3) {
+    int high = nw_client_id_hex_digit(mac[0]);
+    int low = high < 0 ? -1 : nw_client_id_hex_digit(mac[1]);
+    if (low < 0 || (i < 5 && mac[2] != ':'))
+      return -1;
+
+    raw_mac[i] = (high << 4) | low;
+  }
+
+  return 0;
+}
+
+int nw_client_id_from_string(const char *mac, char *client_id)
+{
+  uint8_t raw_mac[6];
+  if (nw_client_id_parse_mac(mac, raw_mac) != 0)
+    return -1;
+
+  return nw_client_id_from_mac(raw_mac, client_id);
+}
+
+void nw_client_id_get_stats(json_object *object)
+{
+  json_object *stats = json_object_new_object();
+  json_object_object_add(stats, "entries", json_object_new_int(cache_count));
+  json_object_object_add(stats, "hits", json_object_new_int(cache_hits));
+  json_object_object_add(stats, "misses", json_object_new_int(cache_misses));
+  json_object_object_add(object, "client_id_cache", stats);
+}
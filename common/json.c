@@ -21,6 +21,7 @@
 
 #include <string.h>
 #include <ctype.h>
+#include <stdlib.h>
 
 int nw_json_from_uci(struct uci_context *uci,
                      const char *location,
@@ -175,3 +176,251 @@ void nw_json_from_ubus(struct ubus_request *req,
   /* Convert the response to JSON objects */
   nw_json_from_blob(msg, true, (json_object**) req->priv);
 }
+
+/* Streaming parser lexer states */
+enum {
+  NW_JSON_STREAM_LEX_NONE = 0,
+  NW_JSON_STREAM_LEX_STRING,
+  NW_JSON_STREAM_LEX_ESCAPE,
+  NW_JSON_STREAM_LEX_UNICODE,
+  NW_JSON_STREAM_LEX_PRIMITIVE,
+};
+
+void nw_json_stream_init(struct nw_json_stream *stream,
+                         nw_json_stream_cb cb,
+                         void *priv)
+{
+  memset(stream, 0, sizeof(struct nw_json_stream));
+  stream->cb = cb;
+  stream->priv = priv;
+}
+
+static void nw_json_stream_token_append(struct nw_json_stream *stream, char c)
+{
+  if (stream->token_length < sizeof(stream->token) - 1)
+    stream->token[stream->token_length++] = c;
+}
+
+static void nw_json_stream_set_path(struct nw_json_stream *stream, size_t base, const char *suffix, bool separator)
+{
+  size_t length = base;
+  if (separator && base > 0 && length < sizeof(stream->path) - 1)
+    stream->path[length++] = '.';
+  while (*suffix && length < sizeof(stream->path) - 1)
+    stream->path[length++] = *suffix++;
+
+  stream->path[length] = 0;
+  stream->path_length = length;
+}
+
+/**
+ * Handles completion of a value at the current path.
+ */
+static void nw_json_stream_value_done(struct nw_json_stream *stream)
+{
+  if (stream->depth == 0)
+    stream->done = true;
+}
+
+static int nw_json_stream_push(struct nw_json_stream *stream, bool object)
+{
+  if (stream->depth > 0 && stream->stack[stream->depth - 1].expect_key)
+    return -1;
+  if (stream->depth >= NW_JSON_STREAM_MAX_DEPTH)
+    return -1;
+
+  stream->cb(stream->priv, object ? NW_JSON_STREAM_OBJECT_START : NW_JSON_STREAM_ARRAY_START, stream->path, NULL);
+  stream->stack[stream->depth].object = object;
+  stream->stack[stream->depth].expect_key = object;
+  stream->stack[stream->depth].path_length = stream->path_length;
+  stream->depth++;
+
+  /* Array elements share a single path. */
+  if (!object)
+    nw_json_stream_set_path(stream, stream->path_length, "[]", false);
+  return 0;
+}
+
+static int nw_json_stream_pop(struct nw_json_stream *stream, bool object)
+{
+  if (stream->depth == 0 || stream->stack[stream->depth - 1].object != object)
+    return -1;
+
+  stream->depth--;
+  stream->path_length = stream->stack[stream->depth].path_length;
+  stream->path[stream->path_length] = 0;
+  stream->cb(stream->priv, object ? NW_JSON_STREAM_OBJECT_END : NW_JSON_STREAM_ARRAY_END, stream->path, NULL);
+  nw_json_stream_value_done(stream);
+  return 0;
+}
+
+static void nw_json_stream_scalar(struct nw_json_stream *stream, enum nw_json_stream_event event)
+{
+  stream->token[stream->token_length] = 0;
+
+  /* Strings in place of object keys extend the path. */
+  if (event == NW_JSON_STREAM_STRING && stream->depth > 0 && stream->stack[stream->depth - 1].expect_key) {
+    stream->stack[stream->depth - 1].expect_key = false;
+    nw_json_stream_set_path(stream, stream->stack[stream->depth - 1].path_length, stream->token, true);
+    return;
+  }
+
+  stream->cb(stream->priv, event, stream->path, stream->token);
+  nw_json_stream_value_done(stream);
+}
+
+static void nw_json_stream_utf8(struct nw_json_stream *stream, unsigned int c)
+{
+  if (c < 0x80) {
+    nw_json_stream_token_append(stream, c);
+  } else if (c < 0x800) {
+    nw_json_stream_token_append(stream, 0xc0 | (c >> 6));
+    nw_json_stream_token_append(stream, 0x80 | (c & 0x3f));
+  } else {
+    nw_json_stream_token_append(stream, 0xe0 | (c >> 12));
+    nw_json_stream_token_append(stream, 0x80 | ((c >> 6) & 0x3f));
+    nw_json_stream_token_append(stream, 0x80 | (c & 0x3f));
+  }
+}
+
+int nw_json_stream_parse(struct nw_json_stream *stream,
+                         const char *data,
+                         size_t length)
+{
+  for (size_t i = 0; i < length && !stream->error; i++) {
+    char c = data[i];
+    if (stream->done) {
+      if (isspace((unsigned char) c))
+        continue;
+
+      /* Only whitespace may follow the document, unless it is a sequence. */
+      if (!stream->sequence) {
+        stream->error = true;
+        continue;
+      }
+
+      stream->done = false;
+      stream->path_length = 0;
+      stream->path[0] = 0;
+    }
+
+    switch (stream->state) {
+      case NW_JSON_STREAM_LEX_STRING: {
+        if (c == '"') {
+          stream->state = NW_JSON_STREAM_LEX_NONE;
+          nw_json_stream_scalar(stream, NW_JSON_STREAM_STRING);
+        } else if (c == '\\') {
+          stream->state = NW_JSON_STREAM_LEX_ESCAPE;
+        } else {
+          nw_json_stream_token_append(stream, c);
+        }
+        continue;
+      }
+      case NW_JSON_STREAM_LEX_ESCAPE: {
+        stream->state = NW_JSON_STREAM_LEX_STRING;
+        switch (c) {
+          case 'b': nw_json_stream_token_append(stream, '\b'); break;
+          case 'f': nw_json_stream_token_append(stream, '\f'); break;
+          case 'n': nw_json_stream_token_append(stream, '\n'); break;
+          case 'r': nw_json_stream_token_append(stream, '\r'); break;
+          case 't': nw_json_stream_token_append(stream, '\t'); break;
+          case 'u': {
+            stream->state = NW_JSON_STREAM_LEX_UNICODE;
+            stream->unicode = 0;
+            stream->unicode_digits = 0;
+            break;
+          }
+          default: nw_json_stream_token_append(stream, c); break;
+        }
+        continue;
+      }
+      case NW_JSON_STREAM_LEX_UNICODE: {
+        if (!isxdigit((unsigned char) c)) {
+          stream->error = true;
+          continue;
+        }
+
+        stream->unicode = (stream->unicode << 4) | (isdigit((unsigned char) c) ? c - '0' : (tolower((unsigned char) c) - 'a' + 10));
+        if (++stream->unicode_digits == 4) {
+          nw_json_stream_utf8(stream, stream->unicode);
+          stream->state = NW_JSON_STREAM_LEX_STRING;
+        }
+        continue;
+      }
+      case NW_JSON_STREAM_LEX_PRIMITIVE: {
+        if (isalnum((unsigned char) c) || c == '.' || c == '-' || c == '+') {
+          nw_json_stream_token_append(stream, c);
+          continue;
+        }
+
+        /* Delimiter ends the primitive and is processed below. */
+        stream->state = NW_JSON_STREAM_LEX_NONE;
+        nw_json_stream_scalar(stream, NW_JSON_STREAM_PRIMITIVE);
+        if (stream->done && !isspace((unsigned char) c))
+          stream->error = true;
+        break;
+      }
+      default: break;
+    }
+
+    if (stream->done)
+      continue;
+
+    switch (c) {
+      case ' ': case '\t': case '\r': case '\n': break;
+      case '{': stream->error = nw_json_stream_push(stream, true) != 0; break;
+      case '[': stream->error = nw_json_stream_push(stream, false) != 0; break;
+      case '}': stream->error = nw_json_stream_pop(stream, true) != 0; break;
+      case ']': stream->error = nw_json_stream_pop(stream, false) != 0; break;
+      case ':': break;
+      case ',': {
+        if (stream->depth == 0) {
+          stream->error = true;
+        } else if (stream->stack[stream->depth - 1].object) {
+          /* Next member of an object. */
+          stream->stack[stream->depth - 1].expect_key = true;
+        }
+        break;
+      }
+      case '"': {
+        stream->state = NW_JSON_STREAM_LEX_STRING;
+        stream->token_length = 0;
+        break;
+      }
+      default: {
+        if (!isalnum((unsigned char) c) && c != '-') {
+          stream->error = true;
+          break;
+        }
+
+        stream->state = NW_JSON_STREAM_LEX_PRIMITIVE;
+        stream->token_length = 0;
+        nw_json_stream_token_append(stream, c);
+        break;
+      }
+    }
+  }
+
+  if (stream->error)
+    return -1;
+  return stream->done ? 1 : 0;
+}
+
+json_object *nw_json_stream_value(enum nw_json_stream_event event,
+                                  const char *value)
+{
+  if (event == NW_JSON_STREAM_STRING)
+    return json_object_new_string(value);
+
+  if (!strcmp(value, "true"))
+    return json_object_new_boolean(true);
+  if (!strcmp(value, "false"))
+    return json_object_new_boolean(false);
+  if (!strcmp(value, "null"))
+    return NULL;
+
+  /* Numbers keep their integer or floating point type. */
+  if (strpbrk(value, ".eE"))
+    return json_object_new_double(strtod(value, NULL));
+  return json_object_new_int64(strtoll(value, NULL, 10));
+}
@@ -19,6 +19,8 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/scheduler.h>
 #include <nodewatcher-agent/output.h>
+#include <nodewatcher-agent/ubus.h>
+#include <nodewatcher-agent/client_id.h>
 
 #include <libubox/avl-cmp.h>
 #include <libubox/blobmsg_json.h>
@@ -38,6 +40,8 @@ static struct ubus_context *module_ubus;
 static struct uci_context *module_uci;
 /* Ubus reply buffer */
 static struct blob_buf reply_buf;
+/* Agent ubus object */
+static struct ubus_object agent_object;
 
 enum {
   AGENT_D_MODULE,
@@ -134,6 +138,24 @@ static int nw_handle_module_get_data(struct ubus_context *ctx, struct ubus_objec
   return UBUS_STATUS_OK;
 }
 
+static int nw_handle_module_get_stats(struct ubus_context *ctx, struct ubus_object *obj,
+                                      struct ubus_request_data *req, const char *method,
+                                      struct blob_attr *msg)
+{
+  /* Collect internal agent statistics */
+  json_object *stats = json_object_new_object();
+  nw_ubus_get_stats(stats);
+  nw_client_id_get_stats(stats);
+
+  blob_buf_init(&reply_buf, 0);
+  blobmsg_add_object(&reply_buf, stats);
+  json_object_put(stats);
+
+  ubus_send_reply(ctx, req, reply_buf.head);
+
+  return UBUS_STATUS_OK;
+}
+
 int nw_module_init(struct ubus_context *ubus, struct uci_context *uci)
 {
   /* Initialize ubus and UCI contexts */
@@ -170,19 +192,23 @@ int nw_module_init(struct ubus_context *ubus, struct uci_context *uci)
   /* Initialize ubus methods */
   static const struct ubus_method agent_methods[] = {
     UBUS_METHOD("get_data", nw_handle_module_get_data, nw_module_policy),
+    UBUS_METHOD_NOARG("get_stats", nw_handle_module_get_stats),
   };
 
   static struct ubus_object_type agent_type =
     UBUS_OBJECT_TYPE("nodewatcher-agent", agent_methods);
 
-  static struct ubus_object obj = {
-    .name = "nodewatcher.agent",
-    .type = &agent_type,
-    .methods = agent_methods,
-    .n_methods = ARRAY_SIZE(agent_methods),
-  };
+  agent_object.name = "nodewatcher.agent";
+  agent_object.type = &agent_type;
+  agent_object.methods = agent_methods;
+  agent_object.n_methods = ARRAY_SIZE(agent_methods);
 
-  return ubus_add_object(ubus, &obj);
+  return ubus_add_object(ubus, &agent_object);
+}
+
+struct ubus_object *nw_module_get_ubus_object()
+{
+  return &agent_object;
 }
 
 int nw_module_start_acquire_data(struct nodewatcher_module *module)
@@ -0,0 +1,235 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/netlink.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/genetlink.h>
+
+/* Receive buffer shared by all netlink sockets (the agent is single-threaded) */
+static char netlink_buffer[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+int nw_netlink_open(struct nw_netlink *nl, int protocol)
+{
+  struct sockaddr_nl local = { .nl_family = AF_NETLINK, };
+  struct timeval timeout = { .tv_sec = 1, .tv_usec = 0, };
+
+  nl->seq = 0;
+  nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+  if (nl->fd < 0)
+    return -1;
+
+  /* Never block the event loop for long if the kernel does not respond */
+  setsockopt(nl->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (bind(nl->fd, (struct sockaddr*) &local, sizeof(local)) < 0) {
+    close(nl->fd);
+    nl->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void nw_netlink_close(struct nw_netlink *nl)
+{
+  if (nl->fd >= 0)
+    close(nl->fd);
+  nl->fd = -1;
+}
+
+int nw_netlink_request(struct nw_netlink *nl,
+                       struct nlmsghdr *request,
+                       nw_netlink_cb cb,
+                       void *priv)
+{
+  struct sockaddr_nl kernel = { .nl_family = AF_NETLINK, };
+
+  if (nl->fd < 0)
+    return -EBADF;
+
+  request->nlmsg_seq = ++nl->seq;
+  request->nlmsg_pid = 0;
+  request->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+
+  if (sendto(nl->fd, request, request->nlmsg_len, 0, (struct sockaddr*) &kernel, sizeof(kernel)) < 0)
+    return -errno;
+
+  /* Process responses until the request has been completed */
+  bool aborted = false;
+  for (;;) {
+    ssize_t length = recv(nl->fd, netlink_buffer, sizeof(netlink_buffer), 0);
+    if (length < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    struct nlmsghdr *hdr;
+    for (hdr = (struct nlmsghdr*) netlink_buffer; NLMSG_OK(hdr, length); hdr = NLMSG_NEXT(hdr, length)) {
+      /* Skip stale responses to earlier requests */
+      if (hdr->nlmsg_seq != nl->seq)
+        continue;
+
+      if (hdr->nlmsg_type == NLMSG_DONE)
+        return aborted ? -ECANCELED : 0;
+
+      if (hdr->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *err = (struct nlmsgerr*) NLMSG_DATA(hdr);
+        if (aborted)
+          return -ECANCELED;
+        return err->error;
+      }
+
+      if (hdr->nlmsg_type == NLMSG_NOOP || aborted || !cb)
+        continue;
+
+      if (cb(hdr, priv) != 0)
+        aborted = true;
+    }
+  }
+}
+
+/* Generic netlink family lookup state */
+struct nw_netlink_genl_lookup {
+  /* Multicast group name or NULL */
+  const char *group;
+  /* Family identifier */
+  uint16_t family;
+  /* Multicast group identifier */
+  uint32_t group_id;
+};
+
+static int nw_netlink_genl_family_cb(struct nlmsghdr *hdr, void *priv)
+{
+  struct nw_netlink_genl_lookup *lookup = (struct nw_netlink_genl_lookup*) priv;
+  struct nlattr *tb[CTRL_ATTR_MAX + 1];
+  nw_netlink_parse_attrs(tb, CTRL_ATTR_MAX, (char*) NLMSG_DATA(hdr) + GENL_HDRLEN,
+    hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+
+  if (tb[CTRL_ATTR_FAMILY_ID])
+    lookup->family = nw_nla_get_u16(tb[CTRL_ATTR_FAMILY_ID]);
+
+  if (lookup->group && tb[CTRL_ATTR_MCAST_GROUPS]) {
+    struct nlattr *group;
+    int rem;
+    nw_nla_for_each_nested(group, tb[CTRL_ATTR_MCAST_GROUPS], rem) {
+      struct nlattr *tb_group[CTRL_ATTR_MCAST_GRP_MAX + 1];
+      nw_netlink_parse_attrs(tb_group, CTRL_ATTR_MCAST_GRP_MAX, nw_nla_data(group), nw_nla_len(group));
+      if (!tb_group[CTRL_ATTR_MCAST_GRP_NAME] || !tb_group[CTRL_ATTR_MCAST_GRP_ID])
+        continue;
+
+      if (strcmp(nw_nla_data(tb_group[CTRL_ATTR_MCAST_GRP_NAME]), lookup->group) == 0)
+        lookup->group_id = nw_nla_get_u32(tb_group[CTRL_ATTR_MCAST_GRP_ID]);
+    }
+  }
+
+  return 0;
+}
+
+static int nw_netlink_genl_lookup(struct nw_netlink *nl, const char *name, struct nw_netlink_genl_lookup *lookup)
+{
+  struct {
+    struct nlmsghdr hdr;
+    struct genlmsghdr genl;
+    char attrs[64];
+  } req;
+
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  req.hdr.nlmsg_type = GENL_ID_CTRL;
+  req.genl.cmd = CTRL_CMD_GETFAMILY;
+  req.genl.version = 1;
+  if (nw_netlink_put_attr(&req.hdr, sizeof(req), CTRL_ATTR_FAMILY_NAME, name, strlen(name) + 1) != 0)
+    return -EINVAL;
+
+  return nw_netlink_request(nl, &req.hdr, nw_netlink_genl_family_cb, lookup);
+}
+
+int nw_netlink_genl_family(struct nw_netlink *nl, const char *name, uint16_t *family)
+{
+  struct nw_netlink_genl_lookup lookup = { .group = NULL, };
+  int ret = nw_netlink_genl_lookup(nl, name, &lookup);
+  if (ret != 0)
+    return ret;
+  if (!lookup.family)
+    return -ENOENT;
+
+  *family = lookup.family;
+  return 0;
+}
+
+int nw_netlink_genl_subscribe(struct nw_netlink *nl, const char *name, const char *group)
+{
+  struct nw_netlink_genl_lookup lookup = { .group = group, };
+  int ret = nw_netlink_genl_lookup(nl, name, &lookup);
+  if (ret != 0)
+    return ret;
+  if (!lookup.group_id)
+    return -ENOENT;
+
+  if (setsockopt(nl->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &lookup.group_id, sizeof(lookup.group_id)) < 0)
+    return -errno;
+
+  return 0;
+}
+
+int nw_netlink_put_attr(struct nlmsghdr *hdr,
+                        size_t max_length,
+                        int type,
+                        const void *data,
+                        size_t length)
+{
+  struct nlattr *nla = (struct nlattr*) ((char*) hdr + NLMSG_ALIGN(hdr->nlmsg_len));
+  size_t total = NLA_HDRLEN + length;
+
+  if (NLMSG_ALIGN(hdr->nlmsg_len) + NLA_ALIGN(total) > max_length)
+    return -1;
+
+  nla->nla_type = type;
+  nla->nla_len = total;
+  if (length)
+    memcpy(nw_nla_data(nla), data, length);
+
+  hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + NLA_ALIGN(total);
+  return 0;
+}
+
+void nw_netlink_parse_attrs(struct nlattr **tb,
+                            int max,
+                            void *data,
+                            int length)
+{
+  struct nlattr *nla = (struct nlattr*) data;
+
+  memset(tb, 0, sizeof(struct nlattr*) * (max + 1));
+
+  while (length >= (int) sizeof(struct nlattr) && nla->nla_len >= sizeof(struct nlattr) && nla->nla_len <= length) {
+    int type = nla->nla_type & NLA_TYPE_MASK;
+    if (type <= max)
+      tb[type] = nla;
+
+    length -= NLA_ALIGN(nla->nla_len);
+    nla = (struct nlattr*) ((char*) nla + NLA_ALIGN(nla->nla_len));
+  }
+}
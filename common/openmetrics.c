@@ -0,0 +1,535 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/openmetrics.h>
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Maximum number of label pairs of a sample */
+#define NW_OPENMETRICS_MAX_LABELS 4
+
+enum nw_openmetrics_type {
+  NW_OPENMETRICS_GAUGE,
+  NW_OPENMETRICS_COUNTER,
+};
+
+/* Metric family, its header is written before the first sample */
+struct nw_openmetrics_family {
+  const char *name;
+  enum nw_openmetrics_type type;
+  const char *help;
+  bool started;
+};
+
+struct nw_openmetrics_writer {
+  struct nw_openmetrics_buffer *buffer;
+  bool error;
+};
+
+/* Sample labels, unused pairs have a NULL name */
+struct nw_openmetrics_labels {
+  const char *name[NW_OPENMETRICS_MAX_LABELS];
+  const char *value[NW_OPENMETRICS_MAX_LABELS];
+};
+
+/* Mapping of a data field to a metric family */
+struct nw_openmetrics_field {
+  const char *key;
+  struct nw_openmetrics_family family;
+  /* Multiplier converting the reported value into base units */
+  double scale;
+};
+
+static bool nw_openmetrics_reserve(struct nw_openmetrics_writer *w, size_t length)
+{
+  struct nw_openmetrics_buffer *buffer = w->buffer;
+  if (w->error)
+    return false;
+
+  if (buffer->length + length + 1 > buffer->size) {
+    size_t size = buffer->size ? buffer->size : 4096;
+    while (size < buffer->length + length + 1)
+      size *= 2;
+
+    char *data = realloc(buffer->data, size);
+    if (!data) {
+      w->error = true;
+      return false;
+    }
+
+    buffer->data = data;
+    buffer->size = size;
+  }
+
+  return true;
+}
+
+static void nw_openmetrics_printf(struct nw_openmetrics_writer *w, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  if (length < 0 || !nw_openmetrics_reserve(w, length))
+    return;
+
+  va_start(args, format);
+  vsnprintf(w->buffer->data + w->buffer->length, length + 1, format, args);
+  va_end(args);
+  w->buffer->length += length;
+}
+
+static void nw_openmetrics_put_escaped(struct nw_openmetrics_writer *w, const char *value)
+{
+  /* Worst case, every character is escaped. */
+  if (!nw_openmetrics_reserve(w, strlen(value) * 2))
+    return;
+
+  char *out = w->buffer->data + w->buffer->length;
+  for (const char *c = value; *c; c++) {
+    switch (*c) {
+      case '\\': *out++ = '\\'; *out++ = '\\'; break;
+      case '"': *out++ = '\\'; *out++ = '"'; break;
+      case '\n': *out++ = '\\'; *out++ = 'n'; break;
+      default: *out++ = *c; break;
+    }
+  }
+  w->buffer->length = out - w->buffer->data;
+}
+
+/**
+ * Formats a numeric JSON value (also accepting numeric strings) scaled
+ * by the given multiplier.
+ *
+ * @return True when the value is numeric
+ */
+static bool nw_openmetrics_format_value(json_object *value, double scale, char *out, size_t length)
+{
+  switch (json_object_get_type(value)) {
+    case json_type_int: {
+      if (scale == 1) {
+        snprintf(out, length, "%" PRId64, json_object_get_int64(value));
+        return true;
+      }
+      snprintf(out, length, "%.10g", (double) json_object_get_int64(value) * scale);
+      return true;
+    }
+    case json_type_double: {
+      snprintf(out, length, "%.10g", json_object_get_double(value) * scale);
+      return true;
+    }
+    case json_type_boolean: {
+      snprintf(out, length, "%d", json_object_get_boolean(value) ? 1 : 0);
+      return true;
+    }
+    case json_type_string: {
+      const char *str = json_object_get_string(value);
+      char *end;
+      double number = strtod(str, &end);
+      if (end == str || *end)
+        return false;
+      snprintf(out, length, "%.10g", number * scale);
+      return true;
+    }
+    default: return false;
+  }
+}
+
+static void nw_openmetrics_sample(struct nw_openmetrics_writer *w,
+                                  struct nw_openmetrics_family *family,
+                                  const struct nw_openmetrics_labels *labels,
+                                  json_object *value,
+                                  double scale)
+{
+  char formatted[64];
+  if (!value || !nw_openmetrics_format_value(value, scale, formatted, sizeof(formatted)))
+    return;
+
+  if (!family->started) {
+    family->started = true;
+    nw_openmetrics_printf(w, "# TYPE %s %s\n# HELP %s %s\n",
+      family->name, family->type == NW_OPENMETRICS_COUNTER ? "counter" : "gauge",
+      family->name, family->help);
+  }
+
+  nw_openmetrics_printf(w, "%s%s", family->name, family->type == NW_OPENMETRICS_COUNTER ? "_total" : "");
+  for (int i = 0; labels && i < NW_OPENMETRICS_MAX_LABELS && labels->name[i]; i++) {
+    nw_openmetrics_printf(w, "%s%s=\"", i ? "," : "{", labels->name[i]);
+    nw_openmetrics_put_escaped(w, labels->value[i]);
+    nw_openmetrics_printf(w, "\"");
+  }
+  nw_openmetrics_printf(w, "%s %s\n", labels && labels->name[0] ? "}" : "", formatted);
+}
+
+static json_object *nw_openmetrics_get(json_object *object, const char *key)
+{
+  json_object *value = NULL;
+  if (object && json_object_get_type(object) == json_type_object)
+    json_object_object_get_ex(object, key, &value);
+  return value;
+}
+
+static json_object *nw_openmetrics_get_path(json_object *object, const char *key1, const char *key2)
+{
+  return nw_openmetrics_get(nw_openmetrics_get(object, key1), key2);
+}
+
+static void nw_openmetrics_render_resources(struct nw_openmetrics_writer *w, json_object *resources)
+{
+  struct nw_openmetrics_labels labels = { { NULL, }, };
+
+  /* Load average */
+  static const char *periods[] = { "1m", "5m", "15m" };
+  struct nw_openmetrics_family load = { "nodewatcher_load_average", NW_OPENMETRICS_GAUGE, "System load average." };
+  json_object *load_average = nw_openmetrics_get(resources, "load_average");
+  if (load_average && json_object_get_type(load_average) == json_type_array) {
+    labels.name[0] = "period";
+    for (int i = 0; i < 3 && i < json_object_array_length(load_average); i++) {
+      labels.value[0] = periods[i];
+      nw_openmetrics_sample(w, &load, &labels, json_object_array_get_idx(load_average, i), 1);
+    }
+  }
+
+  /* CPU usage, per-core usage is not exported */
+  struct nw_openmetrics_family cpu = { "nodewatcher_cpu_usage_ratio", NW_OPENMETRICS_GAUGE, "CPU time share by mode since the previous report." };
+  json_object *cpu_object = nw_openmetrics_get(resources, "cpu");
+  if (cpu_object && json_object_get_type(cpu_object) == json_type_object) {
+    labels.name[0] = "mode";
+    json_object_object_foreach(cpu_object, mode, percentage) {
+      if (json_object_get_type(percentage) != json_type_int)
+        continue;
+      labels.value[0] = mode;
+      nw_openmetrics_sample(w, &cpu, &labels, percentage, 0.01);
+    }
+  }
+
+  /* Memory is reported in kilobytes */
+  static const char *memory_types[] = { "total", "free", "buffers", "cache" };
+  struct nw_openmetrics_family memory = { "nodewatcher_memory_bytes", NW_OPENMETRICS_GAUGE, "Memory usage." };
+  labels.name[0] = "type";
+  for (int i = 0; i < 4; i++) {
+    labels.value[0] = memory_types[i];
+    nw_openmetrics_sample(w, &memory, &labels, nw_openmetrics_get_path(resources, "memory", memory_types[i]), 1024);
+  }
+
+  /* Open connections */
+  static const char *families[] = { "ipv4", "ipv6" };
+  static const char *protocols[] = { "tcp", "udp" };
+  struct nw_openmetrics_family connections = { "nodewatcher_connections", NW_OPENMETRICS_GAUGE, "Open sockets." };
+  json_object *connections_object = nw_openmetrics_get(resources, "connections");
+  labels.name[0] = "family";
+  labels.name[1] = "protocol";
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 2; j++) {
+      labels.value[0] = families[i];
+      labels.value[1] = protocols[j];
+      nw_openmetrics_sample(w, &connections, &labels, nw_openmetrics_get_path(connections_object, families[i], protocols[j]), 1);
+    }
+  }
+  labels.name[1] = NULL;
+
+  /* Connection tracking */
+  json_object *tracking = nw_openmetrics_get(connections_object, "tracking");
+  struct nw_openmetrics_family conntrack_entries = { "nodewatcher_conntrack_entries", NW_OPENMETRICS_GAUGE, "Connection tracking table entries." };
+  struct nw_openmetrics_family conntrack_max = { "nodewatcher_conntrack_max_entries", NW_OPENMETRICS_GAUGE, "Connection tracking table size." };
+  struct nw_openmetrics_family conntrack_events = { "nodewatcher_conntrack_events", NW_OPENMETRICS_COUNTER, "Connection tracking events." };
+  nw_openmetrics_sample(w, &conntrack_entries, NULL, nw_openmetrics_get(tracking, "count"), 1);
+  nw_openmetrics_sample(w, &conntrack_max, NULL, nw_openmetrics_get(tracking, "max"), 1);
+  json_object *statistics = nw_openmetrics_get(tracking, "statistics");
+  if (statistics && json_object_get_type(statistics) == json_type_object) {
+    labels.name[0] = "event";
+    json_object_object_foreach(statistics, event, count) {
+      labels.value[0] = event;
+      nw_openmetrics_sample(w, &conntrack_events, &labels, count, 1);
+    }
+  }
+
+  /* Processes */
+  static const char *states[] = { "running", "sleeping", "blocked", "zombie", "stopped", "paging" };
+  struct nw_openmetrics_family processes = { "nodewatcher_processes", NW_OPENMETRICS_GAUGE, "Processes by state." };
+  labels.name[0] = "state";
+  for (int i = 0; i < 6; i++) {
+    labels.value[0] = states[i];
+    nw_openmetrics_sample(w, &processes, &labels, nw_openmetrics_get_path(resources, "processes", states[i]), 1);
+  }
+
+  /* File descriptors */
+  struct nw_openmetrics_family files_open = { "nodewatcher_open_files", NW_OPENMETRICS_GAUGE, "Allocated file handles." };
+  struct nw_openmetrics_family files_max = { "nodewatcher_max_files", NW_OPENMETRICS_GAUGE, "Maximum number of file handles." };
+  nw_openmetrics_sample(w, &files_open, NULL, nw_openmetrics_get_path(resources, "files", "open"), 1);
+  nw_openmetrics_sample(w, &files_max, NULL, nw_openmetrics_get_path(resources, "files", "max"), 1);
+}
+
+static void nw_openmetrics_render_interfaces(struct nw_openmetrics_writer *w, json_object *interfaces)
+{
+  static struct nw_openmetrics_field fields[] = {
+    { "up", { "nodewatcher_interface_up", NW_OPENMETRICS_GAUGE, "Whether the interface is administratively up." }, 1 },
+    { "carrier", { "nodewatcher_interface_carrier", NW_OPENMETRICS_GAUGE, "Whether the interface has carrier." }, 1 },
+    { "mtu", { "nodewatcher_interface_mtu_bytes", NW_OPENMETRICS_GAUGE, "Interface MTU." }, 1 },
+  };
+  static struct nw_openmetrics_field statistics[] = {
+    { "rx_bytes", { "nodewatcher_interface_receive_bytes", NW_OPENMETRICS_COUNTER, "Received bytes." }, 1 },
+    { "tx_bytes", { "nodewatcher_interface_transmit_bytes", NW_OPENMETRICS_COUNTER, "Transmitted bytes." }, 1 },
+    { "rx_packets", { "nodewatcher_interface_receive_packets", NW_OPENMETRICS_COUNTER, "Received packets." }, 1 },
+    { "tx_packets", { "nodewatcher_interface_transmit_packets", NW_OPENMETRICS_COUNTER, "Transmitted packets." }, 1 },
+    { "rx_errors", { "nodewatcher_interface_receive_errors", NW_OPENMETRICS_COUNTER, "Receive errors." }, 1 },
+    { "tx_errors", { "nodewatcher_interface_transmit_errors", NW_OPENMETRICS_COUNTER, "Transmit errors." }, 1 },
+    { "rx_dropped", { "nodewatcher_interface_receive_dropped", NW_OPENMETRICS_COUNTER, "Dropped received packets." }, 1 },
+    { "tx_dropped", { "nodewatcher_interface_transmit_dropped", NW_OPENMETRICS_COUNTER, "Dropped transmitted packets." }, 1 },
+  };
+  struct nw_openmetrics_labels labels = { { "interface", }, };
+
+  if (!interfaces || json_object_get_type(interfaces) != json_type_object)
+    return;
+
+  /* Samples of a family must be contiguous, so families are the outer loop */
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    struct nw_openmetrics_family family = fields[i].family;
+    json_object_object_foreach(interfaces, name, device) {
+      if (name[0] == '_')
+        continue;
+      labels.value[0] = name;
+      nw_openmetrics_sample(w, &family, &labels, nw_openmetrics_get(device, fields[i].key), fields[i].scale);
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(statistics) / sizeof(statistics[0]); i++) {
+    struct nw_openmetrics_family family = statistics[i].family;
+    json_object_object_foreach(interfaces, name, device) {
+      if (name[0] == '_')
+        continue;
+      labels.value[0] = name;
+      nw_openmetrics_sample(w, &family, &labels, nw_openmetrics_get_path(device, "statistics", statistics[i].key), statistics[i].scale);
+    }
+  }
+}
+
+static void nw_openmetrics_render_wireless(struct nw_openmetrics_writer *w, json_object *wireless)
+{
+  static struct nw_openmetrics_field fields[] = {
+    { "frequency", { "nodewatcher_wireless_frequency_hertz", NW_OPENMETRICS_GAUGE, "Operating frequency." }, 1e6 },
+    { "txpower", { "nodewatcher_wireless_txpower_dbm", NW_OPENMETRICS_GAUGE, "Transmit power." }, 1 },
+    { "noise", { "nodewatcher_wireless_noise_dbm", NW_OPENMETRICS_GAUGE, "Noise level." }, 1 },
+    { "signal", { "nodewatcher_wireless_signal_dbm", NW_OPENMETRICS_GAUGE, "Average signal of associated stations." }, 1 },
+  };
+  /* Station fields are looked up as "<direction>.<key>" when a direction is given */
+  static struct {
+    const char *direction;
+    struct nw_openmetrics_field field;
+  } station_fields[] = {
+    { NULL, { "signal", { "nodewatcher_wireless_station_signal_dbm", NW_OPENMETRICS_GAUGE, "Station signal." }, 1 } },
+    { NULL, { "inactive", { "nodewatcher_wireless_station_inactive_seconds", NW_OPENMETRICS_GAUGE, "Time since the station was last active." }, 0.001 } },
+    { "rx", { "rate", { "nodewatcher_wireless_station_receive_bitrate", NW_OPENMETRICS_GAUGE, "Receive bitrate in bits per second." }, 1000 } },
+    { "tx", { "rate", { "nodewatcher_wireless_station_transmit_bitrate", NW_OPENMETRICS_GAUGE, "Transmit bitrate in bits per second." }, 1000 } },
+    { "rx", { "bytes", { "nodewatcher_wireless_station_receive_bytes", NW_OPENMETRICS_COUNTER, "Bytes received from the station." }, 1 } },
+    { "tx", { "bytes", { "nodewatcher_wireless_station_transmit_bytes", NW_OPENMETRICS_COUNTER, "Bytes transmitted to the station." }, 1 } },
+    { "rx", { "packets", { "nodewatcher_wireless_station_receive_packets", NW_OPENMETRICS_COUNTER, "Packets received from the station." }, 1 } },
+    { "tx", { "packets", { "nodewatcher_wireless_station_transmit_packets", NW_OPENMETRICS_COUNTER, "Packets transmitted to the station." }, 1 } },
+    { "tx", { "retries", { "nodewatcher_wireless_station_transmit_retries", NW_OPENMETRICS_COUNTER, "Transmit retries." }, 1 } },
+    { "tx", { "failed", { "nodewatcher_wireless_station_transmit_failed", NW_OPENMETRICS_COUNTER, "Failed transmissions." }, 1 } },
+  };
+  struct nw_openmetrics_labels labels = { { "interface", }, };
+
+  json_object *interfaces = nw_openmetrics_get(wireless, "interfaces");
+  if (!interfaces || json_object_get_type(interfaces) != json_type_object)
+    return;
+
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+    struct nw_openmetrics_family family = fields[i].family;
+    json_object_object_foreach(interfaces, name, interface) {
+      labels.value[0] = name;
+      nw_openmetrics_sample(w, &family, &labels, nw_openmetrics_get(interface, fields[i].key), fields[i].scale);
+    }
+  }
+
+  /* Associated stations, including those only listed as unchanged */
+  struct nw_openmetrics_family stations = { "nodewatcher_wireless_stations", NW_OPENMETRICS_GAUGE, "Associated stations." };
+  json_object_object_foreach(interfaces, name, interface) {
+    json_object *list = nw_openmetrics_get(interface, "stations");
+    json_object *unchanged = nw_openmetrics_get(interface, "stations_unchanged");
+    int count = 0;
+    if (list && json_object_get_type(list) == json_type_array)
+      count += json_object_array_length(list);
+    if (unchanged && json_object_get_type(unchanged) == json_type_array)
+      count += json_object_array_length(unchanged);
+
+    json_object *value = json_object_new_int(count);
+    labels.value[0] = name;
+    nw_openmetrics_sample(w, &stations, &labels, value, 1);
+    json_object_put(value);
+  }
+
+  /* Per-station series are only complete when stations are not delta encoded */
+  labels.name[1] = "client_id";
+  for (size_t i = 0; i < sizeof(station_fields) / sizeof(station_fields[0]); i++) {
+    struct nw_openmetrics_family family = station_fields[i].field.family;
+    json_object_object_foreach(interfaces, name, interface) {
+      json_object *list = nw_openmetrics_get(interface, "stations");
+      if (!list || json_object_get_type(list) != json_type_array || nw_openmetrics_get(interface, "stations_unchanged"))
+        continue;
+
+      labels.value[0] = name;
+      for (int j = 0; j < json_object_array_length(list); j++) {
+        json_object *station = json_object_array_get_idx(list, j);
+        json_object *client_id = nw_openmetrics_get(station, "client_id");
+        if (!client_id)
+          continue;
+
+        labels.value[1] = json_object_get_string(client_id);
+        json_object *value;
+        if (station_fields[i].direction)
+          value = nw_openmetrics_get_path(station, station_fields[i].direction, station_fields[i].field.key);
+        else
+          value = nw_openmetrics_get(station, station_fields[i].field.key);
+        nw_openmetrics_sample(w, &family, &labels, value, station_fields[i].field.scale);
+      }
+    }
+  }
+}
+
+/**
+ * Calls the callback for each routing daemon instance in module data,
+ * which is either the data itself or reported under "instances".
+ */
+static void nw_openmetrics_foreach_instance(json_object *routing,
+                                            void (*cb)(json_object *instance, const char *name, void *priv),
+                                            void *priv)
+{
+  json_object *instances = nw_openmetrics_get(routing, "instances");
+  if (!instances) {
+    cb(routing, "default", priv);
+    return;
+  }
+
+  if (json_object_get_type(instances) != json_type_object)
+    return;
+
+  json_object_object_foreach(instances, name, instance) {
+    cb(instance, name, priv);
+  }
+}
+
+/* Routing module data and the metric currently being rendered */
+struct nw_openmetrics_routing {
+  struct nw_openmetrics_writer *w;
+  struct nw_openmetrics_family *family;
+  struct nw_openmetrics_labels labels;
+  /* Neighbour attribute, NULL for the neighbour count */
+  const char *key;
+};
+
+static void nw_openmetrics_render_routing_instance(json_object *instance, const char *name, void *priv)
+{
+  struct nw_openmetrics_routing *r = (struct nw_openmetrics_routing*) priv;
+  json_object *neighbours = nw_openmetrics_get(instance, "neighbours");
+  if (!neighbours || json_object_get_type(neighbours) != json_type_array)
+    return;
+
+  r->labels.value[1] = name;
+  if (!r->key) {
+    json_object *value = json_object_new_int(json_object_array_length(neighbours));
+    r->labels.name[2] = NULL;
+    nw_openmetrics_sample(r->w, r->family, &r->labels, value, 1);
+    json_object_put(value);
+    return;
+  }
+
+  for (int i = 0; i < json_object_array_length(neighbours); i++) {
+    json_object *neighbour = json_object_array_get_idx(neighbours, i);
+    json_object *address = nw_openmetrics_get(neighbour, "address");
+    json_object *interface = nw_openmetrics_get(neighbour, "interface");
+    if (!address)
+      continue;
+
+    r->labels.name[2] = "address";
+    r->labels.value[2] = json_object_get_string(address);
+    r->labels.name[3] = interface ? "interface" : NULL;
+    r->labels.value[3] = interface ? json_object_get_string(interface) : NULL;
+    nw_openmetrics_sample(r->w, r->family, &r->labels, nw_openmetrics_get(neighbour, r->key), 1);
+  }
+}
+
+static void nw_openmetrics_render_routing(struct nw_openmetrics_writer *w, json_object *feed)
+{
+  static const struct {
+    const char *module;
+    const char *protocol;
+  } protocols[] = {
+    { "core.routing.babel", "babel" },
+    { "core.routing.olsr", "olsr" },
+    { "core.routing.olsr2", "olsr2" },
+    { "core.routing.batman", "batman-adv" },
+  };
+  struct nw_openmetrics_family neighbours = { "nodewatcher_routing_neighbours", NW_OPENMETRICS_GAUGE, "Routing protocol neighbours." };
+  struct nw_openmetrics_family cost = { "nodewatcher_routing_neighbour_cost", NW_OPENMETRICS_GAUGE, "Link cost to the neighbour as reported by the routing daemon." };
+  struct nw_openmetrics_family lq = { "nodewatcher_routing_neighbour_link_quality", NW_OPENMETRICS_GAUGE, "Link quality to the neighbour as reported by the routing daemon." };
+  struct {
+    struct nw_openmetrics_family *family;
+    const char *key;
+  } metrics[] = {
+    { &neighbours, NULL },
+    { &cost, "cost" },
+    { &lq, "lq" },
+  };
+
+  struct nw_openmetrics_routing r = { .w = w, .labels = { { "protocol", "instance", }, }, };
+  for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+    r.family = metrics[i].family;
+    r.key = metrics[i].key;
+    for (size_t j = 0; j < sizeof(protocols) / sizeof(protocols[0]); j++) {
+      json_object *routing = nw_openmetrics_get(feed, protocols[j].module);
+      if (!routing)
+        continue;
+
+      r.labels.value[0] = protocols[j].protocol;
+      nw_openmetrics_foreach_instance(routing, nw_openmetrics_render_routing_instance, &r);
+    }
+  }
+}
+
+int nw_openmetrics_render(json_object *feed, struct nw_openmetrics_buffer *buffer)
+{
+  struct nw_openmetrics_writer w = { .buffer = buffer };
+  buffer->length = 0;
+
+  nw_openmetrics_render_resources(&w, nw_openmetrics_get(feed, "core.resources"));
+  nw_openmetrics_render_interfaces(&w, nw_openmetrics_get(feed, "core.interfaces"));
+  nw_openmetrics_render_wireless(&w, nw_openmetrics_get(feed, "core.wireless"));
+  nw_openmetrics_render_routing(&w, feed);
+  nw_openmetrics_printf(&w, "# EOF\n");
+
+  if (w.error) {
+    buffer->length = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+void nw_openmetrics_buffer_free(struct nw_openmetrics_buffer *buffer)
+{
+  free(buffer->data);
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->size = 0;
+}
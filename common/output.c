@@ -17,61 +17,695 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <nodewatcher-agent/output.h>
+#include <nodewatcher-agent/module.h>
+#include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/cbor.h>
+#include <nodewatcher-agent/openmetrics.h>
 
+#include <libubox/blobmsg_json.h>
+#include <libubox/uloop.h>
+#include <libubox/ustream.h>
+#include <libubox/usock.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <syslog.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-/* Output file path */
-static char *output_filename = NULL;
+/* Location of the feed when exporting via the legacy output_json option */
+#define NW_OUTPUT_FEED_FILENAME "/tmp/nodewatcher_agent_feed"
+/* Maximum number of stream subscribers per sink */
+#define NW_OUTPUT_STREAM_MAX_CLIENTS 16
+/* Maximum amount of unsent data per stream subscriber (in bytes) */
+#define NW_OUTPUT_STREAM_MAX_PENDING (1024 * 1024)
+/* Maximum size of a UDP datagram */
+#define NW_OUTPUT_UDP_MAX_DATAGRAM 65507
+/* Maximum number of concurrent HTTP clients per sink */
+#define NW_OUTPUT_HTTP_MAX_CLIENTS 8
+/* Maximum size of an HTTP request header (in bytes) */
+#define NW_OUTPUT_HTTP_MAX_REQUEST 4096
+/* Time allowed for an HTTP request to complete (in milliseconds) */
+#define NW_OUTPUT_HTTP_TIMEOUT 5000
 
-int nw_output_init(struct uci_context *uci)
+/* Atomically replaced file */
+struct nw_output_file_sink {
+  struct nw_output_sink sink;
+  char path[PATH_MAX];
+  char temporary[PATH_MAX];
+};
+
+/* Unix socket streaming each update to connected subscribers */
+struct nw_output_stream_sink {
+  struct nw_output_sink sink;
+  struct uloop_fd server;
+  struct list_head clients;
+  int num_clients;
+};
+
+struct nw_output_stream_client {
+  struct list_head list;
+  struct nw_output_stream_sink *sink;
+  struct ustream_fd stream;
+};
+
+/* HTTP listener serving the latest feed to scrapers */
+struct nw_output_http_sink {
+  struct nw_output_sink sink;
+  struct uloop_fd server;
+  struct list_head clients;
+  int num_clients;
+  /* Copy of the latest feed */
+  char *data;
+  size_t length;
+  size_t size;
+  bool available;
+};
+
+struct nw_output_http_client {
+  struct list_head list;
+  struct nw_output_http_sink *sink;
+  struct ustream_fd stream;
+  /* Request timeout, also used to defer closing the connection */
+  struct uloop_timeout timeout;
+  bool responded;
+};
+
+/* Datagrams sent to a local collector */
+struct nw_output_udp_sink {
+  struct nw_output_sink sink;
+  int fd;
+  /* A flag indicating the feed to be too large for a datagram */
+  bool oversized;
+};
+
+/* Notifications on the agent's ubus object */
+struct nw_output_ubus_sink {
+  struct nw_output_sink sink;
+  struct ubus_context *ubus;
+  struct blob_buf buf;
+};
+
+/* Registered output sinks */
+static LIST_HEAD(output_sinks);
+/* Buffers for the CBOR and OpenMetrics feeds, reused across updates */
+static struct nw_cbor_buffer cbor_buffer;
+static struct nw_openmetrics_buffer openmetrics_buffer;
+
+int nw_output_parse_format(const char *name, enum nw_output_format *format)
 {
-  /* Obtain the output filename via UCI */
-  struct uci_ptr ptr;
-  char *loc = strdup("nodewatcher.@agent[0].output_json");
+  if (!name || strcmp(name, "json") == 0)
+    *format = NW_OUTPUT_FORMAT_JSON;
+  else if (strcmp(name, "cbor") == 0)
+    *format = NW_OUTPUT_FORMAT_CBOR;
+  else if (strcmp(name, "openmetrics") == 0)
+    *format = NW_OUTPUT_FORMAT_OPENMETRICS;
+  else
+    return -1;
 
-  /* Perform an UCI extended lookup */
-  if (uci_lookup_ptr(uci, &ptr, loc, true) != UCI_OK) {
-    free(loc);
-    return 0;
+  return 0;
+}
+
+/**
+ * Serializes the feed in the given format. The returned buffer is valid
+ * until the object is freed or the next serialization in the same format.
+ */
+static const char *nw_output_serialize(json_object *object, enum nw_output_format format, size_t *length)
+{
+  switch (format) {
+    case NW_OUTPUT_FORMAT_CBOR: {
+      if (nw_cbor_encode(object, &cbor_buffer) != 0) {
+        syslog(LOG_WARNING, "output: Failed to encode CBOR feed.");
+        return NULL;
+      }
+      *length = cbor_buffer.length;
+      return (const char*) cbor_buffer.data;
+    }
+    case NW_OUTPUT_FORMAT_OPENMETRICS: {
+      if (nw_openmetrics_render(object, &openmetrics_buffer) != 0) {
+        syslog(LOG_WARNING, "output: Failed to render OpenMetrics feed.");
+        return NULL;
+      }
+      *length = openmetrics_buffer.length;
+      return openmetrics_buffer.data;
+    }
+    default: {
+      const char *data = json_object_to_json_string(object);
+      *length = strlen(data);
+      return data;
+    }
+  }
+}
+
+void nw_output_register_sink(struct nw_output_sink *sink)
+{
+  list_add_tail(&sink->list, &output_sinks);
+}
+
+static void nw_output_file_export(struct nw_output_sink *sink, const char *data, size_t length)
+{
+  struct nw_output_file_sink *fs = container_of(sink, struct nw_output_file_sink, sink);
+
+  /* Write a temporary file and rename it, so readers never see partial output */
+  mode_t pmask = umask(0022);
+  FILE *output_file = fopen(fs->temporary, "w");
+  umask(pmask);
+  if (!output_file) {
+    syslog(LOG_WARNING, "output: Unable to open '%s' for writing.", fs->temporary);
+    return;
+  }
+
+  /* Only JSON output is terminated by a newline, binary and OpenMetrics output is written as it is */
+  bool ok = fwrite(data, 1, length, output_file) == length;
+  if (ok && sink->format == NW_OUTPUT_FORMAT_JSON)
+    ok = fputc('\n', output_file) != EOF;
+  if (fclose(output_file) != 0 || !ok) {
+    syslog(LOG_WARNING, "output: Unable to write '%s'.", fs->temporary);
+    unlink(fs->temporary);
+    return;
+  }
+
+  if (rename(fs->temporary, fs->path) != 0) {
+    syslog(LOG_WARNING, "output: Unable to replace '%s'.", fs->path);
+    unlink(fs->temporary);
+  }
+}
+
+static struct nw_output_sink *nw_output_file_create(const char *path)
+{
+  struct nw_output_file_sink *fs = calloc(1, sizeof(struct nw_output_file_sink));
+  if (!fs)
+    return NULL;
+
+  snprintf(fs->path, sizeof(fs->path), "%s", path);
+  snprintf(fs->temporary, sizeof(fs->temporary), "%s.tmp", path);
+  fs->sink.hooks.export = nw_output_file_export;
+  return &fs->sink;
+}
+
+static void nw_output_stream_client_free(struct nw_output_stream_client *client)
+{
+  ustream_free(&client->stream.stream);
+  close(client->stream.fd.fd);
+  list_del(&client->list);
+  client->sink->num_clients--;
+  free(client);
+}
+
+static void nw_output_stream_client_write(struct nw_output_stream_client *client,
+                                          const char *data,
+                                          size_t length)
+{
+  /* Subscribers that do not keep up are dropped instead of buffering without bound */
+  if (ustream_pending_data(&client->stream.stream, true) + length > NW_OUTPUT_STREAM_MAX_PENDING) {
+    syslog(LOG_WARNING, "output: Dropping slow subscriber of '%s'.", client->sink->sink.name);
+    nw_output_stream_client_free(client);
+    return;
+  }
+
+  /* JSON feeds are separated by newlines, CBOR items are self-delimiting */
+  if (client->sink->sink.format == NW_OUTPUT_FORMAT_JSON) {
+    ustream_write(&client->stream.stream, data, length, true);
+    ustream_write(&client->stream.stream, "\n", 1, false);
+  } else {
+    ustream_write(&client->stream.stream, data, length, false);
+  }
+}
+
+static void nw_output_stream_client_read(struct ustream *s, int bytes)
+{
+  /* Subscribers are not expected to send anything, discard it */
+  ustream_consume(s, bytes);
+}
+
+static void nw_output_stream_client_notify_state(struct ustream *s)
+{
+  struct nw_output_stream_client *client = container_of(s, struct nw_output_stream_client, stream.stream);
+  if (!s->eof && !s->write_error)
+    return;
+
+  nw_output_stream_client_free(client);
+}
+
+/**
+ * Accepts a pending connection on a listening socket.
+ *
+ * @return Client file descriptor or -1 when there are no more connections
+ */
+static int nw_output_accept(struct uloop_fd *fd)
+{
+  for (;;) {
+    int client_fd = accept(fd->fd, NULL, NULL);
+    if (client_fd >= 0 || errno != EINTR)
+      return client_fd;
+  }
+}
+
+static void nw_output_stream_accept(struct uloop_fd *fd, unsigned int events)
+{
+  struct nw_output_stream_sink *ss = container_of(fd, struct nw_output_stream_sink, server);
+
+  for (;;) {
+    int client_fd = nw_output_accept(fd);
+    if (client_fd < 0)
+      return;
+
+    if (ss->num_clients >= NW_OUTPUT_STREAM_MAX_CLIENTS) {
+      close(client_fd);
+      continue;
+    }
+
+    struct nw_output_stream_client *client = calloc(1, sizeof(struct nw_output_stream_client));
+    if (!client) {
+      close(client_fd);
+      continue;
+    }
+
+    client->sink = ss;
+    client->stream.stream.string_data = true;
+    client->stream.stream.notify_read = nw_output_stream_client_read;
+    client->stream.stream.notify_state = nw_output_stream_client_notify_state;
+    ustream_fd_init(&client->stream, client_fd);
+    list_add_tail(&client->list, &ss->clients);
+    ss->num_clients++;
+
+    /* New subscribers immediately receive the current feed */
+    json_object *object = nw_module_get_output();
+    size_t length;
+    const char *data = nw_output_serialize(object, ss->sink.format, &length);
+    if (data)
+      nw_output_stream_client_write(client, data, length);
+    json_object_put(object);
+  }
+}
+
+static bool nw_output_stream_is_active(struct nw_output_sink *sink)
+{
+  struct nw_output_stream_sink *ss = container_of(sink, struct nw_output_stream_sink, sink);
+  return ss->num_clients > 0;
+}
+
+static void nw_output_stream_export(struct nw_output_sink *sink, const char *data, size_t length)
+{
+  struct nw_output_stream_sink *ss = container_of(sink, struct nw_output_stream_sink, sink);
+  struct nw_output_stream_client *client, *tmp;
+
+  list_for_each_entry_safe(client, tmp, &ss->clients, list) {
+    nw_output_stream_client_write(client, data, length);
+  }
+}
+
+static struct nw_output_sink *nw_output_stream_create(const char *path)
+{
+  struct nw_output_stream_sink *ss = calloc(1, sizeof(struct nw_output_stream_sink));
+  if (!ss)
+    return NULL;
+
+  /* Remove a stale socket left behind by a previous instance */
+  unlink(path);
+  ss->server.fd = usock(USOCK_UNIX | USOCK_SERVER | USOCK_NONBLOCK, path, NULL);
+  if (ss->server.fd < 0) {
+    syslog(LOG_WARNING, "output: Unable to listen on '%s'.", path);
+    free(ss);
+    return NULL;
+  }
+
+  INIT_LIST_HEAD(&ss->clients);
+  ss->server.cb = nw_output_stream_accept;
+  uloop_fd_add(&ss->server, ULOOP_READ);
+  ss->sink.hooks.is_active = nw_output_stream_is_active;
+  ss->sink.hooks.export = nw_output_stream_export;
+  return &ss->sink;
+}
+
+static void nw_output_http_client_free(struct uloop_timeout *timeout)
+{
+  struct nw_output_http_client *client = container_of(timeout, struct nw_output_http_client, timeout);
+  uloop_timeout_cancel(&client->timeout);
+  ustream_free(&client->stream.stream);
+  close(client->stream.fd.fd);
+  list_del(&client->list);
+  client->sink->num_clients--;
+  free(client);
+}
+
+static void nw_output_http_client_close(struct nw_output_http_client *client)
+{
+  /* Closing is deferred, as the stream may still be used by its caller */
+  client->timeout.cb = nw_output_http_client_free;
+  uloop_timeout_set(&client->timeout, 0);
+}
+
+static const char *nw_output_http_content_type(enum nw_output_format format)
+{
+  switch (format) {
+    case NW_OUTPUT_FORMAT_CBOR: return "application/cbor";
+    case NW_OUTPUT_FORMAT_OPENMETRICS: return "application/openmetrics-text; version=1.0.0; charset=utf-8";
+    default: return "application/json";
+  }
+}
+
+static void nw_output_http_client_respond(struct nw_output_http_client *client, const char *request)
+{
+  struct nw_output_http_sink *hs = client->sink;
+  struct ustream *s = &client->stream.stream;
+  char method[8], path[64];
+  const char *status = "200 OK";
+
+  if (sscanf(request, "%7s %63s", method, path) != 2)
+    status = "400 Bad Request";
+  else if (strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0)
+    status = "405 Method Not Allowed";
+  else if (strcmp(path, "/") != 0 && strcmp(path, "/metrics") != 0)
+    status = "404 Not Found";
+  else if (!hs->available)
+    status = "503 Service Unavailable";
+
+  bool ok = status[0] == '2';
+  ustream_printf(s, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+    status, ok ? nw_output_http_content_type(hs->sink.format) : "text/plain", ok ? hs->length : 0);
+  /* A scrape only copies the cached feed into the stream */
+  if (ok && strcmp(method, "HEAD") != 0)
+    ustream_write(s, hs->data, hs->length, false);
+
+  client->responded = true;
+  if (!ustream_pending_data(s, true))
+    nw_output_http_client_close(client);
+}
+
+static void nw_output_http_client_read(struct ustream *s, int bytes)
+{
+  struct nw_output_http_client *client = container_of(s, struct nw_output_http_client, stream.stream);
+  int length;
+  char *data = ustream_get_read_buf(s, &length);
+  if (!data)
+    return;
+
+  if (client->responded) {
+    ustream_consume(s, length);
+    return;
   }
 
-  if (ptr.o && ptr.o->type == UCI_TYPE_STRING) {
-    output_filename = strdup(ptr.o->v.string);
-    syslog(LOG_INFO, "Configured for direct output to '%s'.", output_filename);
+  /* Wait for the complete request header, the body is never needed */
+  if (strstr(data, "\r\n\r\n") || strstr(data, "\n\n")) {
+    nw_output_http_client_respond(client, data);
+    ustream_consume(s, length);
+  } else if (length >= NW_OUTPUT_HTTP_MAX_REQUEST) {
+    ustream_consume(s, length);
+    nw_output_http_client_close(client);
   }
+}
+
+static void nw_output_http_client_notify_write(struct ustream *s, int bytes)
+{
+  struct nw_output_http_client *client = container_of(s, struct nw_output_http_client, stream.stream);
+  if (client->responded && !ustream_pending_data(s, true))
+    nw_output_http_client_close(client);
+}
+
+static void nw_output_http_client_notify_state(struct ustream *s)
+{
+  struct nw_output_http_client *client = container_of(s, struct nw_output_http_client, stream.stream);
+  if (!s->eof && !s->write_error)
+    return;
+
+  nw_output_http_client_close(client);
+}
+
+static void nw_output_http_accept(struct uloop_fd *fd, unsigned int events)
+{
+  struct nw_output_http_sink *hs = container_of(fd, struct nw_output_http_sink, server);
+
+  for (;;) {
+    int client_fd = nw_output_accept(fd);
+    if (client_fd < 0)
+      return;
+
+    if (hs->num_clients >= NW_OUTPUT_HTTP_MAX_CLIENTS) {
+      close(client_fd);
+      continue;
+    }
+
+    struct nw_output_http_client *client = calloc(1, sizeof(struct nw_output_http_client));
+    if (!client) {
+      close(client_fd);
+      continue;
+    }
+
+    client->sink = hs;
+    client->stream.stream.string_data = true;
+    client->stream.stream.notify_read = nw_output_http_client_read;
+    client->stream.stream.notify_write = nw_output_http_client_notify_write;
+    client->stream.stream.notify_state = nw_output_http_client_notify_state;
+    ustream_fd_init(&client->stream, client_fd);
+    list_add_tail(&client->list, &hs->clients);
+    hs->num_clients++;
+
+    /* Clients that do not complete their request in time are dropped */
+    client->timeout.cb = nw_output_http_client_free;
+    uloop_timeout_set(&client->timeout, NW_OUTPUT_HTTP_TIMEOUT);
+  }
+}
 
-  free(loc);
+static void nw_output_http_export(struct nw_output_sink *sink, const char *data, size_t length)
+{
+  struct nw_output_http_sink *hs = container_of(sink, struct nw_output_http_sink, sink);
+
+  if (length > hs->size) {
+    char *copy = realloc(hs->data, length);
+    if (!copy)
+      return;
+
+    hs->data = copy;
+    hs->size = length;
+  }
+
+  memcpy(hs->data, data, length);
+  hs->length = length;
+  hs->available = true;
+}
+
+static struct nw_output_sink *nw_output_http_create(const char *path, const char *host, const char *port)
+{
+  struct nw_output_http_sink *hs = calloc(1, sizeof(struct nw_output_http_sink));
+  if (!hs)
+    return NULL;
+
+  /* Listen on a unix socket (for proxying by uhttpd) or on a TCP port */
+  if (path) {
+    unlink(path);
+    hs->server.fd = usock(USOCK_UNIX | USOCK_SERVER | USOCK_NONBLOCK, path, NULL);
+  } else {
+    hs->server.fd = usock(USOCK_TCP | USOCK_SERVER | USOCK_NUMERIC | USOCK_NONBLOCK, host, port);
+  }
+  if (hs->server.fd < 0) {
+    syslog(LOG_WARNING, "output: Unable to listen on '%s'.", path ? path : port);
+    free(hs);
+    return NULL;
+  }
+
+  INIT_LIST_HEAD(&hs->clients);
+  hs->server.cb = nw_output_http_accept;
+  uloop_fd_add(&hs->server, ULOOP_READ);
+  hs->sink.hooks.export = nw_output_http_export;
+  return &hs->sink;
+}
+
+static void nw_output_udp_export(struct nw_output_sink *sink, const char *data, size_t length)
+{
+  struct nw_output_udp_sink *us = container_of(sink, struct nw_output_udp_sink, sink);
+
+  if (length > NW_OUTPUT_UDP_MAX_DATAGRAM) {
+    if (!us->oversized)
+      syslog(LOG_WARNING, "output: Feed is too large to be sent by '%s'.", sink->name);
+    us->oversized = true;
+    return;
+  }
+
+  us->oversized = false;
+  /* Errors (for example no collector listening) are not reported */
+  send(us->fd, data, length, 0);
+}
+
+static struct nw_output_sink *nw_output_udp_create(const char *host, const char *port)
+{
+  struct nw_output_udp_sink *us = calloc(1, sizeof(struct nw_output_udp_sink));
+  if (!us)
+    return NULL;
+
+  us->fd = usock(USOCK_UDP | USOCK_NUMERIC | USOCK_NONBLOCK, host, port);
+  if (us->fd < 0) {
+    syslog(LOG_WARNING, "output: Unable to create UDP socket for '%s:%s'.", host, port);
+    free(us);
+    return NULL;
+  }
+
+  us->sink.hooks.export = nw_output_udp_export;
+  return &us->sink;
+}
+
+static bool nw_output_ubus_is_active(struct nw_output_sink *sink)
+{
+  return nw_module_get_ubus_object()->has_subscribers;
+}
+
+static void nw_output_ubus_export(struct nw_output_sink *sink, const char *data, size_t length)
+{
+  struct nw_output_ubus_sink *us = container_of(sink, struct nw_output_ubus_sink, sink);
+
+  blob_buf_init(&us->buf, 0);
+  if (!blobmsg_add_json_from_string(&us->buf, data)) {
+    syslog(LOG_WARNING, "output: Unable to convert feed for ubus notification.");
+    return;
+  }
+
+  ubus_notify(us->ubus, nw_module_get_ubus_object(), "update", us->buf.head, -1);
+}
+
+static struct nw_output_sink *nw_output_ubus_create(struct ubus_context *ubus)
+{
+  struct nw_output_ubus_sink *us = calloc(1, sizeof(struct nw_output_ubus_sink));
+  if (!us)
+    return NULL;
+
+  us->ubus = ubus;
+  us->sink.hooks.is_active = nw_output_ubus_is_active;
+  us->sink.hooks.export = nw_output_ubus_export;
+  return &us->sink;
+}
+
+static int nw_output_init_legacy(struct uci_context *uci)
+{
+  char *output_filename = nw_uci_get_string(uci, "nodewatcher.@agent[0].output_json");
+  if (!output_filename)
+    return 0;
+
+  syslog(LOG_INFO, "Configured for direct output to '%s'.", output_filename);
 
   /* Ensure that the output filename is a symlink to /tmp to avoid flash wear. */
   unlink(output_filename);
   /* Return code of 'unlink' is ignored as the file may not even exist. */
-  if (symlink("/tmp/nodewatcher_agent_feed", output_filename) != 0) {
+  if (symlink(NW_OUTPUT_FEED_FILENAME, output_filename) != 0) {
     syslog(LOG_WARNING, "Unable to create symlink to '/tmp'! This may cause increased flash wear.");
   }
+  free(output_filename);
+
+  struct nw_output_sink *sink = nw_output_file_create(NW_OUTPUT_FEED_FILENAME);
+  if (!sink)
+    return -1;
+
+  snprintf(sink->name, sizeof(sink->name), "output_json");
+  nw_output_register_sink(sink);
+  return 0;
+}
+
+int nw_output_init(struct ubus_context *ubus, struct uci_context *uci)
+{
+  if (nw_output_init_legacy(uci) != 0)
+    return -1;
+
+  struct uci_package *cfg_agent = uci_lookup_package(uci, "nodewatcher");
+  if (!cfg_agent && uci_load(uci, "nodewatcher", &cfg_agent))
+    return 0;
+
+  struct uci_element *e;
+  int i = 0;
+  uci_foreach_element(&cfg_agent->sections, e) {
+    struct uci_section *section = uci_to_section(e);
+    if (strcmp(section->type, "output") != 0)
+      continue;
+
+    const char *type = uci_lookup_option_string(uci, section, "type");
+    const char *path = uci_lookup_option_string(uci, section, "path");
+    const char *host = uci_lookup_option_string(uci, section, "host");
+    const char *port = uci_lookup_option_string(uci, section, "port");
+    const char *format_name = uci_lookup_option_string(uci, section, "format");
+    struct nw_output_sink *sink = NULL;
+    enum nw_output_format format;
+
+    /* HTTP listeners are meant for scraping, so they default to OpenMetrics */
+    if (!format_name && type && strcmp(type, "http") == 0)
+      format_name = "openmetrics";
+
+    if (nw_output_parse_format(format_name, &format) != 0) {
+      syslog(LOG_WARNING, "output: Ignoring output section with unknown format '%s'.", format_name);
+      continue;
+    }
+
+    if (!type) {
+      syslog(LOG_WARNING, "output: Ignoring output section without a type.");
+      continue;
+    } else if (strcmp(type, "file") == 0 && path) {
+      sink = nw_output_file_create(path);
+    } else if (strcmp(type, "stream") == 0 && path) {
+      sink = nw_output_stream_create(path);
+    } else if (strcmp(type, "http") == 0 && (path || port)) {
+      sink = nw_output_http_create(path, host ? host : "127.0.0.1", port);
+    } else if (strcmp(type, "udp") == 0 && port) {
+      sink = nw_output_udp_create(host ? host : "127.0.0.1", port);
+    } else if (strcmp(type, "ubus") == 0) {
+      /* Notifications carry blobmsg converted from the JSON feed */
+      format = NW_OUTPUT_FORMAT_JSON;
+      sink = nw_output_ubus_create(ubus);
+    } else {
+      syslog(LOG_WARNING, "output: Ignoring invalid output section of type '%s'.", type);
+      continue;
+    }
+
+    if (!sink)
+      continue;
+
+    if (section->anonymous)
+      snprintf(sink->name, sizeof(sink->name), "output%d", i);
+    else
+      snprintf(sink->name, sizeof(sink->name), "%s", e->name);
+    sink->format = format;
+    nw_output_register_sink(sink);
+    syslog(LOG_INFO, "Configured output '%s' of type '%s'.", sink->name, type);
+    i++;
+  }
 
   return 0;
 }
 
+static bool nw_output_sink_is_active(struct nw_output_sink *sink)
+{
+  return !sink->hooks.is_active || sink->hooks.is_active(sink);
+}
+
 bool nw_output_is_exporting()
 {
-  return output_filename != NULL;
+  struct nw_output_sink *sink;
+  list_for_each_entry(sink, &output_sinks, list) {
+    if (nw_output_sink_is_active(sink))
+      return true;
+  }
+
+  return false;
 }
 
 void nw_output_export(json_object *object)
 {
-  if (!output_filename)
-    return;
+  /* Serialize once per format, all sinks share the same buffers */
+  const char *data[__NW_OUTPUT_FORMAT_MAX] = { NULL, };
+  size_t length[__NW_OUTPUT_FORMAT_MAX] = { 0, };
+  bool failed[__NW_OUTPUT_FORMAT_MAX] = { false, };
 
-  /* Export JSON to configured output file */
-  mode_t pmask = umask(0022);
-  FILE *output_file = fopen(output_filename, "w");
-  fprintf(output_file, "%s\n", json_object_to_json_string(object));
-  fclose(output_file);
+  struct nw_output_sink *sink;
+  list_for_each_entry(sink, &output_sinks, list) {
+    if (!nw_output_sink_is_active(sink) || failed[sink->format])
+      continue;
 
-  /* Restore umask */
-  umask(pmask);
+    if (!data[sink->format]) {
+      data[sink->format] = nw_output_serialize(object, sink->format, &length[sink->format]);
+      if (!data[sink->format]) {
+        failed[sink->format] = true;
+        continue;
+      }
+    }
+
+    sink->hooks.export(sink, data[sink->format], length[sink->format]);
+  }
 }
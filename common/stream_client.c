@@ -0,0 +1,229 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/stream_client.h>
+
+#include <libubox/usock.h>
+#include <syslog.h>
+#include <string.h>
+#include <unistd.h>
+
+static double nw_stream_client_elapsed_ms(const struct timespec *since)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+void nw_stream_client_init(struct nw_stream_client *client,
+                           const struct nw_endpoint *endpoint,
+                           enum nw_stream_client_framing framing)
+{
+  memset(client, 0, sizeof(struct nw_stream_client));
+  client->endpoint = *endpoint;
+  client->framing = framing;
+  client->fd.fd = -1;
+}
+
+void nw_stream_client_close(struct nw_stream_client *client, enum nw_stream_client_status status)
+{
+  if (!client->active)
+    return;
+
+  client->active = false;
+  client->established = false;
+  client->status = status;
+
+  /* The descriptor is removed from uloop before it is closed. */
+  if (client->stream_active) {
+    ustream_free(&client->stream.stream);
+    client->stream_active = false;
+  }
+  uloop_fd_delete(&client->fd);
+  close(client->fd.fd);
+  client->fd.fd = -1;
+  uloop_timeout_cancel(&client->timer);
+
+  if (client->closed)
+    client->closed(client);
+}
+
+static void nw_stream_client_timeout(struct uloop_timeout *timeout)
+{
+  struct nw_stream_client *client = container_of(timeout, struct nw_stream_client, timer);
+  nw_stream_client_close(client, NW_STREAM_CLIENT_TIMEOUT);
+}
+
+static void nw_stream_client_read_lines(struct nw_stream_client *client, char *data, int length)
+{
+  while (length > 0 && client->active) {
+    /* Append data up to the end of line into the line buffer. */
+    char *newline = memchr(data, '\n', length);
+    size_t chunk = newline ? (size_t) (newline - data) : (size_t) length;
+    if (client->line_length + chunk < sizeof(client->line_buffer)) {
+      memcpy(client->line_buffer + client->line_length, data, chunk);
+      client->line_length += chunk;
+    } else {
+      client->line_overflow = true;
+    }
+
+    if (!newline)
+      return;
+
+    data += chunk + 1;
+    length -= chunk + 1;
+
+    bool overflow = client->line_overflow;
+    client->line_buffer[client->line_length] = 0;
+    client->line_length = 0;
+    client->line_overflow = false;
+    if (overflow) {
+      syslog(LOG_WARNING, "stream-client: Ignoring overly long line from '%s'.", client->endpoint.name);
+      continue;
+    }
+
+    client->line(client, client->line_buffer);
+  }
+}
+
+static void nw_stream_client_read(struct ustream *s, int bytes)
+{
+  struct nw_stream_client *client = container_of(s, struct nw_stream_client, stream.stream);
+
+  for (;;) {
+    int length;
+    char *data = ustream_get_read_buf(s, &length);
+    if (!data || length <= 0)
+      break;
+
+    client->bytes += length;
+    if (client->max_bytes && client->bytes > client->max_bytes) {
+      syslog(LOG_WARNING, "stream-client: Response from '%s' exceeds %zu bytes.", client->endpoint.name, client->max_bytes);
+      return nw_stream_client_close(client, NW_STREAM_CLIENT_OVERFLOW);
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    int result = 0;
+    if (client->framing == NW_STREAM_CLIENT_LINES)
+      nw_stream_client_read_lines(client, data, length);
+    else
+      result = nw_json_stream_parse(&client->parser, data, length);
+
+    client->parse_ms += nw_stream_client_elapsed_ms(&started);
+
+    /* The session may have been closed by a callback, freeing the stream. */
+    if (!client->active)
+      return;
+
+    ustream_consume(s, length);
+    if (result < 0)
+      return nw_stream_client_close(client, NW_STREAM_CLIENT_PARSE_ERROR);
+    if (result > 0 && !client->parser.sequence)
+      return nw_stream_client_close(client, NW_STREAM_CLIENT_DONE);
+  }
+}
+
+static void nw_stream_client_notify_state(struct ustream *s)
+{
+  struct nw_stream_client *client = container_of(s, struct nw_stream_client, stream.stream);
+  if (!s->eof && !s->write_error)
+    return;
+
+  nw_stream_client_close(client, NW_STREAM_CLIENT_EOF);
+}
+
+static void nw_stream_client_callback(struct uloop_fd *fd, unsigned int events)
+{
+  struct nw_stream_client *client = container_of(fd, struct nw_stream_client, fd);
+  if (fd->eof || fd->error) {
+    nw_stream_client_close(client, NW_STREAM_CLIENT_CONNECT_FAILED);
+    return;
+  }
+
+  /* Connection has been established, prepare the stream. */
+  uloop_fd_delete(&client->fd);
+  client->established = true;
+  client->connect_ms = nw_stream_client_elapsed_ms(&client->started);
+  client->stream.stream.string_data = true;
+  client->stream.stream.notify_read = nw_stream_client_read;
+  client->stream.stream.notify_state = nw_stream_client_notify_state;
+  ustream_fd_init(&client->stream, client->fd.fd);
+  client->stream_active = true;
+
+  if (client->persistent)
+    uloop_timeout_cancel(&client->timer);
+  if (client->request)
+    ustream_write(&client->stream.stream, client->request, strlen(client->request), false);
+  if (client->connected)
+    client->connected(client);
+}
+
+int nw_stream_client_connect(struct nw_stream_client *client)
+{
+  if (client->active)
+    return -1;
+
+  client->line_length = 0;
+  client->line_overflow = false;
+  client->bytes = 0;
+  client->parse_ms = 0;
+  client->connect_ms = 0;
+  clock_gettime(CLOCK_MONOTONIC, &client->started);
+  memset(&client->stream, 0, sizeof(client->stream));
+
+  client->fd.cb = nw_stream_client_callback;
+  if (client->endpoint.path[0])
+    client->fd.fd = usock(USOCK_UNIX | USOCK_NONBLOCK, client->endpoint.path, NULL);
+  else
+    client->fd.fd = usock(USOCK_TCP | USOCK_NUMERIC | USOCK_NONBLOCK, client->endpoint.host, client->endpoint.port);
+  if (client->fd.fd < 0) {
+    client->status = NW_STREAM_CLIENT_CONNECT_FAILED;
+    return -1;
+  }
+
+  client->active = true;
+  uloop_fd_add(&client->fd, ULOOP_WRITE);
+
+  /* Start a timer that will abort the session. */
+  client->timer.cb = nw_stream_client_timeout;
+  uloop_timeout_set(&client->timer, client->endpoint.timeout);
+  return 0;
+}
+
+int nw_stream_client_send(struct nw_stream_client *client, const char *data)
+{
+  if (!client->established)
+    return -1;
+
+  ustream_write(&client->stream.stream, data, strlen(data), false);
+  return 0;
+}
+
+json_object *nw_stream_client_get_stats(struct nw_stream_client *client)
+{
+  json_object *stats = json_object_new_object();
+  char parse_ms[32];
+  snprintf(parse_ms, sizeof(parse_ms), "%.2f", client->parse_ms);
+
+  json_object_object_add(stats, "connect_ms", json_object_new_int(client->connect_ms));
+  json_object_object_add(stats, "bytes", json_object_new_int64(client->bytes));
+  json_object_object_add(stats, "parse_ms", json_object_new_string(parse_ms));
+  return stats;
+}
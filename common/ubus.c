@@ -0,0 +1,189 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/ubus.h>
+
+#include <libubox/avl-cmp.h>
+#include <string.h>
+#include <syslog.h>
+
+/* Cached ubus object identifier */
+struct nw_ubus_object {
+  /* Cache AVL node */
+  struct avl_node avl;
+  /* Object identifier */
+  uint32_t id;
+  /* Object path */
+  char path[];
+};
+
+/* AVL tree containing cached object identifiers with object path as their key */
+static struct avl_tree object_cache;
+/* Event handler for object removal notifications */
+static struct ubus_event_handler object_remove_handler;
+
+/* Cache statistics */
+static unsigned int cache_hits = 0;
+static unsigned int cache_misses = 0;
+static unsigned int cache_invalidations = 0;
+
+enum {
+  OBJECT_REMOVE_PATH,
+  __OBJECT_REMOVE_MAX,
+};
+
+static const struct blobmsg_policy nw_ubus_object_remove_policy[__OBJECT_REMOVE_MAX] = {
+  [OBJECT_REMOVE_PATH] = { .name = "path", .type = BLOBMSG_TYPE_STRING },
+};
+
+static void nw_ubus_handle_object_remove(struct ubus_context *ctx,
+                                         struct ubus_event_handler *ev,
+                                         const char *type,
+                                         struct blob_attr *msg)
+{
+  struct blob_attr *tb[__OBJECT_REMOVE_MAX];
+
+  blobmsg_parse(nw_ubus_object_remove_policy, __OBJECT_REMOVE_MAX, tb, blob_data(msg), blob_len(msg));
+  if (!tb[OBJECT_REMOVE_PATH])
+    return;
+
+  nw_ubus_invalidate_id(blobmsg_get_string(tb[OBJECT_REMOVE_PATH]));
+}
+
+int nw_ubus_init(struct ubus_context *ubus)
+{
+  avl_init(&object_cache, avl_strcmp, false, NULL);
+
+  /* Invalidate cached identifiers when objects go away (for example on netifd restart) */
+  object_remove_handler.cb = nw_ubus_handle_object_remove;
+  if (ubus_register_event_handler(ubus, &object_remove_handler, "ubus.object.remove") != UBUS_STATUS_OK) {
+    syslog(LOG_WARNING, "Failed to register ubus object removal handler!");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void nw_ubus_cache_store(const char *path, uint32_t id)
+{
+  struct nw_ubus_object *object;
+
+  object = avl_find_element(&object_cache, path, object, avl);
+  if (object) {
+    object->id = id;
+    return;
+  }
+
+  object = calloc(1, sizeof(struct nw_ubus_object) + strlen(path) + 1);
+  if (!object)
+    return;
+
+  strcpy(object->path, path);
+  object->id = id;
+  object->avl.key = object->path;
+  avl_insert(&object_cache, &object->avl);
+}
+
+int nw_ubus_lookup_id(struct ubus_context *ubus, const char *path, uint32_t *id)
+{
+  struct nw_ubus_object *object;
+
+  object = avl_find_element(&object_cache, path, object, avl);
+  if (object) {
+    cache_hits++;
+    *id = object->id;
+    return 0;
+  }
+
+  cache_misses++;
+  int ret = ubus_lookup_id(ubus, path, id);
+  if (ret != UBUS_STATUS_OK)
+    return ret;
+
+  /* Store the resolved identifier into cache */
+  nw_ubus_cache_store(path, *id);
+  return 0;
+}
+
+bool nw_ubus_has_id(const char *path)
+{
+  struct nw_ubus_object *object;
+  return avl_find_element(&object_cache, path, object, avl) != NULL;
+}
+
+static void nw_ubus_prefetch_object(struct ubus_context *ctx, struct ubus_object_data *obj, void *priv)
+{
+  nw_ubus_cache_store(obj->path, obj->id);
+}
+
+int nw_ubus_prefetch_ids(struct ubus_context *ubus, const char *pattern)
+{
+  cache_misses++;
+  return ubus_lookup(ubus, pattern, nw_ubus_prefetch_object, NULL);
+}
+
+void nw_ubus_invalidate_id(const char *path)
+{
+  struct nw_ubus_object *object;
+
+  object = avl_find_element(&object_cache, path, object, avl);
+  if (!object)
+    return;
+
+  cache_invalidations++;
+  avl_delete(&object_cache, &object->avl);
+  free(object);
+}
+
+int nw_ubus_invoke(struct ubus_context *ubus,
+                   const char *path,
+                   const char *method,
+                   struct blob_attr *msg,
+                   ubus_data_handler_t cb,
+                   void *priv,
+                   int timeout)
+{
+  uint32_t id, new_id;
+  int ret;
+
+  ret = nw_ubus_lookup_id(ubus, path, &id);
+  if (ret != UBUS_STATUS_OK)
+    return ret;
+
+  ret = ubus_invoke(ubus, id, method, msg, cb, priv, timeout);
+  if (ret != UBUS_STATUS_NOT_FOUND)
+    return ret;
+
+  /* The object may have been replaced since it was cached, but methods may also
+     return this status for missing entities, so only retry on a new identifier */
+  nw_ubus_invalidate_id(path);
+  if (nw_ubus_lookup_id(ubus, path, &new_id) != UBUS_STATUS_OK || new_id == id)
+    return ret;
+
+  return ubus_invoke(ubus, new_id, method, msg, cb, priv, timeout);
+}
+
+void nw_ubus_get_stats(json_object *object)
+{
+  json_object *stats = json_object_new_object();
+  json_object_object_add(stats, "objects", json_object_new_int(object_cache.count));
+  json_object_object_add(stats, "hits", json_object_new_int(cache_hits));
+  json_object_object_add(stats, "misses", json_object_new_int(cache_misses));
+  json_object_object_add(stats, "invalidations", json_object_new_int(cache_invalidations));
+  json_object_object_add(object, "ubus_cache", stats);
+}
@@ -66,6 +66,27 @@ int nw_file_line_count(const char *filename)
   return lines;
 }
 
+int nw_file_read_uint64(const char *filename, uint64_t *value)
+{
+  char buffer[32];
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (length <= 0)
+    return -1;
+
+  buffer[length] = 0;
+  char *end;
+  *value = strtoull(buffer, &end, 10);
+  if (end == buffer)
+    return -1;
+
+  return 0;
+}
+
 int nw_base64_encode(const void *data, size_t data_length, char *result, size_t result_length)
 {
   const char base64chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
@@ -192,3 +213,67 @@ int nw_uci_get_int(struct uci_context *uci, const char *location)
 
   return result;
 }
+
+int nw_uci_get_endpoints(struct uci_context *uci,
+                         const char *type,
+                         const char *host,
+                         const char *port,
+                         int timeout,
+                         struct nw_endpoint **endpoints)
+{
+  struct uci_package *cfg_agent = uci_lookup_package(uci, "nodewatcher");
+  if (!cfg_agent && uci_load(uci, "nodewatcher", &cfg_agent))
+    cfg_agent = NULL;
+
+  /* Count configured sections first, so a single array can be allocated */
+  struct uci_element *e;
+  int count = 0;
+  if (cfg_agent) {
+    uci_foreach_element(&cfg_agent->sections, e) {
+      if (strcmp(uci_to_section(e)->type, type) == 0)
+        count++;
+    }
+  }
+
+  *endpoints = calloc(count ? count : 1, sizeof(struct nw_endpoint));
+  if (!*endpoints)
+    return -1;
+
+  if (!count) {
+    struct nw_endpoint *endpoint = &(*endpoints)[0];
+    snprintf(endpoint->name, sizeof(endpoint->name), "default");
+    snprintf(endpoint->host, sizeof(endpoint->host), "%s", host);
+    snprintf(endpoint->port, sizeof(endpoint->port), "%s", port);
+    endpoint->timeout = timeout;
+    return 1;
+  }
+
+  int i = 0;
+  uci_foreach_element(&cfg_agent->sections, e) {
+    struct uci_section *section = uci_to_section(e);
+    if (strcmp(section->type, type) != 0)
+      continue;
+
+    struct nw_endpoint *endpoint = &(*endpoints)[i];
+    const char *value;
+    if (section->anonymous)
+      snprintf(endpoint->name, sizeof(endpoint->name), "%s%d", type, i);
+    else
+      snprintf(endpoint->name, sizeof(endpoint->name), "%s", e->name);
+
+    value = uci_lookup_option_string(uci, section, "host");
+    snprintf(endpoint->host, sizeof(endpoint->host), "%s", value ? value : host);
+    value = uci_lookup_option_string(uci, section, "port");
+    snprintf(endpoint->port, sizeof(endpoint->port), "%s", value ? value : port);
+    value = uci_lookup_option_string(uci, section, "path");
+    if (value)
+      snprintf(endpoint->path, sizeof(endpoint->path), "%s", value);
+    value = uci_lookup_option_string(uci, section, "timeout");
+    endpoint->timeout = value ? atoi(value) : 0;
+    if (endpoint->timeout <= 0)
+      endpoint->timeout = timeout;
+    i++;
+  }
+
+  return count;
+}
@@ -0,0 +1,57 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_CBOR_H
+#define NODEWATCHER_AGENT_CBOR_H
+
+#include <json.h>
+#include <stdint.h>
+
+/**
+ * Growable buffer holding encoded CBOR data. The buffer may be reused
+ * for multiple encodings to avoid reallocations.
+ */
+struct nw_cbor_buffer {
+  uint8_t *data;
+  size_t length;
+  size_t size;
+};
+
+/**
+ * Encodes a JSON object tree into CBOR (RFC 7049), replacing any previous
+ * buffer contents. The tree is walked directly, without serializing it to
+ * JSON first.
+ *
+ * The result is tagged as self-described CBOR and wrapped in a stringref
+ * namespace, so repeated strings (for example field names of stations and
+ * interfaces) are emitted once and later referenced by their index.
+ *
+ * @param object JSON object to encode
+ * @param buffer Destination buffer
+ * @return 0 on success, -1 on failure
+ */
+int nw_cbor_encode(json_object *object, struct nw_cbor_buffer *buffer);
+
+/**
+ * Releases memory held by a CBOR buffer.
+ *
+ * @param buffer Buffer
+ */
+void nw_cbor_buffer_free(struct nw_cbor_buffer *buffer);
+
+#endif
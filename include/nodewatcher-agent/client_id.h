@@ -0,0 +1,64 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_CLIENT_ID_H
+#define NODEWATCHER_AGENT_CLIENT_ID_H
+
+#include <json.h>
+#include <stdint.h>
+
+/* Length of an encoded client identifier (without the terminating null byte) */
+#define NW_CLIENT_ID_LENGTH 24
+
+/**
+ * Computes the client identifier (base64-encoded salted hash) of a MAC
+ * address. Recently used identifiers are served from a bounded cache.
+ *
+ * @param mac Raw 6-byte MAC address
+ * @param client_id Destination buffer of at least NW_CLIENT_ID_LENGTH + 1 bytes
+ * @return 0 on success, -1 on failure
+ */
+int nw_client_id_from_mac(const uint8_t *mac, char *client_id);
+
+/**
+ * Parses a MAC address in its textual representation.
+ *
+ * @param mac MAC address string (for example "00:11:22:aa:bb:cc")
+ * @param raw_mac Destination buffer of 6 bytes
+ * @return 0 on success, -1 when the MAC address is invalid
+ */
+int nw_client_id_parse_mac(const char *mac, uint8_t *raw_mac);
+
+/**
+ * Computes the client identifier of a MAC address in its textual
+ * representation (for example "00:11:22:aa:bb:cc").
+ *
+ * @param mac MAC address string
+ * @param client_id Destination buffer of at least NW_CLIENT_ID_LENGTH + 1 bytes
+ * @return 0 on success, -1 when the MAC address is invalid
+ */
+int nw_client_id_from_string(const char *mac, char *client_id);
+
+/**
+ * Stores client identifier cache statistics into the specified JSON object.
+ *
+ * @param object Destination JSON object
+ */
+void nw_client_id_get_stats(json_object *object);
+
+#endif
@@ -74,6 +74,98 @@ void nw_json_from_ubus(struct ubus_request *req,
                        int type,
                        struct blob_attr *msg);
 
+/* Maximum nesting depth supported by the streaming parser */
+#define NW_JSON_STREAM_MAX_DEPTH 32
+/* Maximum length of paths and of values reported by the streaming parser */
+#define NW_JSON_STREAM_MAX_PATH 256
+#define NW_JSON_STREAM_MAX_VALUE 1024
+
+/* Streaming parser events */
+enum nw_json_stream_event {
+  NW_JSON_STREAM_OBJECT_START,
+  NW_JSON_STREAM_OBJECT_END,
+  NW_JSON_STREAM_ARRAY_START,
+  NW_JSON_STREAM_ARRAY_END,
+  /* String value */
+  NW_JSON_STREAM_STRING,
+  /* Number, boolean or null value */
+  NW_JSON_STREAM_PRIMITIVE,
+};
+
+/**
+ * Streaming parser callback. Paths consist of object keys separated by dots,
+ * with array elements denoted by "[]" (for example "links[].localIP"). The
+ * value is only set for string and primitive events and is only valid
+ * during the callback.
+ */
+typedef void (*nw_json_stream_cb)(void *priv,
+                                  enum nw_json_stream_event event,
+                                  const char *path,
+                                  const char *value);
+
+/* Event-based streaming JSON parser, which never builds the whole document */
+struct nw_json_stream {
+  nw_json_stream_cb cb;
+  void *priv;
+  /* Open containers and the path lengths at which they start */
+  struct {
+    bool object;
+    bool expect_key;
+    size_t path_length;
+  } stack[NW_JSON_STREAM_MAX_DEPTH];
+  int depth;
+  /* Path of the current value */
+  char path[NW_JSON_STREAM_MAX_PATH];
+  size_t path_length;
+  /* Current token, longer tokens are truncated */
+  char token[NW_JSON_STREAM_MAX_VALUE];
+  size_t token_length;
+  /* Lexer state */
+  int state;
+  unsigned int unicode;
+  int unicode_digits;
+  /* Set when the document is complete or invalid */
+  bool done;
+  bool error;
+  /* Accept a sequence of documents instead of a single one */
+  bool sequence;
+};
+
+/**
+ * Initializes a streaming JSON parser.
+ *
+ * @param stream Parser
+ * @param cb Callback invoked for every parser event
+ * @param priv Private data passed to the callback
+ */
+void nw_json_stream_init(struct nw_json_stream *stream,
+                         nw_json_stream_cb cb,
+                         void *priv);
+
+/**
+ * Feeds a chunk of data to the streaming JSON parser. Chunks may split the
+ * document at arbitrary positions.
+ *
+ * @param stream Parser
+ * @param data Data
+ * @param length Data length
+ * @return 1 when the (last) document is complete, 0 when more data is
+ *   needed and -1 on parse errors
+ */
+int nw_json_stream_parse(struct nw_json_stream *stream,
+                         const char *data,
+                         size_t length);
+
+/**
+ * Converts a value reported by the streaming parser to a JSON object.
+ *
+ * @param event Event type (string or primitive)
+ * @param value Value
+ * @return JSON object or NULL for null values
+ */
+json_object *nw_json_stream_value(enum nw_json_stream_event event,
+                                  const char *value);
+
 /* Macro to simplify copying of JSON attributes */
 #define NW_COPY_JSON_OBJECT(src, src_key, dst, dst_key) \
   { \
@@ -118,4 +118,9 @@ int nw_module_finish_acquire_data(struct nodewatcher_module *module, json_object
  */
 json_object *nw_module_get_output();
 
+/**
+ * Returns the agent's ubus object (nodewatcher.agent).
+ */
+struct ubus_object *nw_module_get_ubus_object();
+
 #endif
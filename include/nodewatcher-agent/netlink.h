@@ -0,0 +1,164 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_NETLINK_H
+#define NODEWATCHER_AGENT_NETLINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <linux/netlink.h>
+
+/**
+ * Netlink socket handle.
+ */
+struct nw_netlink {
+  /* Socket file descriptor */
+  int fd;
+  /* Sequence number of the last request */
+  uint32_t seq;
+};
+
+/**
+ * Callback invoked for each data message received in response to
+ * a netlink request.
+ *
+ * @param hdr Netlink message header
+ * @param priv Private data passed to the request
+ * @return 0 to continue processing, -1 to abort
+ */
+typedef int (*nw_netlink_cb)(struct nlmsghdr *hdr, void *priv);
+
+/**
+ * Opens a netlink socket.
+ *
+ * @param nl Netlink handle to initialize
+ * @param protocol Netlink protocol (for example NETLINK_ROUTE)
+ * @return 0 on success, -1 on failure
+ */
+int nw_netlink_open(struct nw_netlink *nl, int protocol);
+
+/**
+ * Closes a netlink socket.
+ *
+ * @param nl Netlink handle
+ */
+void nw_netlink_close(struct nw_netlink *nl);
+
+/**
+ * Sends a request and processes all responses until the request is
+ * complete. The request is always sent with NLM_F_ACK set, so that both
+ * dump and regular requests terminate properly.
+ *
+ * @param nl Netlink handle
+ * @param request Request message; sequence number is assigned automatically
+ * @param cb Callback invoked for each response message (may be NULL)
+ * @param priv Private data for the callback
+ * @return 0 on success, negative error code on failure
+ */
+int nw_netlink_request(struct nw_netlink *nl,
+                       struct nlmsghdr *request,
+                       nw_netlink_cb cb,
+                       void *priv);
+
+/**
+ * Resolves the identifier of a generic netlink family. The handle must
+ * have been opened with the NETLINK_GENERIC protocol.
+ *
+ * @param nl Netlink handle
+ * @param name Family name (for example "nl80211")
+ * @param family Destination for the family identifier
+ * @return 0 on success, negative error code on failure
+ */
+int nw_netlink_genl_family(struct nw_netlink *nl, const char *name, uint16_t *family);
+
+/**
+ * Subscribes a netlink socket to a multicast group of a generic netlink
+ * family. Received events are not processed by nw_netlink_request, so a
+ * dedicated socket should be used for them.
+ *
+ * @param nl Netlink handle (opened with the NETLINK_GENERIC protocol)
+ * @param name Family name (for example "nl80211")
+ * @param group Multicast group name (for example "scan")
+ * @return 0 on success, negative error code on failure
+ */
+int nw_netlink_genl_subscribe(struct nw_netlink *nl, const char *name, const char *group);
+
+/**
+ * Appends an attribute to a netlink message.
+ *
+ * @param hdr Netlink message header
+ * @param max_length Size of the buffer containing the message
+ * @param type Attribute type
+ * @param data Attribute payload
+ * @param length Length of attribute payload
+ * @return 0 on success, -1 when there is not enough space
+ */
+int nw_netlink_put_attr(struct nlmsghdr *hdr,
+                        size_t max_length,
+                        int type,
+                        const void *data,
+                        size_t length);
+
+/**
+ * Parses a stream of attributes into a table indexed by attribute
+ * type. Attributes with types above max are ignored.
+ *
+ * @param tb Destination table with max + 1 entries
+ * @param max Maximum attribute type
+ * @param data Start of attributes
+ * @param length Length of attribute data
+ */
+void nw_netlink_parse_attrs(struct nlattr **tb,
+                            int max,
+                            void *data,
+                            int length);
+
+/* Returns a pointer to the attribute payload */
+#define nw_nla_data(nla) ((void*) ((char*) (nla) + NLA_HDRLEN))
+/* Returns the length of the attribute payload */
+#define nw_nla_len(nla) ((int) (nla)->nla_len - NLA_HDRLEN)
+/* Iterates over nested attributes */
+#define nw_nla_for_each_nested(pos, nla, rem) \
+  for (pos = nw_nla_data(nla), rem = nw_nla_len(nla); \
+       rem >= (int) sizeof(struct nlattr) && pos->nla_len >= sizeof(struct nlattr) && pos->nla_len <= rem; \
+       rem -= NLA_ALIGN(pos->nla_len), pos = (struct nlattr*) ((char*) pos + NLA_ALIGN(pos->nla_len)))
+
+static inline uint8_t nw_nla_get_u8(const struct nlattr *nla)
+{
+  return *(uint8_t*) nw_nla_data(nla);
+}
+
+static inline uint16_t nw_nla_get_u16(const struct nlattr *nla)
+{
+  return *(uint16_t*) nw_nla_data(nla);
+}
+
+static inline uint32_t nw_nla_get_u32(const struct nlattr *nla)
+{
+  return *(uint32_t*) nw_nla_data(nla);
+}
+
+static inline uint64_t nw_nla_get_u64(const struct nlattr *nla)
+{
+  uint64_t value;
+  memcpy(&value, nw_nla_data(nla), sizeof(value));
+  return value;
+}
+
+#endif
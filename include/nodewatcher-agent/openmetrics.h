@@ -0,0 +1,52 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_OPENMETRICS_H
+#define NODEWATCHER_AGENT_OPENMETRICS_H
+
+#include <json.h>
+
+/**
+ * Growable buffer holding rendered OpenMetrics text. The buffer may be
+ * reused for multiple renderings to avoid reallocations.
+ */
+struct nw_openmetrics_buffer {
+  char *data;
+  size_t length;
+  size_t size;
+};
+
+/**
+ * Renders module data as OpenMetrics text exposition, replacing any
+ * previous buffer contents. Metrics are derived from the resources,
+ * interfaces, wireless and routing modules; other data is ignored.
+ *
+ * @param feed JSON object containing module data keyed by module name
+ * @param buffer Destination buffer
+ * @return 0 on success, -1 on failure
+ */
+int nw_openmetrics_render(json_object *feed, struct nw_openmetrics_buffer *buffer);
+
+/**
+ * Releases memory held by an OpenMetrics buffer.
+ *
+ * @param buffer Buffer
+ */
+void nw_openmetrics_buffer_free(struct nw_openmetrics_buffer *buffer);
+
+#endif
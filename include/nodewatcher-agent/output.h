@@ -20,24 +20,78 @@
 #define NODEWATCHER_AGENT_OUTPUT_H
 
 #include <json.h>
+#include <libubox/list.h>
+#include <libubus.h>
 #include <uci.h>
 
+struct nw_output_sink;
+
+/* Feed serialization formats */
+enum nw_output_format {
+  NW_OUTPUT_FORMAT_JSON = 0,
+  NW_OUTPUT_FORMAT_CBOR,
+  NW_OUTPUT_FORMAT_OPENMETRICS,
+  __NW_OUTPUT_FORMAT_MAX,
+};
+
+/**
+ * Hooks implemented by output sinks.
+ */
+struct nw_output_sink_hooks {
+  /* Hook that returns true when the sink currently has consumers (optional) */
+  bool (*is_active)(struct nw_output_sink *sink);
+  /* Hook that delivers a serialized feed */
+  void (*export)(struct nw_output_sink *sink, const char *data, size_t length);
+};
+
+/**
+ * Output sink descriptor. Sinks receive the same serialized feed on
+ * every update.
+ */
+struct nw_output_sink {
+  /* Sink list node */
+  struct list_head list;
+  /* Sink name */
+  char name[32];
+  /* Format of the serialized feed passed to the sink */
+  enum nw_output_format format;
+  /* Sink hooks */
+  struct nw_output_sink_hooks hooks;
+};
+
 /**
  * Perform output initialization.
  *
+ * @param ubus UBUS context
  * @param uci UCI context
  * @return On success 0 is returned, -1 otherwise
  */
-int nw_output_init(struct uci_context *uci);
+int nw_output_init(struct ubus_context *ubus, struct uci_context *uci);
+
+/**
+ * Parses a feed format name ("json", "cbor" or "openmetrics").
+ *
+ * @param name Format name, NULL selects the default format
+ * @param format Destination for the parsed format
+ * @return 0 on success, -1 when the format is not known
+ */
+int nw_output_parse_format(const char *name, enum nw_output_format *format);
+
+/**
+ * Registers an output sink.
+ *
+ * @param sink Sink descriptor
+ */
+void nw_output_register_sink(struct nw_output_sink *sink);
 
 /**
- * Returns true if output export is configured.
+ * Returns true if any output sink currently has consumers.
  */
 bool nw_output_is_exporting();
 
 /**
- * Exports the specified JSON object to the designated output
- * file.
+ * Serializes the specified JSON object once per format in use and
+ * exports it to all active output sinks.
  *
  * @param object JSON object to export
  */
@@ -0,0 +1,158 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_STREAM_CLIENT_H
+#define NODEWATCHER_AGENT_STREAM_CLIENT_H
+
+#include <nodewatcher-agent/json.h>
+#include <nodewatcher-agent/utils.h>
+
+#include <libubox/uloop.h>
+#include <libubox/ustream.h>
+#include <time.h>
+
+/* Maximum length of a single line in line-framed mode */
+#define NW_STREAM_CLIENT_MAX_LINE 1024
+
+/* Framing of received data */
+enum nw_stream_client_framing {
+  /* Data is split into lines, reported through the line callback */
+  NW_STREAM_CLIENT_LINES,
+  /* Data is parsed as JSON, reported through the JSON parser callback */
+  NW_STREAM_CLIENT_JSON,
+};
+
+/* Reason for closing a session */
+enum nw_stream_client_status {
+  /* Closed by the module, for example after a complete response */
+  NW_STREAM_CLIENT_DONE,
+  /* Connection could not be established */
+  NW_STREAM_CLIENT_CONNECT_FAILED,
+  /* Deadline has expired */
+  NW_STREAM_CLIENT_TIMEOUT,
+  /* Remote end has closed the connection */
+  NW_STREAM_CLIENT_EOF,
+  /* Received data could not be parsed */
+  NW_STREAM_CLIENT_PARSE_ERROR,
+  /* Response exceeded the configured size limit */
+  NW_STREAM_CLIENT_OVERFLOW,
+};
+
+struct nw_stream_client;
+
+/**
+ * Callback invoked when a session is established or closed.
+ */
+typedef void (*nw_stream_client_cb)(struct nw_stream_client *client);
+
+/**
+ * Callback invoked for each received line, without the trailing newline.
+ */
+typedef void (*nw_stream_client_line_cb)(struct nw_stream_client *client, char *line);
+
+/**
+ * Asynchronous client session with a local daemon over a TCP or unix
+ * socket. Sessions are embedded in module state and driven by uloop.
+ */
+struct nw_stream_client {
+  /* Endpoint and framing */
+  struct nw_endpoint endpoint;
+  enum nw_stream_client_framing framing;
+  /* Persistent sessions are only subject to the deadline until connected */
+  bool persistent;
+  /* Maximum number of bytes received per session (zero for no limit) */
+  size_t max_bytes;
+  /* Request sent once connected (optional) */
+  const char *request;
+
+  /* Callbacks, all optional except the one for the chosen framing */
+  nw_stream_client_cb connected;
+  nw_stream_client_cb closed;
+  nw_stream_client_line_cb line;
+  /* Parser used with JSON framing, initialized by the module */
+  struct nw_json_stream parser;
+
+  /* Session state */
+  bool active;
+  bool established;
+  enum nw_stream_client_status status;
+  struct uloop_fd fd;
+  struct ustream_fd stream;
+  bool stream_active;
+  struct uloop_timeout timer;
+
+  /* Line assembly buffer, lines may be split across stream buffers */
+  char line_buffer[NW_STREAM_CLIENT_MAX_LINE];
+  size_t line_length;
+  bool line_overflow;
+
+  /* Session statistics */
+  struct timespec started;
+  int connect_ms;
+  size_t bytes;
+  double parse_ms;
+};
+
+/**
+ * Initializes a client session structure.
+ *
+ * @param client Client session
+ * @param endpoint Daemon endpoint (copied)
+ * @param framing Framing of received data
+ */
+void nw_stream_client_init(struct nw_stream_client *client,
+                           const struct nw_endpoint *endpoint,
+                           enum nw_stream_client_framing framing);
+
+/**
+ * Starts connecting to the endpoint. On success the closed callback is
+ * invoked exactly once when the session ends.
+ *
+ * @param client Client session
+ * @return 0 on success, -1 when the connection could not be started
+ */
+int nw_stream_client_connect(struct nw_stream_client *client);
+
+/**
+ * Sends data over an established session.
+ *
+ * @param client Client session
+ * @param data NULL-terminated data
+ * @return 0 on success, -1 when the session is not established
+ */
+int nw_stream_client_send(struct nw_stream_client *client, const char *data);
+
+/**
+ * Closes a session. Closing an inactive session has no effect, so this
+ * may safely be called from any callback.
+ *
+ * @param client Client session
+ * @param status Reason for closing the session
+ */
+void nw_stream_client_close(struct nw_stream_client *client, enum nw_stream_client_status status);
+
+/**
+ * Returns session statistics (connect time, received bytes and time spent
+ * parsing) as a JSON object.
+ *
+ * @param client Client session
+ * @return Statistics object
+ */
+json_object *nw_stream_client_get_stats(struct nw_stream_client *client);
+
+#endif
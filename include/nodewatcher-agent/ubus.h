@@ -0,0 +1,100 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_UBUS_H
+#define NODEWATCHER_AGENT_UBUS_H
+
+#include <json.h>
+#include <libubus.h>
+
+/**
+ * Initializes the ubus object identifier cache. Cached identifiers are
+ * invalidated when ubusd announces that an object has been removed.
+ *
+ * @param ubus UBUS context
+ * @return On success 0 is returned, -1 otherwise
+ */
+int nw_ubus_init(struct ubus_context *ubus);
+
+/**
+ * Resolves an ubus object path to its identifier. Identifiers are only
+ * looked up via ubusd when they are not yet cached.
+ *
+ * @param ubus UBUS context
+ * @param path Object path
+ * @param id Destination for the object identifier
+ * @return 0 on success, ubus status code on failure
+ */
+int nw_ubus_lookup_id(struct ubus_context *ubus, const char *path, uint32_t *id);
+
+/**
+ * Checks whether an object identifier is cached, without contacting ubusd.
+ *
+ * @param path Object path
+ * @return True when the identifier is cached
+ */
+bool nw_ubus_has_id(const char *path);
+
+/**
+ * Resolves all objects matching a path pattern (for example
+ * "network.interface.*") with a single request to ubusd and caches their
+ * identifiers.
+ *
+ * @param ubus UBUS context
+ * @param pattern Object path pattern
+ * @return 0 on success, ubus status code on failure
+ */
+int nw_ubus_prefetch_ids(struct ubus_context *ubus, const char *pattern);
+
+/**
+ * Removes an object identifier from the cache.
+ *
+ * @param path Object path
+ */
+void nw_ubus_invalidate_id(const char *path);
+
+/**
+ * Synchronously invokes a method on an object identified by its path. When
+ * the cached identifier turns out to be stale, it is invalidated and the
+ * request is retried once with a freshly resolved identifier.
+ *
+ * @param ubus UBUS context
+ * @param path Object path
+ * @param method Method name
+ * @param msg Request message
+ * @param cb Response callback
+ * @param priv Private data for the callback
+ * @param timeout Timeout in milliseconds
+ * @return 0 on success, ubus status code on failure
+ */
+int nw_ubus_invoke(struct ubus_context *ubus,
+                   const char *path,
+                   const char *method,
+                   struct blob_attr *msg,
+                   ubus_data_handler_t cb,
+                   void *priv,
+                   int timeout);
+
+/**
+ * Stores ubus object cache statistics into the specified JSON object.
+ *
+ * @param object Destination JSON object
+ */
+void nw_ubus_get_stats(json_object *object);
+
+#endif
@@ -20,8 +20,22 @@
 #define NODEWATCHER_AGENT_UTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <uci.h>
 
+/* Endpoint of a local daemon, configured via UCI */
+struct nw_endpoint {
+  /* Instance name */
+  char name[32];
+  /* TCP host and port, used when no unix socket path is set */
+  char host[64];
+  char port[8];
+  /* Unix socket path */
+  char path[108];
+  /* Timeout in milliseconds */
+  int timeout;
+};
+
 /**
  * Trims a string of whitespace characters. The original string
  * memory is modified but no copy is made. This means that the
@@ -41,6 +55,17 @@ char *nw_string_trim(char *str);
  */
 int nw_file_line_count(const char *filename);
 
+/**
+ * Reads a single unsigned integer from a file. This is intended for
+ * files under /proc and /sys that only contain one value, so only a
+ * small fixed-size buffer is used.
+ *
+ * @param filename Filename
+ * @param value Destination for the parsed value
+ * @return 0 on success, -1 on failure
+ */
+int nw_file_read_uint64(const char *filename, uint64_t *value);
+
 /**
  * Encodes data as Base64.
  *
@@ -88,4 +113,25 @@ char *nw_uci_get_string(struct uci_context *uci, const char *location);
  */
 int nw_uci_get_int(struct uci_context *uci, const char *location);
 
+/**
+ * Returns daemon endpoints configured as nodewatcher sections of the given
+ * type, with host, port, path and timeout options. When no such sections
+ * exist, a single endpoint named "default" is returned. The caller is
+ * required to free the array after use.
+ *
+ * @param uci UCI context
+ * @param type Section type
+ * @param host Default host
+ * @param port Default port
+ * @param timeout Default timeout in milliseconds
+ * @param endpoints Destination for the allocated array of endpoints
+ * @return Number of endpoints or -1 on allocation failure
+ */
+int nw_uci_get_endpoints(struct uci_context *uci,
+                         const char *type,
+                         const char *host,
+                         const char *port,
+                         int timeout,
+                         struct nw_endpoint **endpoints);
+
 #endif
@@ -30,6 +30,7 @@
 #include <nodewatcher-agent/scheduler.h>
 #include <nodewatcher-agent/output.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/ubus.h>
 
 /* Global ubus connection context */
 static struct ubus_context *ubus;
@@ -94,6 +95,12 @@ int main(int argc, char **argv)
 
   ubus_add_uloop(ubus);
 
+  /* Initialize ubus object cache */
+  if (nw_ubus_init(ubus) != 0) {
+    syslog(LOG_ERR, "Unable to initialize ubus object cache!");
+    return -1;
+  }
+
   /* Initialize UCI context */
   uci = uci_alloc_context();
   if (!uci) {
@@ -114,7 +121,7 @@ int main(int argc, char **argv)
   }
 
   /* Initialize the output exporter */
-  if (nw_output_init(uci) != 0) {
+  if (nw_output_init(ubus, uci) != 0) {
     syslog(LOG_ERR, "Unable to initialize output exporter!");
     return -1;
   }
@@ -19,66 +19,636 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/json.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/client_id.h>
+#include <nodewatcher-agent/netlink.h>
+#include <nodewatcher-agent/ubus.h>
 
-#include <libubox/md5.h>
+#include <libubox/uloop.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
 
-#define NW_CLIENT_ID_SALT "nw-client-c3U0XX"
-#define NW_CLIENT_ID_SALT_LENGTH 16
+#define NW_CLIENTS_LEASES_FILE "/tmp/dhcp.leases"
 
-static int nw_clients_start_acquire_data(struct nodewatcher_module *module,
-                                         struct ubus_context *ubus,
-                                         struct uci_context *uci)
+/* Maximum number of interfaces on which neighbours are considered clients */
+#define NW_CLIENTS_MAX_INTERFACES 8
+
+/* Client data sources */
+enum {
+  NW_CLIENTS_SOURCE_DHCP       = 1 << 0,
+  NW_CLIENTS_SOURCE_DHCPV6     = 1 << 1,
+  NW_CLIENTS_SOURCE_NEIGHBOURS = 1 << 2,
+};
+
+/* DHCP lease */
+struct nw_clients_lease {
+  /* Lease table AVL node */
+  struct avl_node avl;
+  /* Raw MAC address (lease table key) */
+  uint8_t mac[6];
+  /* Client identifier */
+  char client_id[NW_CLIENT_ID_LENGTH + 1];
+  /* Leased IPv4 address */
+  char address[46];
+  /* Lease expiry timestamp */
+  unsigned int expiry;
+  /* Time when the lease first appeared (zero when present on startup) */
+  time_t joined_at;
+  /* Parse in which the lease was last seen */
+  unsigned int generation;
+};
+
+/* Lease table with raw MAC addresses as keys */
+static struct avl_tree leases;
+/* Number of lease file parses */
+static unsigned int leases_generation = 0;
+/* Inotify instance and the watch of the lease file (negative when not watched) */
+static struct uloop_fd leases_watch = { .fd = -1, };
+static int leases_watch_wd = -1;
+/* Whether the lease file has been modified since it was last parsed */
+static bool leases_dirty = true;
+/* Modification time, size and inode of the lease file when it was last parsed */
+static struct stat leases_stat;
+/* JSON output reused while no client data source has changed */
+static json_object *cached_object = NULL;
+
+/* Address reported by a client data source other than the lease file */
+struct nw_clients_address {
+  char client_id[NW_CLIENT_ID_LENGTH + 1];
+  int family;
+  char address[INET6_ADDRSTRLEN];
+  int64_t expires;
+};
+
+/* Addresses reported by a client data source in the current and the previous run */
+struct nw_clients_source {
+  struct nw_clients_address *addresses;
+  size_t count;
+  size_t size;
+  struct nw_clients_address *previous;
+  size_t previous_count;
+  size_t previous_size;
+};
+
+static struct nw_clients_source source_dhcpv6;
+static struct nw_clients_source source_neighbours;
+
+/* Enabled client data sources */
+static int clients_sources = NW_CLIENTS_SOURCE_DHCP | NW_CLIENTS_SOURCE_DHCPV6 | NW_CLIENTS_SOURCE_NEIGHBOURS;
+/* Names of interfaces on which neighbours are considered clients */
+static char clients_interfaces[NW_CLIENTS_MAX_INTERFACES][IFNAMSIZ];
+static int clients_num_interfaces = 0;
+/* Netlink socket for neighbour table dumps */
+static struct nw_netlink clients_nl = { .fd = -1, };
+
+/* Lease table statistics */
+static unsigned int counter_joins = 0;
+static unsigned int counter_leaves = 0;
+static time_t changed_at = 0;
+
+static int nw_clients_mac_cmp(const void *k1, const void *k2, void *ptr)
 {
-  json_object *object = json_object_new_object();
+  return memcmp(k1, k2, 6);
+}
+
+static void nw_clients_watch_handler(struct uloop_fd *fd, unsigned int events)
+{
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t length;
 
-  /* Iterate over DHCP leases */
-  FILE *leases_file = fopen("/tmp/dhcp.leases", "r");
+  while ((length = read(fd->fd, buffer, sizeof(buffer))) > 0) {
+    char *ptr = buffer;
+    while (ptr < buffer + length) {
+      struct inotify_event *event = (struct inotify_event*) ptr;
+      leases_dirty = true;
+      /* The watch is gone once the file has been deleted or replaced */
+      if ((event->mask & IN_IGNORED) && event->wd == leases_watch_wd)
+        leases_watch_wd = -1;
+
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+}
+
+/**
+ * Checks whether the lease file needs to be parsed again. Inotify events are
+ * complemented with a modification time and size check in case inotify is
+ * not available.
+ */
+static bool nw_clients_leases_changed(void)
+{
+  /* The file itself is watched, so other writes to its directory cause no
+     wakeups; the watch is established again whenever the file was replaced */
+  if (leases_watch.fd >= 0 && leases_watch_wd < 0) {
+    leases_watch_wd = inotify_add_watch(leases_watch.fd, NW_CLIENTS_LEASES_FILE,
+      IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+  }
+
+  struct stat st;
+  if (stat(NW_CLIENTS_LEASES_FILE, &st) != 0)
+    memset(&st, 0, sizeof(st));
+
+  bool changed = leases_dirty ||
+                 st.st_mtime != leases_stat.st_mtime ||
+                 st.st_size != leases_stat.st_size ||
+                 st.st_ino != leases_stat.st_ino;
+
+  leases_stat = st;
+  leases_dirty = false;
+  return changed;
+}
+
+static void nw_clients_parse_leases(void)
+{
+  FILE *leases_file = fopen(NW_CLIENTS_LEASES_FILE, "r");
+  bool initial = leases_generation == 0;
+  time_t now = time(NULL);
+  bool changed = false;
+
+  leases_generation++;
   if (leases_file) {
-    while (!feof(leases_file)) {
-      unsigned int expiry;
-      char mac[18];
-      char ip_address[46];
-
-      if (fscanf(leases_file, "%u %17s %45s %*[^\n]\n", &expiry, mac, ip_address) == 3) {
-        json_object *client = json_object_new_object();
-        json_object *addresses = json_object_new_array();
-        json_object *address = json_object_new_object();
-        json_object_object_add(address, "family", json_object_new_string("ipv4"));
-        json_object_object_add(address, "address", json_object_new_string(ip_address));
-        json_object_object_add(address, "expires", json_object_new_int(expiry));
-        json_object_array_add(addresses, address);
-        json_object_object_add(client, "addresses", addresses);
-
-        /* Compute salted hash of MAC address */
-        md5_ctx_t ctx;
-        uint8_t raw_mac_id[16];
-        char mac_id[33];
-
-        md5_begin(&ctx);
-        md5_hash(NW_CLIENT_ID_SALT, NW_CLIENT_ID_SALT_LENGTH, &ctx);
-        md5_hash(mac, 17, &ctx);
-        md5_end(raw_mac_id, &ctx);
-
-        /* Base64 encode the hash so it is more compact */
-        if (nw_base64_encode(raw_mac_id, sizeof(raw_mac_id), mac_id, sizeof(mac_id)) == 0) {
-          json_object_object_add(object, mac_id, client);
-        } else {
-          json_object_put(client);
+    char line[1024];
+    while (fgets(line, sizeof(line), leases_file)) {
+      /* Skip the remainder of overly long lines */
+      if (!strchr(line, '\n')) {
+        int c;
+        while ((c = fgetc(leases_file)) != EOF && c != '\n');
+      }
+
+      char *saveptr;
+      char *expiry = strtok_r(line, " \t\n", &saveptr);
+      char *mac = strtok_r(NULL, " \t\n", &saveptr);
+      char *ip_address = strtok_r(NULL, " \t\n", &saveptr);
+      if (!expiry || !mac || !ip_address || strlen(ip_address) >= sizeof(((struct nw_clients_lease*) 0)->address))
+        continue;
+
+      uint8_t raw_mac[6];
+      if (nw_client_id_parse_mac(mac, raw_mac) != 0)
+        continue;
+
+      struct nw_clients_lease *lease = avl_find_element(&leases, raw_mac, lease, avl);
+      if (!lease) {
+        lease = calloc(1, sizeof(struct nw_clients_lease));
+        if (!lease)
+          continue;
+
+        if (nw_client_id_from_mac(raw_mac, lease->client_id) != 0) {
+          free(lease);
+          continue;
         }
+
+        memcpy(lease->mac, raw_mac, sizeof(lease->mac));
+        lease->avl.key = lease->mac;
+        avl_insert(&leases, &lease->avl);
+
+        /* Leases present on startup are not counted as joins */
+        if (!initial) {
+          lease->joined_at = now;
+          counter_joins++;
+        }
+        changed = true;
       }
+
+      lease->expiry = strtoul(expiry, NULL, 10);
+      snprintf(lease->address, sizeof(lease->address), "%s", ip_address);
+      lease->generation = leases_generation;
     }
 
     fclose(leases_file);
   }
 
+  /* Remove leases that are no longer present */
+  struct nw_clients_lease *lease, *tmp;
+  avl_for_each_element_safe(&leases, lease, avl, tmp) {
+    if (lease->generation == leases_generation)
+      continue;
+
+    avl_delete(&leases, &lease->avl);
+    free(lease);
+    counter_leaves++;
+    changed = true;
+  }
+
+  if (changed || initial)
+    changed_at = now;
+}
+
+static json_object *nw_clients_build_object(void)
+{
+  json_object *object = json_object_new_object();
+
+  struct nw_clients_lease *lease;
+  avl_for_each_element(&leases, lease, avl) {
+    json_object *client = json_object_new_object();
+    json_object *addresses = json_object_new_array();
+    json_object *address = json_object_new_object();
+    json_object_object_add(address, "family", json_object_new_string("ipv4"));
+    json_object_object_add(address, "address", json_object_new_string(lease->address));
+    json_object_object_add(address, "expires", json_object_new_int(lease->expiry));
+    json_object_array_add(addresses, address);
+    json_object_object_add(client, "addresses", addresses);
+    if (lease->joined_at)
+      json_object_object_add(client, "joined_at", json_object_new_int64(lease->joined_at));
+
+    json_object_object_add(object, lease->client_id, client);
+  }
+
+  json_object *statistics = json_object_new_object();
+  json_object_object_add(statistics, "joins", json_object_new_int(counter_joins));
+  json_object_object_add(statistics, "leaves", json_object_new_int(counter_leaves));
+  json_object_object_add(statistics, "changed_at", json_object_new_int64(changed_at));
+  json_object_object_add(object, "_statistics", statistics);
+
+  return object;
+}
+
+/**
+ * Starts collecting addresses of a client data source, keeping the ones
+ * from the previous run for comparison.
+ *
+ * @param source Client data source
+ */
+static void nw_clients_source_begin(struct nw_clients_source *source)
+{
+  struct nw_clients_address *addresses = source->previous;
+  size_t size = source->previous_size;
+
+  source->previous = source->addresses;
+  source->previous_size = source->size;
+  source->previous_count = source->count;
+  source->addresses = addresses;
+  source->size = size;
+  source->count = 0;
+}
+
+static void nw_clients_source_add(struct nw_clients_source *source,
+                                  const char *client_id,
+                                  int family,
+                                  const char *address,
+                                  int64_t expires)
+{
+  if (strlen(address) >= INET6_ADDRSTRLEN)
+    return;
+
+  if (source->count == source->size) {
+    size_t size = source->size ? source->size * 2 : 32;
+    struct nw_clients_address *addresses = realloc(source->addresses, size * sizeof(struct nw_clients_address));
+    if (!addresses)
+      return;
+
+    source->addresses = addresses;
+    source->size = size;
+  }
+
+  struct nw_clients_address *entry = &source->addresses[source->count++];
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->client_id, client_id, sizeof(entry->client_id));
+  entry->family = family;
+  strcpy(entry->address, address);
+  entry->expires = expires;
+}
+
+/**
+ * Checks whether a client data source reported different addresses than in
+ * the previous run. Expiry times are derived from remaining lifetimes, so
+ * they may differ by a second without the lease having been renewed.
+ *
+ * @param source Client data source
+ * @return True when the addresses have changed
+ */
+static bool nw_clients_source_changed(struct nw_clients_source *source)
+{
+  if (source->count != source->previous_count)
+    return true;
+
+  for (size_t i = 0; i < source->count; i++) {
+    struct nw_clients_address *a = &source->addresses[i];
+    struct nw_clients_address *b = &source->previous[i];
+    if (a->family != b->family || strcmp(a->client_id, b->client_id) != 0 ||
+        strcmp(a->address, b->address) != 0 || llabs(a->expires - b->expires) > 1)
+      return true;
+  }
+
+  return false;
+}
+
+static void nw_clients_add_address(json_object *object,
+                                   const char *client_id,
+                                   const char *family,
+                                   const char *address,
+                                   int64_t expires)
+{
+  json_object *client = NULL;
+  json_object *addresses = NULL;
+  if (!json_object_object_get_ex(object, client_id, &client)) {
+    client = json_object_new_object();
+    json_object_object_add(object, client_id, client);
+  }
+
+  if (!json_object_object_get_ex(client, "addresses", &addresses)) {
+    addresses = json_object_new_array();
+    json_object_object_add(client, "addresses", addresses);
+  }
+
+  /* The same address may be reported by multiple sources */
+  for (int i = 0; i < json_object_array_length(addresses); i++) {
+    json_object *existing = NULL;
+    json_object_object_get_ex(json_object_array_get_idx(addresses, i), "address", &existing);
+    if (existing && strcmp(json_object_get_string(existing), address) == 0)
+      return;
+  }
+
+  json_object *entry = json_object_new_object();
+  json_object_object_add(entry, "family", json_object_new_string(family));
+  json_object_object_add(entry, "address", json_object_new_string(address));
+  if (expires)
+    json_object_object_add(entry, "expires", json_object_new_int64(expires));
+  json_object_array_add(addresses, entry);
+}
+
+/**
+ * Extracts the link-layer address from a DUID-LLT or DUID-LL.
+ *
+ * @param duid DUID in hexadecimal representation
+ * @param mac Destination buffer of 6 bytes
+ * @return True when a MAC address was found, false otherwise
+ */
+static bool nw_clients_duid_to_mac(const char *duid, uint8_t *mac)
+{
+  uint8_t raw[14];
+  size_t length = strlen(duid) / 2;
+  if (length > sizeof(raw))
+    length = sizeof(raw);
+
+  for (size_t i = 0; i < length; i++) {
+    if (sscanf(&duid[i * 2], "%2hhx", &raw[i]) != 1)
+      return false;
+  }
+
+  /* Only Ethernet hardware addresses are supported */
+  if (length == 14 && raw[0] == 0 && raw[1] == 1 && raw[2] == 0 && raw[3] == 1) {
+    memcpy(mac, &raw[8], 6);
+    return true;
+  } else if (length == 10 && raw[0] == 0 && raw[1] == 3 && raw[2] == 0 && raw[3] == 1) {
+    memcpy(mac, &raw[4], 6);
+    return true;
+  }
+
+  return false;
+}
+
+static void nw_clients_collect_odhcpd(struct ubus_context *ubus, struct nw_clients_source *source)
+{
+  json_object *data = NULL;
+  static struct blob_buf req;
+  blob_buf_init(&req, 0);
+
+  /* odhcpd is not necessarily running, so a missing object is not an error */
+  int ret = nw_ubus_invoke(ubus, "dhcp", "ipv6leases", req.head, nw_json_from_ubus, &data, 500);
+  if (ret != UBUS_STATUS_OK || !data) {
+    if (ret != UBUS_STATUS_OK && ret != UBUS_STATUS_NOT_FOUND)
+      syslog(LOG_WARNING, "clients: Failed to request DHCPv6 leases from odhcpd!");
+    if (data)
+      json_object_put(data);
+    return;
+  }
+
+  time_t now = time(NULL);
+  json_object *devices = NULL;
+  json_object_object_get_ex(data, "device", &devices);
+  if (devices) {
+    json_object_object_foreach(devices, devname, device) {
+      /* Supress unused variable warning */
+      (void) devname;
+
+      json_object *leases = NULL;
+      json_object_object_get_ex(device, "leases", &leases);
+      if (!leases)
+        continue;
+
+      for (int i = 0; i < json_object_array_length(leases); i++) {
+        json_object *lease = json_object_array_get_idx(leases, i);
+        json_object *duid = NULL;
+        uint8_t mac[6];
+        char client_id[NW_CLIENT_ID_LENGTH + 1];
+        json_object_object_get_ex(lease, "duid", &duid);
+        if (!duid || !nw_clients_duid_to_mac(json_object_get_string(duid), mac))
+          continue;
+        if (nw_client_id_from_mac(mac, client_id) != 0)
+          continue;
+
+        /* Newer odhcpd versions report per-address lifetimes */
+        json_object *addresses = NULL;
+        if (json_object_object_get_ex(lease, "ipv6-addr", &addresses)) {
+          for (int j = 0; j < json_object_array_length(addresses); j++) {
+            json_object *address = json_object_array_get_idx(addresses, j);
+            json_object *value = NULL;
+            json_object *valid = NULL;
+            json_object_object_get_ex(address, "address", &value);
+            json_object_object_get_ex(address, "valid-lifetime", &valid);
+            if (!value)
+              continue;
+
+            nw_clients_source_add(source, client_id, AF_INET6, json_object_get_string(value),
+              valid && json_object_get_int64(valid) > 0 ? now + json_object_get_int64(valid) : 0);
+          }
+        } else if (json_object_object_get_ex(lease, "ipv6", &addresses)) {
+          json_object *valid = NULL;
+          json_object_object_get_ex(lease, "valid", &valid);
+          for (int j = 0; j < json_object_array_length(addresses); j++) {
+            nw_clients_source_add(source, client_id, AF_INET6, json_object_get_string(json_object_array_get_idx(addresses, j)),
+              valid && json_object_get_int64(valid) > 0 ? now + json_object_get_int64(valid) : 0);
+          }
+        }
+      }
+    }
+  }
+
+  json_object_put(data);
+}
+
+struct nw_clients_neighbour_context {
+  /* Destination client data source */
+  struct nw_clients_source *source;
+  /* Indices of interfaces on which neighbours are considered clients */
+  int ifindex[NW_CLIENTS_MAX_INTERFACES];
+  int num_ifindex;
+};
+
+static int nw_clients_parse_neighbour(struct nlmsghdr *hdr, void *priv)
+{
+  struct nw_clients_neighbour_context *ctx = (struct nw_clients_neighbour_context*) priv;
+  struct ndmsg *ndm = NLMSG_DATA(hdr);
+  struct nlattr *tb[NDA_MAX + 1];
+
+  if (hdr->nlmsg_type != RTM_NEWNEIGH)
+    return 0;
+  if (ndm->ndm_state & (NUD_NOARP | NUD_FAILED | NUD_INCOMPLETE))
+    return 0;
+  if (ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6)
+    return 0;
+
+  bool client_interface = false;
+  for (int i = 0; i < ctx->num_ifindex; i++) {
+    if (ctx->ifindex[i] == ndm->ndm_ifindex)
+      client_interface = true;
+  }
+  if (!client_interface)
+    return 0;
+
+  nw_netlink_parse_attrs(tb, NDA_MAX, (char*) ndm + NLMSG_ALIGN(sizeof(*ndm)),
+    hdr->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm)));
+  if (!tb[NDA_DST] || !tb[NDA_LLADDR] || nw_nla_len(tb[NDA_LLADDR]) != 6)
+    return 0;
+
+  /* Link-local IPv6 addresses are not interesting */
+  const uint8_t *dst = nw_nla_data(tb[NDA_DST]);
+  if (ndm->ndm_family == AF_INET6 && dst[0] == 0xfe && (dst[1] & 0xc0) == 0x80)
+    return 0;
+
+  char address[INET6_ADDRSTRLEN];
+  char client_id[NW_CLIENT_ID_LENGTH + 1];
+  if (!inet_ntop(ndm->ndm_family, dst, address, sizeof(address)))
+    return 0;
+  if (nw_client_id_from_mac(nw_nla_data(tb[NDA_LLADDR]), client_id) != 0)
+    return 0;
+
+  nw_clients_source_add(ctx->source, client_id, ndm->ndm_family, address, 0);
+  return 0;
+}
+
+static void nw_clients_collect_neighbours(struct nw_clients_source *source)
+{
+  struct nw_clients_neighbour_context ctx = { .source = source, .num_ifindex = 0, };
+  for (int i = 0; i < clients_num_interfaces; i++) {
+    int ifindex = if_nametoindex(clients_interfaces[i]);
+    if (ifindex > 0)
+      ctx.ifindex[ctx.num_ifindex++] = ifindex;
+  }
+  if (!ctx.num_ifindex)
+    return;
+
+  struct {
+    struct nlmsghdr hdr;
+    struct ndmsg ndm;
+  } req;
+
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+  req.hdr.nlmsg_type = RTM_GETNEIGH;
+  req.hdr.nlmsg_flags = NLM_F_DUMP;
+  req.ndm.ndm_family = AF_UNSPEC;
+  if (nw_netlink_request(&clients_nl, &req.hdr, nw_clients_parse_neighbour, &ctx) != 0)
+    syslog(LOG_WARNING, "clients: Failed to dump neighbour table via netlink!");
+}
+
+/**
+ * Merges addresses of a client data source into the lease object, keyed by
+ * client identifier.
+ */
+static void nw_clients_source_merge(struct nw_clients_source *source, json_object *object)
+{
+  for (size_t i = 0; i < source->count; i++) {
+    struct nw_clients_address *entry = &source->addresses[i];
+    nw_clients_add_address(object, entry->client_id, entry->family == AF_INET ? "ipv4" : "ipv6",
+      entry->address, entry->expires);
+  }
+}
+
+static int nw_clients_start_acquire_data(struct nodewatcher_module *module,
+                                         struct ubus_context *ubus,
+                                         struct uci_context *uci)
+{
+  bool changed = false;
+
+  /* Only parse DHCP leases again when they have changed */
+  if ((clients_sources & NW_CLIENTS_SOURCE_DHCP) && nw_clients_leases_changed()) {
+    nw_clients_parse_leases();
+    changed = true;
+  }
+
+  /* Other sources are queried on every run, but only compared to the previous run */
+  if (clients_sources & NW_CLIENTS_SOURCE_DHCPV6) {
+    nw_clients_source_begin(&source_dhcpv6);
+    nw_clients_collect_odhcpd(ubus, &source_dhcpv6);
+    changed |= nw_clients_source_changed(&source_dhcpv6);
+  }
+  if (clients_sources & NW_CLIENTS_SOURCE_NEIGHBOURS) {
+    nw_clients_source_begin(&source_neighbours);
+    nw_clients_collect_neighbours(&source_neighbours);
+    changed |= nw_clients_source_changed(&source_neighbours);
+  }
+
+  /* The merged object is only rebuilt when one of the sources has changed */
+  if (changed || !cached_object) {
+    if (cached_object)
+      json_object_put(cached_object);
+
+    cached_object = nw_clients_build_object();
+    if (clients_sources & NW_CLIENTS_SOURCE_DHCPV6)
+      nw_clients_source_merge(&source_dhcpv6, cached_object);
+    if (clients_sources & NW_CLIENTS_SOURCE_NEIGHBOURS)
+      nw_clients_source_merge(&source_neighbours, cached_object);
+  }
+
   /* Store resulting JSON object */
-  return nw_module_finish_acquire_data(module, object);
+  return nw_module_finish_acquire_data(module, json_object_get(cached_object));
 }
 
 static int nw_clients_init(struct nodewatcher_module *module,
                            struct ubus_context *ubus,
                            struct uci_context *uci)
 {
+  avl_init(&leases, nw_clients_mac_cmp, false, NULL);
+
+  /* Client data sources */
+  char *sources = nw_uci_get_string(uci, "nodewatcher.@agent[0].clients_sources");
+  if (sources) {
+    char *saveptr;
+    clients_sources = 0;
+    for (char *source = strtok_r(sources, " ", &saveptr); source; source = strtok_r(NULL, " ", &saveptr)) {
+      if (strcmp(source, "dhcp") == 0)
+        clients_sources |= NW_CLIENTS_SOURCE_DHCP;
+      else if (strcmp(source, "dhcpv6") == 0)
+        clients_sources |= NW_CLIENTS_SOURCE_DHCPV6;
+      else if (strcmp(source, "neighbours") == 0)
+        clients_sources |= NW_CLIENTS_SOURCE_NEIGHBOURS;
+    }
+    free(sources);
+  }
+
+  /* Interfaces on which neighbours are considered clients */
+  char *interfaces = nw_uci_get_string(uci, "nodewatcher.@agent[0].clients_interfaces");
+  char default_interfaces[] = "br-lan";
+  char *saveptr;
+  for (char *ifname = strtok_r(interfaces ? interfaces : default_interfaces, " ", &saveptr);
+       ifname && clients_num_interfaces < NW_CLIENTS_MAX_INTERFACES;
+       ifname = strtok_r(NULL, " ", &saveptr)) {
+    snprintf(clients_interfaces[clients_num_interfaces++], IFNAMSIZ, "%s", ifname);
+  }
+  free(interfaces);
+
+  if ((clients_sources & NW_CLIENTS_SOURCE_NEIGHBOURS) && nw_netlink_open(&clients_nl, NETLINK_ROUTE) != 0) {
+    syslog(LOG_WARNING, "clients: Failed to open netlink socket, neighbours will not be reported.");
+    clients_sources &= ~NW_CLIENTS_SOURCE_NEIGHBOURS;
+  }
+
+  /* The lease file is watched once it exists, see nw_clients_leases_changed */
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    syslog(LOG_WARNING, "clients: Failed to watch DHCP leases, falling back to periodic checks.");
+    return 0;
+  }
+
+  leases_watch.fd = fd;
+  leases_watch.cb = nw_clients_watch_handler;
+  uloop_fd_add(&leases_watch, ULOOP_READ);
   return 0;
 }
 
@@ -86,7 +656,7 @@ static int nw_clients_init(struct nodewatcher_module *module,
 struct nodewatcher_module nw_module = {
   .name = "core.clients",
   .author = "Jernej Kos <jernej@kos.mx>",
-  .version = 1,
+  .version = 3,
   .hooks = {
     .init               = nw_clients_init,
     .start_acquire_data = nw_clients_start_acquire_data,
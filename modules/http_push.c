@@ -19,12 +19,16 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/json.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/output.h>
+#include <nodewatcher-agent/cbor.h>
 
 #include <syslog.h>
 #include <curl.h>
 
 /* Timestamp when last successful push occurred. */
 static time_t last_push_at = 0;
+/* Buffer for CBOR encoded pushes, reused across pushes. */
+static struct nw_cbor_buffer cbor_buffer;
 
 static size_t nw_http_push_ignore_data(void *buffer, size_t size, size_t nmemb, void *userp)
 {
@@ -65,7 +69,29 @@ static int nw_http_push_start_acquire_data(struct nodewatcher_module *module,
         curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1);
         curl_easy_setopt(curl, CURLOPT_URL, url);
         curl_easy_setopt(curl, CURLOPT_POST, 1);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_object_to_json_string(data));
+
+        /* Encode the data in the configured format. */
+        char *format_name = nw_uci_get_string(uci, "nodewatcher.@agent[0].push_format");
+        enum nw_output_format format;
+        if (nw_output_parse_format(format_name, &format) != 0) {
+          syslog(LOG_WARNING, "http-push: Unknown push format '%s', using JSON.", format_name);
+          format = NW_OUTPUT_FORMAT_JSON;
+        } else if (format == NW_OUTPUT_FORMAT_OPENMETRICS) {
+          /* OpenMetrics is an exposition format to be scraped, it is not pushed. */
+          syslog(LOG_WARNING, "http-push: Unsupported push format '%s', using JSON.", format_name);
+          format = NW_OUTPUT_FORMAT_JSON;
+        }
+        free(format_name);
+
+        struct curl_slist *headers = NULL;
+        if (format == NW_OUTPUT_FORMAT_CBOR && nw_cbor_encode(data, &cbor_buffer) == 0) {
+          headers = curl_slist_append(headers, "Content-Type: application/cbor");
+          curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+          curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) cbor_buffer.length);
+          curl_easy_setopt(curl, CURLOPT_POSTFIELDS, cbor_buffer.data);
+        } else {
+          curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json_object_to_json_string(data));
+        }
 #if LIBCURL_VERSION_NUM >= 0x072700
         /* Pin server-side public key when configured. */
         char *server_pubkey = nw_uci_get_string(uci, "nodewatcher.@agent[0].push_server_pubkey");
@@ -129,6 +155,7 @@ static int nw_http_push_start_acquire_data(struct nodewatcher_module *module,
           last_push_at = time(NULL);
 
         curl_easy_cleanup(curl);
+        curl_slist_free_all(headers);
       } else {
         push_result = "init_error";
       }
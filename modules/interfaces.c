@@ -19,6 +19,8 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/json.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/netlink.h>
+#include <nodewatcher-agent/ubus.h>
 
 #include <uci.h>
 #include <syslog.h>
@@ -26,132 +28,791 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
 #include <unistd.h>
+#include <time.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/if_addr.h>
 
-static bool nw_interfaces_process_device(struct ubus_context *ubus,
-                                         const char *ifname,
-                                         const char *devname,
-                                         const char *parent,
-                                         json_object *addresses,
-                                         json_object *object)
+#ifndef IFF_LOWER_UP
+#define IFF_LOWER_UP 0x10000
+#endif
+
+/* Interface data backends */
+enum {
+  NW_INTERFACES_BACKEND_NETLINK,
+  NW_INTERFACES_BACKEND_UBUS,
+};
+
+/* Configured interface data backend */
+static int interfaces_backend = NW_INTERFACES_BACKEND_NETLINK;
+
+/* Counters for which per-second rates are published */
+static const char *nw_interfaces_rate_counters[] = {
+  "rx_bytes",
+  "tx_bytes",
+  "rx_packets",
+  "tx_packets",
+  "rx_errors",
+  "tx_errors",
+  "rx_dropped",
+  "tx_dropped",
+};
+
+#define NW_INTERFACES_RATE_COUNTERS ARRAY_SIZE(nw_interfaces_rate_counters)
+
+/* Previous counter sample of a single device */
+struct nw_interfaces_sample {
+  /* Interface index (zero when unknown) */
+  int ifindex;
+  /* Device name (empty for unused slots) */
+  char name[IFNAMSIZ];
+  /* Acquisition in which the device was last seen */
+  unsigned int generation;
+  /* Time of the sample */
+  struct timespec at;
+  /* Counter values */
+  uint64_t values[NW_INTERFACES_RATE_COUNTERS];
+  /* Rates computed in the last acquisition (negative when unknown) */
+  double rates[NW_INTERFACES_RATE_COUNTERS];
+};
+
+/* Open addressing table of device samples, sized to the device count */
+static struct {
+  struct nw_interfaces_sample *samples;
+  size_t size;
+  size_t count;
+  unsigned int generation;
+} irt;
+
+static size_t nw_interfaces_sample_hash(int ifindex, const char *name)
 {
-  json_object *device = json_object_new_object();
-  json_object_object_add(device, "name", json_object_new_string(devname));
-  json_object_object_add(device, "config", json_object_new_string(ifname));
-  if (parent)
-    json_object_object_add(device, "parent", json_object_new_string(parent));
+  size_t hash = 5381 + ifindex;
+  for (; *name; name++)
+    hash = hash * 33 + (uint8_t) *name;
+  return hash;
+}
 
-  /* Include addresses (can be NULL) */
-  if (addresses && json_object_array_length(addresses) > 0)
-    json_object_object_add(device, "addresses", json_object_get(addresses));
+static struct nw_interfaces_sample *nw_interfaces_sample_slot(struct nw_interfaces_sample *samples,
+                                                             size_t size,
+                                                             int ifindex,
+                                                             const char *name)
+{
+  size_t mask = size - 1;
+  for (size_t i = nw_interfaces_sample_hash(ifindex, name) & mask;; i = (i + 1) & mask) {
+    struct nw_interfaces_sample *sample = &samples[i];
+    if (!sample->name[0] || (sample->ifindex == ifindex && strcmp(sample->name, name) == 0))
+      return sample;
+  }
+}
+
+/**
+ * Resizes the sample table so that it fits the given number of devices.
+ *
+ * @param count Number of devices to make room for
+ * @return True on success, false on allocation failure
+ */
+static bool nw_interfaces_samples_resize(size_t count)
+{
+  size_t size = 16;
+  while (size < count * 2)
+    size *= 2;
+
+  struct nw_interfaces_sample *samples = calloc(size, sizeof(struct nw_interfaces_sample));
+  if (!samples)
+    return false;
 
-  /* Request detailed device statistics */
-  uint32_t ubus_id;
-  if (ubus_lookup_id(ubus, "network.device", &ubus_id)) {
-    syslog(LOG_WARNING, "interfaces: Failed to find netifd object 'network.device'!");
-    goto data_error;
+  for (size_t i = 0; i < irt.size; i++) {
+    struct nw_interfaces_sample *sample = &irt.samples[i];
+    if (sample->name[0])
+      *nw_interfaces_sample_slot(samples, size, sample->ifindex, sample->name) = *sample;
   }
 
-  json_object *data = NULL;
-  static struct blob_buf req;
-  blob_buf_init(&req, 0);
-  blobmsg_add_string(&req, "name", devname);
+  free(irt.samples);
+  irt.samples = samples;
+  irt.size = size;
+  return true;
+}
 
-  if (ubus_invoke(ubus, ubus_id, "status", req.head, nw_json_from_ubus, &data, 500) != UBUS_STATUS_OK)
-    goto data_error;
-  if (!data)
-    goto data_error;
+/**
+ * Removes a sample from the table, moving back later samples of the same
+ * probe sequence so that lookups need no tombstones.
+ *
+ * @param index Slot of the sample to remove
+ */
+static void nw_interfaces_samples_remove(size_t index)
+{
+  size_t mask = irt.size - 1;
+  size_t hole = index;
+  for (size_t i = (index + 1) & mask; irt.samples[i].name[0]; i = (i + 1) & mask) {
+    struct nw_interfaces_sample *sample = &irt.samples[i];
+    size_t home = nw_interfaces_sample_hash(sample->ifindex, sample->name) & mask;
+    /* Samples may only move towards their home slot */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      irt.samples[hole] = *sample;
+      hole = i;
+    }
+  }
 
-  /* XXX: Currently, MAC address of wireless interfaces is not reported because
-          of a bug in netifd. See OpenWrt ticket #16633. */
-  json_object *mac;
-  json_object_object_get_ex(data, "macaddr", &mac);
-  if (mac) {
-    json_object_object_add(device, "mac", json_object_get(mac));
-  } else {
-    /* Manually try to obtain a device's MAC address via ioctl */
-    struct ifreq ifr;
-    int fd = socket(AF_LOCAL, SOCK_DGRAM, 0);
+  memset(&irt.samples[hole], 0, sizeof(struct nw_interfaces_sample));
+  irt.count--;
+}
 
-    if (fd != -1) {
-      memset(&ifr, 0, sizeof(ifr));
-      strncpy(ifr.ifr_name, devname, sizeof(ifr.ifr_name));
+/**
+ * Starts a new acquisition, dropping samples of devices that have
+ * disappeared since the previous one.
+ */
+static void nw_interfaces_samples_begin(void)
+{
+  for (size_t i = 0; i < irt.size;) {
+    struct nw_interfaces_sample *sample = &irt.samples[i];
+    /* The slot is checked again as another sample may have moved into it */
+    if (sample->name[0] && sample->generation != irt.generation)
+      nw_interfaces_samples_remove(i);
+    else
+      i++;
+  }
 
-      if (ioctl(fd, SIOCGIFHWADDR, &ifr) == 0) {
-        char mac_address[18] = {0, };
-        snprintf(mac_address, sizeof(mac_address), "%02x:%02x:%02x:%02x:%02x:%02x",
-          (uint8_t) ifr.ifr_hwaddr.sa_data[0], (uint8_t) ifr.ifr_hwaddr.sa_data[1],
-          (uint8_t) ifr.ifr_hwaddr.sa_data[2], (uint8_t) ifr.ifr_hwaddr.sa_data[3],
-          (uint8_t) ifr.ifr_hwaddr.sa_data[4], (uint8_t) ifr.ifr_hwaddr.sa_data[5]);
+  /* Shrink the table only after most devices have disappeared */
+  if (irt.size > 16 && irt.count * 8 < irt.size)
+    nw_interfaces_samples_resize(irt.count);
 
-        json_object_object_add(device, "mac", json_object_new_string(mac_address));
-      }
+  irt.generation++;
+}
 
-      close(fd);
-    }
+/**
+ * Computes the increase of a counter since the previous sample. Drivers
+ * that only maintain 32-bit counters wrap around, which is distinguished
+ * from a counter reset by the size of the apparent decrease.
+ *
+ * @param previous Previous counter value
+ * @param current Current counter value
+ * @param delta Destination for the increase
+ * @return True when the increase is known, false on counter reset
+ */
+static bool nw_interfaces_counter_delta(uint64_t previous, uint64_t current, uint64_t *delta)
+{
+  if (current >= previous) {
+    *delta = current - previous;
+    return true;
   }
 
-  NW_COPY_JSON_OBJECT(data, "mtu", device, "mtu");
-  NW_COPY_JSON_OBJECT(data, "up", device, "up");
-  NW_COPY_JSON_OBJECT(data, "carrier", device, "carrier");
-  NW_COPY_JSON_OBJECT(data, "speed", device, "speed");
-  NW_COPY_JSON_OBJECT(data, "statistics", device, "statistics");
+  if (previous <= UINT32_MAX && previous - current > UINT32_MAX / 2) {
+    *delta = (UINT32_MAX - previous) + current + 1;
+    return true;
+  }
 
-  json_object_object_add(object, devname, device);
+  return false;
+}
 
-  /* If the device is a bridge and has any children, we should add them as well */
-  json_object *children = NULL;
-  json_object_object_get_ex(data, "bridge-members", &children);
-  if (children) {
-    int i;
-    for (i = 0; i < json_object_array_length(children); i++) {
-      const char *childname = json_object_get_string(json_object_array_get_idx(children, i));
-      nw_interfaces_process_device(ubus, ifname, childname, devname, NULL, object);
+static void nw_interfaces_add_rates(int ifindex, const char *name, json_object *device)
+{
+  json_object *statistics = NULL;
+  json_object_object_get_ex(device, "statistics", &statistics);
+  if (!statistics || !name[0] || strlen(name) >= IFNAMSIZ)
+    return;
+
+  /* Make sure there is always room for another device */
+  if ((irt.count + 1) * 2 > irt.size && !nw_interfaces_samples_resize(irt.count + 1))
+    return;
+
+  struct nw_interfaces_sample *sample = nw_interfaces_sample_slot(irt.samples, irt.size, ifindex, name);
+  if (sample->name[0] && sample->generation != irt.generation) {
+    /* Compute rates since the previous acquisition */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double interval = (now.tv_sec - sample->at.tv_sec) +
+                      (now.tv_nsec - sample->at.tv_nsec) / 1e9;
+
+    for (size_t i = 0; i < NW_INTERFACES_RATE_COUNTERS; i++) {
+      json_object *counter = NULL;
+      uint64_t value, delta;
+      sample->rates[i] = -1;
+      if (!json_object_object_get_ex(statistics, nw_interfaces_rate_counters[i], &counter))
+        continue;
+
+      value = (uint64_t) json_object_get_int64(counter);
+      if (interval > 0 && nw_interfaces_counter_delta(sample->values[i], value, &delta))
+        sample->rates[i] = delta / interval;
+      sample->values[i] = value;
+    }
+
+    sample->at = now;
+  } else if (!sample->name[0]) {
+    /* New device, rates are only available in the next acquisition */
+    sample->ifindex = ifindex;
+    strcpy(sample->name, name);
+    irt.count++;
+    clock_gettime(CLOCK_MONOTONIC, &sample->at);
+    for (size_t i = 0; i < NW_INTERFACES_RATE_COUNTERS; i++) {
+      json_object *counter = NULL;
+      json_object_object_get_ex(statistics, nw_interfaces_rate_counters[i], &counter);
+      sample->values[i] = counter ? (uint64_t) json_object_get_int64(counter) : 0;
+      sample->rates[i] = -1;
     }
   }
 
-  json_object_put(data);
-  return true;
+  /* Devices referenced by multiple interfaces reuse the rates from this acquisition */
+  sample->generation = irt.generation;
 
-data_error:
-  syslog(LOG_WARNING, "interfaces: Failed to parse netifd device data!");
-  json_object_put(device);
-  return false;
+  json_object *rates = NULL;
+  for (size_t i = 0; i < NW_INTERFACES_RATE_COUNTERS; i++) {
+    if (sample->rates[i] < 0)
+      continue;
+
+    if (!rates)
+      rates = json_object_new_object();
+
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.2f", sample->rates[i]);
+    json_object_object_add(rates, nw_interfaces_rate_counters[i], json_object_new_string(rate));
+  }
+
+  if (rates)
+    json_object_object_add(device, "rates", rates);
 }
 
-static bool nw_interfaces_process_interface(struct ubus_context *ubus,
-                                            const char *ifname,
-                                            json_object *object)
+/* Netlink interface statistics exported in the same format as netifd */
+static const struct {
+  const char *name;
+  size_t offset;
+} nw_interfaces_link_stats[] = {
+  { "rx_packets",          offsetof(struct rtnl_link_stats64, rx_packets) },
+  { "tx_packets",          offsetof(struct rtnl_link_stats64, tx_packets) },
+  { "rx_bytes",            offsetof(struct rtnl_link_stats64, rx_bytes) },
+  { "tx_bytes",            offsetof(struct rtnl_link_stats64, tx_bytes) },
+  { "rx_errors",           offsetof(struct rtnl_link_stats64, rx_errors) },
+  { "tx_errors",           offsetof(struct rtnl_link_stats64, tx_errors) },
+  { "rx_dropped",          offsetof(struct rtnl_link_stats64, rx_dropped) },
+  { "tx_dropped",          offsetof(struct rtnl_link_stats64, tx_dropped) },
+  { "multicast",           offsetof(struct rtnl_link_stats64, multicast) },
+  { "collisions",          offsetof(struct rtnl_link_stats64, collisions) },
+  { "rx_length_errors",    offsetof(struct rtnl_link_stats64, rx_length_errors) },
+  { "rx_over_errors",      offsetof(struct rtnl_link_stats64, rx_over_errors) },
+  { "rx_crc_errors",       offsetof(struct rtnl_link_stats64, rx_crc_errors) },
+  { "rx_frame_errors",     offsetof(struct rtnl_link_stats64, rx_frame_errors) },
+  { "rx_fifo_errors",      offsetof(struct rtnl_link_stats64, rx_fifo_errors) },
+  { "rx_missed_errors",    offsetof(struct rtnl_link_stats64, rx_missed_errors) },
+  { "tx_aborted_errors",   offsetof(struct rtnl_link_stats64, tx_aborted_errors) },
+  { "tx_carrier_errors",   offsetof(struct rtnl_link_stats64, tx_carrier_errors) },
+  { "tx_fifo_errors",      offsetof(struct rtnl_link_stats64, tx_fifo_errors) },
+  { "tx_heartbeat_errors", offsetof(struct rtnl_link_stats64, tx_heartbeat_errors) },
+  { "tx_window_errors",    offsetof(struct rtnl_link_stats64, tx_window_errors) },
+  { "rx_compressed",       offsetof(struct rtnl_link_stats64, rx_compressed) },
+  { "tx_compressed",       offsetof(struct rtnl_link_stats64, tx_compressed) },
+};
+
+/* Network device as reported by a RTM_GETLINK dump */
+struct nw_interfaces_link {
+  /* Interface index */
+  int ifindex;
+  /* Interface index of the master device (bridge) or zero */
+  int master;
+  /* Device name */
+  char name[IFNAMSIZ];
+  /* Hardware address */
+  uint8_t mac[ETH_ALEN];
+  bool has_mac;
+  /* Device MTU */
+  unsigned int mtu;
+  /* Device flags (IFF_*) */
+  unsigned int flags;
+  /* Device statistics */
+  struct rtnl_link_stats64 stats;
+  bool has_stats;
+  /* First address assigned to this device (index) or -1 */
+  int first_address;
+  /* First device enslaved to this device (index) or -1 */
+  int first_child;
+  /* Next device enslaved to the same master (index) or -1 */
+  int next_sibling;
+};
+
+/* Address as reported by a RTM_GETADDR dump */
+struct nw_interfaces_address {
+  /* Address family */
+  int family;
+  /* Prefix length */
+  int prefixlen;
+  /* Address in presentation format */
+  char address[INET6_ADDRSTRLEN];
+  /* Next address assigned to the same device (index) or -1 */
+  int next;
+};
+
+/**
+ * Results of the netlink dumps. The tables are reused between runs so
+ * that no allocations are needed in the steady state.
+ */
+struct nw_interfaces_netlink {
+  /* Netlink socket */
+  struct nw_netlink nl;
+  /* Devices */
+  struct nw_interfaces_link *links;
+  size_t links_size;
+  size_t num_links;
+  /* Addresses */
+  struct nw_interfaces_address *addresses;
+  size_t addresses_size;
+  size_t num_addresses;
+  /* Open addressing index from ifindex to device (position + 1) */
+  int *index;
+  size_t index_size;
+};
+
+/* Netlink backend state */
+static struct nw_interfaces_netlink inl = { .nl = { .fd = -1, }, };
+
+static struct nw_interfaces_link *nw_interfaces_netlink_find_link(int ifindex)
 {
-  /* Resolve proper ubus object path */
-  char ubus_path[64] = { 0, };
-  snprintf(ubus_path, sizeof(ubus_path), "network.interface.%s", ifname);
+  if (!inl.index_size)
+    return NULL;
+
+  size_t mask = inl.index_size - 1;
+  for (size_t i = ifindex & mask;; i = (i + 1) & mask) {
+    int position = inl.index[i];
+    if (!position)
+      return NULL;
+    if (inl.links[position - 1].ifindex == ifindex)
+      return &inl.links[position - 1];
+  }
+}
+
+static struct nw_interfaces_link *nw_interfaces_netlink_find_link_by_name(const char *name)
+{
+  for (size_t i = 0; i < inl.num_links; i++) {
+    if (strcmp(inl.links[i].name, name) == 0)
+      return &inl.links[i];
+  }
+
+  return NULL;
+}
+
+static int nw_interfaces_netlink_parse_link(struct nlmsghdr *hdr, void *priv)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(hdr);
+  struct nlattr *tb[IFLA_MAX + 1];
+
+  if (hdr->nlmsg_type != RTM_NEWLINK)
+    return 0;
+
+  nw_netlink_parse_attrs(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(hdr));
+  if (!tb[IFLA_IFNAME])
+    return 0;
+
+  /* Grow the device table when needed */
+  if (inl.num_links == inl.links_size) {
+    size_t size = inl.links_size ? inl.links_size * 2 : 16;
+    struct nw_interfaces_link *links = realloc(inl.links, size * sizeof(*links));
+    if (!links)
+      return -1;
+
+    inl.links = links;
+    inl.links_size = size;
+  }
+
+  struct nw_interfaces_link *link = &inl.links[inl.num_links++];
+  memset(link, 0, sizeof(*link));
+  link->ifindex = ifi->ifi_index;
+  link->flags = ifi->ifi_flags;
+  link->first_address = -1;
+  link->first_child = -1;
+  link->next_sibling = -1;
+  snprintf(link->name, sizeof(link->name), "%s", (char*) nw_nla_data(tb[IFLA_IFNAME]));
+
+  if (tb[IFLA_MASTER])
+    link->master = nw_nla_get_u32(tb[IFLA_MASTER]);
+  if (tb[IFLA_MTU])
+    link->mtu = nw_nla_get_u32(tb[IFLA_MTU]);
+  if (tb[IFLA_ADDRESS] && nw_nla_len(tb[IFLA_ADDRESS]) == ETH_ALEN) {
+    memcpy(link->mac, nw_nla_data(tb[IFLA_ADDRESS]), ETH_ALEN);
+    link->has_mac = true;
+  }
+  if (tb[IFLA_STATS64] && nw_nla_len(tb[IFLA_STATS64]) >= (int) sizeof(link->stats)) {
+    memcpy(&link->stats, nw_nla_data(tb[IFLA_STATS64]), sizeof(link->stats));
+    link->has_stats = true;
+  }
+
+  return 0;
+}
+
+static int nw_interfaces_netlink_parse_address(struct nlmsghdr *hdr, void *priv)
+{
+  struct ifaddrmsg *ifa = NLMSG_DATA(hdr);
+  struct nlattr *tb[IFA_MAX + 1];
 
-  uint32_t ubus_id;
-  if (ubus_lookup_id(ubus, ubus_path, &ubus_id)) {
-    syslog(LOG_WARNING, "interfaces: Failed to find netifd object '%s'!", ubus_path);
+  if (hdr->nlmsg_type != RTM_NEWADDR)
+    return 0;
+
+  /* Only report global addresses, as netifd does */
+  if (ifa->ifa_scope != RT_SCOPE_UNIVERSE)
+    return 0;
+
+  struct nw_interfaces_link *link = nw_interfaces_netlink_find_link(ifa->ifa_index);
+  if (!link)
+    return 0;
+
+  nw_netlink_parse_attrs(tb, IFA_MAX, IFA_RTA(ifa), IFA_PAYLOAD(hdr));
+  struct nlattr *addr = tb[IFA_LOCAL] ? tb[IFA_LOCAL] : tb[IFA_ADDRESS];
+  if (!addr)
+    return 0;
+
+  /* Grow the address table when needed */
+  if (inl.num_addresses == inl.addresses_size) {
+    size_t size = inl.addresses_size ? inl.addresses_size * 2 : 16;
+    struct nw_interfaces_address *addresses = realloc(inl.addresses, size * sizeof(*addresses));
+    if (!addresses)
+      return -1;
+
+    inl.addresses = addresses;
+    inl.addresses_size = size;
+  }
+
+  struct nw_interfaces_address *address = &inl.addresses[inl.num_addresses];
+  address->family = ifa->ifa_family;
+  address->prefixlen = ifa->ifa_prefixlen;
+  if (!inet_ntop(ifa->ifa_family, nw_nla_data(addr), address->address, sizeof(address->address)))
+    return 0;
+
+  /* Append to the end of the per-device list to preserve kernel ordering */
+  address->next = -1;
+  if (link->first_address < 0) {
+    link->first_address = inl.num_addresses;
+  } else {
+    int last = link->first_address;
+    while (inl.addresses[last].next >= 0)
+      last = inl.addresses[last].next;
+    inl.addresses[last].next = inl.num_addresses;
+  }
+
+  inl.num_addresses++;
+  return 0;
+}
+
+static bool nw_interfaces_netlink_dump(void)
+{
+  struct {
+    struct nlmsghdr hdr;
+    union {
+      struct ifinfomsg ifi;
+      struct ifaddrmsg ifa;
+    };
+  } req;
+
+  inl.num_links = 0;
+  inl.num_addresses = 0;
+
+  /* Dump all network devices */
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  req.hdr.nlmsg_type = RTM_GETLINK;
+  req.hdr.nlmsg_flags = NLM_F_DUMP;
+  req.ifi.ifi_family = AF_UNSPEC;
+  if (nw_netlink_request(&inl.nl, &req.hdr, nw_interfaces_netlink_parse_link, NULL) != 0) {
+    syslog(LOG_WARNING, "interfaces: Failed to dump network devices via netlink!");
     return false;
   }
 
-  /* Prepare and send a request */
-  json_object *data = NULL;
-  static struct blob_buf req;
-  blob_buf_init(&req, 0);
-  if (ubus_invoke(ubus, ubus_id, "status", req.head, nw_json_from_ubus, &data, 500) != UBUS_STATUS_OK) {
-    syslog(LOG_WARNING, "interfaces: Failed to request status from netifd object '%s'!", ubus_path);
+  /* Index devices by ifindex, sizing the index to the device count */
+  size_t index_size = 16;
+  while (index_size < inl.num_links * 2)
+    index_size *= 2;
+  if (index_size != inl.index_size) {
+    int *index = realloc(inl.index, index_size * sizeof(*index));
+    if (!index)
+      return false;
+
+    inl.index = index;
+    inl.index_size = index_size;
+  }
+
+  memset(inl.index, 0, inl.index_size * sizeof(*inl.index));
+  for (size_t i = 0; i < inl.num_links; i++) {
+    size_t mask = inl.index_size - 1;
+    size_t j = inl.links[i].ifindex & mask;
+    while (inl.index[j])
+      j = (j + 1) & mask;
+    inl.index[j] = i + 1;
+  }
+
+  /* Link enslaved devices to their masters */
+  for (size_t i = inl.num_links; i-- > 0;) {
+    struct nw_interfaces_link *link = &inl.links[i];
+    if (!link->master)
+      continue;
+
+    struct nw_interfaces_link *master = nw_interfaces_netlink_find_link(link->master);
+    if (!master)
+      continue;
+
+    link->next_sibling = master->first_child;
+    master->first_child = i;
+  }
+
+  /* Dump all addresses */
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+  req.hdr.nlmsg_type = RTM_GETADDR;
+  req.hdr.nlmsg_flags = NLM_F_DUMP;
+  req.ifa.ifa_family = AF_UNSPEC;
+  if (nw_netlink_request(&inl.nl, &req.hdr, nw_interfaces_netlink_parse_address, NULL) != 0) {
+    syslog(LOG_WARNING, "interfaces: Failed to dump addresses via netlink!");
     return false;
   }
-  if (!data) {
-    syslog(LOG_WARNING, "interfaces: Failed to parse netifd interface data!");
+
+  return true;
+}
+
+static void nw_interfaces_netlink_add_speed(const char *devname, json_object *device)
+{
+  /* Format link speed the same way as netifd does (for example 1000F) */
+  char path[64];
+  uint64_t speed;
+  snprintf(path, sizeof(path), "/sys/class/net/%s/speed", devname);
+  if (nw_file_read_uint64(path, &speed) != 0 || speed == 0 || speed >= INT32_MAX)
+    return;
+
+  char duplex[8] = { 0, };
+  snprintf(path, sizeof(path), "/sys/class/net/%s/duplex", devname);
+  FILE *duplex_file = fopen(path, "r");
+  if (duplex_file) {
+    if (fscanf(duplex_file, "%7s", duplex) != 1)
+      duplex[0] = 0;
+    fclose(duplex_file);
+  }
+
+  char value[32];
+  snprintf(value, sizeof(value), "%d%c", (int) speed, strcmp(duplex, "full") == 0 ? 'F' : 'H');
+  json_object_object_add(device, "speed", json_object_new_string(value));
+}
+
+static void nw_interfaces_netlink_process_device(const char *ifname,
+                                                 struct nw_interfaces_link *link,
+                                                 struct nw_interfaces_link *l3_link,
+                                                 const char *parent,
+                                                 json_object *object)
+{
+  json_object *device = json_object_new_object();
+  json_object_object_add(device, "name", json_object_new_string(link->name));
+  json_object_object_add(device, "config", json_object_new_string(ifname));
+  if (parent)
+    json_object_object_add(device, "parent", json_object_new_string(parent));
+
+  /* Interface addresses are reported on the layer 3 device */
+  if (l3_link && l3_link->first_address >= 0) {
+    json_object *addresses = json_object_new_array();
+    for (int i = l3_link->first_address; i >= 0; i = inl.addresses[i].next) {
+      struct nw_interfaces_address *a = &inl.addresses[i];
+      json_object *address = json_object_new_object();
+      json_object_object_add(address, "family", json_object_new_string(a->family == AF_INET6 ? "ipv6" : "ipv4"));
+      json_object_object_add(address, "address", json_object_new_string(a->address));
+      json_object_object_add(address, "mask", json_object_new_int(a->prefixlen));
+      json_object_array_add(addresses, address);
+    }
+    json_object_object_add(device, "addresses", addresses);
+  }
+
+  if (link->has_mac) {
+    char mac_address[18];
+    snprintf(mac_address, sizeof(mac_address), "%02x:%02x:%02x:%02x:%02x:%02x",
+      link->mac[0], link->mac[1], link->mac[2], link->mac[3], link->mac[4], link->mac[5]);
+    json_object_object_add(device, "mac", json_object_new_string(mac_address));
+  }
+
+  json_object_object_add(device, "mtu", json_object_new_int(link->mtu));
+  json_object_object_add(device, "up", json_object_new_boolean(link->flags & IFF_UP));
+  json_object_object_add(device, "carrier", json_object_new_boolean(link->flags & IFF_LOWER_UP));
+  if (link->flags & IFF_LOWER_UP)
+    nw_interfaces_netlink_add_speed(link->name, device);
+
+  if (link->has_stats) {
+    json_object *statistics = json_object_new_object();
+    for (size_t i = 0; i < ARRAY_SIZE(nw_interfaces_link_stats); i++) {
+      uint64_t value = *(uint64_t*) ((char*) &link->stats + nw_interfaces_link_stats[i].offset);
+      json_object_object_add(statistics, nw_interfaces_link_stats[i].name, json_object_new_int64(value));
+    }
+    json_object_object_add(device, "statistics", statistics);
+    nw_interfaces_add_rates(link->ifindex, link->name, device);
+  }
+
+  json_object_object_add(object, link->name, device);
+
+  /* If the device is a bridge and has any children, we should add them as well */
+  for (int i = link->first_child; i >= 0; i = inl.links[i].next_sibling)
+    nw_interfaces_netlink_process_device(ifname, &inl.links[i], NULL, link->name, object);
+}
+
+static bool nw_interfaces_netlink_process_dump(json_object *data,
+                                               struct uci_package *cfg_network,
+                                               json_object *object)
+{
+  json_object *interfaces = NULL;
+  json_object_object_get_ex(data, "interface", &interfaces);
+  if (!interfaces || !nw_interfaces_netlink_dump())
     return false;
+
+  int i;
+  for (i = 0; i < json_object_array_length(interfaces); i++) {
+    json_object *interface = json_object_array_get_idx(interfaces, i);
+    json_object *name = NULL;
+    json_object *devname = NULL;
+    json_object *l3_devname = NULL;
+    json_object_object_get_ex(interface, "interface", &name);
+    json_object_object_get_ex(interface, "device", &devname);
+    json_object_object_get_ex(interface, "l3_device", &l3_devname);
+    if (!name || !devname)
+      continue;
+
+    /* Only report interfaces that are present in the configuration */
+    const char *ifname = json_object_get_string(name);
+    struct uci_section *cfg_section = uci_lookup_section(cfg_network->ctx, cfg_network, ifname);
+    if (!cfg_section || strcmp(cfg_section->type, "interface") != 0)
+      continue;
+
+    struct nw_interfaces_link *link = nw_interfaces_netlink_find_link_by_name(json_object_get_string(devname));
+    if (!link)
+      continue;
+
+    struct nw_interfaces_link *l3_link = link;
+    if (l3_devname)
+      l3_link = nw_interfaces_netlink_find_link_by_name(json_object_get_string(l3_devname));
+
+    nw_interfaces_netlink_process_device(ifname, link, l3_link, NULL, object);
+  }
+
+  return true;
+}
+
+/* Overall deadline for all netifd requests of a single acquisition (in ms) */
+#define NW_INTERFACES_DEADLINE 2000
+
+/* Types of netifd requests */
+enum {
+  NW_INTERFACES_REQUEST_DUMP,
+  NW_INTERFACES_REQUEST_INTERFACE,
+  NW_INTERFACES_REQUEST_DEVICE,
+};
+
+/* Pending asynchronous netifd request */
+struct nw_interfaces_request {
+  /* Pending request list entry */
+  struct list_head list;
+  /* Ubus request */
+  struct ubus_request req;
+  /* Request type */
+  int type;
+  /* Whether the request has already been retried */
+  bool retried;
+  /* Reply data */
+  json_object *data;
+  /* Configured interface name */
+  char *ifname;
+  /* Device name (device requests only) */
+  char *devname;
+  /* Parent device name (bridge members only) */
+  char *parent;
+  /* Interface addresses (device requests only, can be NULL) */
+  json_object *addresses;
+};
+
+/* State of the current acquisition */
+static struct {
+  /* Module that is acquiring data */
+  struct nodewatcher_module *module;
+  /* UBUS context */
+  struct ubus_context *ubus;
+  /* Loaded network configuration */
+  struct uci_package *cfg_network;
+  /* Resulting JSON object */
+  json_object *object;
+  /* Requests that are still waiting for replies */
+  struct list_head requests;
+  /* Deadline timer */
+  struct uloop_timeout deadline;
+} ia = {
+  .requests = LIST_HEAD_INIT(ia.requests),
+};
+
+static bool nw_interfaces_request_send(int type,
+                                       const char *ifname,
+                                       const char *devname,
+                                       const char *parent,
+                                       json_object *addresses,
+                                       bool retried);
+
+static void nw_interfaces_request_free(struct nw_interfaces_request *r)
+{
+  list_del(&r->list);
+  if (r->data)
+    json_object_put(r->data);
+  if (r->addresses)
+    json_object_put(r->addresses);
+  free(r->ifname);
+  free(r->devname);
+  free(r->parent);
+  free(r);
+}
+
+static int nw_interfaces_finish(void)
+{
+  uloop_timeout_cancel(&ia.deadline);
+
+  /* Abort any requests that did not complete in time */
+  struct nw_interfaces_request *r, *tmp;
+  list_for_each_entry_safe(r, tmp, &ia.requests, list) {
+    ubus_abort_request(ia.ubus, &r->req);
+    nw_interfaces_request_free(r);
+  }
+
+  json_object *object = ia.object;
+  ia.object = NULL;
+  return nw_module_finish_acquire_data(ia.module, object);
+}
+
+static void nw_interfaces_deadline(struct uloop_timeout *timeout)
+{
+  syslog(LOG_WARNING, "interfaces: Timed out while waiting for netifd replies!");
+  nw_interfaces_finish();
+}
+
+static void nw_interfaces_request_interfaces(void)
+{
+  struct uci_element *e;
+
+  /* Resolve all interface objects with a single round trip when any of them is not cached,
+     which happens on the first run and after netifd has been restarted */
+  uci_foreach_element(&ia.cfg_network->sections, e) {
+    struct uci_section *cfg_section = uci_to_section(e);
+    char ubus_path[64];
+    if (strcmp(cfg_section->type, "interface") != 0)
+      continue;
+
+    snprintf(ubus_path, sizeof(ubus_path), "network.interface.%s", cfg_section->e.name);
+    if (!nw_ubus_has_id(ubus_path)) {
+      nw_ubus_prefetch_ids(ia.ubus, "network.interface.*");
+      break;
+    }
+  }
+
+  uci_foreach_element(&ia.cfg_network->sections, e) {
+    struct uci_section *cfg_section = uci_to_section(e);
+    if (strcmp(cfg_section->type, "interface") != 0)
+      continue;
+
+    nw_interfaces_request_send(NW_INTERFACES_REQUEST_INTERFACE, cfg_section->e.name, NULL, NULL, NULL, false);
   }
+}
 
+static void nw_interfaces_handle_interface(struct nw_interfaces_request *r)
+{
   /* Extract underlying network device */
   json_object *device = NULL;
-  json_object_object_get_ex(data, "device", &device);
+  json_object_object_get_ex(r->data, "device", &device);
   if (!device) {
-    syslog(LOG_WARNING, "interfaces: Failed to parse netifd interface data '%s' (device name not found)!", ubus_path);
-    goto data_error;
+    syslog(LOG_WARNING, "interfaces: Failed to parse netifd interface data '%s' (device name not found)!", r->ifname);
+    return;
   }
 
   /* Parse interface addresses as they are not available per-device */
@@ -159,7 +820,7 @@ static bool nw_interfaces_process_interface(struct ubus_context *ubus,
   json_object *addresses = json_object_new_array();
   /* Add IPv4 addresses */
   json_object *ipv4 = NULL;
-  json_object_object_get_ex(data, "ipv4-address", &ipv4);
+  json_object_object_get_ex(r->data, "ipv4-address", &ipv4);
   if (ipv4) {
     for (i = 0; i < json_object_array_length(ipv4); i++) {
       json_object *address = json_object_new_object();
@@ -175,7 +836,7 @@ static bool nw_interfaces_process_interface(struct ubus_context *ubus,
   }
   /* Add IPv6 addresses */
   json_object *ipv6 = NULL;
-  json_object_object_get_ex(data, "ipv6-address", &ipv6);
+  json_object_object_get_ex(r->data, "ipv6-address", &ipv6);
   if (ipv6) {
     for (i = 0; i < json_object_array_length(ipv6); i++) {
       json_object *address = json_object_new_object();
@@ -190,20 +851,177 @@ static bool nw_interfaces_process_interface(struct ubus_context *ubus,
     }
   }
 
-  /* Process the individual device */
-  if (!nw_interfaces_process_device(ubus, ifname, json_object_get_string(device), NULL, addresses, object))
-    goto data_error_free_addresses;
+  /* Request the individual device, the request takes over the addresses */
+  nw_interfaces_request_send(NW_INTERFACES_REQUEST_DEVICE, r->ifname, json_object_get_string(device),
+    NULL, addresses, false);
+}
 
-  json_object_put(addresses);
-  json_object_put(data);
-  return true;
+static void nw_interfaces_handle_device(struct nw_interfaces_request *r)
+{
+  json_object *device = json_object_new_object();
+  json_object_object_add(device, "name", json_object_new_string(r->devname));
+  json_object_object_add(device, "config", json_object_new_string(r->ifname));
+  if (r->parent)
+    json_object_object_add(device, "parent", json_object_new_string(r->parent));
 
-data_error_free_addresses:
-  json_object_put(addresses);
-data_error:
-  if (data)
-    json_object_put(data);
-  return false;
+  /* Include addresses (can be NULL) */
+  if (r->addresses && json_object_array_length(r->addresses) > 0)
+    json_object_object_add(device, "addresses", json_object_get(r->addresses));
+
+  /* XXX: Currently, MAC address of wireless interfaces is not reported because
+          of a bug in netifd. See OpenWrt ticket #16633. */
+  json_object *mac = NULL;
+  json_object_object_get_ex(r->data, "macaddr", &mac);
+  if (mac) {
+    json_object_object_add(device, "mac", json_object_get(mac));
+  } else {
+    /* Manually try to obtain a device's MAC address via ioctl */
+    struct ifreq ifr;
+    int fd = socket(AF_LOCAL, SOCK_DGRAM, 0);
+
+    if (fd != -1) {
+      memset(&ifr, 0, sizeof(ifr));
+      strncpy(ifr.ifr_name, r->devname, sizeof(ifr.ifr_name) - 1);
+
+      if (ioctl(fd, SIOCGIFHWADDR, &ifr) == 0) {
+        char mac_address[18] = {0, };
+        snprintf(mac_address, sizeof(mac_address), "%02x:%02x:%02x:%02x:%02x:%02x",
+          (uint8_t) ifr.ifr_hwaddr.sa_data[0], (uint8_t) ifr.ifr_hwaddr.sa_data[1],
+          (uint8_t) ifr.ifr_hwaddr.sa_data[2], (uint8_t) ifr.ifr_hwaddr.sa_data[3],
+          (uint8_t) ifr.ifr_hwaddr.sa_data[4], (uint8_t) ifr.ifr_hwaddr.sa_data[5]);
+
+        json_object_object_add(device, "mac", json_object_new_string(mac_address));
+      }
+
+      close(fd);
+    }
+  }
+
+  NW_COPY_JSON_OBJECT(r->data, "mtu", device, "mtu");
+  NW_COPY_JSON_OBJECT(r->data, "up", device, "up");
+  NW_COPY_JSON_OBJECT(r->data, "carrier", device, "carrier");
+  NW_COPY_JSON_OBJECT(r->data, "speed", device, "speed");
+  NW_COPY_JSON_OBJECT(r->data, "statistics", device, "statistics");
+  nw_interfaces_add_rates(if_nametoindex(r->devname), r->devname, device);
+
+  json_object_object_add(ia.object, r->devname, device);
+
+  /* If the device is a bridge and has any children, request them immediately */
+  json_object *children = NULL;
+  json_object_object_get_ex(r->data, "bridge-members", &children);
+  if (children) {
+    int i;
+    for (i = 0; i < json_object_array_length(children); i++) {
+      const char *childname = json_object_get_string(json_object_array_get_idx(children, i));
+      nw_interfaces_request_send(NW_INTERFACES_REQUEST_DEVICE, r->ifname, childname, r->devname, NULL, false);
+    }
+  }
+}
+
+static void nw_interfaces_request_complete(struct ubus_request *req, int ret)
+{
+  struct nw_interfaces_request *r = container_of(req, struct nw_interfaces_request, req);
+
+  if (ret == UBUS_STATUS_NOT_FOUND && r->type == NW_INTERFACES_REQUEST_INTERFACE && !r->retried) {
+    /* Interface objects are recreated by netifd on reload, so the cached identifier may be stale */
+    char ubus_path[64] = { 0, };
+    snprintf(ubus_path, sizeof(ubus_path), "network.interface.%s", r->ifname);
+    nw_ubus_invalidate_id(ubus_path);
+    nw_interfaces_request_send(r->type, r->ifname, NULL, NULL, NULL, true);
+  } else if (ret != UBUS_STATUS_OK || !r->data) {
+    switch (r->type) {
+      case NW_INTERFACES_REQUEST_DUMP: {
+        syslog(LOG_WARNING, "interfaces: Failed to request interface dump from netifd!");
+        nw_interfaces_request_interfaces();
+        break;
+      }
+      case NW_INTERFACES_REQUEST_INTERFACE: {
+        syslog(LOG_WARNING, "interfaces: Failed to request status from netifd interface '%s'!", r->ifname);
+        break;
+      }
+      case NW_INTERFACES_REQUEST_DEVICE: {
+        syslog(LOG_WARNING, "interfaces: Failed to request status from netifd device '%s'!", r->devname);
+        break;
+      }
+    }
+  } else {
+    switch (r->type) {
+      case NW_INTERFACES_REQUEST_DUMP: {
+        /* Fall back to per-device ubus requests when netlink data is not available */
+        if (!nw_interfaces_netlink_process_dump(r->data, ia.cfg_network, ia.object))
+          nw_interfaces_request_interfaces();
+        break;
+      }
+      case NW_INTERFACES_REQUEST_INTERFACE: nw_interfaces_handle_interface(r); break;
+      case NW_INTERFACES_REQUEST_DEVICE: nw_interfaces_handle_device(r); break;
+    }
+  }
+
+  nw_interfaces_request_free(r);
+
+  /* Finish once the last reply has arrived */
+  if (list_empty(&ia.requests))
+    nw_interfaces_finish();
+}
+
+static bool nw_interfaces_request_send(int type,
+                                       const char *ifname,
+                                       const char *devname,
+                                       const char *parent,
+                                       json_object *addresses,
+                                       bool retried)
+{
+  char ubus_path[64] = { 0, };
+  const char *method = "status";
+  static struct blob_buf req;
+  blob_buf_init(&req, 0);
+
+  switch (type) {
+    case NW_INTERFACES_REQUEST_DUMP: {
+      snprintf(ubus_path, sizeof(ubus_path), "network.interface");
+      method = "dump";
+      break;
+    }
+    case NW_INTERFACES_REQUEST_INTERFACE: {
+      snprintf(ubus_path, sizeof(ubus_path), "network.interface.%s", ifname);
+      break;
+    }
+    case NW_INTERFACES_REQUEST_DEVICE: {
+      snprintf(ubus_path, sizeof(ubus_path), "network.device");
+      blobmsg_add_string(&req, "name", devname);
+      break;
+    }
+  }
+
+  struct nw_interfaces_request *r = calloc(1, sizeof(struct nw_interfaces_request));
+  if (!r) {
+    if (addresses)
+      json_object_put(addresses);
+    return false;
+  }
+
+  INIT_LIST_HEAD(&r->list);
+  r->type = type;
+  r->retried = retried;
+  r->ifname = ifname ? strdup(ifname) : NULL;
+  r->devname = devname ? strdup(devname) : NULL;
+  r->parent = parent ? strdup(parent) : NULL;
+  r->addresses = addresses;
+
+  uint32_t id;
+  if (nw_ubus_lookup_id(ia.ubus, ubus_path, &id) != UBUS_STATUS_OK ||
+      ubus_invoke_async(ia.ubus, id, method, req.head, &r->req) != UBUS_STATUS_OK) {
+    syslog(LOG_WARNING, "interfaces: Failed to request %s from netifd object '%s'!", method, ubus_path);
+    nw_interfaces_request_free(r);
+    return false;
+  }
+
+  r->req.data_cb = nw_json_from_ubus;
+  r->req.complete_cb = nw_interfaces_request_complete;
+  r->req.priv = &r->data;
+  list_add_tail(&r->list, &ia.requests);
+  ubus_complete_request_async(ia.ubus, &r->req);
+  return true;
 }
 
 static int nw_interfaces_start_acquire_data(struct nodewatcher_module *module,
@@ -221,24 +1039,41 @@ static int nw_interfaces_start_acquire_data(struct nodewatcher_module *module,
     return nw_module_finish_acquire_data(module, object);
   }
 
-  struct uci_element *e;
-  uci_foreach_element(&cfg_network->sections, e) {
-    struct uci_section *cfg_section = uci_to_section(e);
-    if (strcmp(cfg_section->type, "interface") != 0)
-      continue;
+  ia.module = module;
+  ia.ubus = ubus;
+  ia.cfg_network = cfg_network;
+  ia.object = object;
+  nw_interfaces_samples_begin();
 
-    /* Process interface */
-    nw_interfaces_process_interface(ubus, cfg_section->e.name, object);
-  }
+  /* Use netlink to obtain all device data at once, with a fallback to per-device ubus requests */
+  if (interfaces_backend != NW_INTERFACES_BACKEND_NETLINK ||
+      !nw_interfaces_request_send(NW_INTERFACES_REQUEST_DUMP, NULL, NULL, NULL, NULL, false))
+    nw_interfaces_request_interfaces();
+
+  /* Finish immediately when no requests could be sent */
+  if (list_empty(&ia.requests))
+    return nw_interfaces_finish();
 
-  /* Store resulting JSON object */
-  return nw_module_finish_acquire_data(module, object);
+  /* Replies are collected asynchronously until the deadline */
+  uloop_timeout_set(&ia.deadline, NW_INTERFACES_DEADLINE);
+  return 0;
 }
 
 static int nw_interfaces_init(struct nodewatcher_module *module,
                               struct ubus_context *ubus,
                               struct uci_context *uci)
 {
+  char *backend = nw_uci_get_string(uci, "nodewatcher.@agent[0].interfaces_backend");
+  if (backend && strcmp(backend, "ubus") == 0)
+    interfaces_backend = NW_INTERFACES_BACKEND_UBUS;
+  free(backend);
+
+  if (interfaces_backend == NW_INTERFACES_BACKEND_NETLINK && nw_netlink_open(&inl.nl, NETLINK_ROUTE) != 0) {
+    syslog(LOG_WARNING, "interfaces: Failed to open netlink socket, falling back to ubus.");
+    interfaces_backend = NW_INTERFACES_BACKEND_UBUS;
+  }
+
+  ia.deadline.cb = nw_interfaces_deadline;
   return 0;
 }
 
@@ -246,7 +1081,7 @@ static int nw_interfaces_init(struct nodewatcher_module *module,
 struct nodewatcher_module nw_module = {
   .name = "core.interfaces",
   .author = "Jernej Kos <jernej@kos.mx>",
-  .version = 3,
+  .version = 5,
   .hooks = {
     .init               = nw_interfaces_init,
     .start_acquire_data = nw_interfaces_start_acquire_data,
@@ -24,9 +24,574 @@
 #include <dirent.h>
 #include <math.h>
 #include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <libubox/uloop.h>
 
-/* Previous CPU usage values */
-static unsigned int last_cpu_times[7] = {0, };
+/* Maximum number of CPUs tracked by conntrack statistics */
+#define NW_CONNTRACK_MAX_CPUS 32
+/* Maximum number of columns in conntrack statistics */
+#define NW_CONNTRACK_MAX_COLUMNS 32
+
+/* Conntrack statistics that are reported */
+enum {
+  NW_CONNTRACK_FOUND,
+  NW_CONNTRACK_INSERT_FAILED,
+  NW_CONNTRACK_DROP,
+  NW_CONNTRACK_EARLY_DROP,
+  NW_CONNTRACK_SEARCH_RESTART,
+  __NW_CONNTRACK_MAX,
+};
+
+static const char *nw_conntrack_stat_names[__NW_CONNTRACK_MAX] = {
+  [NW_CONNTRACK_FOUND]          = "found",
+  [NW_CONNTRACK_INSERT_FAILED]  = "insert_failed",
+  [NW_CONNTRACK_DROP]           = "drop",
+  [NW_CONNTRACK_EARLY_DROP]     = "early_drop",
+  [NW_CONNTRACK_SEARCH_RESTART] = "search_restart",
+};
+
+/* Previous per-CPU conntrack statistics (kernel counters are 32-bit) */
+static uint32_t last_conntrack_stats[NW_CONNTRACK_MAX_CPUS][__NW_CONNTRACK_MAX];
+/* Number of CPUs in the previous conntrack sample */
+static int last_conntrack_cpus = 0;
+/* Time of the previous conntrack sample */
+static struct timespec last_conntrack_at;
+
+/* Maximum number of individually tracked CPUs */
+#define NW_CPU_MAX_CPUS 64
+
+/* CPU time categories in the order used by /proc/stat */
+enum {
+  NW_CPU_USER,
+  NW_CPU_NICE,
+  NW_CPU_SYSTEM,
+  NW_CPU_IDLE,
+  NW_CPU_IOWAIT,
+  NW_CPU_IRQ,
+  NW_CPU_SOFTIRQ,
+  NW_CPU_STEAL,
+  NW_CPU_GUEST,
+  NW_CPU_GUEST_NICE,
+  __NW_CPU_MAX,
+};
+
+static const char *nw_cpu_time_names[__NW_CPU_MAX] = {
+  [NW_CPU_USER]       = "user",
+  [NW_CPU_NICE]       = "nice",
+  [NW_CPU_SYSTEM]     = "system",
+  [NW_CPU_IDLE]       = "idle",
+  [NW_CPU_IOWAIT]     = "iowait",
+  [NW_CPU_IRQ]        = "irq",
+  [NW_CPU_SOFTIRQ]    = "softirq",
+  [NW_CPU_STEAL]      = "steal",
+  [NW_CPU_GUEST]      = "guest",
+  [NW_CPU_GUEST_NICE] = "guest_nice",
+};
+
+struct nw_cpu_sample {
+  /* Whether the CPU was online in the sample */
+  bool online;
+  /* CPU times in jiffies */
+  uint64_t times[__NW_CPU_MAX];
+};
+
+/* Maximum number of sub-interval samples kept between two reports */
+#define NW_SAMPLER_MAX_SAMPLES 64
+/* Default sub-interval sampling period in seconds */
+#define NW_SAMPLER_DEFAULT_INTERVAL 2
+
+/* Counters collected by the sub-interval sampler */
+enum {
+  NW_SAMPLE_CPU,
+  NW_SAMPLE_SOFTIRQ,
+  NW_SAMPLE_MEMORY,
+  NW_SAMPLE_RX,
+  NW_SAMPLE_TX,
+  __NW_SAMPLE_MAX,
+};
+
+#define NW_SAMPLE_MASK(counter) (1 << (counter))
+
+static const char *nw_sample_names[__NW_SAMPLE_MAX] = {
+  [NW_SAMPLE_CPU]     = "cpu",
+  [NW_SAMPLE_SOFTIRQ] = "softirq",
+  [NW_SAMPLE_MEMORY]  = "memory_free",
+  [NW_SAMPLE_RX]      = "rx_bytes",
+  [NW_SAMPLE_TX]      = "tx_bytes",
+};
+
+/**
+ * Background sampler that collects cheap counters several times per
+ * reporting interval. All state is preallocated, so sampling does not
+ * allocate any memory.
+ */
+struct nw_sampler {
+  /* Sampling timer */
+  struct uloop_timeout timer;
+  /* Sampling interval in seconds */
+  int interval;
+  /* Mask of enabled counters */
+  unsigned int counters;
+  /* Ring buffer of samples for each counter */
+  uint32_t samples[__NW_SAMPLE_MAX][NW_SAMPLER_MAX_SAMPLES];
+  /* Next ring buffer position */
+  unsigned int head;
+  /* Number of valid samples */
+  unsigned int count;
+  /* Whether previous raw values are available */
+  bool primed;
+  /* Previous raw values */
+  uint64_t last_cpu_total;
+  uint64_t last_cpu_idle;
+  uint64_t last_cpu_softirq;
+  uint64_t last_rx_bytes;
+  uint64_t last_tx_bytes;
+  struct timespec last_at;
+  /* Buffer for reading /proc files */
+  char buffer[16384];
+};
+
+/* Sub-interval sampler instance */
+static struct nw_sampler sampler;
+
+/* Whether any CPU sample has been taken */
+static bool cpu_sampled = false;
+/* Previous aggregate CPU usage values */
+static struct nw_cpu_sample last_cpu_aggregate;
+/* Previous per-CPU usage values */
+static struct nw_cpu_sample last_cpu_samples[NW_CPU_MAX_CPUS];
+
+static void nw_resources_process_conntrack(json_object *tracking)
+{
+  FILE *stat_file = fopen("/proc/net/stat/nf_conntrack", "r");
+  if (!stat_file)
+    return;
+
+  /* Map header columns to reported statistics as column layout differs between kernels */
+  char line[512];
+  int columns[NW_CONNTRACK_MAX_COLUMNS];
+  int entries_column = -1;
+  int num_columns = 0;
+  if (!fgets(line, sizeof(line), stat_file)) {
+    fclose(stat_file);
+    return;
+  }
+
+  char *saveptr;
+  char *name = strtok_r(line, " \t\n", &saveptr);
+  while (name && num_columns < NW_CONNTRACK_MAX_COLUMNS) {
+    columns[num_columns] = -1;
+    if (strcmp(name, "entries") == 0) {
+      entries_column = num_columns;
+    } else {
+      for (int i = 0; i < __NW_CONNTRACK_MAX; i++) {
+        if (strcmp(name, nw_conntrack_stat_names[i]) == 0) {
+          columns[num_columns] = i;
+          break;
+        }
+      }
+    }
+
+    num_columns++;
+    name = strtok_r(NULL, " \t\n", &saveptr);
+  }
+
+  /* Parse per-CPU statistics and compute deltas since the last sample */
+  uint32_t stats[NW_CONNTRACK_MAX_CPUS][__NW_CONNTRACK_MAX] = {{0, }};
+  uint64_t totals[__NW_CONNTRACK_MAX] = {0, };
+  uint64_t deltas[__NW_CONNTRACK_MAX] = {0, };
+  uint32_t entries = 0;
+  int cpus = 0;
+
+  while (cpus < NW_CONNTRACK_MAX_CPUS && fgets(line, sizeof(line), stat_file)) {
+    char *value = line;
+    for (int column = 0; column < num_columns; column++) {
+      char *end;
+      uint32_t v = strtoul(value, &end, 16);
+      if (end == value)
+        break;
+      value = end;
+
+      if (column == entries_column)
+        entries = v;
+      else if (columns[column] >= 0)
+        stats[cpus][columns[column]] = v;
+    }
+
+    for (int i = 0; i < __NW_CONNTRACK_MAX; i++) {
+      totals[i] += stats[cpus][i];
+      /* Unsigned arithmetic handles wrapping of 32-bit kernel counters */
+      deltas[i] += (uint32_t) (stats[cpus][i] - last_conntrack_stats[cpus][i]);
+    }
+
+    cpus++;
+  }
+  fclose(stat_file);
+
+  if (!cpus)
+    return;
+
+  if (entries_column >= 0)
+    json_object_object_add(tracking, "count", json_object_new_int(entries));
+
+  json_object *statistics = json_object_new_object();
+  for (int i = 0; i < __NW_CONNTRACK_MAX; i++)
+    json_object_object_add(statistics, nw_conntrack_stat_names[i], json_object_new_int64(totals[i]));
+  json_object_object_add(tracking, "statistics", statistics);
+
+  /* Compute rates when a compatible previous sample is available */
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double interval = (now.tv_sec - last_conntrack_at.tv_sec) +
+                    (now.tv_nsec - last_conntrack_at.tv_nsec) / 1e9;
+
+  if (last_conntrack_cpus == cpus && interval > 0) {
+    json_object *rates = json_object_new_object();
+    for (int i = 0; i < __NW_CONNTRACK_MAX; i++) {
+      char rate[32];
+      snprintf(rate, sizeof(rate), "%.2f", deltas[i] / interval);
+      json_object_object_add(rates, nw_conntrack_stat_names[i], json_object_new_string(rate));
+    }
+    json_object_object_add(tracking, "rates", rates);
+  }
+
+  memcpy(last_conntrack_stats, stats, sizeof(stats));
+  last_conntrack_cpus = cpus;
+  last_conntrack_at = now;
+}
+
+static uint64_t nw_resources_cpu_delta(uint64_t current, uint64_t previous)
+{
+  if (current >= previous)
+    return current - previous;
+
+  /* Kernels with 32-bit cputime wrap around at 2^32 */
+  if (previous <= UINT32_MAX)
+    return current + ((uint64_t) UINT32_MAX + 1) - previous;
+
+  /* Counter has been reset */
+  return 0;
+}
+
+static json_object *nw_resources_cpu_usage(struct nw_cpu_sample *sample,
+                                           struct nw_cpu_sample *last)
+{
+  uint64_t deltas[__NW_CPU_MAX];
+  uint64_t sum = 0;
+
+  for (int i = 0; i < __NW_CPU_MAX; i++) {
+    deltas[i] = nw_resources_cpu_delta(sample->times[i], last->times[i]);
+    /* Guest time is already accounted for in user and nice time */
+    if (i != NW_CPU_GUEST && i != NW_CPU_GUEST_NICE)
+      sum += deltas[i];
+  }
+
+  if (!sum)
+    return NULL;
+
+  /* Compute CPU usage percentages since the last run interval; guest time is
+     not reported separately, so the reported shares add up to the total */
+  json_object *cpu = json_object_new_object();
+  for (int i = 0; i < NW_CPU_GUEST; i++) {
+    int percentage = (int) round((double) deltas[i] * 100 / sum);
+    json_object_object_add(cpu, nw_cpu_time_names[i], json_object_new_int(percentage));
+  }
+
+  return cpu;
+}
+
+static void nw_resources_process_cpu(json_object *object)
+{
+  FILE *cpu_file = fopen("/proc/stat", "r");
+  if (!cpu_file)
+    return;
+
+  struct nw_cpu_sample aggregate = { .online = false, };
+  struct nw_cpu_sample samples[NW_CPU_MAX_CPUS];
+  char line[512];
+
+  memset(samples, 0, sizeof(samples));
+
+  /* Parse aggregate and per-CPU lines, which are always listed first */
+  while (fgets(line, sizeof(line), cpu_file)) {
+    struct nw_cpu_sample *sample;
+    char *value;
+
+    if (strncmp(line, "cpu", 3) != 0)
+      break;
+
+    if (line[3] == ' ') {
+      sample = &aggregate;
+      value = line + 3;
+    } else {
+      int id = strtol(line + 3, &value, 10);
+      if (value == line + 3 || id < 0 || id >= NW_CPU_MAX_CPUS)
+        continue;
+      sample = &samples[id];
+    }
+
+    /* Older kernels do not report all of the columns */
+    for (int i = 0; i < __NW_CPU_MAX; i++) {
+      char *end;
+      sample->times[i] = strtoull(value, &end, 10);
+      if (end == value)
+        break;
+      value = end;
+    }
+    sample->online = true;
+  }
+  fclose(cpu_file);
+
+  if (!aggregate.online)
+    return;
+
+  json_object *cpu = nw_resources_cpu_usage(&aggregate, &last_cpu_aggregate);
+  if (cpu) {
+    json_object *cpus = json_object_new_object();
+    for (int id = 0; id < NW_CPU_MAX_CPUS; id++) {
+      if (!samples[id].online)
+        continue;
+
+      /* CPUs that have just come online only provide a new baseline */
+      if (cpu_sampled && !last_cpu_samples[id].online)
+        continue;
+
+      json_object *core = nw_resources_cpu_usage(&samples[id], &last_cpu_samples[id]);
+      if (core) {
+        char name[16];
+        snprintf(name, sizeof(name), "cpu%d", id);
+        json_object_object_add(cpus, name, core);
+      }
+    }
+
+    json_object_object_add(cpu, "cores", cpus);
+    json_object_object_add(object, "cpu", cpu);
+  }
+
+  last_cpu_aggregate = aggregate;
+  memcpy(last_cpu_samples, samples, sizeof(samples));
+  cpu_sampled = true;
+}
+
+static int nw_resources_sampler_read(const char *filename, char *buffer, size_t length)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  size_t total = 0;
+  while (total < length - 1) {
+    ssize_t n = read(fd, buffer + total, length - 1 - total);
+    if (n <= 0)
+      break;
+    total += n;
+  }
+  close(fd);
+
+  buffer[total] = 0;
+  return total;
+}
+
+static void nw_resources_sampler_sample(struct uloop_timeout *timeout)
+{
+  struct timespec now;
+  uint32_t values[__NW_SAMPLE_MAX] = {0, };
+  uint64_t cpu_total = 0, cpu_idle = 0, cpu_softirq = 0;
+  uint64_t rx_bytes = 0, tx_bytes = 0;
+  char *line;
+
+  uloop_timeout_set(&sampler.timer, sampler.interval * 1000);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  /* CPU jiffies from the aggregate line */
+  if (sampler.counters & (NW_SAMPLE_MASK(NW_SAMPLE_CPU) | NW_SAMPLE_MASK(NW_SAMPLE_SOFTIRQ))) {
+    if (nw_resources_sampler_read("/proc/stat", sampler.buffer, 512) > 0 &&
+        strncmp(sampler.buffer, "cpu ", 4) == 0) {
+      char *value = sampler.buffer + 3;
+      for (int i = 0; i < NW_CPU_GUEST; i++) {
+        char *end;
+        uint64_t v = strtoull(value, &end, 10);
+        if (end == value)
+          break;
+        value = end;
+
+        cpu_total += v;
+        if (i == NW_CPU_IDLE || i == NW_CPU_IOWAIT)
+          cpu_idle += v;
+        else if (i == NW_CPU_SOFTIRQ)
+          cpu_softirq = v;
+      }
+    }
+  }
+
+  /* Free memory */
+  if (sampler.counters & NW_SAMPLE_MASK(NW_SAMPLE_MEMORY)) {
+    if (nw_resources_sampler_read("/proc/meminfo", sampler.buffer, 512) > 0) {
+      line = strstr(sampler.buffer, "MemFree:");
+      if (line)
+        values[NW_SAMPLE_MEMORY] = strtoul(line + 8, NULL, 10);
+    }
+  }
+
+  /* Byte counters summed over all non-loopback interfaces */
+  if (sampler.counters & (NW_SAMPLE_MASK(NW_SAMPLE_RX) | NW_SAMPLE_MASK(NW_SAMPLE_TX))) {
+    if (nw_resources_sampler_read("/proc/net/dev", sampler.buffer, sizeof(sampler.buffer)) > 0) {
+      /* Skip the two header lines */
+      line = strchr(sampler.buffer, '\n');
+      if (line)
+        line = strchr(line + 1, '\n');
+
+      while (line && *++line) {
+        char *colon = strchr(line, ':');
+        char *next = strchr(line, '\n');
+        if (!colon || (next && colon > next))
+          break;
+
+        while (*line == ' ')
+          line++;
+
+        if (strncmp(line, "lo:", 3) != 0) {
+          char *value = colon + 1;
+          /* Receive bytes are the first column, transmit bytes the ninth */
+          for (int i = 0; i < 9; i++) {
+            char *end;
+            uint64_t v = strtoull(value, &end, 10);
+            if (end == value)
+              break;
+            value = end;
+
+            if (i == 0)
+              rx_bytes += v;
+            else if (i == 8)
+              tx_bytes += v;
+          }
+        }
+
+        line = next;
+      }
+    }
+  }
+
+  /* Compute rates against the previous sample */
+  if (sampler.primed) {
+    uint64_t total = nw_resources_cpu_delta(cpu_total, sampler.last_cpu_total);
+    uint64_t idle = nw_resources_cpu_delta(cpu_idle, sampler.last_cpu_idle);
+    uint64_t softirq = nw_resources_cpu_delta(cpu_softirq, sampler.last_cpu_softirq);
+    if (total > 0 && idle <= total) {
+      values[NW_SAMPLE_CPU] = (total - idle) * 100 / total;
+      values[NW_SAMPLE_SOFTIRQ] = softirq * 100 / total;
+    }
+
+    uint64_t elapsed = (now.tv_sec - sampler.last_at.tv_sec) * 1000 +
+                       (now.tv_nsec - sampler.last_at.tv_nsec) / 1000000;
+    if (elapsed > 0) {
+      if (rx_bytes >= sampler.last_rx_bytes)
+        values[NW_SAMPLE_RX] = (rx_bytes - sampler.last_rx_bytes) * 1000 / elapsed;
+      if (tx_bytes >= sampler.last_tx_bytes)
+        values[NW_SAMPLE_TX] = (tx_bytes - sampler.last_tx_bytes) * 1000 / elapsed;
+    }
+
+    /* Store sample into the ring buffer, overwriting the oldest one */
+    for (int i = 0; i < __NW_SAMPLE_MAX; i++)
+      sampler.samples[i][sampler.head] = values[i];
+
+    sampler.head = (sampler.head + 1) % NW_SAMPLER_MAX_SAMPLES;
+    if (sampler.count < NW_SAMPLER_MAX_SAMPLES)
+      sampler.count++;
+  }
+
+  sampler.last_cpu_total = cpu_total;
+  sampler.last_cpu_idle = cpu_idle;
+  sampler.last_cpu_softirq = cpu_softirq;
+  sampler.last_rx_bytes = rx_bytes;
+  sampler.last_tx_bytes = tx_bytes;
+  sampler.last_at = now;
+  sampler.primed = true;
+}
+
+static void nw_resources_sampler_rollup(json_object *object)
+{
+  if (!sampler.counters || !sampler.count)
+    return;
+
+  json_object *samples = json_object_new_object();
+  json_object_object_add(samples, "interval", json_object_new_int(sampler.interval));
+  json_object_object_add(samples, "count", json_object_new_int(sampler.count));
+
+  for (int i = 0; i < __NW_SAMPLE_MAX; i++) {
+    if (!(sampler.counters & NW_SAMPLE_MASK(i)))
+      continue;
+
+    /* Sort samples with insertion sort as there are only a few of them */
+    uint32_t sorted[NW_SAMPLER_MAX_SAMPLES];
+    uint64_t sum = 0;
+    for (unsigned int j = 0; j < sampler.count; j++) {
+      uint32_t value = sampler.samples[i][j];
+      unsigned int k = j;
+      while (k > 0 && sorted[k - 1] > value) {
+        sorted[k] = sorted[k - 1];
+        k--;
+      }
+      sorted[k] = value;
+      sum += value;
+    }
+
+    json_object *rollup = json_object_new_object();
+    json_object_object_add(rollup, "min", json_object_new_int64(sorted[0]));
+    json_object_object_add(rollup, "max", json_object_new_int64(sorted[sampler.count - 1]));
+    json_object_object_add(rollup, "avg", json_object_new_int64(sum / sampler.count));
+    json_object_object_add(rollup, "p95", json_object_new_int64(sorted[(sampler.count * 95 + 99) / 100 - 1]));
+    json_object_object_add(samples, nw_sample_names[i], rollup);
+  }
+
+  json_object_object_add(object, "samples", samples);
+
+  /* Start a new reporting interval */
+  sampler.count = 0;
+  sampler.head = 0;
+}
+
+static void nw_resources_sampler_init(struct uci_context *uci)
+{
+  sampler.interval = nw_uci_get_int(uci, "nodewatcher.@agent[0].sample_interval");
+  if (sampler.interval <= 0)
+    sampler.interval = NW_SAMPLER_DEFAULT_INTERVAL;
+
+  /* Determine which counters should be sampled */
+  char *counters = nw_uci_get_string(uci, "nodewatcher.@agent[0].sample_counters");
+  if (!counters) {
+    sampler.counters = NW_SAMPLE_MASK(NW_SAMPLE_CPU) | NW_SAMPLE_MASK(NW_SAMPLE_SOFTIRQ) |
+                       NW_SAMPLE_MASK(NW_SAMPLE_MEMORY) | NW_SAMPLE_MASK(NW_SAMPLE_RX) |
+                       NW_SAMPLE_MASK(NW_SAMPLE_TX);
+  } else {
+    char *saveptr;
+    char *name = strtok_r(counters, " ,", &saveptr);
+    while (name) {
+      if (strcmp(name, "cpu") == 0) {
+        sampler.counters |= NW_SAMPLE_MASK(NW_SAMPLE_CPU);
+      } else if (strcmp(name, "softirq") == 0) {
+        sampler.counters |= NW_SAMPLE_MASK(NW_SAMPLE_SOFTIRQ);
+      } else if (strcmp(name, "memory") == 0) {
+        sampler.counters |= NW_SAMPLE_MASK(NW_SAMPLE_MEMORY);
+      } else if (strcmp(name, "network") == 0) {
+        sampler.counters |= NW_SAMPLE_MASK(NW_SAMPLE_RX) | NW_SAMPLE_MASK(NW_SAMPLE_TX);
+      } else if (strcmp(name, "none") != 0) {
+        syslog(LOG_WARNING, "resources: Ignoring unknown sample counter '%s'.", name);
+      }
+      name = strtok_r(NULL, " ,", &saveptr);
+    }
+    free(counters);
+  }
+
+  if (!sampler.counters)
+    return;
+
+  sampler.timer.cb = nw_resources_sampler_sample;
+  uloop_timeout_set(&sampler.timer, sampler.interval * 1000);
+}
 
 static int nw_resources_start_acquire_data(struct nodewatcher_module *module,
                                            struct ubus_context *ubus,
@@ -86,8 +651,15 @@ static int nw_resources_start_acquire_data(struct nodewatcher_module *module,
   json_object_object_add(connections, "ipv6", connections_ipv6);
   /* Number of entries in connection tracking table */
   json_object *connections_tracking = json_object_new_object();
-  nw_json_from_file("/proc/sys/net/netfilter/nf_conntrack_count", connections_tracking, "count", true);
-  nw_json_from_file("/proc/sys/net/netfilter/nf_conntrack_max", connections_tracking, "max", true);
+  nw_resources_process_conntrack(connections_tracking);
+
+  uint64_t conntrack_value;
+  json_object *conntrack_count;
+  if (!json_object_object_get_ex(connections_tracking, "count", &conntrack_count) &&
+      nw_file_read_uint64("/proc/sys/net/netfilter/nf_conntrack_count", &conntrack_value) == 0)
+    json_object_object_add(connections_tracking, "count", json_object_new_int64(conntrack_value));
+  if (nw_file_read_uint64("/proc/sys/net/netfilter/nf_conntrack_max", &conntrack_value) == 0)
+    json_object_object_add(connections_tracking, "max", json_object_new_int64(conntrack_value));
   json_object_object_add(connections, "tracking", connections_tracking);
   json_object_object_add(object, "connections", connections);
 
@@ -131,36 +703,7 @@ static int nw_resources_start_acquire_data(struct nodewatcher_module *module,
   }
 
   /* CPU usage by category */
-  FILE *cpu_file = fopen("/proc/stat", "r");
-  if (cpu_file) {
-    unsigned int cpu_times[7] = {0, };
-    if (fscanf(cpu_file, "cpu %u %u %u %u %u %u %u",
-          &cpu_times[0], &cpu_times[1], &cpu_times[2], &cpu_times[3],
-          &cpu_times[4], &cpu_times[5], &cpu_times[6]) == 7) {
-      unsigned long sum = 0;
-      for (int i = 0; i < 7; i++) {
-        int tmp = cpu_times[i];
-        cpu_times[i] -= last_cpu_times[i];
-        last_cpu_times[i] = tmp;
-        sum += cpu_times[i];
-      }
-
-      /* Compute CPU usage percentages since the last run interval */
-      for (int i = 0; i < 7; i++)
-        cpu_times[i] = (unsigned int) (round((double) cpu_times[i] * 100 / sum));
-
-      json_object *cpu = json_object_new_object();
-      json_object_object_add(cpu, "user", json_object_new_int(cpu_times[0]));
-      json_object_object_add(cpu, "system", json_object_new_int(cpu_times[1]));
-      json_object_object_add(cpu, "nice", json_object_new_int(cpu_times[2]));
-      json_object_object_add(cpu, "idle", json_object_new_int(cpu_times[3]));
-      json_object_object_add(cpu, "iowait", json_object_new_int(cpu_times[4]));
-      json_object_object_add(cpu, "irq", json_object_new_int(cpu_times[5]));
-      json_object_object_add(cpu, "softirq", json_object_new_int(cpu_times[6]));
-      json_object_object_add(object, "cpu", cpu);
-    }
-    fclose(cpu_file);
-  }
+  nw_resources_process_cpu(object);
 
   /* Number of IPv4 routes */
   /* Number of IPv6 routes */
@@ -179,6 +722,9 @@ static int nw_resources_start_acquire_data(struct nodewatcher_module *module,
     fclose(filenr_file);
   }
 
+  /* Sub-interval rollups */
+  nw_resources_sampler_rollup(object);
+
   /* Store resulting JSON object */
   nw_module_finish_acquire_data(module, object);
   return 0;
@@ -188,6 +734,9 @@ static int nw_resources_init(struct nodewatcher_module *module,
                              struct ubus_context *ubus,
                              struct uci_context *uci)
 {
+  /* Start the background sampler */
+  nw_resources_sampler_init(uci);
+
   return 0;
 }
 
@@ -195,7 +744,7 @@ static int nw_resources_init(struct nodewatcher_module *module,
 struct nodewatcher_module nw_module = {
   .name = "core.resources",
   .author = "Jernej Kos <jernej@kos.mx>",
-  .version = 2,
+  .version = 4,
   .hooks = {
     .init               = nw_resources_init,
     .start_acquire_data = nw_resources_start_acquire_data,
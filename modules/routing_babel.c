@@ -19,241 +19,889 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/json.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/stream_client.h>
 
+#include <libubox/avl.h>
+#include <libubox/avl-cmp.h>
 #include <libubox/uloop.h>
-#include <libubox/ustream.h>
-#include <libubox/usock.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <ifaddrs.h>
 #include <unistd.h>
 #include <net/if.h>
 
-#define INFO_SELF 1
-#define INFO_SELF_NAME "self"
-#define INFO_NEIGHBOUR 2
-#define INFO_NEIGHBOUR_NAME "neighbour"
-#define INFO_XROUTE 3
-#define INFO_XROUTE_NAME "xroute"
-#define INFO_ROUTE 4
-#define INFO_ROUTE_NAME "route"
+/* Default connection timeout (in milliseconds) */
+#define BABEL_CONNECT_TIMEOUT 5000
+/* Initial and maximum delay before reconnecting (in milliseconds) */
+#define BABEL_RECONNECT_MIN 1000
+#define BABEL_RECONNECT_MAX 60000
+/* Default maximum number of tracked imported routes */
+#define BABEL_MAX_ROUTES 32768
+/* Maximum number of routes in the top list */
+#define BABEL_MAX_ROUTES_TOP 64
+/* Metric of unreachable routes */
+#define BABEL_INFINITY 0xFFFF
 
-struct babel_client {
-  /* A flag indicating the client to be ready for new connections. */
-  bool ready;
-  /* Module reference. */
-  struct nodewatcher_module *module;
-  /* File descriptor. */
-  struct uloop_fd client;
-  /* Read stream. */
-  struct ustream_fd stream;
-  /* Timer. */
-  struct uloop_timeout timer;
-  /* Result object. */
+/* Tokens of the babeld local protocol */
+enum babel_token {
+  BABEL_TOKEN_UNKNOWN = 0,
+  /* Line types */
+  BABEL_TOKEN_BABEL,
+  BABEL_TOKEN_ADD,
+  BABEL_TOKEN_CHANGE,
+  BABEL_TOKEN_FLUSH,
+  BABEL_TOKEN_DONE,
+  BABEL_TOKEN_OK,
+  /* Information types */
+  BABEL_TOKEN_SELF,
+  BABEL_TOKEN_NEIGHBOUR,
+  BABEL_TOKEN_XROUTE,
+  BABEL_TOKEN_ROUTE,
+  /* Keys */
+  BABEL_TOKEN_ID,
+  BABEL_TOKEN_ADDRESS,
+  BABEL_TOKEN_IF,
+  BABEL_TOKEN_REACH,
+  BABEL_TOKEN_RXCOST,
+  BABEL_TOKEN_TXCOST,
+  BABEL_TOKEN_RTT,
+  BABEL_TOKEN_RTTCOST,
+  BABEL_TOKEN_COST,
+  BABEL_TOKEN_PREFIX,
+  BABEL_TOKEN_FROM,
+  BABEL_TOKEN_METRIC,
+  BABEL_TOKEN_INSTALLED,
+  BABEL_TOKEN_FEASIBLE,
+  BABEL_TOKEN_VIA,
+};
+
+/* Neighbour or exported route reported by babeld */
+struct babel_entry {
+  struct avl_node avl;
+  /* Identifier assigned by babeld */
+  char id[32];
+  /* Reported attributes, replaced as a whole on every change */
   json_object *object;
 };
 
-/* Global Babel client instance. */
-static struct babel_client bc;
+/* Prefix trie node, IPv4 prefixes are stored as IPv4-mapped IPv6 prefixes */
+struct babel_prefix {
+  struct babel_prefix *parent;
+  struct babel_prefix *child[2];
+  uint8_t key[16];
+  uint8_t plen;
+  /* Number of routes to this prefix, zero for intermediate nodes */
+  uint16_t routes;
+};
+
+/* Imported route reported by babeld */
+struct babel_route {
+  struct avl_node avl;
+  /* Identifier assigned by babeld */
+  char id[24];
+  /* Destination prefix */
+  struct babel_prefix *prefix;
+  /* Next hop and outgoing interface */
+  uint8_t via[16];
+  char ifname[IFNAMSIZ];
+  uint16_t metric;
+  bool installed;
+  bool feasible;
+};
+
+struct babel_client {
+  /* Persistent monitoring session. */
+  struct nw_stream_client session;
+  /* Reconnection timer. */
+  struct uloop_timeout reconnect;
+  /* Current reconnection delay. */
+  int reconnect_delay;
+  /* Number of "ok" replies received in the current session. */
+  int replies;
+  /* Router identifier. */
+  char router_id[64];
+  /* Neighbours and exported routes keyed by identifier. */
+  struct avl_tree neighbours;
+  struct avl_tree exported_routes;
+  /* Imported routes keyed by identifier and their destination prefixes. */
+  struct avl_tree routes;
+  struct babel_prefix *prefixes;
+  /* Number of distinct destination prefixes. */
+  int num_prefixes;
+  /* Maximum number of tracked routes and number of routes ignored due to it. */
+  int max_routes;
+  int routes_ignored;
+  /* Route changes since the last report. */
+  int route_changes;
+  /* Number of reported routes with the highest metric. */
+  int routes_top;
+};
+
+/* Babel client instances. */
+static struct babel_client *instances;
+static int num_instances;
+
+static void nw_routing_babel_connect(struct uloop_timeout *timeout);
 
-static void nw_routing_babel_client_close(struct ustream *s)
+static void nw_routing_babel_clear_entries(struct avl_tree *tree)
 {
-  ustream_free(s);
-  close(bc.client.fd);
-  uloop_fd_delete(&bc.client);
-
-  /* Since we are done, we may cancel the timer. */
-  uloop_timeout_cancel(&bc.timer);
-
-  /* We have finished acquiring data. */
-  bc.ready = true;
-  nw_module_finish_acquire_data(bc.module, bc.object);
-  /* We have passed object ownership, so remove the reference. */
-  bc.object = NULL;
+  struct babel_entry *entry, *tmp;
+  avl_for_each_element_safe(tree, entry, avl, tmp) {
+    avl_delete(tree, &entry->avl);
+    json_object_put(entry->object);
+    free(entry);
+  }
 }
 
-static void nw_routing_babel_client_timeout(struct uloop_timeout *timeout)
+/**
+ * Maps a protocol token to its identifier without comparing against every
+ * known token.
+ *
+ * @param token Token string
+ * @param length Token length
+ * @return Token identifier or BABEL_TOKEN_UNKNOWN
+ */
+static enum babel_token nw_routing_babel_token(const char *token, size_t length)
 {
-  syslog(LOG_WARNING, "routing-babel: Connection with local Babel instance timed out.");
-  nw_routing_babel_client_close(&bc.stream.stream);
+#define BABEL_MATCH(name, id) if (!memcmp(token, name, length)) return id
+  switch (length) {
+    case 2:
+      BABEL_MATCH("id", BABEL_TOKEN_ID);
+      BABEL_MATCH("if", BABEL_TOKEN_IF);
+      BABEL_MATCH("ok", BABEL_TOKEN_OK);
+      break;
+    case 3:
+      BABEL_MATCH("add", BABEL_TOKEN_ADD);
+      BABEL_MATCH("rtt", BABEL_TOKEN_RTT);
+      BABEL_MATCH("via", BABEL_TOKEN_VIA);
+      break;
+    case 4:
+      BABEL_MATCH("self", BABEL_TOKEN_SELF);
+      BABEL_MATCH("done", BABEL_TOKEN_DONE);
+      BABEL_MATCH("cost", BABEL_TOKEN_COST);
+      BABEL_MATCH("from", BABEL_TOKEN_FROM);
+      break;
+    case 5:
+      BABEL_MATCH("BABEL", BABEL_TOKEN_BABEL);
+      BABEL_MATCH("route", BABEL_TOKEN_ROUTE);
+      BABEL_MATCH("reach", BABEL_TOKEN_REACH);
+      BABEL_MATCH("flush", BABEL_TOKEN_FLUSH);
+      break;
+    case 6:
+      BABEL_MATCH("xroute", BABEL_TOKEN_XROUTE);
+      BABEL_MATCH("change", BABEL_TOKEN_CHANGE);
+      BABEL_MATCH("rxcost", BABEL_TOKEN_RXCOST);
+      BABEL_MATCH("txcost", BABEL_TOKEN_TXCOST);
+      BABEL_MATCH("prefix", BABEL_TOKEN_PREFIX);
+      BABEL_MATCH("metric", BABEL_TOKEN_METRIC);
+      break;
+    case 7:
+      BABEL_MATCH("address", BABEL_TOKEN_ADDRESS);
+      BABEL_MATCH("rttcost", BABEL_TOKEN_RTTCOST);
+      break;
+    case 8: BABEL_MATCH("feasible", BABEL_TOKEN_FEASIBLE); break;
+    case 9:
+      BABEL_MATCH("neighbour", BABEL_TOKEN_NEIGHBOUR);
+      BABEL_MATCH("installed", BABEL_TOKEN_INSTALLED);
+      break;
+  }
+#undef BABEL_MATCH
+
+  return BABEL_TOKEN_UNKNOWN;
 }
 
-static json_object *nw_routing_babel_add_array_item(const char *key)
+/**
+ * Splits off the next space-separated token of a line.
+ *
+ * @param line Pointer to the remainder of the line, advanced past the token
+ * @param length Destination for token length
+ * @return Pointer to the NULL-terminated token or NULL when there are no more
+ */
+static char *nw_routing_babel_next_token(char **line, size_t *length)
 {
-  /* Get the existing list or create a new one. */
-  json_object *list;
-  json_object_object_get_ex(bc.object, key, &list);
-  if (!list) {
-    list = json_object_new_array();
-    json_object_object_add(bc.object, key, list);
+  char *token = *line;
+  while (*token == ' ')
+    token++;
+  if (!*token)
+    return NULL;
+
+  char *end = token;
+  while (*end && *end != ' ')
+    end++;
+
+  *length = end - token;
+  if (*end)
+    *end++ = 0;
+  *line = end;
+  return token;
+}
+
+static inline int nw_routing_babel_bit(const uint8_t *key, int bit)
+{
+  return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+static int nw_routing_babel_common_bits(const uint8_t *a, const uint8_t *b, int max)
+{
+  int bits = 0;
+  while (bits < max) {
+    uint8_t diff = a[bits >> 3] ^ b[bits >> 3];
+    if (!diff) {
+      bits += 8;
+      continue;
+    }
+
+    while (!(diff & (0x80 >> (bits & 7))))
+      bits++;
+    break;
   }
 
-  /* Create a new array entry. */
-  json_object *item = json_object_new_object();
-  json_object_array_add(list, item);
-  return item;
+  return bits < max ? bits : max;
 }
 
-static void nw_routing_babel_client_read(struct ustream *s, int bytes)
+static struct babel_prefix **nw_routing_babel_prefix_slot(struct babel_client *bc, struct babel_prefix *node)
 {
-  struct ustream_buf *buf = s->r.head;
+  if (!node->parent)
+    return &bc->prefixes;
+  return &node->parent->child[nw_routing_babel_bit(node->key, node->parent->plen)];
+}
+
+static struct babel_prefix *nw_routing_babel_prefix_new(const uint8_t *key, int plen, struct babel_prefix *parent)
+{
+  struct babel_prefix *node = calloc(1, sizeof(struct babel_prefix));
+  if (!node)
+    return NULL;
+
+  /* Only keep the significant bits, so keys of equal prefixes compare equal. */
+  for (int i = 0; i < plen; i++) {
+    if (nw_routing_babel_bit(key, i))
+      node->key[i >> 3] |= 0x80 >> (i & 7);
+  }
+  node->plen = plen;
+  node->parent = parent;
+  return node;
+}
+
+/**
+ * Finds or inserts a prefix into the path-compressed prefix trie.
+ *
+ * @param key Prefix address
+ * @param plen Prefix length
+ * @return Trie node or NULL on allocation failure
+ */
+static struct babel_prefix *nw_routing_babel_prefix_get(struct babel_client *bc, const uint8_t *key, int plen)
+{
+  struct babel_prefix *parent = NULL;
+  struct babel_prefix **slot = &bc->prefixes;
+  while (*slot) {
+    struct babel_prefix *node = *slot;
+    int common = nw_routing_babel_common_bits(node->key, key, node->plen < plen ? node->plen : plen);
+    if (common == node->plen && node->plen == plen)
+      return node;
+
+    if (common == node->plen) {
+      /* Node is a shorter prefix of the key, descend. */
+      parent = node;
+      slot = &node->child[nw_routing_babel_bit(key, node->plen)];
+      continue;
+    }
+
+    /* Split the edge, either by the new prefix or by an intermediate node. */
+    struct babel_prefix *split = nw_routing_babel_prefix_new(key, common, parent);
+    if (!split)
+      return NULL;
+
+    split->child[nw_routing_babel_bit(node->key, common)] = node;
+    node->parent = split;
+    *slot = split;
+    if (common == plen)
+      return split;
+
+    struct babel_prefix *leaf = nw_routing_babel_prefix_new(key, plen, split);
+    if (!leaf)
+      return NULL;
+    split->child[nw_routing_babel_bit(key, common)] = leaf;
+    return leaf;
+  }
+
+  *slot = nw_routing_babel_prefix_new(key, plen, parent);
+  return *slot;
+}
+
+/**
+ * Removes prefix trie nodes that are no longer needed, starting at the
+ * given node and continuing towards the root.
+ *
+ * @param node Trie node
+ */
+static void nw_routing_babel_prefix_release(struct babel_client *bc, struct babel_prefix *node)
+{
+  while (node && !node->routes) {
+    if (node->child[0] && node->child[1])
+      return;
+
+    struct babel_prefix *parent = node->parent;
+    struct babel_prefix *child = node->child[0] ? node->child[0] : node->child[1];
+    *nw_routing_babel_prefix_slot(bc, node) = child;
+    if (child)
+      child->parent = parent;
+    free(node);
+
+    /* Intermediate nodes with only one remaining child are removed as well. */
+    node = child ? NULL : parent;
+  }
+}
+
+static void nw_routing_babel_prefix_free(struct babel_prefix *node)
+{
+  if (!node)
+    return;
+
+  nw_routing_babel_prefix_free(node->child[0]);
+  nw_routing_babel_prefix_free(node->child[1]);
+  free(node);
+}
+
+static void nw_routing_babel_route_detach(struct babel_client *bc, struct babel_route *route)
+{
+  if (!route->prefix)
+    return;
+
+  if (!--route->prefix->routes) {
+    bc->num_prefixes--;
+    nw_routing_babel_prefix_release(bc, route->prefix);
+  }
+  route->prefix = NULL;
+}
+
+static void nw_routing_babel_clear_routes(struct babel_client *bc)
+{
+  struct babel_route *route, *tmp;
+  avl_for_each_element_safe(&bc->routes, route, avl, tmp) {
+    avl_delete(&bc->routes, &route->avl);
+    free(route);
+  }
+
+  nw_routing_babel_prefix_free(bc->prefixes);
+  bc->prefixes = NULL;
+  bc->num_prefixes = 0;
+}
+
+/**
+ * Parses an address or a prefix into an IPv6 or IPv4-mapped key.
+ *
+ * @param value Address with an optional prefix length
+ * @param key Destination key
+ * @param plen Optional destination for the prefix length
+ * @return True on success, false on parse errors
+ */
+static bool nw_routing_babel_parse_address(const char *value, uint8_t *key, int *plen)
+{
+  char address[INET6_ADDRSTRLEN];
+  const char *slash = strchr(value, '/');
+  size_t length = slash ? (size_t) (slash - value) : strlen(value);
+  if (length >= sizeof(address))
+    return false;
+
+  memcpy(address, value, length);
+  address[length] = 0;
+
+  int bits;
+  if (inet_pton(AF_INET6, address, key) == 1) {
+    bits = 128;
+  } else if (inet_pton(AF_INET, address, key + 12) == 1) {
+    memset(key, 0, 10);
+    key[10] = key[11] = 0xff;
+    bits = 32;
+  } else {
+    return false;
+  }
+
+  if (plen) {
+    int prefix = slash ? atoi(slash + 1) : bits;
+    if (prefix < 0 || prefix > bits)
+      return false;
+    *plen = prefix + 128 - bits;
+  }
+
+  return true;
+}
+
+static void nw_routing_babel_format_address(const uint8_t *key, int plen, bool prefix, char *buffer, size_t length)
+{
+  char address[INET6_ADDRSTRLEN] = "";
+  if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr*) key) && plen >= 96) {
+    inet_ntop(AF_INET, key + 12, address, sizeof(address));
+    plen -= 96;
+  } else {
+    inet_ntop(AF_INET6, key, address, sizeof(address));
+  }
+
+  if (prefix)
+    snprintf(buffer, length, "%s/%d", address, plen);
+  else
+    snprintf(buffer, length, "%s", address);
+}
+
+/**
+ * Applies an imported route event to the route table.
+ *
+ * @param action Event type
+ * @param id Route identifier
+ * @param line Remainder of the line with route attributes
+ */
+static void nw_routing_babel_parse_route(struct babel_client *bc, enum babel_token action, const char *id, char *line)
+{
+  struct babel_route *route = avl_find_element(&bc->routes, id, route, avl);
+  bc->route_changes++;
+
+  if (action == BABEL_TOKEN_FLUSH) {
+    if (route) {
+      nw_routing_babel_route_detach(bc, route);
+      avl_delete(&bc->routes, &route->avl);
+      free(route);
+    }
+    return;
+  }
+
+  if (!route) {
+    /* Memory use is bounded by ignoring routes above the configured limit. */
+    if (bc->routes.count >= (unsigned int) bc->max_routes) {
+      bc->routes_ignored++;
+      return;
+    }
+
+    route = calloc(1, sizeof(struct babel_route));
+    if (!route)
+      return;
+
+    snprintf(route->id, sizeof(route->id), "%s", id);
+    route->avl.key = route->id;
+    avl_insert(&bc->routes, &route->avl);
+  }
 
-  /* Read line by line and parse the data. */
   for (;;) {
-    char *str = ustream_get_read_buf(s, NULL);
-    if (!str)
+    size_t length, value_length;
+    char *key = nw_routing_babel_next_token(&line, &length);
+    char *value = nw_routing_babel_next_token(&line, &value_length);
+    if (!key || !value)
       break;
 
-    /* Check if we have read a whole line. */
-    char *newline = strchr(buf->data, '\n');
-    if (!newline)
+    switch (nw_routing_babel_token(key, length)) {
+      /* Destination prefix. */
+      case BABEL_TOKEN_PREFIX: {
+        uint8_t prefix[16];
+        int plen;
+        if (!nw_routing_babel_parse_address(value, prefix, &plen))
+          break;
+
+        struct babel_prefix *node = nw_routing_babel_prefix_get(bc, prefix, plen);
+        if (!node || node == route->prefix)
+          break;
+
+        nw_routing_babel_route_detach(bc, route);
+        if (!node->routes++)
+          bc->num_prefixes++;
+        route->prefix = node;
+        break;
+      }
+      case BABEL_TOKEN_INSTALLED: route->installed = !strcmp(value, "yes"); break;
+      case BABEL_TOKEN_FEASIBLE: route->feasible = !strcmp(value, "yes"); break;
+      case BABEL_TOKEN_METRIC: route->metric = atoi(value); break;
+      case BABEL_TOKEN_VIA: nw_routing_babel_parse_address(value, route->via, NULL); break;
+      case BABEL_TOKEN_IF: snprintf(route->ifname, sizeof(route->ifname), "%s", value); break;
+      default: break;
+    }
+  }
+}
+
+/**
+ * Schedules a reconnection with exponential backoff.
+ */
+static void nw_routing_babel_schedule_reconnect(struct babel_client *bc)
+{
+  bc->reconnect.cb = nw_routing_babel_connect;
+  uloop_timeout_set(&bc->reconnect, bc->reconnect_delay);
+  bc->reconnect_delay *= 2;
+  if (bc->reconnect_delay > BABEL_RECONNECT_MAX)
+    bc->reconnect_delay = BABEL_RECONNECT_MAX;
+}
+
+/**
+ * Drops all state obtained through a closed monitoring session and
+ * schedules a reconnection.
+ */
+static void nw_routing_babel_session_closed(struct nw_stream_client *client)
+{
+  struct babel_client *bc = container_of(client, struct babel_client, session);
+  switch (client->status) {
+    case NW_STREAM_CLIENT_CONNECT_FAILED: {
+      syslog(LOG_WARNING, "routing-babel: Failed to connect to Babel instance '%s'.", client->endpoint.name);
       break;
+    }
+    case NW_STREAM_CLIENT_TIMEOUT: {
+      syslog(LOG_WARNING, "routing-babel: Connection with Babel instance '%s' timed out.", client->endpoint.name);
+      break;
+    }
+    default: {
+      syslog(LOG_WARNING, "routing-babel: Lost connection with Babel instance '%s'.", client->endpoint.name);
+      break;
+    }
+  }
+
+  /* State is rebuilt from the initial dump after reconnecting. */
+  bc->replies = 0;
+  bc->router_id[0] = 0;
+  nw_routing_babel_clear_entries(&bc->neighbours);
+  nw_routing_babel_clear_entries(&bc->exported_routes);
+  nw_routing_babel_clear_routes(bc);
+
+  nw_routing_babel_schedule_reconnect(bc);
+}
+
+/**
+ * Parses a single line of babeld output and applies it to the tables.
+ *
+ * @param line NULL-terminated line without the trailing newline
+ */
+static void nw_routing_babel_parse_line(struct babel_client *bc, char *line)
+{
+  size_t length;
+  char *type = nw_routing_babel_next_token(&line, &length);
+  if (!type)
+    return;
+
+  enum babel_token action = nw_routing_babel_token(type, length);
+  switch (action) {
+    case BABEL_TOKEN_ADD:
+    case BABEL_TOKEN_CHANGE:
+    case BABEL_TOKEN_FLUSH: break;
+    case BABEL_TOKEN_OK: {
+      /* The first reply follows the connection header, the second one the initial dump. */
+      if (++bc->replies < 2)
+        return;
+    }
+    /* Fall through. */
+    case BABEL_TOKEN_DONE: {
+      /* Initial dump has been received, connection is considered stable. */
+      bc->reconnect_delay = BABEL_RECONNECT_MIN;
+      return;
+    }
+    /* Header and other lines are ignored. */
+    default: return;
+  }
+
+  /* Information. */
+  char *info_type = nw_routing_babel_next_token(&line, &length);
+  if (!info_type)
+    return;
 
-    /* Replace newline with NULL, to get a NULL-terminated line in "str". */
-    *newline = 0;
-    /* Tokenize by spaces. */
-    char *type = strtok(str, " ");
-    if (!strcmp(type, "BABEL")) {
-      /* Header. */
-    } else if (!strcmp(type, "add")) {
-      /* Information. */
-      char *info_type = strtok(NULL, " ");
-      char *info_id = strtok(NULL, " ");
-      int info = -1;
-      json_object *item = NULL;
-
-      /* Currently ignored. */
-      (void) info_id;
-
-      if (!strcmp(info_type, INFO_SELF_NAME)) {
-        /* Router ID. */
-        info = INFO_SELF;
-      } else if (!strcmp(info_type, INFO_NEIGHBOUR_NAME)) {
-        /* Neighbours. */
-        info = INFO_NEIGHBOUR;
-        item = nw_routing_babel_add_array_item("neighbours");
-      } else if (!strcmp(info_type, INFO_XROUTE_NAME)) {
-        /* Exported routes. */
-        info = INFO_XROUTE;
-        item = nw_routing_babel_add_array_item("exported_routes");
-      } else if (!strcmp(info_type, INFO_ROUTE_NAME)) {
-        /* Imported routes. */
-        info = INFO_ROUTE;
+  enum babel_token info = nw_routing_babel_token(info_type, length);
+  struct avl_tree *tree = NULL;
+  switch (info) {
+    /* Neighbours. */
+    case BABEL_TOKEN_NEIGHBOUR: tree = &bc->neighbours; break;
+    /* Exported routes. */
+    case BABEL_TOKEN_XROUTE: tree = &bc->exported_routes; break;
+    /* Router ID and imported routes. */
+    case BABEL_TOKEN_SELF:
+    case BABEL_TOKEN_ROUTE: break;
+    default: return;
+  }
+
+  char *id = nw_routing_babel_next_token(&line, &length);
+  if (!id)
+    return;
+
+  if (info == BABEL_TOKEN_ROUTE)
+    return nw_routing_babel_parse_route(bc, action, id, line);
+
+  struct babel_entry *entry = NULL;
+  if (tree) {
+    entry = avl_find_element(tree, id, entry, avl);
+    if (action == BABEL_TOKEN_FLUSH) {
+      if (entry) {
+        avl_delete(tree, &entry->avl);
+        json_object_put(entry->object);
+        free(entry);
       }
+      return;
+    }
 
-      for (;;) {
-        char *key = strtok(NULL, " ");
-        char *value = strtok(NULL, " ");
-        if (!key || !value)
-          break;
+    if (!entry) {
+      entry = calloc(1, sizeof(struct babel_entry));
+      if (!entry)
+        return;
 
-        switch (info) {
-          case INFO_SELF: {
-            if (!strcmp(key, "id")) {
-              /* Router identifier. */
-              json_object_object_add(bc.object, "router_id", json_object_new_string(value));
-            }
-            break;
-          }
-          case INFO_NEIGHBOUR: {
-            if (!strcmp(key, "address")) {
-              /* Link-local address of the neighbour. */
-              json_object_object_add(item, "address", json_object_new_string(value));
-            } else if (!strcmp(key, "if")) {
-              /* Neighbour interface. */
-              json_object_object_add(item, "interface", json_object_new_string(value));
-            } else if (!strcmp(key, "reach")) {
-              /* Neighbour reachability. */
-              json_object_object_add(item, "reachability", json_object_new_int(strtol(value, NULL, 16)));
-            } else if (!strcmp(key, "rxcost")) {
-              /* Neighbour RX cost. */
-              json_object_object_add(item, "rxcost", json_object_new_int(atoi(value)));
-            } else if (!strcmp(key, "txcost")) {
-              /* Neighbour TX cost. */
-              json_object_object_add(item, "txcost", json_object_new_int(atoi(value)));
-            } else if (!strcmp(key, "rtt")) {
-              /* Neighbour RTT. */
-              unsigned int thousands, rest;
-              if (sscanf(value, "%d.%d", &thousands, &rest) == 2)
-                json_object_object_add(item, "rtt", json_object_new_int(thousands * 1000 + rest));
-            } else if (!strcmp(key, "rttcost")) {
-              /* Neighbour RTT cost. */
-              json_object_object_add(item, "rttcost", json_object_new_int(atoi(value)));
-            } else if (!strcmp(key, "cost")) {
-              /* Neighbour cost. */
-              json_object_object_add(item, "cost", json_object_new_int(atoi(value)));
-            }
-            break;
-          }
-          case INFO_XROUTE: {
-            if (!strcmp(key, "prefix")) {
-              /* Advertised destination prefix. */
-              json_object_object_add(item, "dst_prefix", json_object_new_string(value));
-            } else if (!strcmp(key, "from")) {
-              /* Advertised source prefix. */
-              json_object_object_add(item, "src_prefix", json_object_new_string(value));
-            } else if (!strcmp(key, "metric")) {
-              /* Advertised metric. */
-              json_object_object_add(item, "metric", json_object_new_int(atoi(value)));
-            }
-            break;
-          }
-          case INFO_ROUTE: {
-            /* Currently we do not report imported routes. */
-            break;
-          }
+      snprintf(entry->id, sizeof(entry->id), "%s", id);
+      entry->avl.key = entry->id;
+      avl_insert(tree, &entry->avl);
+    }
+
+    /* Snapshots may still reference the previous object, so it is replaced. */
+    json_object_put(entry->object);
+    entry->object = json_object_new_object();
+  } else if (action == BABEL_TOKEN_FLUSH) {
+    bc->router_id[0] = 0;
+    return;
+  }
+
+  json_object *item = entry ? entry->object : NULL;
+  for (;;) {
+    size_t value_length;
+    char *key = nw_routing_babel_next_token(&line, &length);
+    char *value = nw_routing_babel_next_token(&line, &value_length);
+    if (!key || !value)
+      break;
+
+    switch (nw_routing_babel_token(key, length)) {
+      /* Router identifier. */
+      case BABEL_TOKEN_ID: {
+        if (info == BABEL_TOKEN_SELF)
+          snprintf(bc->router_id, sizeof(bc->router_id), "%s", value);
+        break;
+      }
+      /* Link-local address of the neighbour. */
+      case BABEL_TOKEN_ADDRESS: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "address", json_object_new_string(value));
+        break;
+      }
+      /* Neighbour interface. */
+      case BABEL_TOKEN_IF: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "interface", json_object_new_string(value));
+        break;
+      }
+      /* Neighbour reachability. */
+      case BABEL_TOKEN_REACH: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "reachability", json_object_new_int(strtol(value, NULL, 16)));
+        break;
+      }
+      /* Neighbour RX cost. */
+      case BABEL_TOKEN_RXCOST: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "rxcost", json_object_new_int(atoi(value)));
+        break;
+      }
+      /* Neighbour TX cost. */
+      case BABEL_TOKEN_TXCOST: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "txcost", json_object_new_int(atoi(value)));
+        break;
+      }
+      /* Neighbour RTT. */
+      case BABEL_TOKEN_RTT: {
+        if (info == BABEL_TOKEN_NEIGHBOUR) {
+          char *rest;
+          long thousands = strtol(value, &rest, 10);
+          if (rest != value && *rest == '.' && rest[1])
+            json_object_object_add(item, "rtt", json_object_new_int(thousands * 1000 + atoi(rest + 1)));
         }
+        break;
+      }
+      /* Neighbour RTT cost. */
+      case BABEL_TOKEN_RTTCOST: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "rttcost", json_object_new_int(atoi(value)));
+        break;
+      }
+      /* Neighbour cost. */
+      case BABEL_TOKEN_COST: {
+        if (info == BABEL_TOKEN_NEIGHBOUR)
+          json_object_object_add(item, "cost", json_object_new_int(atoi(value)));
+        break;
+      }
+      /* Advertised destination prefix. */
+      case BABEL_TOKEN_PREFIX: {
+        if (info == BABEL_TOKEN_XROUTE)
+          json_object_object_add(item, "dst_prefix", json_object_new_string(value));
+        break;
       }
-    } else if (!strcmp(type, "done")) {
-      /* Finished. */
-      return nw_routing_babel_client_close(s);
+      /* Advertised source prefix. */
+      case BABEL_TOKEN_FROM: {
+        if (info == BABEL_TOKEN_XROUTE)
+          json_object_object_add(item, "src_prefix", json_object_new_string(value));
+        break;
+      }
+      /* Advertised metric. */
+      case BABEL_TOKEN_METRIC: {
+        if (info == BABEL_TOKEN_XROUTE)
+          json_object_object_add(item, "metric", json_object_new_int(atoi(value)));
+        break;
+      }
+      default: break;
     }
-
-    /* Mark data as consumed. */
-    ustream_consume(s, newline + 1 - str);
   }
 }
 
-static void nw_routing_babel_client_notify_state(struct ustream *s)
+static void nw_routing_babel_session_line(struct nw_stream_client *client, char *line)
 {
-  if (!s->eof)
-    return;
+  struct babel_client *bc = container_of(client, struct babel_client, session);
+  nw_routing_babel_parse_line(bc, line);
+}
+
+static void nw_routing_babel_connect(struct uloop_timeout *timeout)
+{
+  struct babel_client *bc = container_of(timeout, struct babel_client, reconnect);
 
-  nw_routing_babel_client_close(s);
+  /* Request the initial dump followed by a stream of changes. */
+  if (nw_stream_client_connect(&bc->session) < 0) {
+    syslog(LOG_WARNING, "routing-babel: Failed to connect to Babel instance '%s'.", bc->session.endpoint.name);
+    nw_routing_babel_schedule_reconnect(bc);
+  }
 }
 
-static void nw_routing_babel_client_callback(struct uloop_fd *fd, unsigned int events)
+static json_object *nw_routing_babel_snapshot(struct avl_tree *tree)
 {
-  if (fd->eof || fd->error) {
-    syslog(LOG_WARNING, "routing-babel: Failed to connect to local Babel instance.");
-    nw_routing_babel_client_close(&bc.stream.stream);
-    return;
+  json_object *list = json_object_new_array();
+  struct babel_entry *entry;
+  avl_for_each_element(tree, entry, avl) {
+    json_object_array_add(list, json_object_get(entry->object));
+  }
+  return list;
+}
+
+/**
+ * Summarizes the imported route table. The table itself is not reported
+ * as it may contain many thousands of routes.
+ *
+ * @return Route summary
+ */
+static json_object *nw_routing_babel_summarize_routes(struct babel_client *bc)
+{
+  /* Upper bounds of metric distribution buckets. */
+  static const int bounds[] = { 256, 512, 1024, 2048, 4096, BABEL_INFINITY - 1 };
+  int buckets[sizeof(bounds) / sizeof(bounds[0]) + 1] = { 0, };
+  int installed = 0, feasible = 0;
+
+  /* Per-neighbour route counts, there are only a few neighbours. */
+  struct {
+    uint8_t via[16];
+    char ifname[IFNAMSIZ];
+    int routes;
+    int installed;
+  } neighbours[64];
+  int num_neighbours = 0;
+
+  /* Installed routes with the highest metrics. */
+  struct babel_route *top[BABEL_MAX_ROUTES_TOP];
+  int num_top = 0;
+
+  struct babel_route *route;
+  avl_for_each_element(&bc->routes, route, avl) {
+    if (!route->prefix)
+      continue;
+
+    size_t bucket = 0;
+    while (bucket < sizeof(bounds) / sizeof(bounds[0]) && route->metric > bounds[bucket])
+      bucket++;
+    buckets[bucket]++;
+
+    if (route->installed)
+      installed++;
+    if (route->feasible)
+      feasible++;
+
+    int i;
+    for (i = 0; i < num_neighbours; i++) {
+      if (!memcmp(neighbours[i].via, route->via, 16) && !strcmp(neighbours[i].ifname, route->ifname))
+        break;
+    }
+    if (i == num_neighbours && num_neighbours < (int) (sizeof(neighbours) / sizeof(neighbours[0]))) {
+      memcpy(neighbours[i].via, route->via, 16);
+      memcpy(neighbours[i].ifname, route->ifname, IFNAMSIZ);
+      neighbours[i].routes = 0;
+      neighbours[i].installed = 0;
+      num_neighbours++;
+    }
+    if (i < num_neighbours) {
+      neighbours[i].routes++;
+      neighbours[i].installed += route->installed;
+    }
+
+    if (!route->installed || !bc->routes_top)
+      continue;
+
+    /* Insertion into the list ordered by decreasing metric. */
+    int position = num_top < bc->routes_top ? num_top++ : num_top;
+    while (position > 0 && top[position - 1]->metric < route->metric) {
+      if (position < bc->routes_top)
+        top[position] = top[position - 1];
+      position--;
+    }
+    if (position < bc->routes_top)
+      top[position] = route;
+  }
+
+  json_object *summary = json_object_new_object();
+  json_object_object_add(summary, "total", json_object_new_int(bc->routes.count));
+  json_object_object_add(summary, "installed", json_object_new_int(installed));
+  json_object_object_add(summary, "feasible", json_object_new_int(feasible));
+  json_object_object_add(summary, "prefixes", json_object_new_int(bc->num_prefixes));
+  json_object_object_add(summary, "changes", json_object_new_int(bc->route_changes));
+  if (bc->routes_ignored)
+    json_object_object_add(summary, "ignored", json_object_new_int(bc->routes_ignored));
+  bc->route_changes = 0;
+
+  json_object *metrics = json_object_new_object();
+  for (size_t i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++) {
+    char bound[16];
+    if (i < sizeof(bounds) / sizeof(bounds[0]))
+      snprintf(bound, sizeof(bound), "%d", bounds[i]);
+    else
+      snprintf(bound, sizeof(bound), "unreachable");
+    json_object_object_add(metrics, bound, json_object_new_int(buckets[i]));
   }
+  json_object_object_add(summary, "metrics", metrics);
 
-  /* Connection has been established, prepare the stream. */
-  uloop_fd_delete(&bc.client);
-  bc.stream.stream.string_data = true;
-  bc.stream.stream.notify_read = nw_routing_babel_client_read;
-  bc.stream.stream.notify_state = nw_routing_babel_client_notify_state;
-  ustream_fd_init(&bc.stream, bc.client.fd);
+  json_object *per_neighbour = json_object_new_array();
+  for (int i = 0; i < num_neighbours; i++) {
+    char address[INET6_ADDRSTRLEN];
+    json_object *neighbour = json_object_new_object();
+    nw_routing_babel_format_address(neighbours[i].via, 128, false, address, sizeof(address));
+    json_object_object_add(neighbour, "address", json_object_new_string(address));
+    json_object_object_add(neighbour, "interface", json_object_new_string(neighbours[i].ifname));
+    json_object_object_add(neighbour, "routes", json_object_new_int(neighbours[i].routes));
+    json_object_object_add(neighbour, "installed", json_object_new_int(neighbours[i].installed));
+    json_object_array_add(per_neighbour, neighbour);
+  }
+  json_object_object_add(summary, "neighbours", per_neighbour);
+
+  if (bc->routes_top) {
+    json_object *list = json_object_new_array();
+    for (int i = 0; i < num_top; i++) {
+      char prefix[INET6_ADDRSTRLEN + 4], via[INET6_ADDRSTRLEN];
+      nw_routing_babel_format_address(top[i]->prefix->key, top[i]->prefix->plen, true, prefix, sizeof(prefix));
+      nw_routing_babel_format_address(top[i]->via, 128, false, via, sizeof(via));
+
+      json_object *item = json_object_new_object();
+      json_object_object_add(item, "dst_prefix", json_object_new_string(prefix));
+      json_object_object_add(item, "metric", json_object_new_int(top[i]->metric));
+      json_object_object_add(item, "via", json_object_new_string(via));
+      json_object_object_add(item, "interface", json_object_new_string(top[i]->ifname));
+      json_object_array_add(list, item);
+    }
+    json_object_object_add(summary, "top", list);
+  }
+
+  return summary;
 }
 
 static int nw_routing_babel_start_acquire_data(struct nodewatcher_module *module,
                                                struct ubus_context *ubus,
                                                struct uci_context *uci)
 {
-  /* Ignore new requests if previous ones did not complete yet. */
-  if (!bc.ready)
-    return -1;
-
-  bc.object = json_object_new_object();
+  json_object *object = json_object_new_object();
 
   /* Get the link-local addresses of the local interfaces. */
   struct ifaddrs *ifaddr, *ifa;
   json_object *link_local = json_object_new_array();
-  json_object_object_add(bc.object, "link_local", link_local);
+  json_object_object_add(object, "link_local", link_local);
 
   if (!getifaddrs(&ifaddr)) {
     for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
@@ -284,33 +932,82 @@ static int nw_routing_babel_start_acquire_data(struct nodewatcher_module *module
     syslog(LOG_WARNING, "routing-babel: Failed to obtain link-local addresses.");
   }
 
-  /* Open a connection to the Babel local socket. */
-  /* TODO: We currently assume the local server to be running on [::1]:33123. */
-  bc.client.cb = nw_routing_babel_client_callback;
-  bc.client.fd = usock(USOCK_TCP | USOCK_NUMERIC | USOCK_NONBLOCK, "::1", "33123");
-  if (bc.client.fd < 0) {
-    syslog(LOG_WARNING, "routing-babel: Failed to connect to local Babel instance.");
-    return nw_module_finish_acquire_data(module, bc.object);
+  /* With multiple instances, their data is reported under instance names. */
+  json_object *instances_object = NULL;
+  if (num_instances > 1) {
+    instances_object = json_object_new_object();
+    json_object_object_add(object, "instances", instances_object);
   }
 
-  bc.ready = false;
-  uloop_fd_add(&bc.client, ULOOP_READ);
+  for (int i = 0; i < num_instances; i++) {
+    struct babel_client *bc = &instances[i];
+    json_object *instance = object;
+    if (instances_object) {
+      instance = json_object_new_object();
+      json_object_object_add(instances_object, bc->session.endpoint.name, instance);
+    }
 
-  /* Start a timer that will abort data retrieval. */
-  bc.timer.cb = nw_routing_babel_client_timeout;
-  uloop_timeout_set(&bc.timer, 5000);
+    /* Tables are kept up to date by the monitoring session. */
+    if (!bc->session.established)
+      continue;
 
-  return 0;
+    if (bc->router_id[0])
+      json_object_object_add(instance, "router_id", json_object_new_string(bc->router_id));
+    if (!avl_is_empty(&bc->neighbours))
+      json_object_object_add(instance, "neighbours", nw_routing_babel_snapshot(&bc->neighbours));
+    if (!avl_is_empty(&bc->exported_routes))
+      json_object_object_add(instance, "exported_routes", nw_routing_babel_snapshot(&bc->exported_routes));
+    json_object_object_add(instance, "imported_routes", nw_routing_babel_summarize_routes(bc));
+    json_object_object_add(instance, "session", nw_stream_client_get_stats(&bc->session));
+  }
+
+  return nw_module_finish_acquire_data(module, object);
 }
 
 static int nw_routing_babel_init(struct nodewatcher_module *module,
                                  struct ubus_context *ubus,
                                  struct uci_context *uci)
 {
-  /* Initialize the client structure. */
-  bc.ready = true;
-  bc.module = module;
+  struct nw_endpoint *endpoints;
+  num_instances = nw_uci_get_endpoints(uci, "routing_babel", "::1", "33123", BABEL_CONNECT_TIMEOUT, &endpoints);
+  if (num_instances < 0)
+    return -1;
+
+  instances = calloc(num_instances, sizeof(struct babel_client));
+  if (!instances) {
+    free(endpoints);
+    return -1;
+  }
+
+  int max_routes = nw_uci_get_int(uci, "nodewatcher.@agent[0].babel_max_routes");
+  if (max_routes <= 0)
+    max_routes = BABEL_MAX_ROUTES;
+  int routes_top = nw_uci_get_int(uci, "nodewatcher.@agent[0].babel_routes_top");
+  if (routes_top < 0)
+    routes_top = 0;
+  else if (routes_top > BABEL_MAX_ROUTES_TOP)
+    routes_top = BABEL_MAX_ROUTES_TOP;
+
+  for (int i = 0; i < num_instances; i++) {
+    /* Initialize the client structure. */
+    struct babel_client *bc = &instances[i];
+    nw_stream_client_init(&bc->session, &endpoints[i], NW_STREAM_CLIENT_LINES);
+    bc->session.persistent = true;
+    bc->session.request = "monitor\n";
+    bc->session.line = nw_routing_babel_session_line;
+    bc->session.closed = nw_routing_babel_session_closed;
+    bc->reconnect_delay = BABEL_RECONNECT_MIN;
+    bc->max_routes = max_routes;
+    bc->routes_top = routes_top;
+    avl_init(&bc->neighbours, avl_strcmp, false, NULL);
+    avl_init(&bc->exported_routes, avl_strcmp, false, NULL);
+    avl_init(&bc->routes, avl_strcmp, false, NULL);
+
+    /* Establish a persistent monitoring session. */
+    nw_routing_babel_connect(&bc->reconnect);
+  }
 
+  free(endpoints);
   return 0;
 }
 
@@ -318,7 +1015,7 @@ static int nw_routing_babel_init(struct nodewatcher_module *module,
 struct nodewatcher_module nw_module = {
   .name = "core.routing.babel",
   .author = "Jernej Kos <jernej@kos.mx>",
-  .version = 1,
+  .version = 5,
   .hooks = {
     .init               = nw_routing_babel_init,
     .start_acquire_data = nw_routing_babel_start_acquire_data,
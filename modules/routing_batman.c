@@ -0,0 +1,304 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/module.h>
+#include <nodewatcher-agent/json.h>
+#include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/netlink.h>
+
+#include <syslog.h>
+#include <string.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/genetlink.h>
+#include <linux/batman_adv.h>
+
+/* Default batman-adv mesh interface */
+#define BATMAN_DEFAULT_INTERFACE "bat0"
+/* Maximum number of neighbours that originator data is matched against */
+#define BATMAN_MAX_NEIGHBOURS 128
+
+/* Generic netlink request with room for a few attributes */
+struct batman_request {
+  struct nlmsghdr hdr;
+  struct genlmsghdr genl;
+  char attrs[32];
+};
+
+/* Neighbour reported on a hard interface */
+struct batman_neighbour {
+  uint8_t address[ETH_ALEN];
+  uint32_t hard_ifindex;
+  json_object *object;
+};
+
+/* Data collected for a single mesh interface */
+struct batman_mesh {
+  json_object *object;
+  json_object *neighbours;
+  struct batman_neighbour entries[BATMAN_MAX_NEIGHBOURS];
+  int num_entries;
+  int originators;
+  int tt_local;
+  int tt_global;
+};
+
+/* Module state */
+static struct {
+  /* Netlink socket and resolved batman-adv family */
+  struct nw_netlink nl;
+  uint16_t family;
+  /* Configured mesh interfaces (space-separated) */
+  char *interfaces;
+} bn = { .nl = { .fd = -1, }, };
+
+static void nw_routing_batman_prepare(struct batman_request *req, uint8_t cmd, int flags, uint32_t ifindex)
+{
+  memset(req, 0, sizeof(*req));
+  req->hdr.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  req->hdr.nlmsg_type = bn.family;
+  req->hdr.nlmsg_flags = flags;
+  req->genl.cmd = cmd;
+  req->genl.version = 1;
+  nw_netlink_put_attr(&req->hdr, sizeof(*req), BATADV_ATTR_MESH_IFINDEX, &ifindex, sizeof(ifindex));
+}
+
+static void nw_routing_batman_parse(struct nlattr **tb, struct nlmsghdr *hdr)
+{
+  nw_netlink_parse_attrs(tb, BATADV_ATTR_MAX, (char*) NLMSG_DATA(hdr) + GENL_HDRLEN,
+    hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
+
+static json_object *nw_routing_batman_mac(const struct nlattr *nla)
+{
+  const uint8_t *mac = nw_nla_data(nla);
+  char buffer[18];
+  snprintf(buffer, sizeof(buffer), "%02x:%02x:%02x:%02x:%02x:%02x",
+    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return json_object_new_string(buffer);
+}
+
+static int nw_routing_batman_parse_mesh_info(struct nlmsghdr *hdr, void *priv)
+{
+  struct batman_mesh *mesh = (struct batman_mesh*) priv;
+  struct nlattr *tb[BATADV_ATTR_MAX + 1];
+  nw_routing_batman_parse(tb, hdr);
+
+  /* Router identifier. */
+  if (tb[BATADV_ATTR_MESH_ADDRESS])
+    json_object_object_add(mesh->object, "router_id", nw_routing_batman_mac(tb[BATADV_ATTR_MESH_ADDRESS]));
+  if (tb[BATADV_ATTR_ALGO_NAME])
+    json_object_object_add(mesh->object, "algorithm", json_object_new_string(nw_nla_data(tb[BATADV_ATTR_ALGO_NAME])));
+  return 0;
+}
+
+static int nw_routing_batman_parse_neighbour(struct nlmsghdr *hdr, void *priv)
+{
+  struct batman_mesh *mesh = (struct batman_mesh*) priv;
+  struct nlattr *tb[BATADV_ATTR_MAX + 1];
+  nw_routing_batman_parse(tb, hdr);
+  if (!tb[BATADV_ATTR_NEIGH_ADDRESS] || !tb[BATADV_ATTR_HARD_IFINDEX])
+    return 0;
+
+  json_object *neighbour = json_object_new_object();
+  json_object_array_add(mesh->neighbours, neighbour);
+  json_object_object_add(neighbour, "address", nw_routing_batman_mac(tb[BATADV_ATTR_NEIGH_ADDRESS]));
+
+  uint32_t hard_ifindex = nw_nla_get_u32(tb[BATADV_ATTR_HARD_IFINDEX]);
+  char ifname[IF_NAMESIZE];
+  if (if_indextoname(hard_ifindex, ifname))
+    json_object_object_add(neighbour, "interface", json_object_new_string(ifname));
+  if (tb[BATADV_ATTR_LAST_SEEN_MSECS])
+    json_object_object_add(neighbour, "last_seen", json_object_new_int(nw_nla_get_u32(tb[BATADV_ATTR_LAST_SEEN_MSECS])));
+  if (tb[BATADV_ATTR_THROUGHPUT])
+    json_object_object_add(neighbour, "throughput", json_object_new_int64(nw_nla_get_u32(tb[BATADV_ATTR_THROUGHPUT])));
+
+  /* Remember the neighbour, so link quality from originator data can be added. */
+  if (mesh->num_entries < BATMAN_MAX_NEIGHBOURS) {
+    struct batman_neighbour *entry = &mesh->entries[mesh->num_entries++];
+    memcpy(entry->address, nw_nla_data(tb[BATADV_ATTR_NEIGH_ADDRESS]), ETH_ALEN);
+    entry->hard_ifindex = hard_ifindex;
+    entry->object = neighbour;
+  }
+
+  return 0;
+}
+
+static int nw_routing_batman_parse_originator(struct nlmsghdr *hdr, void *priv)
+{
+  struct batman_mesh *mesh = (struct batman_mesh*) priv;
+  struct nlattr *tb[BATADV_ATTR_MAX + 1];
+  nw_routing_batman_parse(tb, hdr);
+  if (!tb[BATADV_ATTR_FLAG_BEST] || !tb[BATADV_ATTR_ORIG_ADDRESS] || !tb[BATADV_ATTR_NEIGH_ADDRESS])
+    return 0;
+
+  mesh->originators++;
+
+  /* Originators that are direct neighbours carry the neighbour's link quality. */
+  const uint8_t *orig = nw_nla_data(tb[BATADV_ATTR_ORIG_ADDRESS]);
+  const uint8_t *neigh = nw_nla_data(tb[BATADV_ATTR_NEIGH_ADDRESS]);
+  if (!tb[BATADV_ATTR_TQ] || memcmp(orig, neigh, ETH_ALEN) != 0)
+    return 0;
+
+  uint32_t hard_ifindex = tb[BATADV_ATTR_HARD_IFINDEX] ? nw_nla_get_u32(tb[BATADV_ATTR_HARD_IFINDEX]) : 0;
+  for (int i = 0; i < mesh->num_entries; i++) {
+    struct batman_neighbour *entry = &mesh->entries[i];
+    if (memcmp(entry->address, neigh, ETH_ALEN) == 0 && (!hard_ifindex || entry->hard_ifindex == hard_ifindex)) {
+      json_object_object_add(entry->object, "lq", json_object_new_int(nw_nla_get_u8(tb[BATADV_ATTR_TQ])));
+      break;
+    }
+  }
+
+  return 0;
+}
+
+static int nw_routing_batman_parse_tt_local(struct nlmsghdr *hdr, void *priv)
+{
+  struct batman_mesh *mesh = (struct batman_mesh*) priv;
+  mesh->tt_local++;
+  return 0;
+}
+
+static int nw_routing_batman_parse_tt_global(struct nlmsghdr *hdr, void *priv)
+{
+  struct batman_mesh *mesh = (struct batman_mesh*) priv;
+  struct nlattr *tb[BATADV_ATTR_MAX + 1];
+  nw_routing_batman_parse(tb, hdr);
+
+  /* Global entries are reported once per announcing originator. */
+  if (tb[BATADV_ATTR_FLAG_BEST])
+    mesh->tt_global++;
+  return 0;
+}
+
+/**
+ * Collects routing data of a single batman-adv mesh interface.
+ *
+ * @param ifname Mesh interface name
+ * @param object Destination object
+ * @return True on success, false when the interface is not available
+ */
+static bool nw_routing_batman_process_mesh(const char *ifname, json_object *object)
+{
+  uint32_t ifindex = if_nametoindex(ifname);
+  if (!ifindex)
+    return false;
+
+  struct batman_mesh *mesh = calloc(1, sizeof(struct batman_mesh));
+  if (!mesh)
+    return false;
+
+  struct batman_request req;
+  mesh->object = object;
+  nw_routing_batman_prepare(&req, BATADV_CMD_GET_MESH_INFO, 0, ifindex);
+  if (nw_netlink_request(&bn.nl, &req.hdr, nw_routing_batman_parse_mesh_info, mesh) != 0) {
+    free(mesh);
+    return false;
+  }
+
+  /* Neighbours are dumped first, so originator data can be matched to them. */
+  mesh->neighbours = json_object_new_array();
+  json_object_object_add(object, "neighbours", mesh->neighbours);
+  nw_routing_batman_prepare(&req, BATADV_CMD_GET_NEIGHBORS, NLM_F_DUMP, ifindex);
+  nw_netlink_request(&bn.nl, &req.hdr, nw_routing_batman_parse_neighbour, mesh);
+
+  nw_routing_batman_prepare(&req, BATADV_CMD_GET_ORIGINATORS, NLM_F_DUMP, ifindex);
+  nw_netlink_request(&bn.nl, &req.hdr, nw_routing_batman_parse_originator, mesh);
+  json_object_object_add(object, "originators", json_object_new_int(mesh->originators));
+
+  nw_routing_batman_prepare(&req, BATADV_CMD_GET_TRANSTABLE_LOCAL, NLM_F_DUMP, ifindex);
+  nw_netlink_request(&bn.nl, &req.hdr, nw_routing_batman_parse_tt_local, mesh);
+  nw_routing_batman_prepare(&req, BATADV_CMD_GET_TRANSTABLE_GLOBAL, NLM_F_DUMP, ifindex);
+  nw_netlink_request(&bn.nl, &req.hdr, nw_routing_batman_parse_tt_global, mesh);
+
+  json_object *tt = json_object_new_object();
+  json_object_object_add(tt, "local", json_object_new_int(mesh->tt_local));
+  json_object_object_add(tt, "global", json_object_new_int(mesh->tt_global));
+  json_object_object_add(object, "translation_table", tt);
+
+  free(mesh);
+  return true;
+}
+
+static int nw_routing_batman_start_acquire_data(struct nodewatcher_module *module,
+                                                struct ubus_context *ubus,
+                                                struct uci_context *uci)
+{
+  json_object *object = json_object_new_object();
+
+  /* The batman-adv kernel module may be loaded after the agent has started. */
+  if (!bn.family && nw_netlink_genl_family(&bn.nl, BATADV_NL_NAME, &bn.family) != 0)
+    return nw_module_finish_acquire_data(module, object);
+
+  char interfaces[256];
+  snprintf(interfaces, sizeof(interfaces), "%s", bn.interfaces ? bn.interfaces : BATMAN_DEFAULT_INTERFACE);
+
+  /* With multiple mesh interfaces, their data is reported under interface names. */
+  json_object *instances_object = NULL;
+  if (strchr(interfaces, ' ')) {
+    instances_object = json_object_new_object();
+    json_object_object_add(object, "instances", instances_object);
+  }
+
+  char *saveptr;
+  for (char *ifname = strtok_r(interfaces, " ", &saveptr); ifname; ifname = strtok_r(NULL, " ", &saveptr)) {
+    json_object *instance = object;
+    if (instances_object)
+      instance = json_object_new_object();
+
+    if (!nw_routing_batman_process_mesh(ifname, instance)) {
+      syslog(LOG_WARNING, "routing-batman: Failed to obtain data for mesh interface '%s'.", ifname);
+      if (instances_object)
+        json_object_put(instance);
+      continue;
+    }
+
+    if (instances_object)
+      json_object_object_add(instances_object, ifname, instance);
+  }
+
+  return nw_module_finish_acquire_data(module, object);
+}
+
+static int nw_routing_batman_init(struct nodewatcher_module *module,
+                                  struct ubus_context *ubus,
+                                  struct uci_context *uci)
+{
+  if (nw_netlink_open(&bn.nl, NETLINK_GENERIC) != 0) {
+    syslog(LOG_WARNING, "routing-batman: Failed to open generic netlink socket.");
+    return -1;
+  }
+
+  bn.interfaces = nw_uci_get_string(uci, "nodewatcher.@agent[0].batman_interfaces");
+
+  return 0;
+}
+
+/* Module descriptor. */
+struct nodewatcher_module nw_module = {
+  .name = "core.routing.batman",
+  .author = "Jernej Kos <jernej@kos.mx>",
+  .version = 1,
+  .hooks = {
+    .init               = nw_routing_batman_init,
+    .start_acquire_data = nw_routing_batman_start_acquire_data,
+  },
+  .schedule = {
+    .refresh_interval = 30,
+  },
+};
@@ -19,10 +19,9 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/json.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/stream_client.h>
 
 #include <libubox/uloop.h>
-#include <libubox/ustream.h>
-#include <libubox/usock.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -30,222 +29,327 @@
 #include <ifaddrs.h>
 #include <unistd.h>
 #include <net/if.h>
+#include <arpa/inet.h>
+
+/* Default request timeout (in milliseconds) */
+#define OLSR_TIMEOUT 5000
+/* Maximum size of a jsoninfo response (in bytes) */
+#define OLSR_MAX_RESPONSE (4 * 1024 * 1024)
+
+/* Local interface address, IPv4 addresses are stored as IPv4-mapped */
+struct olsr_interface {
+  bool used;
+  uint8_t address[16];
+  char name[IFNAMSIZ];
+};
+
+/* Neighbour whose interface is resolved once all interfaces are known */
+struct olsr_link {
+  json_object *neighbour;
+  uint8_t local[16];
+};
 
 struct olsr_client {
-  /* A flag indicating the client to be ready for new connections. */
-  bool ready;
-  /* Module reference. */
-  struct nodewatcher_module *module;
-  /* File descriptor. */
-  struct uloop_fd client;
-  /* Read stream. */
-  struct ustream_fd stream;
-  /* Timer. */
-  struct uloop_timeout timer;
-  /* JSON parser. */
-  struct json_tokener *jstok;
+  /* Request session. */
+  struct nw_stream_client session;
   /* Result object. */
   json_object *object;
+  /* Result arrays. */
+  json_object *exported_routes;
+  json_object *link_local;
+  json_object *neighbours;
+  /* Currently parsed neighbour. */
+  json_object *neighbour;
+  /* Currently parsed HNA entry. */
+  char hna_destination[INET6_ADDRSTRLEN];
+  int hna_genmask;
+  /* Currently parsed interface. */
+  char iface_name[IFNAMSIZ];
+  char iface_ipv4[INET6_ADDRSTRLEN];
+  char iface_ipv6[INET6_ADDRSTRLEN];
+  /* Open addressing index of local interface addresses. */
+  struct olsr_interface *interfaces;
+  size_t interfaces_size;
+  size_t interfaces_count;
+  /* Links with unresolved interfaces. */
+  struct olsr_link *links;
+  size_t links_size;
+  size_t links_count;
 };
 
-/* Global OLSR client instance. */
-static struct olsr_client oc;
+/* OLSR client instances. */
+static struct {
+  /* Module reference. */
+  struct nodewatcher_module *module;
+  /* Client instances. */
+  struct olsr_client *instances;
+  int num_instances;
+  /* Number of instances with requests in progress. */
+  int pending;
+  /* Result object. */
+  json_object *object;
+} ol;
 
-static void nw_routing_olsr_client_close(struct ustream *s)
+static bool nw_routing_olsr_parse_address(const char *value, uint8_t *address)
 {
-  ustream_free(s);
-  close(oc.client.fd);
-  uloop_fd_delete(&oc.client);
-
-  /* Free the JSON parser. */
-  json_tokener_free(oc.jstok);
-  oc.jstok = NULL;
+  if (inet_pton(AF_INET6, value, address) == 1)
+    return true;
 
-  /* Since we are done, we may cancel the timer. */
-  uloop_timeout_cancel(&oc.timer);
+  memset(address, 0, 10);
+  address[10] = address[11] = 0xff;
+  return inet_pton(AF_INET, value, address + 12) == 1;
+}
 
-  /* We have finished acquiring data. */
-  oc.ready = true;
-  nw_module_finish_acquire_data(oc.module, oc.object);
-  /* We have passed object ownership, so remove the reference. */
-  oc.object = NULL;
+static struct olsr_interface *nw_routing_olsr_interface_slot(struct olsr_interface *table,
+                                                             size_t size,
+                                                             const uint8_t *address)
+{
+  /* FNV-1a over the address. */
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 16; i++)
+    hash = (hash ^ address[i]) * 16777619u;
+
+  size_t mask = size - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    if (!table[i].used || !memcmp(table[i].address, address, 16))
+      return &table[i];
+  }
 }
 
-static void nw_routing_olsr_client_timeout(struct uloop_timeout *timeout)
+static void nw_routing_olsr_interface_add(struct olsr_client *oc, const char *value, const char *name)
 {
-  syslog(LOG_WARNING, "routing-olsr: Connection with local OLSR instance timed out.");
-  nw_routing_olsr_client_close(&oc.stream.stream);
+  uint8_t address[16];
+  if (!value[0] || !nw_routing_olsr_parse_address(value, address))
+    return;
+
+  /* Keep the table at most half full. */
+  if ((oc->interfaces_count + 1) * 2 > oc->interfaces_size) {
+    size_t size = oc->interfaces_size ? oc->interfaces_size * 2 : 16;
+    struct olsr_interface *table = calloc(size, sizeof(struct olsr_interface));
+    if (!table)
+      return;
+
+    for (size_t i = 0; i < oc->interfaces_size; i++) {
+      if (oc->interfaces[i].used)
+        *nw_routing_olsr_interface_slot(table, size, oc->interfaces[i].address) = oc->interfaces[i];
+    }
+
+    free(oc->interfaces);
+    oc->interfaces = table;
+    oc->interfaces_size = size;
+  }
+
+  struct olsr_interface *iface = nw_routing_olsr_interface_slot(oc->interfaces, oc->interfaces_size, address);
+  if (iface->used)
+    return;
+
+  iface->used = true;
+  memcpy(iface->address, address, 16);
+  snprintf(iface->name, sizeof(iface->name), "%s", name);
+  oc->interfaces_count++;
 }
 
-static void nw_routing_olsr_client_read(struct ustream *s, int bytes)
+static void nw_routing_olsr_link_add(struct olsr_client *oc, const char *local_ip)
 {
-  /* Read and parse the JSON response. */
-  for (;;) {
-    int len;
-    char *data = ustream_get_read_buf(s, &len);
-    if (!data)
-      break;
+  uint8_t local[16];
+  if (!oc->neighbour || !nw_routing_olsr_parse_address(local_ip, local))
+    return;
 
-    /* Parse data as JSON, incrementally. */
-    json_object *object = json_tokener_parse_ex(oc.jstok, data, len);
-    if (object) {
-      /* Request has been parsed. */
-      json_object *config = NULL;
-      json_object *interfaces = NULL;
-      json_object *links = NULL;
-      json_object_object_get_ex(object, "config", &config);
-      json_object_object_get_ex(object, "interfaces", &interfaces);
-      json_object_object_get_ex(object, "links", &links);
-
-      if (config) {
-        /* Router identifier. */
-        NW_COPY_JSON_OBJECT(config, "mainIpAddress", oc.object, "router_id");
-        /* Exported routes. */
-        json_object *exported_routes = json_object_new_array();
-        json_object *hna;
-        json_object_object_get_ex(config, "hna", &hna);
-        if (hna) {
-          int i;
-          for (i = 0; i < json_object_array_length(hna); i++) {
-            json_object *entry = json_object_array_get_idx(hna, i);
-            json_object *json_destination;
-            json_object *json_genmask;
-            json_object_object_get_ex(entry, "destination", &json_destination);
-            json_object_object_get_ex(entry, "genmask", &json_genmask);
-            if (!json_destination || !json_genmask)
-              continue;
-
-            const char *destination = json_object_get_string(json_destination);
-            int genmask = json_object_get_int(json_genmask);
-            /* Maximum address length + prefix size. */
-            char dst_prefix[INET6_ADDRSTRLEN + 4];
-            snprintf(dst_prefix, sizeof(dst_prefix), "%s/%d", destination, genmask);
-
-            json_object *exported_route = json_object_new_object();
-            json_object_object_add(exported_route, "dst_prefix", json_object_new_string(dst_prefix));
-            json_object_array_add(exported_routes, exported_route);
-          }
-        }
-
-        json_object_object_add(oc.object, "exported_routes", exported_routes);
-      }
+  if (oc->links_count == oc->links_size) {
+    size_t size = oc->links_size ? oc->links_size * 2 : 16;
+    struct olsr_link *links = realloc(oc->links, size * sizeof(struct olsr_link));
+    if (!links)
+      return;
 
-      /* MID. */
-      json_object *aliases = json_object_new_array();
-      json_object_object_add(oc.object, "link_local", aliases);
-      if (interfaces) {
-        int i;
-        for (i = 0; i < json_object_array_length(interfaces); i++) {
-          json_object *iface = json_object_array_get_idx(interfaces, i);
-          json_object *json_address;
-          json_object *json_name;
-          json_object_object_get_ex(iface, "nameFromKernel", &json_name);
-          json_object_object_get_ex(iface, "ipv4Address", &json_address);
-          /* Try IPv6 if no address set. */
-          if (!json_address) {
-            json_object_object_get_ex(iface, "ipv6Address", &json_address);
-          }
-
-          if (!json_address || !json_name)
-            continue;
-
-          const char *address = json_object_get_string(json_address);
-          const char *name = json_object_get_string(json_name);
-          char address_interface[INET6_ADDRSTRLEN + 1 + IFNAMSIZ];
-          snprintf(address_interface, sizeof(address_interface), "%s%%%s", address, name);
-          json_object_array_add(aliases, json_object_new_string(address_interface));
-        }
-      }
+    oc->links = links;
+    oc->links_size = size;
+  }
 
-      /* Neighbours. */
-      json_object *neighbours = json_object_new_array();
-      json_object_object_add(oc.object, "neighbours", neighbours);
-      if (links) {
-        int i;
-        for (i = 0; i < json_object_array_length(links); i++) {
-          json_object *link = json_object_array_get_idx(links, i);
-          json_object *neighbour = json_object_new_object();
-          json_object_array_add(neighbours, neighbour);
-
-          NW_COPY_JSON_OBJECT(link, "remoteIP", neighbour, "address");
-          NW_COPY_JSON_OBJECT(link, "linkQuality", neighbour, "lq");
-          NW_COPY_JSON_OBJECT(link, "neighborLinkQuality", neighbour, "ilq");
-          NW_COPY_JSON_OBJECT(link, "linkCost", neighbour, "cost");
-
-          /* Determine which interface has this address. */
-          if (interfaces) {
-            json_object *json_local_ip;
-            json_object_object_get_ex(link, "localIP", &json_local_ip);
-
-            if (json_local_ip) {
-              int j;
-              const char *local_ip = json_object_get_string(json_local_ip);
-
-              for (j = 0; j < json_object_array_length(interfaces); j++) {
-                json_object *iface = json_object_array_get_idx(interfaces, i);
-                json_object *json_address;
-                json_object *json_name;
-                json_object_object_get_ex(iface, "nameFromKernel", &json_name);
-                json_object_object_get_ex(iface, "ipv4Address", &json_address);
-                /* Try IPv6 if no address set. */
-                if (!json_address) {
-                  json_object_object_get_ex(iface, "ipv6Address", &json_address);
-                }
-
-                if (!json_address || !json_name)
-                  continue;
-
-                const char *address = json_object_get_string(json_address);
-                const char *name = json_object_get_string(json_name);
-                if (!strcmp(address, local_ip)) {
-                  json_object_object_add(link, "interface", json_object_new_string(name));
-                  break;
-                }
-              }
-            }
-          }
-        }
-      }
+  oc->links[oc->links_count].neighbour = oc->neighbour;
+  memcpy(oc->links[oc->links_count].local, local, 16);
+  oc->links_count++;
+}
 
-      json_object_put(object);
+/**
+ * Determines which local interface each neighbour is reachable over. Links
+ * may be reported before interfaces, so this is done once the whole
+ * response has been parsed.
+ */
+static void nw_routing_olsr_resolve_links(struct olsr_client *oc)
+{
+  for (size_t i = 0; i < oc->links_count && oc->interfaces_count; i++) {
+    struct olsr_link *link = &oc->links[i];
+    struct olsr_interface *iface = nw_routing_olsr_interface_slot(oc->interfaces, oc->interfaces_size, link->local);
+    if (iface->used)
+      json_object_object_add(link->neighbour, "interface", json_object_new_string(iface->name));
+  }
+}
 
-      return nw_routing_olsr_client_close(s);
-    } else if (json_tokener_get_error(oc.jstok) != json_tokener_continue) {
-      /* Parse error has occurred. */
+static void nw_routing_olsr_session_closed(struct nw_stream_client *client)
+{
+  struct olsr_client *oc = container_of(client, struct olsr_client, session);
+  switch (client->status) {
+    case NW_STREAM_CLIENT_DONE: {
+      /* Response has been parsed. */
+      nw_routing_olsr_resolve_links(oc);
+      break;
+    }
+    case NW_STREAM_CLIENT_CONNECT_FAILED: {
+      syslog(LOG_WARNING, "routing-olsr: Failed to connect to OLSR instance '%s'.", client->endpoint.name);
+      break;
+    }
+    case NW_STREAM_CLIENT_TIMEOUT: {
+      syslog(LOG_WARNING, "routing-olsr: Connection with OLSR instance '%s' timed out.", client->endpoint.name);
+      break;
+    }
+    case NW_STREAM_CLIENT_PARSE_ERROR: {
       syslog(LOG_WARNING, "routing-olsr: Parse error while processing jsoninfo output.");
-      return nw_routing_olsr_client_close(s);
+      break;
     }
-
-    /* Mark data as consumed. */
-    ustream_consume(s, len);
+    default: break;
   }
+
+  json_object_object_add(oc->object, "session", nw_stream_client_get_stats(client));
+
+  /* Release the per-response indices. */
+  free(oc->interfaces);
+  oc->interfaces = NULL;
+  oc->interfaces_size = 0;
+  oc->interfaces_count = 0;
+  free(oc->links);
+  oc->links = NULL;
+  oc->links_size = 0;
+  oc->links_count = 0;
+
+  /* We have finished acquiring data once all instances are done. */
+  if (--ol.pending > 0)
+    return;
+
+  nw_module_finish_acquire_data(ol.module, ol.object);
+  /* We have passed object ownership, so remove the reference. */
+  ol.object = NULL;
 }
 
-static void nw_routing_olsr_client_notify_state(struct ustream *s)
+/**
+ * Extracts the needed parts of jsoninfo output as it is being parsed.
+ */
+static void nw_routing_olsr_parse(void *priv,
+                                  enum nw_json_stream_event event,
+                                  const char *path,
+                                  const char *value)
 {
-  if (!s->eof)
-    return;
+  struct olsr_client *oc = (struct olsr_client*) priv;
 
-  nw_routing_olsr_client_close(s);
+  switch (event) {
+    case NW_JSON_STREAM_OBJECT_START: {
+      if (!strcmp(path, "config")) {
+        /* Exported routes. */
+        oc->exported_routes = json_object_new_array();
+        json_object_object_add(oc->object, "exported_routes", oc->exported_routes);
+      } else if (!strcmp(path, "config.hna[]")) {
+        oc->hna_destination[0] = 0;
+        oc->hna_genmask = -1;
+      } else if (!strcmp(path, "interfaces[]")) {
+        oc->iface_name[0] = 0;
+        oc->iface_ipv4[0] = 0;
+        oc->iface_ipv6[0] = 0;
+      } else if (!strcmp(path, "links[]")) {
+        /* Neighbours. */
+        oc->neighbour = json_object_new_object();
+        json_object_array_add(oc->neighbours, oc->neighbour);
+      }
+      break;
+    }
+    case NW_JSON_STREAM_OBJECT_END: {
+      if (!strcmp(path, "config.hna[]")) {
+        if (!oc->hna_destination[0] || oc->hna_genmask < 0 || oc->hna_genmask > 128 || !oc->exported_routes)
+          break;
+
+        /* Maximum address length + prefix size. */
+        char dst_prefix[INET6_ADDRSTRLEN + 4];
+        snprintf(dst_prefix, sizeof(dst_prefix), "%s/%d", oc->hna_destination, oc->hna_genmask);
+
+        json_object *exported_route = json_object_new_object();
+        json_object_object_add(exported_route, "dst_prefix", json_object_new_string(dst_prefix));
+        json_object_array_add(oc->exported_routes, exported_route);
+      } else if (!strcmp(path, "interfaces[]")) {
+        if (!oc->iface_name[0])
+          break;
+
+        nw_routing_olsr_interface_add(oc, oc->iface_ipv4, oc->iface_name);
+        nw_routing_olsr_interface_add(oc, oc->iface_ipv6, oc->iface_name);
+
+        /* MID, IPv6 is used if no IPv4 address is set. */
+        const char *address = oc->iface_ipv4[0] ? oc->iface_ipv4 : oc->iface_ipv6;
+        if (!address[0])
+          break;
+
+        char address_interface[INET6_ADDRSTRLEN + 1 + IFNAMSIZ];
+        snprintf(address_interface, sizeof(address_interface), "%s%%%s", address, oc->iface_name);
+        json_object_array_add(oc->link_local, json_object_new_string(address_interface));
+      } else if (!strcmp(path, "links[]")) {
+        oc->neighbour = NULL;
+      }
+      break;
+    }
+    case NW_JSON_STREAM_STRING:
+    case NW_JSON_STREAM_PRIMITIVE: {
+      const char *key = strrchr(path, '.');
+      key = key ? key + 1 : path;
+
+      if (oc->neighbour && !strncmp(path, "links[].", 8) && !strchr(path + 8, '.')) {
+        const char *dst_key = NULL;
+        if (!strcmp(key, "remoteIP"))
+          dst_key = "address";
+        else if (!strcmp(key, "linkQuality"))
+          dst_key = "lq";
+        else if (!strcmp(key, "neighborLinkQuality"))
+          dst_key = "ilq";
+        else if (!strcmp(key, "linkCost"))
+          dst_key = "cost";
+
+        if (dst_key)
+          json_object_object_add(oc->neighbour, dst_key, nw_json_stream_value(event, value));
+        else if (!strcmp(key, "localIP") && event == NW_JSON_STREAM_STRING)
+          nw_routing_olsr_link_add(oc, value);
+      } else if (!strcmp(path, "config.mainIpAddress")) {
+        /* Router identifier. */
+        json_object_object_add(oc->object, "router_id", nw_json_stream_value(event, value));
+      } else if (!strcmp(path, "config.hna[].destination")) {
+        snprintf(oc->hna_destination, sizeof(oc->hna_destination), "%s", value);
+      } else if (!strcmp(path, "config.hna[].genmask")) {
+        oc->hna_genmask = atoi(value);
+      } else if (!strcmp(path, "interfaces[].nameFromKernel")) {
+        snprintf(oc->iface_name, sizeof(oc->iface_name), "%s", value);
+      } else if (!strcmp(path, "interfaces[].ipv4Address")) {
+        snprintf(oc->iface_ipv4, sizeof(oc->iface_ipv4), "%s", value);
+      } else if (!strcmp(path, "interfaces[].ipv6Address")) {
+        snprintf(oc->iface_ipv6, sizeof(oc->iface_ipv6), "%s", value);
+      }
+      break;
+    }
+    default: break;
+  }
 }
 
-static void nw_routing_olsr_client_callback(struct uloop_fd *fd, unsigned int events)
+static void nw_routing_olsr_client_start(struct olsr_client *oc, json_object *object)
 {
-  if (fd->eof || fd->error) {
-    syslog(LOG_WARNING, "routing-olsr: Failed to connect to local OLSR instance.");
-    nw_routing_olsr_client_close(&oc.stream.stream);
+  oc->object = object;
+  oc->exported_routes = NULL;
+  oc->neighbour = NULL;
+  oc->link_local = json_object_new_array();
+  json_object_object_add(object, "link_local", oc->link_local);
+  oc->neighbours = json_object_new_array();
+  json_object_object_add(object, "neighbours", oc->neighbours);
+  nw_json_stream_init(&oc->session.parser, nw_routing_olsr_parse, oc);
+
+  /* Request the configuration, interfaces and links from olsrd jsoninfo. */
+  if (nw_stream_client_connect(&oc->session) < 0) {
+    syslog(LOG_WARNING, "routing-olsr: Failed to connect to OLSR instance '%s'.", oc->session.endpoint.name);
     return;
   }
 
-  /* Connection has been established, prepare the stream. */
-  uloop_fd_delete(&oc.client);
-  oc.stream.stream.string_data = true;
-  oc.stream.stream.notify_read = nw_routing_olsr_client_read;
-  oc.stream.stream.notify_state = nw_routing_olsr_client_notify_state;
-  ustream_fd_init(&oc.stream, oc.client.fd);
-
-  /* Send the request. */
-  ustream_printf(&oc.stream.stream, "/config/interfaces/links\n");
+  ol.pending++;
 }
 
 static int nw_routing_olsr_start_acquire_data(struct nodewatcher_module *module,
@@ -253,27 +357,35 @@ static int nw_routing_olsr_start_acquire_data(struct nodewatcher_module *module,
                                                struct uci_context *uci)
 {
   /* Ignore new requests if previous ones did not complete yet. */
-  if (!oc.ready)
+  if (ol.pending)
     return -1;
 
-  oc.object = json_object_new_object();
-  oc.jstok = json_tokener_new();
+  ol.object = json_object_new_object();
 
-  /* Open a connection to the olsrd jsoninfo socket. */
-  /* TODO: We currently assume the local server to be running on 127.0.0.1:9090. */
-  oc.client.cb = nw_routing_olsr_client_callback;
-  oc.client.fd = usock(USOCK_TCP | USOCK_NUMERIC | USOCK_NONBLOCK, "127.0.0.1", "9090");
-  if (oc.client.fd < 0) {
-    syslog(LOG_WARNING, "routing-olsr: Failed to connect to local OLSR instance.");
-    return nw_module_finish_acquire_data(module, oc.object);
+  /* With multiple instances, their data is reported under instance names. */
+  json_object *instances_object = NULL;
+  if (ol.num_instances > 1) {
+    instances_object = json_object_new_object();
+    json_object_object_add(ol.object, "instances", instances_object);
   }
 
-  oc.ready = false;
-  uloop_fd_add(&oc.client, ULOOP_WRITE);
+  /* All instances are queried in parallel. */
+  for (int i = 0; i < ol.num_instances; i++) {
+    struct olsr_client *oc = &ol.instances[i];
+    json_object *instance = ol.object;
+    if (instances_object) {
+      instance = json_object_new_object();
+      json_object_object_add(instances_object, oc->session.endpoint.name, instance);
+    }
 
-  /* Start a timer that will abort data retrieval. */
-  oc.timer.cb = nw_routing_olsr_client_timeout;
-  uloop_timeout_set(&oc.timer, 5000);
+    nw_routing_olsr_client_start(oc, instance);
+  }
+
+  if (!ol.pending) {
+    json_object *object = ol.object;
+    ol.object = NULL;
+    return nw_module_finish_acquire_data(module, object);
+  }
 
   return 0;
 }
@@ -282,10 +394,28 @@ static int nw_routing_olsr_init(struct nodewatcher_module *module,
                                  struct ubus_context *ubus,
                                  struct uci_context *uci)
 {
-  /* Initialize the client structure. */
-  oc.ready = true;
-  oc.module = module;
+  struct nw_endpoint *endpoints;
+  ol.module = module;
+  ol.num_instances = nw_uci_get_endpoints(uci, "routing_olsr", "127.0.0.1", "9090", OLSR_TIMEOUT, &endpoints);
+  if (ol.num_instances < 0)
+    return -1;
+
+  ol.instances = calloc(ol.num_instances, sizeof(struct olsr_client));
+  if (!ol.instances) {
+    free(endpoints);
+    return -1;
+  }
+
+  /* Initialize the client structures. */
+  for (int i = 0; i < ol.num_instances; i++) {
+    struct olsr_client *oc = &ol.instances[i];
+    nw_stream_client_init(&oc->session, &endpoints[i], NW_STREAM_CLIENT_JSON);
+    oc->session.max_bytes = OLSR_MAX_RESPONSE;
+    oc->session.request = "/config/interfaces/links\n";
+    oc->session.closed = nw_routing_olsr_session_closed;
+  }
 
+  free(endpoints);
   return 0;
 }
 
@@ -293,7 +423,7 @@ static int nw_routing_olsr_init(struct nodewatcher_module *module,
 struct nodewatcher_module nw_module = {
   .name = "core.routing.olsr",
   .author = "Jernej Kos <jernej@kos.mx>",
-  .version = 1,
+  .version = 4,
   .hooks = {
     .init               = nw_routing_olsr_init,
     .start_acquire_data = nw_routing_olsr_start_acquire_data,
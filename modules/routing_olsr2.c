@@ -0,0 +1,281 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <nodewatcher-agent/module.h>
+#include <nodewatcher-agent/json.h>
+#include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/stream_client.h>
+
+#include <libubox/uloop.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <net/if.h>
+
+/* Default request timeout (in milliseconds) */
+#define OLSR2_TIMEOUT 5000
+/* Maximum size of a telnet response (in bytes) */
+#define OLSR2_MAX_RESPONSE (4 * 1024 * 1024)
+
+struct olsr2_client {
+  /* Request session. */
+  struct nw_stream_client session;
+  /* Result object. */
+  json_object *object;
+  /* Result arrays. */
+  json_object *exported_routes;
+  json_object *neighbours;
+  /* Currently parsed neighbour. */
+  json_object *neighbour;
+  /* Router identifier (originator address). */
+  char router_id[INET6_ADDRSTRLEN];
+  /* Currently parsed attached network. */
+  char lan_node[INET6_ADDRSTRLEN];
+  char lan_prefix[INET6_ADDRSTRLEN + 4];
+  json_object *lan_metric;
+};
+
+/* OLSRv2 client instances. */
+static struct {
+  /* Module reference. */
+  struct nodewatcher_module *module;
+  /* Client instances. */
+  struct olsr2_client *instances;
+  int num_instances;
+  /* Number of instances with requests in progress. */
+  int pending;
+  /* Result object. */
+  json_object *object;
+} ol2;
+
+static void nw_routing_olsr2_session_closed(struct nw_stream_client *client)
+{
+  struct olsr2_client *oc = container_of(client, struct olsr2_client, session);
+  switch (client->status) {
+    case NW_STREAM_CLIENT_CONNECT_FAILED: {
+      syslog(LOG_WARNING, "routing-olsr2: Failed to connect to OLSRv2 instance '%s'.", client->endpoint.name);
+      break;
+    }
+    case NW_STREAM_CLIENT_TIMEOUT: {
+      syslog(LOG_WARNING, "routing-olsr2: Connection with OLSRv2 instance '%s' timed out.", client->endpoint.name);
+      break;
+    }
+    case NW_STREAM_CLIENT_PARSE_ERROR: {
+      syslog(LOG_WARNING, "routing-olsr2: Parse error while processing telnet output.");
+      break;
+    }
+    /* The session normally ends with the daemon closing the connection. */
+    default: break;
+  }
+
+  json_object_object_add(oc->object, "session", nw_stream_client_get_stats(client));
+  json_object_put(oc->lan_metric);
+  oc->lan_metric = NULL;
+
+  /* We have finished acquiring data once all instances are done. */
+  if (--ol2.pending > 0)
+    return;
+
+  nw_module_finish_acquire_data(ol2.module, ol2.object);
+  /* We have passed object ownership, so remove the reference. */
+  ol2.object = NULL;
+}
+
+/**
+ * Extracts the needed parts of olsrd2 telnet output as it is being parsed.
+ * Each command produces a separate JSON document.
+ */
+static void nw_routing_olsr2_parse(void *priv,
+                                   enum nw_json_stream_event event,
+                                   const char *path,
+                                   const char *value)
+{
+  struct olsr2_client *oc = (struct olsr2_client*) priv;
+
+  switch (event) {
+    case NW_JSON_STREAM_OBJECT_START: {
+      if (!strcmp(path, "link[]")) {
+        /* Neighbours. */
+        oc->neighbour = json_object_new_object();
+        json_object_array_add(oc->neighbours, oc->neighbour);
+      } else if (!strcmp(path, "lan[]")) {
+        oc->lan_node[0] = 0;
+        oc->lan_prefix[0] = 0;
+        json_object_put(oc->lan_metric);
+        oc->lan_metric = NULL;
+      }
+      break;
+    }
+    case NW_JSON_STREAM_OBJECT_END: {
+      if (!strcmp(path, "link[]")) {
+        oc->neighbour = NULL;
+      } else if (!strcmp(path, "lan[]")) {
+        /* Only networks attached to this router are exported routes. */
+        if (!oc->lan_prefix[0] || !oc->router_id[0] || strcmp(oc->lan_node, oc->router_id) != 0)
+          break;
+
+        json_object *exported_route = json_object_new_object();
+        json_object_object_add(exported_route, "dst_prefix", json_object_new_string(oc->lan_prefix));
+        if (oc->lan_metric) {
+          json_object_object_add(exported_route, "metric", oc->lan_metric);
+          oc->lan_metric = NULL;
+        }
+        json_object_array_add(oc->exported_routes, exported_route);
+      }
+      break;
+    }
+    case NW_JSON_STREAM_STRING:
+    case NW_JSON_STREAM_PRIMITIVE: {
+      if (oc->neighbour && !strncmp(path, "link[].", 7)) {
+        const char *key = path + 7;
+        const char *dst_key = NULL;
+        if (!strcmp(key, "neighbor_originator"))
+          dst_key = "address";
+        else if (!strcmp(key, "link_bindto"))
+          dst_key = "link_address";
+        else if (!strcmp(key, "if"))
+          dst_key = "interface";
+        else if (!strcmp(key, "link_status"))
+          dst_key = "status";
+        else if (!strcmp(key, "domain_metric_out_raw"))
+          dst_key = "cost";
+
+        if (dst_key)
+          json_object_object_add(oc->neighbour, dst_key, nw_json_stream_value(event, value));
+      } else if (!strcmp(path, "originator[].originator")) {
+        /* Router identifier. */
+        snprintf(oc->router_id, sizeof(oc->router_id), "%s", value);
+        json_object_object_add(oc->object, "router_id", json_object_new_string(value));
+      } else if (!strcmp(path, "lan[].node")) {
+        snprintf(oc->lan_node, sizeof(oc->lan_node), "%s", value);
+      } else if (!strcmp(path, "lan[].lan")) {
+        snprintf(oc->lan_prefix, sizeof(oc->lan_prefix), "%s", value);
+      } else if (!strcmp(path, "lan[].domain_metric_out_raw")) {
+        json_object_put(oc->lan_metric);
+        oc->lan_metric = nw_json_stream_value(event, value);
+      }
+      break;
+    }
+    default: break;
+  }
+}
+
+static void nw_routing_olsr2_client_start(struct olsr2_client *oc, json_object *object)
+{
+  oc->object = object;
+  oc->neighbour = NULL;
+  oc->router_id[0] = 0;
+  oc->exported_routes = json_object_new_array();
+  json_object_object_add(object, "exported_routes", oc->exported_routes);
+  oc->neighbours = json_object_new_array();
+  json_object_object_add(object, "neighbours", oc->neighbours);
+  nw_json_stream_init(&oc->session.parser, nw_routing_olsr2_parse, oc);
+  oc->session.parser.sequence = true;
+
+  /* Open a session with the olsrd2 telnet socket. */
+  if (nw_stream_client_connect(&oc->session) < 0) {
+    syslog(LOG_WARNING, "routing-olsr2: Failed to connect to OLSRv2 instance '%s'.", oc->session.endpoint.name);
+    return;
+  }
+
+  ol2.pending++;
+}
+
+static int nw_routing_olsr2_start_acquire_data(struct nodewatcher_module *module,
+                                               struct ubus_context *ubus,
+                                               struct uci_context *uci)
+{
+  /* Ignore new requests if previous ones did not complete yet. */
+  if (ol2.pending)
+    return -1;
+
+  ol2.object = json_object_new_object();
+
+  /* With multiple instances, their data is reported under instance names. */
+  json_object *instances_object = NULL;
+  if (ol2.num_instances > 1) {
+    instances_object = json_object_new_object();
+    json_object_object_add(ol2.object, "instances", instances_object);
+  }
+
+  /* All instances are queried in parallel. */
+  for (int i = 0; i < ol2.num_instances; i++) {
+    struct olsr2_client *oc = &ol2.instances[i];
+    json_object *instance = ol2.object;
+    if (instances_object) {
+      instance = json_object_new_object();
+      json_object_object_add(instances_object, oc->session.endpoint.name, instance);
+    }
+
+    nw_routing_olsr2_client_start(oc, instance);
+  }
+
+  if (!ol2.pending) {
+    json_object *object = ol2.object;
+    ol2.object = NULL;
+    return nw_module_finish_acquire_data(module, object);
+  }
+
+  return 0;
+}
+
+static int nw_routing_olsr2_init(struct nodewatcher_module *module,
+                                 struct ubus_context *ubus,
+                                 struct uci_context *uci)
+{
+  struct nw_endpoint *endpoints;
+  ol2.module = module;
+  ol2.num_instances = nw_uci_get_endpoints(uci, "routing_olsr2", "127.0.0.1", "2009", OLSR2_TIMEOUT, &endpoints);
+  if (ol2.num_instances < 0)
+    return -1;
+
+  ol2.instances = calloc(ol2.num_instances, sizeof(struct olsr2_client));
+  if (!ol2.instances) {
+    free(endpoints);
+    return -1;
+  }
+
+  /* Initialize the client structures. */
+  for (int i = 0; i < ol2.num_instances; i++) {
+    struct olsr2_client *oc = &ol2.instances[i];
+    nw_stream_client_init(&oc->session, &endpoints[i], NW_STREAM_CLIENT_JSON);
+    oc->session.max_bytes = OLSR2_MAX_RESPONSE;
+    /* The originator is needed to identify local attached networks. */
+    oc->session.request = "/olsrv2info json originator/olsrv2info json lan/nhdpinfo json link/quit\n";
+    oc->session.closed = nw_routing_olsr2_session_closed;
+  }
+
+  free(endpoints);
+  return 0;
+}
+
+/* Module descriptor. */
+struct nodewatcher_module nw_module = {
+  .name = "core.routing.olsr2",
+  .author = "Jernej Kos <jernej@kos.mx>",
+  .version = 2,
+  .hooks = {
+    .init               = nw_routing_olsr2_init,
+    .start_acquire_data = nw_routing_olsr2_start_acquire_data,
+  },
+  .schedule = {
+    .refresh_interval = 30,
+  },
+};
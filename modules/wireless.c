@@ -19,20 +19,21 @@
 #include <nodewatcher-agent/module.h>
 #include <nodewatcher-agent/json.h>
 #include <nodewatcher-agent/utils.h>
+#include <nodewatcher-agent/ubus.h>
+#include <nodewatcher-agent/netlink.h>
+#include <nodewatcher-agent/client_id.h>
 
 #include <uci.h>
 #include <syslog.h>
 #include <iwinfo.h>
 #include <iwinfo/utils.h>
-#include <libubox/md5.h>
-
-#define NW_CLIENT_ID_SALT "nw-client-c3U0XX"
-#define NW_CLIENT_ID_SALT_LENGTH 16
-
-/* Results of last scan survey */
-static json_object *last_scan_survey = NULL;
-/* Number of monitoring intervals */
-static int counter_monitor_intervals = 0;
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/genetlink.h>
+#include <linux/nl80211.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <errno.h>
 
 static void nw_wireless_call_str(json_object *object,
                                  const char *ifname,
@@ -143,6 +144,790 @@ static void nw_wireless_add_encryption(json_object *object,
   json_object_object_add(object, key, encryption);
 }
 
+/* Minimum number of packets for a station to be reported in delta mode */
+#define NW_WIRELESS_DELTA_PACKETS 16
+/* Minimum signal change (in dB) for a station to be reported in delta mode */
+#define NW_WIRELESS_DELTA_SIGNAL 3
+
+/* Persistent record of an associated station */
+struct nw_wireless_station {
+  /* Whether the slot is in use */
+  bool used;
+  /* Interface index */
+  int ifindex;
+  /* Station MAC address */
+  uint8_t mac[ETH_ALEN];
+  /* Acquisition in which the station was last seen */
+  unsigned int generation;
+  /* Cached client identifier */
+  char client_id[NW_CLIENT_ID_LENGTH + 1];
+  /* Values included in the last report (delta mode only) */
+  uint32_t rx_packets;
+  uint32_t tx_packets;
+  uint32_t rx_bytes;
+  uint32_t tx_bytes;
+  uint32_t tx_retries;
+  uint32_t tx_failed;
+  int8_t signal;
+};
+
+/* Open addressing table of stations on all interfaces, keyed by raw MAC */
+static struct {
+  struct nw_wireless_station *stations;
+  size_t size;
+  size_t count;
+  unsigned int generation;
+} wst;
+
+/* Whether only stations with changed counters are reported, with counters as deltas */
+static bool wireless_station_delta = false;
+
+static size_t nw_wireless_station_hash(int ifindex, const uint8_t *mac)
+{
+  size_t hash = ifindex;
+  for (int i = 0; i < ETH_ALEN; i++)
+    hash = hash * 31 + mac[i];
+  return hash;
+}
+
+static struct nw_wireless_station *nw_wireless_station_slot(struct nw_wireless_station *stations,
+                                                            size_t size,
+                                                            int ifindex,
+                                                            const uint8_t *mac)
+{
+  size_t mask = size - 1;
+  for (size_t i = nw_wireless_station_hash(ifindex, mac) & mask;; i = (i + 1) & mask) {
+    struct nw_wireless_station *station = &stations[i];
+    if (!station->used || (station->ifindex == ifindex && memcmp(station->mac, mac, ETH_ALEN) == 0))
+      return station;
+  }
+}
+
+/**
+ * Resizes the station table so that it fits the given number of stations.
+ *
+ * @param count Number of stations to make room for
+ * @return True on success, false on allocation failure
+ */
+static bool nw_wireless_stations_resize(size_t count)
+{
+  size_t size = 64;
+  while (size < count * 2)
+    size *= 2;
+
+  struct nw_wireless_station *stations = calloc(size, sizeof(struct nw_wireless_station));
+  if (!stations)
+    return false;
+
+  for (size_t i = 0; i < wst.size; i++) {
+    struct nw_wireless_station *station = &wst.stations[i];
+    if (station->used)
+      *nw_wireless_station_slot(stations, size, station->ifindex, station->mac) = *station;
+  }
+
+  free(wst.stations);
+  wst.stations = stations;
+  wst.size = size;
+  return true;
+}
+
+/**
+ * Removes a station from the table, moving back later stations of the same
+ * probe sequence so that lookups need no tombstones.
+ *
+ * @param index Slot of the station to remove
+ */
+static void nw_wireless_stations_remove(size_t index)
+{
+  size_t mask = wst.size - 1;
+  size_t hole = index;
+  for (size_t i = (index + 1) & mask; wst.stations[i].used; i = (i + 1) & mask) {
+    struct nw_wireless_station *station = &wst.stations[i];
+    size_t home = nw_wireless_station_hash(station->ifindex, station->mac) & mask;
+    /* Stations may only move towards their home slot */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      wst.stations[hole] = *station;
+      hole = i;
+    }
+  }
+
+  memset(&wst.stations[hole], 0, sizeof(struct nw_wireless_station));
+  wst.count--;
+}
+
+/**
+ * Starts a new acquisition, dropping stations that have disassociated
+ * since the previous one.
+ */
+static void nw_wireless_stations_begin(void)
+{
+  for (size_t i = 0; i < wst.size;) {
+    struct nw_wireless_station *station = &wst.stations[i];
+    /* The slot is checked again as another station may have moved into it */
+    if (station->used && station->generation != wst.generation)
+      nw_wireless_stations_remove(i);
+    else
+      i++;
+  }
+
+  /* Shrink the table only after most stations have disassociated */
+  if (wst.size > 64 && wst.count * 8 < wst.size)
+    nw_wireless_stations_resize(wst.count);
+
+  wst.generation++;
+}
+
+static struct nw_wireless_station *nw_wireless_station_get(int ifindex, const uint8_t *mac, bool *created)
+{
+  if ((wst.count + 1) * 2 > wst.size && !nw_wireless_stations_resize(wst.count + 1))
+    return NULL;
+
+  struct nw_wireless_station *station = nw_wireless_station_slot(wst.stations, wst.size, ifindex, mac);
+  *created = !station->used;
+  if (station->used)
+    return station;
+
+  memset(station, 0, sizeof(*station));
+  if (nw_client_id_from_mac(mac, station->client_id) != 0)
+    return NULL;
+
+  station->used = true;
+  station->ifindex = ifindex;
+  memcpy(station->mac, mac, ETH_ALEN);
+  wst.count++;
+  return station;
+}
+
+static bool nw_wireless_station_changed(struct nw_wireless_station *station,
+                                        struct iwinfo_assoclist_entry *entry)
+{
+  uint32_t packets = (entry->rx_packets - station->rx_packets) + (entry->tx_packets - station->tx_packets);
+  int signal = entry->signal - station->signal;
+
+  return packets >= NW_WIRELESS_DELTA_PACKETS || signal >= NW_WIRELESS_DELTA_SIGNAL ||
+         signal <= -NW_WIRELESS_DELTA_SIGNAL || entry->tx_failed != station->tx_failed;
+}
+
+static void nw_wireless_add_station(json_object *stations,
+                                    struct nw_wireless_station *record,
+                                    struct iwinfo_assoclist_entry *entry)
+{
+  json_object *station = json_object_new_object();
+  json_object_object_add(station, "client_id", json_object_new_string(record->client_id));
+
+  /* In delta mode, counters are reported relative to the previous report */
+  struct nw_wireless_station base = { 0, };
+  if (wireless_station_delta)
+    base = *record;
+
+  json_object_object_add(station, "signal", json_object_new_int(entry->signal));
+  json_object_object_add(station, "noise", json_object_new_int(entry->noise));
+  json_object_object_add(station, "inactive", json_object_new_int(entry->inactive));
+
+  json_object *rx = json_object_new_object();
+  json_object_object_add(rx, "rate", json_object_new_int(entry->rx_rate.rate));
+  json_object_object_add(rx, "mcs", json_object_new_int(entry->rx_rate.mcs));
+  json_object_object_add(rx, "40mhz", json_object_new_boolean(entry->rx_rate.is_40mhz));
+  json_object_object_add(rx, "short_gi", json_object_new_boolean(entry->rx_rate.is_short_gi));
+  json_object_object_add(rx, "packets", json_object_new_int64((uint32_t) (entry->rx_packets - base.rx_packets)));
+  json_object_object_add(rx, "bytes", json_object_new_int64((uint32_t) (entry->rx_bytes - base.rx_bytes)));
+  json_object_object_add(station, "rx", rx);
+
+  json_object *tx = json_object_new_object();
+  json_object_object_add(tx, "rate", json_object_new_int(entry->tx_rate.rate));
+  json_object_object_add(tx, "mcs", json_object_new_int(entry->tx_rate.mcs));
+  json_object_object_add(tx, "40mhz", json_object_new_boolean(entry->tx_rate.is_40mhz));
+  json_object_object_add(tx, "short_gi", json_object_new_boolean(entry->tx_rate.is_short_gi));
+  json_object_object_add(tx, "packets", json_object_new_int64((uint32_t) (entry->tx_packets - base.tx_packets)));
+  json_object_object_add(tx, "bytes", json_object_new_int64((uint32_t) (entry->tx_bytes - base.tx_bytes)));
+  json_object_object_add(tx, "retries", json_object_new_int64((uint32_t) (entry->tx_retries - base.tx_retries)));
+  json_object_object_add(tx, "failed", json_object_new_int64((uint32_t) (entry->tx_failed - base.tx_failed)));
+  json_object_object_add(station, "tx", tx);
+
+  json_object_object_add(station, "authorized", json_object_new_boolean(entry->is_authorized));
+  json_object_object_add(station, "authenticated", json_object_new_boolean(entry->is_authenticated));
+  json_object_object_add(station, "preamble_short", json_object_new_boolean(entry->is_preamble_short));
+  json_object_object_add(station, "wme", json_object_new_boolean(entry->is_wme));
+  json_object_object_add(station, "mfp", json_object_new_boolean(entry->is_mfp));
+  json_object_object_add(station, "tdls", json_object_new_boolean(entry->is_tdls));
+
+  json_object_array_add(stations, station);
+}
+
+static void nw_wireless_add_stations(json_object *interface,
+                                     int ifindex,
+                                     struct iwinfo_assoclist_entry *entries,
+                                     size_t count)
+{
+  json_object *stations = json_object_new_array();
+  json_object *unchanged = NULL;
+  if (wireless_station_delta)
+    unchanged = json_object_new_array();
+
+  for (size_t i = 0; i < count; i++) {
+    struct iwinfo_assoclist_entry *entry = &entries[i];
+    bool created;
+    struct nw_wireless_station *station = nw_wireless_station_get(ifindex, entry->mac, &created);
+    if (!station)
+      continue;
+
+    station->generation = wst.generation;
+    if (!wireless_station_delta) {
+      nw_wireless_add_station(stations, station, entry);
+      continue;
+    }
+
+    /* Stations without meaningful changes are only listed by their identifier */
+    if (!created && !nw_wireless_station_changed(station, entry)) {
+      json_object_array_add(unchanged, json_object_new_string(station->client_id));
+      continue;
+    }
+
+    nw_wireless_add_station(stations, station, entry);
+    station->rx_packets = entry->rx_packets;
+    station->tx_packets = entry->tx_packets;
+    station->rx_bytes = entry->rx_bytes;
+    station->tx_bytes = entry->tx_bytes;
+    station->tx_retries = entry->tx_retries;
+    station->tx_failed = entry->tx_failed;
+    station->signal = entry->signal;
+  }
+
+  json_object_object_add(interface, "stations", stations);
+  if (unchanged)
+    json_object_object_add(interface, "stations_unchanged", unchanged);
+}
+
+static void nw_wireless_add_protocols(json_object *object, int modes)
+{
+  json_object *protocols = json_object_new_array();
+  if (modes & IWINFO_80211_A)
+    json_object_array_add(protocols, json_object_new_string("a"));
+  if (modes & IWINFO_80211_B)
+    json_object_array_add(protocols, json_object_new_string("b"));
+  if (modes & IWINFO_80211_G)
+    json_object_array_add(protocols, json_object_new_string("g"));
+  if (modes & IWINFO_80211_N)
+    json_object_array_add(protocols, json_object_new_string("n"));
+  json_object_object_add(object, "protocols", protocols);
+}
+
+/* Wireless data backends */
+enum {
+  NW_WIRELESS_BACKEND_NL80211,
+  NW_WIRELESS_BACKEND_IWINFO,
+};
+
+/* Configured wireless data backend */
+static int wireless_backend = NW_WIRELESS_BACKEND_NL80211;
+
+/* Wireless PHY as reported by NL80211_CMD_GET_WIPHY */
+struct nw_wireless_phy {
+  /* PHY index */
+  uint32_t wiphy;
+  /* PHY name */
+  char name[32];
+  /* Supported protocols (IWINFO_80211_*) */
+  int hwmodes;
+};
+
+/* Wireless interface as reported by NL80211_CMD_GET_INTERFACE */
+struct nw_wireless_iface {
+  /* Interface index */
+  int ifindex;
+  /* Interface name */
+  char name[IFNAMSIZ];
+  /* PHY index */
+  uint32_t wiphy;
+  /* Interface type (NL80211_IFTYPE_*) */
+  uint32_t iftype;
+  /* Hardware address */
+  uint8_t mac[ETH_ALEN];
+  /* SSID (empty when not available) */
+  char ssid[33];
+  /* Operating frequency in MHz or zero */
+  uint32_t frequency;
+  /* Transmit power in mBm */
+  int32_t txpower;
+  bool has_txpower;
+  /* Noise floor of the operating channel */
+  int8_t noise;
+  bool has_noise;
+  /* Associated stations (index into the station table and count) */
+  size_t first_station;
+  size_t num_stations;
+};
+
+/* Maximum number of cached PHYs */
+#define NW_WIRELESS_MAX_PHYS 16
+
+/**
+ * Results of the nl80211 dumps. A single generic netlink socket is kept
+ * open and the tables are reused between runs.
+ */
+struct nw_wireless_nl80211 {
+  /* Generic netlink socket */
+  struct nw_netlink nl;
+  /* Family identifier of nl80211 */
+  uint16_t family;
+  /* PHYs (cached as their capabilities do not change) */
+  struct nw_wireless_phy phys[NW_WIRELESS_MAX_PHYS];
+  size_t num_phys;
+  /* Interfaces */
+  struct nw_wireless_iface *ifaces;
+  size_t ifaces_size;
+  size_t num_ifaces;
+  /* Stations of all interfaces */
+  struct iwinfo_assoclist_entry *stations;
+  size_t stations_size;
+  size_t num_stations;
+  /* Regulatory domain */
+  char country[3];
+};
+
+/* nl80211 backend state */
+static struct nw_wireless_nl80211 wnl = { .nl = { .fd = -1, }, };
+
+/* Generic netlink request with room for a few attributes */
+struct nw_wireless_nl80211_request {
+  struct nlmsghdr hdr;
+  struct genlmsghdr genl;
+  char attrs[64];
+};
+
+static void nw_wireless_nl80211_prepare(struct nw_wireless_nl80211_request *req,
+                                        uint8_t cmd,
+                                        int flags)
+{
+  memset(req, 0, sizeof(*req));
+  req->hdr.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  req->hdr.nlmsg_type = wnl.family;
+  req->hdr.nlmsg_flags = flags;
+  req->genl.cmd = cmd;
+}
+
+static void nw_wireless_nl80211_parse(struct nlattr **tb, struct nlmsghdr *hdr)
+{
+  nw_netlink_parse_attrs(tb, NL80211_ATTR_MAX, (char*) NLMSG_DATA(hdr) + GENL_HDRLEN,
+    hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
+
+static struct nw_wireless_phy *nw_wireless_nl80211_find_phy(uint32_t wiphy)
+{
+  for (size_t i = 0; i < wnl.num_phys; i++) {
+    if (wnl.phys[i].wiphy == wiphy)
+      return &wnl.phys[i];
+  }
+
+  return NULL;
+}
+
+static bool nw_wireless_nl80211_phy_in_use(uint32_t wiphy)
+{
+  for (size_t i = 0; i < wnl.num_ifaces; i++) {
+    if (wnl.ifaces[i].wiphy == wiphy)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * Drops cached PHYs without any interfaces. PHYs get a new index whenever
+ * they reappear (for example after a driver reload), so the cache would
+ * otherwise fill up with PHYs that no longer exist.
+ */
+static void nw_wireless_nl80211_prune_phys(void)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < wnl.num_phys; i++) {
+    if (nw_wireless_nl80211_phy_in_use(wnl.phys[i].wiphy))
+      wnl.phys[count++] = wnl.phys[i];
+  }
+
+  wnl.num_phys = count;
+}
+
+static int nw_wireless_nl80211_parse_phy(struct nlmsghdr *hdr, void *priv)
+{
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (!tb[NL80211_ATTR_WIPHY])
+    return 0;
+
+  /* Split dumps report a single PHY in multiple messages */
+  uint32_t wiphy = nw_nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+  struct nw_wireless_phy *phy = nw_wireless_nl80211_find_phy(wiphy);
+  if (!phy) {
+    /* Only PHYs with interfaces are cached */
+    if (wnl.num_phys >= NW_WIRELESS_MAX_PHYS || !nw_wireless_nl80211_phy_in_use(wiphy))
+      return 0;
+
+    phy = &wnl.phys[wnl.num_phys++];
+    memset(phy, 0, sizeof(*phy));
+    phy->wiphy = wiphy;
+    snprintf(phy->name, sizeof(phy->name), "phy%u", wiphy);
+  }
+
+  if (tb[NL80211_ATTR_WIPHY_NAME])
+    snprintf(phy->name, sizeof(phy->name), "%s", (char*) nw_nla_data(tb[NL80211_ATTR_WIPHY_NAME]));
+
+  if (tb[NL80211_ATTR_WIPHY_BANDS]) {
+    struct nlattr *band;
+    int rem;
+    nw_nla_for_each_nested(band, tb[NL80211_ATTR_WIPHY_BANDS], rem) {
+      switch (band->nla_type & NLA_TYPE_MASK) {
+        case NL80211_BAND_2GHZ: phy->hwmodes |= IWINFO_80211_B | IWINFO_80211_G; break;
+        case NL80211_BAND_5GHZ: phy->hwmodes |= IWINFO_80211_A; break;
+      }
+
+      struct nlattr *tb_band[NL80211_BAND_ATTR_MAX + 1];
+      nw_netlink_parse_attrs(tb_band, NL80211_BAND_ATTR_MAX, nw_nla_data(band), nw_nla_len(band));
+      if (tb_band[NL80211_BAND_ATTR_HT_CAPA])
+        phy->hwmodes |= IWINFO_80211_N;
+    }
+  }
+
+  return 0;
+}
+
+static int nw_wireless_nl80211_parse_iface(struct nlmsghdr *hdr, void *priv)
+{
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (!tb[NL80211_ATTR_IFINDEX] || !tb[NL80211_ATTR_IFNAME] || !tb[NL80211_ATTR_WIPHY])
+    return 0;
+
+  if (wnl.num_ifaces >= wnl.ifaces_size) {
+    size_t size = wnl.ifaces_size ? wnl.ifaces_size * 2 : 8;
+    struct nw_wireless_iface *ifaces = realloc(wnl.ifaces, size * sizeof(*ifaces));
+    if (!ifaces)
+      return -1;
+
+    wnl.ifaces = ifaces;
+    wnl.ifaces_size = size;
+  }
+
+  struct nw_wireless_iface *iface = &wnl.ifaces[wnl.num_ifaces++];
+  memset(iface, 0, sizeof(*iface));
+  iface->ifindex = nw_nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+  snprintf(iface->name, sizeof(iface->name), "%s", (char*) nw_nla_data(tb[NL80211_ATTR_IFNAME]));
+  iface->wiphy = nw_nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+
+  if (tb[NL80211_ATTR_IFTYPE])
+    iface->iftype = nw_nla_get_u32(tb[NL80211_ATTR_IFTYPE]);
+  if (tb[NL80211_ATTR_MAC] && nw_nla_len(tb[NL80211_ATTR_MAC]) >= ETH_ALEN)
+    memcpy(iface->mac, nw_nla_data(tb[NL80211_ATTR_MAC]), ETH_ALEN);
+  if (tb[NL80211_ATTR_SSID]) {
+    int length = nw_nla_len(tb[NL80211_ATTR_SSID]);
+    if (length > (int) sizeof(iface->ssid) - 1)
+      length = sizeof(iface->ssid) - 1;
+    memcpy(iface->ssid, nw_nla_data(tb[NL80211_ATTR_SSID]), length);
+  }
+  if (tb[NL80211_ATTR_WIPHY_FREQ])
+    iface->frequency = nw_nla_get_u32(tb[NL80211_ATTR_WIPHY_FREQ]);
+  if (tb[NL80211_ATTR_WIPHY_TX_POWER_LEVEL]) {
+    iface->txpower = (int32_t) nw_nla_get_u32(tb[NL80211_ATTR_WIPHY_TX_POWER_LEVEL]);
+    iface->has_txpower = true;
+  }
+
+  return 0;
+}
+
+static void nw_wireless_nl80211_parse_rate(struct nlattr *attr, struct iwinfo_rate_entry *rate)
+{
+  struct nlattr *tb[NL80211_RATE_INFO_MAX + 1];
+  nw_netlink_parse_attrs(tb, NL80211_RATE_INFO_MAX, nw_nla_data(attr), nw_nla_len(attr));
+
+  /* Rates are reported in units of 100 kbit/s, iwinfo uses kbit/s */
+  if (tb[NL80211_RATE_INFO_BITRATE32])
+    rate->rate = nw_nla_get_u32(tb[NL80211_RATE_INFO_BITRATE32]) * 100;
+  else if (tb[NL80211_RATE_INFO_BITRATE])
+    rate->rate = nw_nla_get_u16(tb[NL80211_RATE_INFO_BITRATE]) * 100;
+
+  if (tb[NL80211_RATE_INFO_MCS])
+    rate->mcs = nw_nla_get_u8(tb[NL80211_RATE_INFO_MCS]);
+  rate->is_40mhz = tb[NL80211_RATE_INFO_40_MHZ_WIDTH] != NULL;
+  rate->is_short_gi = tb[NL80211_RATE_INFO_SHORT_GI] != NULL;
+}
+
+static int nw_wireless_nl80211_parse_station(struct nlmsghdr *hdr, void *priv)
+{
+  struct nw_wireless_iface *iface = (struct nw_wireless_iface*) priv;
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (!tb[NL80211_ATTR_MAC] || nw_nla_len(tb[NL80211_ATTR_MAC]) < ETH_ALEN || !tb[NL80211_ATTR_STA_INFO])
+    return 0;
+
+  if (wnl.num_stations >= wnl.stations_size) {
+    size_t size = wnl.stations_size ? wnl.stations_size * 2 : 32;
+    struct iwinfo_assoclist_entry *stations = realloc(wnl.stations, size * sizeof(*stations));
+    if (!stations)
+      return -1;
+
+    wnl.stations = stations;
+    wnl.stations_size = size;
+  }
+
+  struct iwinfo_assoclist_entry *entry = &wnl.stations[wnl.num_stations++];
+  iface->num_stations++;
+  memset(entry, 0, sizeof(*entry));
+  memcpy(entry->mac, nw_nla_data(tb[NL80211_ATTR_MAC]), ETH_ALEN);
+
+  struct nlattr *sinfo[NL80211_STA_INFO_MAX + 1];
+  nw_netlink_parse_attrs(sinfo, NL80211_STA_INFO_MAX, nw_nla_data(tb[NL80211_ATTR_STA_INFO]),
+    nw_nla_len(tb[NL80211_ATTR_STA_INFO]));
+
+  if (sinfo[NL80211_STA_INFO_SIGNAL])
+    entry->signal = (int8_t) nw_nla_get_u8(sinfo[NL80211_STA_INFO_SIGNAL]);
+  if (sinfo[NL80211_STA_INFO_INACTIVE_TIME])
+    entry->inactive = nw_nla_get_u32(sinfo[NL80211_STA_INFO_INACTIVE_TIME]);
+  if (sinfo[NL80211_STA_INFO_RX_PACKETS])
+    entry->rx_packets = nw_nla_get_u32(sinfo[NL80211_STA_INFO_RX_PACKETS]);
+  if (sinfo[NL80211_STA_INFO_TX_PACKETS])
+    entry->tx_packets = nw_nla_get_u32(sinfo[NL80211_STA_INFO_TX_PACKETS]);
+  if (sinfo[NL80211_STA_INFO_RX_BYTES])
+    entry->rx_bytes = nw_nla_get_u32(sinfo[NL80211_STA_INFO_RX_BYTES]);
+  if (sinfo[NL80211_STA_INFO_TX_BYTES])
+    entry->tx_bytes = nw_nla_get_u32(sinfo[NL80211_STA_INFO_TX_BYTES]);
+  if (sinfo[NL80211_STA_INFO_TX_RETRIES])
+    entry->tx_retries = nw_nla_get_u32(sinfo[NL80211_STA_INFO_TX_RETRIES]);
+  if (sinfo[NL80211_STA_INFO_TX_FAILED])
+    entry->tx_failed = nw_nla_get_u32(sinfo[NL80211_STA_INFO_TX_FAILED]);
+  if (sinfo[NL80211_STA_INFO_RX_BITRATE])
+    nw_wireless_nl80211_parse_rate(sinfo[NL80211_STA_INFO_RX_BITRATE], &entry->rx_rate);
+  if (sinfo[NL80211_STA_INFO_TX_BITRATE])
+    nw_wireless_nl80211_parse_rate(sinfo[NL80211_STA_INFO_TX_BITRATE], &entry->tx_rate);
+
+  if (sinfo[NL80211_STA_INFO_STA_FLAGS] &&
+      nw_nla_len(sinfo[NL80211_STA_INFO_STA_FLAGS]) >= (int) sizeof(struct nl80211_sta_flag_update)) {
+    struct nl80211_sta_flag_update *flags = nw_nla_data(sinfo[NL80211_STA_INFO_STA_FLAGS]);
+    uint32_t set = flags->mask & flags->set;
+    entry->is_authorized = !!(set & (1 << NL80211_STA_FLAG_AUTHORIZED));
+    entry->is_authenticated = !!(set & (1 << NL80211_STA_FLAG_AUTHENTICATED));
+    entry->is_preamble_short = !!(set & (1 << NL80211_STA_FLAG_SHORT_PREAMBLE));
+    entry->is_wme = !!(set & (1 << NL80211_STA_FLAG_WME));
+    entry->is_mfp = !!(set & (1 << NL80211_STA_FLAG_MFP));
+    entry->is_tdls = !!(set & (1 << NL80211_STA_FLAG_TDLS_PEER));
+  }
+
+  return 0;
+}
+
+static int nw_wireless_nl80211_parse_survey(struct nlmsghdr *hdr, void *priv)
+{
+  struct nw_wireless_iface *iface = (struct nw_wireless_iface*) priv;
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (!tb[NL80211_ATTR_SURVEY_INFO])
+    return 0;
+
+  struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+  nw_netlink_parse_attrs(sinfo, NL80211_SURVEY_INFO_MAX, nw_nla_data(tb[NL80211_ATTR_SURVEY_INFO]),
+    nw_nla_len(tb[NL80211_ATTR_SURVEY_INFO]));
+
+  /* Only the channel that is currently in use is relevant */
+  if (sinfo[NL80211_SURVEY_INFO_IN_USE] && sinfo[NL80211_SURVEY_INFO_NOISE]) {
+    iface->noise = (int8_t) nw_nla_get_u8(sinfo[NL80211_SURVEY_INFO_NOISE]);
+    iface->has_noise = true;
+  }
+
+  return 0;
+}
+
+static int nw_wireless_nl80211_parse_reg(struct nlmsghdr *hdr, void *priv)
+{
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (tb[NL80211_ATTR_REG_ALPHA2] && nw_nla_len(tb[NL80211_ATTR_REG_ALPHA2]) >= 2)
+    memcpy(wnl.country, nw_nla_data(tb[NL80211_ATTR_REG_ALPHA2]), 2);
+
+  return 0;
+}
+
+static int nw_wireless_nl80211_iface_request(uint8_t cmd,
+                                             int flags,
+                                             struct nw_wireless_iface *iface,
+                                             nw_netlink_cb cb)
+{
+  struct nw_wireless_nl80211_request req;
+  uint32_t ifindex = iface->ifindex;
+  nw_wireless_nl80211_prepare(&req, cmd, flags);
+  nw_netlink_put_attr(&req.hdr, sizeof(req), NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+  return nw_netlink_request(&wnl.nl, &req.hdr, cb, iface);
+}
+
+/**
+ * Dumps all wireless interfaces together with their stations and noise
+ * levels over the shared nl80211 socket.
+ *
+ * @return True on success, false on failure
+ */
+static bool nw_wireless_nl80211_dump(void)
+{
+  struct nw_wireless_nl80211_request req;
+
+  wnl.num_ifaces = 0;
+  wnl.num_stations = 0;
+  memset(wnl.country, 0, sizeof(wnl.country));
+
+  nw_wireless_nl80211_prepare(&req, NL80211_CMD_GET_INTERFACE, NLM_F_DUMP);
+  if (nw_netlink_request(&wnl.nl, &req.hdr, nw_wireless_nl80211_parse_iface, NULL) != 0) {
+    syslog(LOG_WARNING, "wireless: Failed to dump wireless interfaces via nl80211!");
+    return false;
+  }
+
+  /* PHY capabilities only need to be requested when a new PHY appears */
+  nw_wireless_nl80211_prune_phys();
+  for (size_t i = 0; i < wnl.num_ifaces; i++) {
+    if (nw_wireless_nl80211_find_phy(wnl.ifaces[i].wiphy))
+      continue;
+
+    nw_wireless_nl80211_prepare(&req, NL80211_CMD_GET_WIPHY, NLM_F_DUMP);
+    nw_netlink_put_attr(&req.hdr, sizeof(req), NL80211_ATTR_SPLIT_WIPHY_DUMP, NULL, 0);
+    if (nw_netlink_request(&wnl.nl, &req.hdr, nw_wireless_nl80211_parse_phy, NULL) != 0)
+      syslog(LOG_WARNING, "wireless: Failed to dump wireless PHYs via nl80211!");
+    break;
+  }
+
+  nw_wireless_nl80211_prepare(&req, NL80211_CMD_GET_REG, 0);
+  nw_netlink_request(&wnl.nl, &req.hdr, nw_wireless_nl80211_parse_reg, NULL);
+
+  for (size_t i = 0; i < wnl.num_ifaces; i++) {
+    struct nw_wireless_iface *iface = &wnl.ifaces[i];
+    if (iface->iftype == NL80211_IFTYPE_MONITOR)
+      continue;
+
+    iface->first_station = wnl.num_stations;
+    nw_wireless_nl80211_iface_request(NL80211_CMD_GET_STATION, NLM_F_DUMP, iface,
+      nw_wireless_nl80211_parse_station);
+    nw_wireless_nl80211_iface_request(NL80211_CMD_GET_SURVEY, NLM_F_DUMP, iface,
+      nw_wireless_nl80211_parse_survey);
+  }
+
+  return true;
+}
+
+static struct nw_wireless_iface *nw_wireless_nl80211_find_iface(const char *ifname)
+{
+  for (size_t i = 0; i < wnl.num_ifaces; i++) {
+    if (strcmp(wnl.ifaces[i].name, ifname) == 0)
+      return &wnl.ifaces[i];
+  }
+
+  return NULL;
+}
+
+static int nw_wireless_nl80211_opmode(uint32_t iftype)
+{
+  switch (iftype) {
+    case NL80211_IFTYPE_ADHOC: return IWINFO_OPMODE_ADHOC;
+    case NL80211_IFTYPE_STATION: return IWINFO_OPMODE_CLIENT;
+    case NL80211_IFTYPE_AP: return IWINFO_OPMODE_MASTER;
+    case NL80211_IFTYPE_AP_VLAN: return IWINFO_OPMODE_AP_VLAN;
+    case NL80211_IFTYPE_WDS: return IWINFO_OPMODE_WDS;
+    case NL80211_IFTYPE_MONITOR: return IWINFO_OPMODE_MONITOR;
+    case NL80211_IFTYPE_MESH_POINT: return IWINFO_OPMODE_MESHPOINT;
+    case NL80211_IFTYPE_P2P_CLIENT: return IWINFO_OPMODE_P2P_CLIENT;
+    case NL80211_IFTYPE_P2P_GO: return IWINFO_OPMODE_P2P_GO;
+    default: return IWINFO_OPMODE_UNKNOWN;
+  }
+}
+
+static int nw_wireless_nl80211_channel(uint32_t frequency)
+{
+  if (frequency == 2484)
+    return 14;
+  else if (frequency < 2484)
+    return (frequency - 2407) / 5;
+  else if (frequency >= 4910 && frequency <= 4980)
+    return (frequency - 4000) / 5;
+  else if (frequency <= 45000)
+    return (frequency - 5000) / 5;
+  else if (frequency >= 58320 && frequency <= 64800)
+    return (frequency - 56160) / 2160;
+
+  return 0;
+}
+
+static bool nw_wireless_nl80211_process_interface(const char *ifname,
+                                                  json_object *object)
+{
+  struct nw_wireless_iface *iface = nw_wireless_nl80211_find_iface(ifname);
+  if (!iface)
+    return false;
+
+  json_object *interface = json_object_new_object();
+  struct nw_wireless_phy *phy = nw_wireless_nl80211_find_phy(iface->wiphy);
+  if (phy)
+    json_object_object_add(interface, "phy", json_object_new_string(phy->name));
+
+  /* Encryption details are only available from hostapd/wpa_supplicant via iwinfo */
+  const struct iwinfo_ops *iwinfo = iwinfo_backend(ifname);
+
+  if (iface->ssid[0])
+    json_object_object_add(interface, "ssid", json_object_new_string(iface->ssid));
+  else if (iwinfo)
+    nw_wireless_call_str(interface, ifname, "ssid", iwinfo->ssid);
+
+  /* In client mode the only station is the access point */
+  const uint8_t *bssid = iface->mac;
+  if (iface->iftype == NL80211_IFTYPE_STATION) {
+    bssid = NULL;
+    if (iface->num_stations > 0)
+      bssid = wnl.stations[iface->first_station].mac;
+  }
+  if (bssid) {
+    char mac[18];
+    snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X",
+      bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+    json_object_object_add(interface, "bssid", json_object_new_string(mac));
+  }
+
+  if (wnl.country[0])
+    json_object_object_add(interface, "country", json_object_new_string(wnl.country));
+
+  json_object_object_add(interface, "mode",
+    json_object_new_string(IWINFO_OPMODE_NAMES[nw_wireless_nl80211_opmode(iface->iftype)]));
+  if (iface->frequency) {
+    json_object_object_add(interface, "channel", json_object_new_int(nw_wireless_nl80211_channel(iface->frequency)));
+    json_object_object_add(interface, "frequency", json_object_new_int(iface->frequency));
+  }
+  if (iface->has_txpower)
+    json_object_object_add(interface, "txpower", json_object_new_int(iface->txpower / 100));
+
+  /* Signal and bitrate are averaged over all associated stations */
+  if (iface->num_stations > 0) {
+    int signal = 0;
+    uint64_t bitrate = 0;
+    for (size_t i = 0; i < iface->num_stations; i++) {
+      signal += wnl.stations[iface->first_station + i].signal;
+      bitrate += wnl.stations[iface->first_station + i].tx_rate.rate;
+    }
+
+    json_object_object_add(interface, "signal", json_object_new_int(signal / (int) iface->num_stations));
+    json_object_object_add(interface, "bitrate", json_object_new_int(bitrate / iface->num_stations));
+  }
+  if (iface->has_noise)
+    json_object_object_add(interface, "noise", json_object_new_int(iface->noise));
+
+  if (phy)
+    nw_wireless_add_protocols(interface, phy->hwmodes);
+
+  /* Encryption */
+  struct iwinfo_crypto_entry crypto = { 0, };
+  if (iwinfo && !iwinfo->encryption(ifname, (char*) &crypto))
+    nw_wireless_add_encryption(interface, "encryption", &crypto);
+
+  /* Stations */
+  for (size_t i = 0; i < iface->num_stations; i++)
+    wnl.stations[iface->first_station + i].noise = iface->noise;
+  nw_wireless_add_stations(interface, iface->ifindex, &wnl.stations[iface->first_station], iface->num_stations);
+
+  json_object_object_add(object, ifname, interface);
+  return true;
+}
+
 static bool nw_wireless_process_interface(const char *ifname,
                                           json_object *object)
 {
@@ -172,18 +957,8 @@ static bool nw_wireless_process_interface(const char *ifname,
 
   /* Protocols */
   int modes;
-  if (!iwinfo->hwmodelist(ifname, &modes)) {
-    json_object *protocols = json_object_new_array();
-    if (modes & IWINFO_80211_A)
-      json_object_array_add(protocols, json_object_new_string("a"));
-    if (modes & IWINFO_80211_B)
-      json_object_array_add(protocols, json_object_new_string("b"));
-    if (modes & IWINFO_80211_G)
-      json_object_array_add(protocols, json_object_new_string("g"));
-    if (modes & IWINFO_80211_N)
-      json_object_array_add(protocols, json_object_new_string("n"));
-    json_object_object_add(interface, "protocols", protocols);
-  }
+  if (!iwinfo->hwmodelist(ifname, &modes))
+    nw_wireless_add_protocols(interface, modes);
 
   /* Encryption */
   struct iwinfo_crypto_entry crypto = { 0, };
@@ -192,140 +967,848 @@ static bool nw_wireless_process_interface(const char *ifname,
   }
 
   /* Stations */
-  char result[IWINFO_BUFSIZE];
-  int length, i;
+  static char result[IWINFO_BUFSIZE];
+  int length;
   if (!iwinfo->assoclist(ifname, result, &length)) {
-    json_object *stations = json_object_new_array();
-    for (i = 0; i < length; i += sizeof(struct iwinfo_assoclist_entry)) {
-      struct iwinfo_assoclist_entry *entry = (struct iwinfo_assoclist_entry*) &result[i];
-      json_object *station = json_object_new_object();
+    nw_wireless_add_stations(interface, if_nametoindex(ifname), (struct iwinfo_assoclist_entry*) result,
+      length / sizeof(struct iwinfo_assoclist_entry));
+  }
 
-      char mac[18];
-      snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
-        entry->mac[0], entry->mac[1], entry->mac[2],
-        entry->mac[3], entry->mac[4], entry->mac[5]);
-
-      /* Compute salted hash of MAC address */
-      md5_ctx_t ctx;
-      uint8_t raw_mac_id[16];
-      char mac_id[33];
-
-      md5_begin(&ctx);
-      md5_hash(NW_CLIENT_ID_SALT, NW_CLIENT_ID_SALT_LENGTH, &ctx);
-      md5_hash(mac, 17, &ctx);
-      md5_end(raw_mac_id, &ctx);
-
-      /* Base64 encode the hash so it is more compact */
-      if (nw_base64_encode(raw_mac_id, sizeof(raw_mac_id), mac_id, sizeof(mac_id)) == 0) {
-        json_object_object_add(station, "client_id", json_object_new_string(mac_id));
-      } else {
-        json_object_put(station);
-        continue;
+  json_object_object_add(object, ifname, interface);
+  return true;
+}
+
+/* Default interval between radio surveys (in seconds) */
+#define NW_WIRELESS_SURVEY_INTERVAL 7200
+/* Delay of the first radio survey after startup (in seconds) */
+#define NW_WIRELESS_SURVEY_DELAY 60
+/* Interval of checks whether the survey window has opened (in seconds) */
+#define NW_WIRELESS_SURVEY_WINDOW_CHECK 900
+/* Maximum duration of a scan (in seconds) */
+#define NW_WIRELESS_SURVEY_TIMEOUT 30
+
+/* Default maximum age of surveyed networks (in seconds) */
+#define NW_WIRELESS_SURVEY_MAX_AGE 14400
+/* Maximum number of channels tracked per radio */
+#define NW_WIRELESS_SURVEY_MAX_CHANNELS 64
+
+/* Radio that should be surveyed */
+struct nw_wireless_survey_radio {
+  /* Interface used for scanning */
+  char ifname[IFNAMSIZ];
+  /* Interface index while a scan is pending, zero otherwise */
+  int pending_ifindex;
+  /* PHY index of the pending scan */
+  uint32_t wiphy;
+};
+
+/* Network seen in scan results */
+struct nw_wireless_bss {
+  /* Whether the slot is in use */
+  bool used;
+  /* BSSID */
+  uint8_t bssid[ETH_ALEN];
+  /* SSID (empty when hidden) */
+  char ssid[33];
+  /* Operating mode (IWINFO_OPMODE_*) */
+  int mode;
+  /* Channel */
+  int channel;
+  /* Signal in dBm */
+  int signal;
+  bool has_signal;
+  /* Encryption */
+  struct iwinfo_crypto_entry crypto;
+  /* Time when the network was last seen */
+  time_t last_seen;
+};
+
+/* Channel survey data with cumulative times in milliseconds */
+struct nw_wireless_channel {
+  /* Channel frequency in MHz */
+  uint32_t frequency;
+  /* Noise floor */
+  int8_t noise;
+  bool has_noise;
+  /* Whether the radio currently operates on this channel */
+  bool in_use;
+  /* Cumulative active, busy, receive and transmit times */
+  uint64_t active;
+  uint64_t busy;
+  uint64_t rx;
+  uint64_t tx;
+  /* Busy percentage since the previous sample (negative when unknown) */
+  double utilization;
+  /* Time when the channel was last reported */
+  time_t last_seen;
+};
+
+/* Passive survey data of a single radio */
+struct nw_wireless_radio_survey {
+  /* PHY name (empty for unused entries) */
+  char phy[32];
+  /* Whether the radio has been seen in the current pass over all radios */
+  bool seen;
+  /* Open addressing table of networks keyed by BSSID */
+  struct nw_wireless_bss *bss;
+  size_t bss_size;
+  size_t bss_count;
+  /* Channels */
+  struct nw_wireless_channel channels[NW_WIRELESS_SURVEY_MAX_CHANNELS];
+  int num_channels;
+};
+
+/* Radio survey scheduler and results */
+static struct {
+  /* Interval between surveys in seconds (zero disables active surveys) */
+  int interval;
+  /* Maximum age of surveyed networks in seconds */
+  int max_age;
+  /* Off-peak window (local hours), surveys are unrestricted when start equals end */
+  int window_start;
+  int window_end;
+  /* Radios, identified by the first interface reported by netifd */
+  struct nw_wireless_survey_radio radios[NW_WIRELESS_MAX_PHYS];
+  int num_radios;
+  /* Scheduling timer */
+  struct uloop_timeout timer;
+  /* Scan timeout */
+  struct uloop_timeout timeout;
+  /* Socket subscribed to nl80211 scan events */
+  struct nw_netlink events;
+  struct uloop_fd events_fd;
+  /* Survey data keyed by PHY name */
+  struct nw_wireless_radio_survey surveys[NW_WIRELESS_MAX_PHYS];
+} ws = { .events = { .fd = -1, }, };
+
+/* Cipher suite selectors used in RSN and WPA information elements */
+static int nw_wireless_parse_cipher(const uint8_t *suite)
+{
+  switch (suite[3]) {
+    case 1: return IWINFO_CIPHER_WEP40;
+    case 2: return IWINFO_CIPHER_TKIP;
+    case 3: return IWINFO_CIPHER_WRAP;
+    case 4: return IWINFO_CIPHER_CCMP;
+    case 5: return IWINFO_CIPHER_WEP104;
+    default: return 0;
+  }
+}
+
+/**
+ * Parses the body of a RSN or WPA information element into a crypto entry.
+ *
+ * @param data Element body (starting with the version)
+ * @param length Length of the element body
+ * @param version WPA version indicated by the element
+ * @param crypto Destination crypto entry
+ */
+static void nw_wireless_parse_rsn(const uint8_t *data, int length, int version, struct iwinfo_crypto_entry *crypto)
+{
+  crypto->enabled = 1;
+  crypto->wpa_version |= version;
+
+  /* Defaults when the element omits the cipher and key management lists */
+  int group = version == 2 ? IWINFO_CIPHER_CCMP : IWINFO_CIPHER_TKIP;
+  int pairwise = group;
+  int auth = IWINFO_KMGMT_8021x;
+
+  data += 2;
+  length -= 2;
+  if (length >= 4) {
+    group = nw_wireless_parse_cipher(data);
+    data += 4;
+    length -= 4;
+  }
+
+  if (length >= 2) {
+    int count = data[0] | (data[1] << 8);
+    data += 2;
+    length -= 2;
+    for (pairwise = 0; count > 0 && length >= 4; count--, data += 4, length -= 4)
+      pairwise |= nw_wireless_parse_cipher(data);
+  }
+
+  if (length >= 2) {
+    int count = data[0] | (data[1] << 8);
+    data += 2;
+    length -= 2;
+    for (auth = 0; count > 0 && length >= 4; count--, data += 4, length -= 4) {
+      switch (data[3]) {
+        case 1: auth |= IWINFO_KMGMT_8021x; break;
+        case 2: auth |= IWINFO_KMGMT_PSK; break;
+        default: auth |= IWINFO_KMGMT_NONE; break;
       }
+    }
+  }
+
+  crypto->group_ciphers |= group;
+  crypto->pair_ciphers |= pairwise;
+  crypto->auth_suites |= auth;
+}
+
+static struct nw_wireless_radio_survey *nw_wireless_survey_find(const char *phy)
+{
+  for (int i = 0; i < NW_WIRELESS_MAX_PHYS; i++) {
+    if (ws.surveys[i].phy[0] && strcmp(ws.surveys[i].phy, phy) == 0)
+      return &ws.surveys[i];
+  }
+
+  return NULL;
+}
 
-      json_object_object_add(station, "signal", json_object_new_int(entry->signal));
-      json_object_object_add(station, "noise", json_object_new_int(entry->noise));
-      json_object_object_add(station, "inactive", json_object_new_int(entry->inactive));
-
-      json_object *rx = json_object_new_object();
-      json_object_object_add(rx, "rate", json_object_new_int(entry->rx_rate.rate));
-      json_object_object_add(rx, "mcs", json_object_new_int(entry->rx_rate.mcs));
-      json_object_object_add(rx, "40mhz", json_object_new_boolean(entry->rx_rate.is_40mhz));
-      json_object_object_add(rx, "short_gi", json_object_new_boolean(entry->rx_rate.is_short_gi));
-      json_object_object_add(rx, "packets", json_object_new_int(entry->rx_packets));
-      json_object_object_add(rx, "bytes", json_object_new_int(entry->rx_bytes));
-      json_object_object_add(station, "rx", rx);
-
-      json_object *tx = json_object_new_object();
-      json_object_object_add(tx, "rate", json_object_new_int(entry->tx_rate.rate));
-      json_object_object_add(tx, "mcs", json_object_new_int(entry->tx_rate.mcs));
-      json_object_object_add(tx, "40mhz", json_object_new_boolean(entry->tx_rate.is_40mhz));
-      json_object_object_add(tx, "short_gi", json_object_new_boolean(entry->tx_rate.is_short_gi));
-      json_object_object_add(tx, "packets", json_object_new_int(entry->tx_packets));
-      json_object_object_add(tx, "bytes", json_object_new_int(entry->tx_bytes));
-      json_object_object_add(tx, "retries", json_object_new_int(entry->tx_retries));
-      json_object_object_add(tx, "failed", json_object_new_int(entry->tx_failed));
-      json_object_object_add(station, "tx", tx);
-
-      json_object_object_add(station, "authorized", json_object_new_boolean(entry->is_authorized));
-      json_object_object_add(station, "authenticated", json_object_new_boolean(entry->is_authenticated));
-      json_object_object_add(station, "preamble_short", json_object_new_boolean(entry->is_preamble_short));
-      json_object_object_add(station, "wme", json_object_new_boolean(entry->is_wme));
-      json_object_object_add(station, "mfp", json_object_new_boolean(entry->is_mfp));
-      json_object_object_add(station, "tdls", json_object_new_boolean(entry->is_tdls));
-
-      json_object_array_add(stations, station);
+static struct nw_wireless_radio_survey *nw_wireless_survey_get(const char *phy)
+{
+  struct nw_wireless_radio_survey *survey = nw_wireless_survey_find(phy);
+  for (int i = 0; !survey && i < NW_WIRELESS_MAX_PHYS; i++) {
+    if (!ws.surveys[i].phy[0]) {
+      survey = &ws.surveys[i];
+      snprintf(survey->phy, sizeof(survey->phy), "%s", phy);
     }
+  }
 
-    json_object_object_add(interface, "stations", stations);
+  return survey;
+}
+
+/**
+ * Releases survey data of radios that have not been seen in the last pass
+ * over all radios, so that PHYs renamed after driver reloads do not use up
+ * all survey slots.
+ */
+static void nw_wireless_survey_release_unseen(void)
+{
+  for (int i = 0; i < NW_WIRELESS_MAX_PHYS; i++) {
+    struct nw_wireless_radio_survey *survey = &ws.surveys[i];
+    if (survey->phy[0] && !survey->seen) {
+      free(survey->bss);
+      memset(survey, 0, sizeof(*survey));
+    }
+    survey->seen = false;
   }
+}
 
-  json_object_object_add(object, ifname, interface);
+static size_t nw_wireless_bss_hash(const uint8_t *bssid)
+{
+  return bssid[5] | (bssid[4] << 8) | (bssid[3] << 16);
+}
 
-  iwinfo = NULL;
-  iwinfo_finish();
+static struct nw_wireless_bss *nw_wireless_bss_slot(struct nw_wireless_bss *table,
+                                                    size_t size,
+                                                    const uint8_t *bssid)
+{
+  size_t mask = size - 1;
+  for (size_t i = nw_wireless_bss_hash(bssid) & mask;; i = (i + 1) & mask) {
+    if (!table[i].used || memcmp(table[i].bssid, bssid, ETH_ALEN) == 0)
+      return &table[i];
+  }
+}
+
+/**
+ * Resizes the network table of a radio.
+ *
+ * @param survey Radio survey
+ * @param count Number of networks to make room for
+ * @return True on success, false on allocation failure
+ */
+static bool nw_wireless_bss_resize(struct nw_wireless_radio_survey *survey, size_t count)
+{
+  size_t size = 32;
+  while (size < count * 2)
+    size *= 2;
+
+  struct nw_wireless_bss *table = calloc(size, sizeof(struct nw_wireless_bss));
+  if (!table)
+    return false;
+
+  for (size_t i = 0; i < survey->bss_size; i++) {
+    struct nw_wireless_bss *bss = &survey->bss[i];
+    if (bss->used)
+      *nw_wireless_bss_slot(table, size, bss->bssid) = *bss;
+  }
+
+  free(survey->bss);
+  survey->bss = table;
+  survey->bss_size = size;
   return true;
 }
 
-static bool nw_wireless_process_radio(const char *ifname,
-                                      json_object *object)
+/**
+ * Removes a network from the table, moving back later networks of the same
+ * probe sequence so that lookups need no tombstones.
+ *
+ * @param survey Radio survey
+ * @param index Slot of the network to remove
+ */
+static void nw_wireless_bss_remove(struct nw_wireless_radio_survey *survey, size_t index)
+{
+  size_t mask = survey->bss_size - 1;
+  size_t hole = index;
+  for (size_t i = (index + 1) & mask; survey->bss[i].used; i = (i + 1) & mask) {
+    struct nw_wireless_bss *bss = &survey->bss[i];
+    size_t home = nw_wireless_bss_hash(bss->bssid) & mask;
+    /* Networks may only move towards their home slot */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      survey->bss[hole] = *bss;
+      hole = i;
+    }
+  }
+
+  memset(&survey->bss[hole], 0, sizeof(struct nw_wireless_bss));
+  survey->bss_count--;
+}
+
+/**
+ * Drops networks and channels of a radio that have not been seen for
+ * longer than the maximum age.
+ *
+ * @param survey Radio survey
+ * @param now Current time
+ */
+static void nw_wireless_survey_expire(struct nw_wireless_radio_survey *survey, time_t now)
+{
+  for (size_t i = 0; i < survey->bss_size;) {
+    struct nw_wireless_bss *bss = &survey->bss[i];
+    /* The slot is checked again as another network may have moved into it */
+    if (bss->used && now - bss->last_seen > ws.max_age)
+      nw_wireless_bss_remove(survey, i);
+    else
+      i++;
+  }
+
+  /* Shrink the table only after most networks have disappeared */
+  if (survey->bss_size > 32 && survey->bss_count * 8 < survey->bss_size)
+    nw_wireless_bss_resize(survey, survey->bss_count);
+
+  int kept = 0;
+  for (int i = 0; i < survey->num_channels; i++) {
+    if (now - survey->channels[i].last_seen <= ws.max_age)
+      survey->channels[kept++] = survey->channels[i];
+  }
+  survey->num_channels = kept;
+}
+
+static void nw_wireless_bss_update(struct nw_wireless_radio_survey *survey, struct nw_wireless_bss *update)
+{
+  if ((survey->bss_count + 1) * 2 > survey->bss_size && !nw_wireless_bss_resize(survey, survey->bss_count + 1))
+    return;
+
+  struct nw_wireless_bss *bss = nw_wireless_bss_slot(survey->bss, survey->bss_size, update->bssid);
+  if (!bss->used)
+    survey->bss_count++;
+  else if (bss->last_seen > update->last_seen)
+    return;
+
+  *bss = *update;
+  bss->used = true;
+}
+
+static int nw_wireless_survey_parse_bss(struct nlmsghdr *hdr, void *priv)
+{
+  struct nw_wireless_radio_survey *survey = (struct nw_wireless_radio_survey*) priv;
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (!tb[NL80211_ATTR_BSS])
+    return 0;
+
+  struct nlattr *attrs[NL80211_BSS_MAX + 1];
+  nw_netlink_parse_attrs(attrs, NL80211_BSS_MAX, nw_nla_data(tb[NL80211_ATTR_BSS]), nw_nla_len(tb[NL80211_ATTR_BSS]));
+  if (!attrs[NL80211_BSS_BSSID] || nw_nla_len(attrs[NL80211_BSS_BSSID]) < ETH_ALEN)
+    return 0;
+
+  struct nw_wireless_bss bss;
+  memset(&bss, 0, sizeof(bss));
+  memcpy(bss.bssid, nw_nla_data(attrs[NL80211_BSS_BSSID]), ETH_ALEN);
+
+  uint16_t capability = 0;
+  if (attrs[NL80211_BSS_CAPABILITY])
+    capability = nw_nla_get_u16(attrs[NL80211_BSS_CAPABILITY]);
+
+  /* Information elements */
+  struct nlattr *ies = attrs[NL80211_BSS_INFORMATION_ELEMENTS];
+  if (!ies)
+    ies = attrs[NL80211_BSS_BEACON_IES];
+  if (ies) {
+    const uint8_t *ie = nw_nla_data(ies);
+    int length = nw_nla_len(ies);
+    while (length >= 2 && ie[1] + 2 <= length) {
+      switch (ie[0]) {
+        case 0: {
+          /* SSID */
+          memcpy(bss.ssid, &ie[2], ie[1] < 32 ? ie[1] : 32);
+          break;
+        }
+        case 48: {
+          /* RSN */
+          nw_wireless_parse_rsn(&ie[2], ie[1], 2, &bss.crypto);
+          break;
+        }
+        case 221: {
+          /* Vendor specific, WPA uses the Microsoft OUI with type 1 */
+          if (ie[1] >= 4 && ie[2] == 0x00 && ie[3] == 0x50 && ie[4] == 0xf2 && ie[5] == 1)
+            nw_wireless_parse_rsn(&ie[6], ie[1] - 4, 1, &bss.crypto);
+          break;
+        }
+      }
+
+      length -= ie[1] + 2;
+      ie += ie[1] + 2;
+    }
+  }
+
+  /* Privacy without WPA means WEP */
+  if ((capability & (1 << 4)) && !bss.crypto.enabled) {
+    bss.crypto.enabled = 1;
+    bss.crypto.auth_algs = IWINFO_AUTH_OPEN | IWINFO_AUTH_SHARED;
+    bss.crypto.pair_ciphers = IWINFO_CIPHER_WEP40 | IWINFO_CIPHER_WEP104;
+  }
+
+  bss.mode = IWINFO_OPMODE_UNKNOWN;
+  if (capability & (1 << 0))
+    bss.mode = IWINFO_OPMODE_MASTER;
+  else if (capability & (1 << 1))
+    bss.mode = IWINFO_OPMODE_ADHOC;
+
+  if (attrs[NL80211_BSS_FREQUENCY])
+    bss.channel = nw_wireless_nl80211_channel(nw_nla_get_u32(attrs[NL80211_BSS_FREQUENCY]));
+  if (attrs[NL80211_BSS_SIGNAL_MBM]) {
+    bss.signal = (int32_t) nw_nla_get_u32(attrs[NL80211_BSS_SIGNAL_MBM]) / 100;
+    bss.has_signal = true;
+  }
+
+  /* The kernel keeps results of earlier scans, including ones triggered by other tools */
+  bss.last_seen = time(NULL);
+  if (attrs[NL80211_BSS_SEEN_MS_AGO])
+    bss.last_seen -= nw_nla_get_u32(attrs[NL80211_BSS_SEEN_MS_AGO]) / 1000;
+
+  nw_wireless_bss_update(survey, &bss);
+  return 0;
+}
+
+static int nw_wireless_survey_parse_channel(struct nlmsghdr *hdr, void *priv)
+{
+  struct nw_wireless_radio_survey *survey = (struct nw_wireless_radio_survey*) priv;
+  struct nlattr *tb[NL80211_ATTR_MAX + 1];
+  nw_wireless_nl80211_parse(tb, hdr);
+  if (!tb[NL80211_ATTR_SURVEY_INFO])
+    return 0;
+
+  struct nlattr *sinfo[NL80211_SURVEY_INFO_MAX + 1];
+  nw_netlink_parse_attrs(sinfo, NL80211_SURVEY_INFO_MAX, nw_nla_data(tb[NL80211_ATTR_SURVEY_INFO]),
+    nw_nla_len(tb[NL80211_ATTR_SURVEY_INFO]));
+  if (!sinfo[NL80211_SURVEY_INFO_FREQUENCY])
+    return 0;
+
+  uint32_t frequency = nw_nla_get_u32(sinfo[NL80211_SURVEY_INFO_FREQUENCY]);
+  struct nw_wireless_channel *channel = NULL;
+  for (int i = 0; i < survey->num_channels; i++) {
+    if (survey->channels[i].frequency == frequency)
+      channel = &survey->channels[i];
+  }
+  if (!channel) {
+    if (survey->num_channels >= NW_WIRELESS_SURVEY_MAX_CHANNELS)
+      return 0;
+
+    channel = &survey->channels[survey->num_channels++];
+    memset(channel, 0, sizeof(*channel));
+    channel->frequency = frequency;
+    channel->utilization = -1;
+  }
+
+  channel->in_use = sinfo[NL80211_SURVEY_INFO_IN_USE] != NULL;
+  channel->has_noise = sinfo[NL80211_SURVEY_INFO_NOISE] != NULL;
+  if (channel->has_noise)
+    channel->noise = (int8_t) nw_nla_get_u8(sinfo[NL80211_SURVEY_INFO_NOISE]);
+
+  /* Channel times are cumulative, so utilization is computed from their increase and is
+     unknown when the channel has not been surveyed since the previous sample */
+  if (sinfo[NL80211_SURVEY_INFO_TIME] && sinfo[NL80211_SURVEY_INFO_TIME_BUSY]) {
+    uint64_t active = nw_nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME]);
+    uint64_t busy = nw_nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_BUSY]);
+    if (active > channel->active && busy >= channel->busy && channel->active)
+      channel->utilization = (busy - channel->busy) * 100.0 / (active - channel->active);
+    else
+      channel->utilization = -1;
+
+    if (active != channel->active)
+      channel->last_seen = time(NULL);
+    channel->active = active;
+    channel->busy = busy;
+  } else {
+    /* Without channel times, the channel counts as seen whenever it is reported */
+    channel->last_seen = time(NULL);
+  }
+  if (sinfo[NL80211_SURVEY_INFO_TIME_RX])
+    channel->rx = nw_nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_RX]);
+  if (sinfo[NL80211_SURVEY_INFO_TIME_TX])
+    channel->tx = nw_nla_get_u64(sinfo[NL80211_SURVEY_INFO_TIME_TX]);
+
+  return 0;
+}
+
+static int nw_wireless_survey_request(uint8_t cmd,
+                                      uint32_t ifindex,
+                                      nw_netlink_cb cb,
+                                      struct nw_wireless_radio_survey *survey)
+{
+  struct nw_wireless_nl80211_request req;
+  nw_wireless_nl80211_prepare(&req, cmd, NLM_F_DUMP);
+  nw_netlink_put_attr(&req.hdr, sizeof(req), NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+  return nw_netlink_request(&wnl.nl, &req.hdr, cb, survey);
+}
+
+static bool nw_wireless_process_radio(const char *ifname)
 {
   /* Initialize iwinfo backend for this device */
-  static const struct iwinfo_ops *iwinfo;
-  iwinfo = iwinfo_backend(ifname);
+  const struct iwinfo_ops *iwinfo = iwinfo_backend(ifname);
   if (!iwinfo)
     return false;
 
-  json_object *radio = json_object_new_object();
+  char phyname[IWINFO_BUFSIZE] = { 0, };
+  if (iwinfo->phyname(ifname, phyname))
+    return false;
+
+  struct nw_wireless_radio_survey *survey = nw_wireless_survey_get(phyname);
+  if (!survey)
+    return false;
+  survey->seen = true;
 
   /* Wireless network survey */
-  char result[IWINFO_BUFSIZE];
+  static char result[IWINFO_BUFSIZE];
   int len, i;
-  if (!iwinfo->scanlist(ifname, result, &len) && len > 0) {
-    json_object *survey = json_object_new_array();
-    for (i = 0; i < len; i += sizeof(struct iwinfo_scanlist_entry)) {
-      json_object *network = json_object_new_object();
-      struct iwinfo_scanlist_entry *entry = (struct iwinfo_scanlist_entry*) &result[i];
+  if (iwinfo->scanlist(ifname, result, &len) || len <= 0)
+    return false;
+
+  for (i = 0; i < len; i += sizeof(struct iwinfo_scanlist_entry)) {
+    struct iwinfo_scanlist_entry *entry = (struct iwinfo_scanlist_entry*) &result[i];
+    struct nw_wireless_bss bss;
+    memset(&bss, 0, sizeof(bss));
+    memcpy(bss.bssid, entry->mac, ETH_ALEN);
+    snprintf(bss.ssid, sizeof(bss.ssid), "%s", (const char*) entry->ssid);
+    bss.mode = entry->mode;
+    bss.channel = entry->channel;
+    bss.signal = (int) entry->signal - 0x100;
+    bss.has_signal = true;
+    bss.crypto = entry->crypto;
+    bss.last_seen = time(NULL);
+    nw_wireless_bss_update(survey, &bss);
+  }
+
+  return true;
+}
+
+/**
+ * Updates survey data of all radios from scan results and channel survey
+ * data that the kernel already has, without triggering any scans.
+ */
+static void nw_wireless_survey_update(void)
+{
+  /* Release radios whose PHY is gone before slots are claimed for new ones */
+  for (int i = 0; i < ws.num_radios; i++) {
+    struct nw_wireless_iface *iface = nw_wireless_nl80211_find_iface(ws.radios[i].ifname);
+    struct nw_wireless_phy *phy = iface ? nw_wireless_nl80211_find_phy(iface->wiphy) : NULL;
+    struct nw_wireless_radio_survey *survey = phy ? nw_wireless_survey_find(phy->name) : NULL;
+    if (survey)
+      survey->seen = true;
+  }
+  nw_wireless_survey_release_unseen();
+
+  for (int i = 0; i < ws.num_radios; i++) {
+    struct nw_wireless_iface *iface = nw_wireless_nl80211_find_iface(ws.radios[i].ifname);
+    struct nw_wireless_phy *phy = iface ? nw_wireless_nl80211_find_phy(iface->wiphy) : NULL;
+    struct nw_wireless_radio_survey *survey = phy ? nw_wireless_survey_get(phy->name) : NULL;
+    if (!survey)
+      continue;
+
+    nw_wireless_survey_request(NL80211_CMD_GET_SCAN, iface->ifindex, nw_wireless_survey_parse_bss, survey);
+
+    /* Drivers may only report the operating channel, so a previous one must not stay in use */
+    for (int j = 0; j < survey->num_channels; j++)
+      survey->channels[j].in_use = false;
+    nw_wireless_survey_request(NL80211_CMD_GET_SURVEY, iface->ifindex, nw_wireless_survey_parse_channel, survey);
+  }
+}
+
+static json_object *nw_wireless_survey_build(void)
+{
+  json_object *radios = json_object_new_object();
+  time_t now = time(NULL);
 
-      /* SSID */
-      if (entry->ssid[0])
-        json_object_object_add(network, "ssid", json_object_new_string((const char*) entry->ssid));
+  for (int i = 0; i < NW_WIRELESS_MAX_PHYS; i++) {
+    struct nw_wireless_radio_survey *survey = &ws.surveys[i];
+    if (!survey->phy[0])
+      continue;
+
+    /* Age out networks and channels that have not been seen for a while */
+    nw_wireless_survey_expire(survey, now);
+
+    json_object *radio = json_object_new_object();
+    json_object *networks = json_object_new_array();
+    for (size_t j = 0; j < survey->bss_size; j++) {
+      struct nw_wireless_bss *bss = &survey->bss[j];
+      if (!bss->used)
+        continue;
+
+      json_object *network = json_object_new_object();
+      if (bss->ssid[0])
+        json_object_object_add(network, "ssid", json_object_new_string(bss->ssid));
 
-      /* BSSID */
       char mac[18];
       snprintf(mac, sizeof(mac), "%02X:%02X:%02X:%02X:%02X:%02X",
-        entry->mac[0], entry->mac[1], entry->mac[2],
-        entry->mac[3], entry->mac[4], entry->mac[5]);
-
+        bss->bssid[0], bss->bssid[1], bss->bssid[2], bss->bssid[3], bss->bssid[4], bss->bssid[5]);
       json_object_object_add(network, "bssid", json_object_new_string(mac));
+      json_object_object_add(network, "mode", json_object_new_string(IWINFO_OPMODE_NAMES[bss->mode]));
+      json_object_object_add(network, "channel", json_object_new_int(bss->channel));
+      if (bss->has_signal)
+        json_object_object_add(network, "signal", json_object_new_int(bss->signal));
+      nw_wireless_add_encryption(network, "encryption", &bss->crypto);
+      json_object_object_add(network, "age", json_object_new_int(now - bss->last_seen));
+
+      json_object_array_add(networks, network);
+    }
+    json_object_object_add(radio, "survey", networks);
+
+    if (survey->num_channels > 0) {
+      json_object *channels = json_object_new_array();
+      for (int j = 0; j < survey->num_channels; j++) {
+        struct nw_wireless_channel *channel = &survey->channels[j];
+        json_object *entry = json_object_new_object();
+        json_object_object_add(entry, "channel", json_object_new_int(nw_wireless_nl80211_channel(channel->frequency)));
+        json_object_object_add(entry, "frequency", json_object_new_int(channel->frequency));
+        json_object_object_add(entry, "in_use", json_object_new_boolean(channel->in_use));
+        if (channel->has_noise)
+          json_object_object_add(entry, "noise", json_object_new_int(channel->noise));
+        json_object_object_add(entry, "active_time", json_object_new_int64(channel->active));
+        json_object_object_add(entry, "busy_time", json_object_new_int64(channel->busy));
+        json_object_object_add(entry, "rx_time", json_object_new_int64(channel->rx));
+        json_object_object_add(entry, "tx_time", json_object_new_int64(channel->tx));
+        if (channel->utilization >= 0) {
+          char utilization[32];
+          snprintf(utilization, sizeof(utilization), "%.2f", channel->utilization);
+          json_object_object_add(entry, "utilization", json_object_new_string(utilization));
+        }
+        if (channel->last_seen)
+          json_object_object_add(entry, "age", json_object_new_int(now - channel->last_seen));
+
+        json_object_array_add(channels, entry);
+      }
+      json_object_object_add(radio, "channels", channels);
+    }
 
-      /* Mode */
-      json_object_object_add(network, "mode", json_object_new_string(IWINFO_OPMODE_NAMES[entry->mode]));
-      /* Channel */
-      json_object_object_add(network, "channel", json_object_new_int(entry->channel));
-      /* Signal */
-      json_object_object_add(network, "signal", json_object_new_int((uint32_t) (entry->signal - 0x100)));
-      /* Encryption */
-      nw_wireless_add_encryption(network, "encryption", &entry->crypto);
+    json_object_object_add(radios, survey->phy, radio);
+  }
 
-      json_object_array_add(survey, network);
+  return radios;
+}
+
+static struct nw_wireless_survey_radio *nw_wireless_survey_find_pending(int ifindex)
+{
+  for (int i = 0; i < ws.num_radios; i++) {
+    if (ws.radios[i].pending_ifindex == ifindex)
+      return &ws.radios[i];
+  }
+
+  return NULL;
+}
+
+static void nw_wireless_survey_fetch(struct nw_wireless_survey_radio *radio)
+{
+  struct nw_wireless_phy *phy = nw_wireless_nl80211_find_phy(radio->wiphy);
+  struct nw_wireless_radio_survey *survey = phy ? nw_wireless_survey_get(phy->name) : NULL;
+  if (!survey)
+    return;
+
+  if (nw_wireless_survey_request(NL80211_CMD_GET_SCAN, radio->pending_ifindex, nw_wireless_survey_parse_bss, survey) != 0)
+    syslog(LOG_WARNING, "wireless: Failed to obtain scan results on '%s'!", radio->ifname);
+}
+
+static void nw_wireless_survey_event(struct uloop_fd *fd, unsigned int events)
+{
+  static char buffer[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+  ssize_t length;
+
+  while ((length = recv(fd->fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+    struct nlmsghdr *hdr;
+    for (hdr = (struct nlmsghdr*) buffer; NLMSG_OK(hdr, length); hdr = NLMSG_NEXT(hdr, length)) {
+      if (hdr->nlmsg_type != wnl.family)
+        continue;
+
+      struct genlmsghdr *genl = NLMSG_DATA(hdr);
+      if (genl->cmd != NL80211_CMD_NEW_SCAN_RESULTS && genl->cmd != NL80211_CMD_SCAN_ABORTED)
+        continue;
+
+      struct nlattr *tb[NL80211_ATTR_MAX + 1];
+      nw_wireless_nl80211_parse(tb, hdr);
+      if (!tb[NL80211_ATTR_IFINDEX])
+        continue;
+
+      struct nw_wireless_survey_radio *radio = nw_wireless_survey_find_pending(nw_nla_get_u32(tb[NL80211_ATTR_IFINDEX]));
+      if (!radio)
+        continue;
+
+      if (genl->cmd == NL80211_CMD_NEW_SCAN_RESULTS)
+        nw_wireless_survey_fetch(radio);
+      else
+        syslog(LOG_WARNING, "wireless: Scan on '%s' has been aborted.", radio->ifname);
+      radio->pending_ifindex = 0;
     }
+  }
+}
 
-    json_object_object_add(radio, "survey", survey);
+static void nw_wireless_survey_timeout(struct uloop_timeout *timeout)
+{
+  for (int i = 0; i < ws.num_radios; i++) {
+    if (!ws.radios[i].pending_ifindex)
+      continue;
+
+    syslog(LOG_WARNING, "wireless: Scan on '%s' did not complete in time.", ws.radios[i].ifname);
+    ws.radios[i].pending_ifindex = 0;
   }
+}
 
-  /* Determine the PHY name and add appropriate section */
-  char phyname[IWINFO_BUFSIZE] = { 0, };
-  if (!iwinfo->phyname(ifname, phyname)) {
-    json_object_object_add(object, phyname, radio);
-  } else {
-    json_object_put(radio);
+static bool nw_wireless_survey_in_window(void)
+{
+  if (ws.window_start == ws.window_end)
+    return true;
+
+  time_t now = time(NULL);
+  struct tm tm;
+  localtime_r(&now, &tm);
+
+  /* Windows may wrap around midnight */
+  if (ws.window_start < ws.window_end)
+    return tm.tm_hour >= ws.window_start && tm.tm_hour < ws.window_end;
+  return tm.tm_hour >= ws.window_start || tm.tm_hour < ws.window_end;
+}
+
+static void nw_wireless_survey_start(struct uloop_timeout *timer)
+{
+  if (!nw_wireless_survey_in_window()) {
+    uloop_timeout_set(&ws.timer, NW_WIRELESS_SURVEY_WINDOW_CHECK * 1000);
+    return;
   }
 
+  uloop_timeout_set(&ws.timer, nw_roughly(ws.interval) * 1000);
 
-  iwinfo = NULL;
-  iwinfo_finish();
-  return true;
+  if (wireless_backend != NW_WIRELESS_BACKEND_NL80211) {
+    /* The iwinfo backend can only scan synchronously */
+    for (int i = 0; i < ws.num_radios; i++)
+      nw_wireless_process_radio(ws.radios[i].ifname);
+    nw_wireless_survey_release_unseen();
+    iwinfo_finish();
+    return;
+  }
+
+  if (!nw_wireless_nl80211_dump())
+    return;
+
+  /* Trigger scans on all radios, results are fetched once the kernel reports them */
+  bool pending = false;
+  for (int i = 0; i < ws.num_radios; i++) {
+    struct nw_wireless_survey_radio *radio = &ws.radios[i];
+    struct nw_wireless_iface *iface = nw_wireless_nl80211_find_iface(radio->ifname);
+    if (!iface || radio->pending_ifindex)
+      continue;
+
+    /* Prefer low priority scans that are also allowed on beaconing interfaces */
+    struct nw_wireless_nl80211_request req;
+    uint32_t ifindex = iface->ifindex;
+    uint32_t flags = NL80211_SCAN_FLAG_LOW_PRIORITY | NL80211_SCAN_FLAG_AP;
+    int ret;
+    for (;;) {
+      nw_wireless_nl80211_prepare(&req, NL80211_CMD_TRIGGER_SCAN, 0);
+      nw_netlink_put_attr(&req.hdr, sizeof(req), NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+      if (flags)
+        nw_netlink_put_attr(&req.hdr, sizeof(req), NL80211_ATTR_SCAN_FLAGS, &flags, sizeof(flags));
+
+      ret = nw_netlink_request(&wnl.nl, &req.hdr, NULL, NULL);
+      if (ret != -EOPNOTSUPP || !flags)
+        break;
+
+      /* Drivers that do not support the flags reject the whole request */
+      flags = 0;
+    }
+
+    if (ret != 0) {
+      syslog(LOG_WARNING, "wireless: Failed to trigger scan on '%s' (error %d)!", radio->ifname, ret);
+      continue;
+    }
+
+    radio->pending_ifindex = iface->ifindex;
+    radio->wiphy = iface->wiphy;
+    pending = true;
+  }
+
+  if (pending)
+    uloop_timeout_set(&ws.timeout, NW_WIRELESS_SURVEY_TIMEOUT * 1000);
+}
+
+/**
+ * Records the radios that should be surveyed. The first survey is scheduled
+ * once radios are known.
+ *
+ * @param ifname Name of the first interface of a radio
+ */
+static void nw_wireless_survey_add_radio(const char *ifname)
+{
+  for (int i = 0; i < ws.num_radios; i++) {
+    if (strcmp(ws.radios[i].ifname, ifname) == 0)
+      return;
+  }
+
+  if (ws.num_radios >= NW_WIRELESS_MAX_PHYS)
+    return;
+
+  struct nw_wireless_survey_radio *radio = &ws.radios[ws.num_radios++];
+  snprintf(radio->ifname, sizeof(radio->ifname), "%s", ifname);
+  radio->pending_ifindex = 0;
+
+  if (ws.interval > 0 && !ws.timer.pending)
+    uloop_timeout_set(&ws.timer, NW_WIRELESS_SURVEY_DELAY * 1000);
+}
+
+static void nw_wireless_survey_init(struct uci_context *uci)
+{
+  ws.timer.cb = nw_wireless_survey_start;
+  ws.timeout.cb = nw_wireless_survey_timeout;
+
+  ws.interval = NW_WIRELESS_SURVEY_INTERVAL;
+  char *interval = nw_uci_get_string(uci, "nodewatcher.@agent[0].survey_interval");
+  if (interval) {
+    ws.interval = atoi(interval);
+    free(interval);
+  }
+
+  ws.max_age = NW_WIRELESS_SURVEY_MAX_AGE;
+  char *max_age = nw_uci_get_string(uci, "nodewatcher.@agent[0].survey_max_age");
+  if (max_age) {
+    ws.max_age = atoi(max_age);
+    free(max_age);
+  }
+
+  char *window = nw_uci_get_string(uci, "nodewatcher.@agent[0].survey_window");
+  if (window) {
+    if (sscanf(window, "%d-%d", &ws.window_start, &ws.window_end) != 2 ||
+        ws.window_start < 0 || ws.window_start > 23 || ws.window_end < 0 || ws.window_end > 24) {
+      syslog(LOG_WARNING, "wireless: Ignoring invalid survey window '%s'.", window);
+      ws.window_start = ws.window_end = 0;
+    }
+    free(window);
+  }
+
+  if (ws.interval <= 0 || wireless_backend != NW_WIRELESS_BACKEND_NL80211)
+    return;
+
+  /* Scan completion is reported via the nl80211 scan multicast group */
+  if (nw_netlink_open(&ws.events, NETLINK_GENERIC) != 0 ||
+      nw_netlink_genl_subscribe(&ws.events, "nl80211", "scan") != 0) {
+    syslog(LOG_WARNING, "wireless: Failed to subscribe to nl80211 scan events, surveys are disabled.");
+    nw_netlink_close(&ws.events);
+    ws.interval = 0;
+    return;
+  }
+
+  ws.events_fd.fd = ws.events.fd;
+  ws.events_fd.cb = nw_wireless_survey_event;
+  uloop_fd_add(&ws.events_fd, ULOOP_READ);
 }
 
 static int nw_wireless_start_acquire_data(struct nodewatcher_module *module,
@@ -335,18 +1818,11 @@ static int nw_wireless_start_acquire_data(struct nodewatcher_module *module,
   json_object *object = json_object_new_object();
 
   /* Obtain a list of wireless interfaces */
-  uint32_t ubus_id;
-  if (ubus_lookup_id(ubus, "network.wireless", &ubus_id)) {
-    syslog(LOG_WARNING, "wireless: Failed to find netifd object 'network.wireless'!");
-    return nw_module_finish_acquire_data(module, object);
-  }
-
-  /* Prepare and send a request */
   json_object *data = NULL;
   static struct blob_buf req;
   blob_buf_init(&req, 0);
 
-  if (ubus_invoke(ubus, ubus_id, "status", req.head, nw_json_from_ubus, &data, 500) != UBUS_STATUS_OK) {
+  if (nw_ubus_invoke(ubus, "network.wireless", "status", req.head, nw_json_from_ubus, &data, 500) != UBUS_STATUS_OK) {
     syslog(LOG_WARNING, "wireless: Failed to invoke netifd status method!");
     return nw_module_finish_acquire_data(module, object);
   }
@@ -357,14 +1833,11 @@ static int nw_wireless_start_acquire_data(struct nodewatcher_module *module,
   }
 
   json_object *interfaces = json_object_new_object();
-  json_object *radios = json_object_new_object();
 
-  /* Limit radio scans to once every ~240 monitoring intervals */
-  bool new_radio_survey = false;
-  if (!last_scan_survey || ++counter_monitor_intervals >= nw_roughly(240)) {
-    new_radio_survey = true;
-    counter_monitor_intervals = 0;
-  }
+  nw_wireless_stations_begin();
+
+  /* Obtain data for all wireless interfaces at once, falling back to iwinfo on failure */
+  bool use_nl80211 = wireless_backend == NW_WIRELESS_BACKEND_NL80211 && nw_wireless_nl80211_dump();
 
   /* Iterate over the list of radios */
   json_object_object_foreach(data, key, val) {
@@ -386,32 +1859,26 @@ static int nw_wireless_start_acquire_data(struct nodewatcher_module *module,
       if (!ifname)
         continue;
 
-      nw_wireless_process_interface(json_object_get_string(ifname), interfaces);
+      if (!use_nl80211 || !nw_wireless_nl80211_process_interface(json_object_get_string(ifname), interfaces))
+        nw_wireless_process_interface(json_object_get_string(ifname), interfaces);
       if (!first_radio_iface)
         first_radio_iface = json_object_get_string(ifname);
     }
 
-    /* Process radio */
-    if (new_radio_survey && first_radio_iface)
-      nw_wireless_process_radio(first_radio_iface, radios);
+    /* Radios are surveyed on their own schedule */
+    if (first_radio_iface)
+      nw_wireless_survey_add_radio(first_radio_iface);
   }
 
   json_object_object_add(object, "interfaces", interfaces);
-  if (new_radio_survey) {
-    json_object_object_add(object, "radios", radios);
-    if (last_scan_survey != NULL)
-      json_object_put(last_scan_survey);
+  /* Passively update survey data from what the kernel already knows */
+  if (use_nl80211)
+    nw_wireless_survey_update();
+  json_object_object_add(object, "radios", nw_wireless_survey_build());
 
-    last_scan_survey = json_object_get(radios);
-  } else {
-    /* Free the radios object as it has not been used this time */
-    json_object_put(radios);
-    /* Just reuse previous survey */
-    json_object_object_add(object, "radios", json_object_get(last_scan_survey));
-  }
-
-  /* Free data */
+  /* Free data and release iwinfo state once per run */
   json_object_put(data);
+  iwinfo_finish();
 
   /* Store resulting JSON object */
   return nw_module_finish_acquire_data(module, object);
@@ -421,6 +1888,24 @@ static int nw_wireless_init(struct nodewatcher_module *module,
                             struct ubus_context *ubus,
                             struct uci_context *uci)
 {
+  wireless_station_delta = nw_uci_get_int(uci, "nodewatcher.@agent[0].wireless_station_delta") > 0;
+
+  char *backend = nw_uci_get_string(uci, "nodewatcher.@agent[0].wireless_backend");
+  if (backend && strcmp(backend, "iwinfo") == 0)
+    wireless_backend = NW_WIRELESS_BACKEND_IWINFO;
+  free(backend);
+
+  if (wireless_backend == NW_WIRELESS_BACKEND_NL80211) {
+    if (nw_netlink_open(&wnl.nl, NETLINK_GENERIC) != 0 ||
+        nw_netlink_genl_family(&wnl.nl, "nl80211", &wnl.family) != 0) {
+      syslog(LOG_WARNING, "wireless: Failed to initialize nl80211, falling back to iwinfo.");
+      nw_netlink_close(&wnl.nl);
+      wireless_backend = NW_WIRELESS_BACKEND_IWINFO;
+    }
+  }
+
+  nw_wireless_survey_init(uci);
+
   return 0;
 }
 
@@ -428,7 +1913,7 @@ static int nw_wireless_init(struct nodewatcher_module *module,
 struct nodewatcher_module nw_module = {
   .name = "core.wireless",
   .author = "Jernej Kos <jernej@kos.mx>",
-  .version = 3,
+  .version = 7,
   .hooks = {
     .init               = nw_wireless_init,
     .start_acquire_data = nw_wireless_start_acquire_data,
@@ -0,0 +1,119 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../modules/routing_babel.c"
+
+/* Number of lines in the generated dump */
+#define BENCH_LINES 10000
+/* Number of neighbours and exported routes in the generated dump */
+#define BENCH_NEIGHBOURS 8
+#define BENCH_XROUTES 32
+
+/**
+ * Generates a monitor dump in the format used by babeld, with imported
+ * routes filling up the requested number of lines.
+ *
+ * @param lines Destination line array
+ * @param count Number of lines
+ * @return Number of imported routes in the dump
+ */
+static int bench_babel_generate(char **lines, int count)
+{
+  int n = 0, routes = 0;
+  lines[n++] = strdup("BABEL 1.0");
+  lines[n++] = strdup("version babeld-1.8.0");
+  lines[n++] = strdup("host node-1");
+  lines[n++] = strdup("my-id 02:0c:42:ff:fe:00:00:01");
+  lines[n++] = strdup("ok");
+  lines[n++] = strdup("add self 02:0c:42:ff:fe:00:00:01 id 02:0c:42:ff:fe:00:00:01");
+
+  for (int i = 0; i < BENCH_NEIGHBOURS; i++) {
+    lines[n] = malloc(256);
+    snprintf(lines[n++], 256, "add neighbour %x address fe80::c:42ff:fe00:%x if wlan%d reach ffff rxcost 96 "
+      "txcost 96 rtt 1.%03d rttcost 0 cost 96", 0x5573d0 + i, 0x100 + i, i % 2, i * 7);
+  }
+  for (int i = 0; i < BENCH_XROUTES; i++) {
+    lines[n] = malloc(256);
+    snprintf(lines[n++], 256, "add xroute 10.1.%d.0/24-::/0 prefix 10.1.%d.0/24 from ::/0 metric 0", i, i);
+  }
+
+  while (n < count - 1) {
+    int neighbour = routes % BENCH_NEIGHBOURS;
+    lines[n] = malloc(256);
+    snprintf(lines[n++], 256, "add route %x prefix 10.%d.%d.0/24 from 0.0.0.0/0 installed %s "
+      "id 02:0c:42:ff:fe:01:%02x:%02x metric %d refmetric %d via fe80::c:42ff:fe00:%x if wlan%d",
+      0x55d2a0 + routes, 16 + routes / 256, routes % 256, routes % 3 ? "no" : "yes",
+      (routes >> 8) & 0xff, routes & 0xff, 96 + routes % 2000, routes % 2000,
+      0x100 + neighbour, neighbour % 2);
+    routes++;
+  }
+  lines[n++] = strdup("ok");
+  return routes;
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = nw_bench_iterations(argc, argv, 20);
+  static char *lines[BENCH_LINES];
+  static char line[NW_STREAM_CLIENT_MAX_LINE];
+  struct babel_client bc;
+
+  int routes = bench_babel_generate(lines, BENCH_LINES);
+  memset(&bc, 0, sizeof(bc));
+  bc.max_routes = BABEL_MAX_ROUTES;
+  bc.routes_top = 16;
+  avl_init(&bc.neighbours, avl_strcmp, false, NULL);
+  avl_init(&bc.exported_routes, avl_strcmp, false, NULL);
+  avl_init(&bc.routes, avl_strcmp, false, NULL);
+
+  double parse = 0, summarize = 0;
+  for (int n = 0; n < iterations; n++) {
+    /* Lines are tokenized in place, as received from the stream. */
+    double start = nw_bench_now();
+    for (int i = 0; i < BENCH_LINES; i++) {
+      strcpy(line, lines[i]);
+      nw_routing_babel_parse_line(&bc, line);
+    }
+    parse += nw_bench_now() - start;
+
+    NW_TEST_CHECK_INT(bc.neighbours.count, BENCH_NEIGHBOURS);
+    NW_TEST_CHECK_INT(bc.exported_routes.count, BENCH_XROUTES);
+    NW_TEST_CHECK_INT(bc.routes.count, routes);
+    NW_TEST_CHECK_INT(bc.num_prefixes, routes);
+    NW_TEST_CHECK_STR(bc.router_id, "02:0c:42:ff:fe:00:00:01");
+
+    start = nw_bench_now();
+    json_object *summary = nw_routing_babel_summarize_routes(&bc);
+    summarize += nw_bench_now() - start;
+    json_object_put(summary);
+
+    /* State is rebuilt from scratch after every reconnect. */
+    nw_routing_babel_clear_entries(&bc.neighbours);
+    nw_routing_babel_clear_entries(&bc.exported_routes);
+    nw_routing_babel_clear_routes(&bc);
+  }
+
+  printf("babel: %d lines (%d routes), %.1f us per dump, %.2f us per line, %.1f us per summary\n",
+    BENCH_LINES, routes, parse / iterations, parse / iterations / BENCH_LINES, summarize / iterations);
+
+  for (int i = 0; i < BENCH_LINES; i++)
+    free(lines[i]);
+  return nw_test_result();
+}
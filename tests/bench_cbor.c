@@ -0,0 +1,56 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include <nodewatcher-agent/cbor.h>
+
+int main(int argc, char **argv)
+{
+  int iterations = nw_bench_iterations(argc, argv, 1000);
+  struct nw_cbor_buffer buffer = { NULL, };
+
+  /* Feed recorded on a node with a few dozen stations and clients. */
+  char *data = nw_test_read_fixture("feed.json", NULL);
+  json_object *feed = json_tokener_parse(data);
+  free(data);
+  NW_TEST_CHECK(feed != NULL);
+  if (!feed)
+    return nw_test_result();
+
+  size_t json_length = 0;
+  double start = nw_bench_now();
+  for (int n = 0; n < iterations; n++)
+    json_length = strlen(json_object_to_json_string_ext(feed, JSON_C_TO_STRING_PLAIN));
+  double json = (nw_bench_now() - start) / iterations;
+
+  start = nw_bench_now();
+  for (int n = 0; n < iterations; n++)
+    NW_TEST_CHECK_INT(nw_cbor_encode(feed, &buffer), 0);
+  double cbor = (nw_bench_now() - start) / iterations;
+
+  /* Strings repeat across stations and interfaces, so CBOR must be smaller. */
+  NW_TEST_CHECK(buffer.length < json_length);
+
+  printf("cbor: json %zu bytes in %.1f us, cbor %zu bytes (%.0f%%) in %.1f us\n",
+    json_length, json, buffer.length, 100.0 * buffer.length / json_length, cbor);
+
+  nw_cbor_buffer_free(&buffer);
+  json_object_put(feed);
+  return nw_test_result();
+}
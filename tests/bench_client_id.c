@@ -0,0 +1,78 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include <nodewatcher-agent/client_id.h>
+#include <nodewatcher-agent/utils.h>
+
+#include <libubox/md5.h>
+
+/* Number of clients, as in a busy lease file */
+#define BENCH_CLIENTS 1000
+
+/**
+ * Computes a client identifier the way it was done for every lease before
+ * identifiers were cached.
+ */
+static int bench_client_id_uncached(const char *mac, char *client_id)
+{
+  md5_ctx_t ctx;
+  uint8_t raw_mac_id[16];
+
+  md5_begin(&ctx);
+  md5_hash("nw-client-c3U0XX", 16, &ctx);
+  md5_hash(mac, 17, &ctx);
+  md5_end(raw_mac_id, &ctx);
+
+  return nw_base64_encode(raw_mac_id, sizeof(raw_mac_id), client_id, NW_CLIENT_ID_LENGTH + 1);
+}
+
+int main(int argc, char **argv)
+{
+  int iterations = nw_bench_iterations(argc, argv, 1000);
+  static char macs[BENCH_CLIENTS][18];
+  char expected[NW_CLIENT_ID_LENGTH + 1], client_id[NW_CLIENT_ID_LENGTH + 1];
+
+  for (int i = 0; i < BENCH_CLIENTS; i++) {
+    snprintf(macs[i], sizeof(macs[i]), "02:00:5e:%02x:%02x:%02x", (i * 37) & 0xff, i >> 8, i & 0xff);
+
+    /* Cached identifiers must match the ones computed directly */
+    NW_TEST_CHECK(bench_client_id_uncached(macs[i], expected) == 0);
+    NW_TEST_CHECK(nw_client_id_from_string(macs[i], client_id) == 0);
+    NW_TEST_CHECK_STR(client_id, expected);
+  }
+
+  double start = nw_bench_now();
+  for (int n = 0; n < iterations; n++) {
+    for (int i = 0; i < BENCH_CLIENTS; i++)
+      bench_client_id_uncached(macs[i], client_id);
+  }
+  double uncached = (nw_bench_now() - start) / iterations;
+
+  start = nw_bench_now();
+  for (int n = 0; n < iterations; n++) {
+    for (int i = 0; i < BENCH_CLIENTS; i++)
+      nw_client_id_from_string(macs[i], client_id);
+  }
+  double cached = (nw_bench_now() - start) / iterations;
+
+  printf("client_id: %d clients, %.1f us per run uncached, %.1f us per run cached (%.1fx)\n",
+    BENCH_CLIENTS, uncached, cached, cached > 0 ? uncached / cached : 0);
+  return nw_test_result();
+}
@@ -0,0 +1,158 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NODEWATCHER_AGENT_TEST_H
+#define NODEWATCHER_AGENT_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Returns the number of failed checks.
+ */
+static inline int *nw_test_failures(void)
+{
+  static int failures = 0;
+  return &failures;
+}
+
+/* Records a failed check when the condition does not hold */
+#define NW_TEST_CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      (*nw_test_failures())++; \
+    } \
+  } while (0)
+
+/* Records a failed check when two integers differ */
+#define NW_TEST_CHECK_INT(actual, expected) \
+  do { \
+    long long _actual = (actual), _expected = (expected); \
+    if (_actual != _expected) { \
+      fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, _actual, _expected); \
+      (*nw_test_failures())++; \
+    } \
+  } while (0)
+
+/* Records a failed check when two strings differ (NULL never matches) */
+#define NW_TEST_CHECK_STR(actual, expected) \
+  do { \
+    const char *_actual = (actual), *_expected = (expected); \
+    if (!_actual || strcmp(_actual, _expected) != 0) { \
+      fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #actual, \
+        _actual ? _actual : "(null)", _expected); \
+      (*nw_test_failures())++; \
+    } \
+  } while (0)
+
+/**
+ * Returns the process exit status for the recorded checks.
+ */
+static inline int nw_test_result(void)
+{
+  return *nw_test_failures() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Reads a fixture file into a NULL-terminated buffer, which must be freed
+ * by the caller. Missing fixtures abort the test.
+ *
+ * @param name Fixture filename, relative to the fixtures directory
+ * @param length Optional destination for the data length
+ * @return Fixture data
+ */
+static inline char *nw_test_read_fixture(const char *name, size_t *length)
+{
+  char path[512];
+  snprintf(path, sizeof(path), "%s/%s", NW_TEST_FIXTURES, name);
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Unable to open fixture '%s'.\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t size = 4096, used = 0;
+  char *data = malloc(size);
+  for (;;) {
+    if (!data) {
+      fprintf(stderr, "Out of memory while reading fixture '%s'.\n", path);
+      exit(EXIT_FAILURE);
+    }
+
+    used += fread(data + used, 1, size - used - 1, file);
+    if (used < size - 1)
+      break;
+
+    size *= 2;
+    data = realloc(data, size);
+  }
+
+  fclose(file);
+  data[used] = 0;
+  if (length)
+    *length = used;
+  return data;
+}
+
+/**
+ * Creates a private temporary directory. Failures abort the test.
+ *
+ * @param path Destination buffer for the directory path
+ * @param size Size of the destination buffer
+ */
+static inline void nw_test_temp_dir(char *path, size_t size)
+{
+  const char *base = getenv("TMPDIR");
+  snprintf(path, size, "%s/nodewatcher-test-XXXXXX", base ? base : "/tmp");
+  if (!mkdtemp(path)) {
+    fprintf(stderr, "Unable to create temporary directory '%s'.\n", path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Returns monotonic time in microseconds.
+ */
+static inline double nw_bench_now(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+/**
+ * Returns the number of benchmark iterations, which may be overridden by
+ * the first command line argument.
+ *
+ * @param argc Argument count
+ * @param argv Arguments
+ * @param iterations Default number of iterations
+ * @return Number of iterations
+ */
+static inline int nw_bench_iterations(int argc, char **argv, int iterations)
+{
+  if (argc > 1 && atoi(argv[1]) > 0)
+    return atoi(argv[1]);
+  return iterations;
+}
+
+#endif
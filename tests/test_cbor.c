@@ -0,0 +1,284 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../common/cbor.c"
+
+/* Minimal CBOR decoder, covering what the encoder produces */
+struct test_cbor_decoder {
+  const uint8_t *data;
+  size_t length;
+  size_t offset;
+  /* Current stringref table, NULL outside of a namespace */
+  json_object *strings;
+  bool error;
+};
+
+static uint64_t test_cbor_read(struct test_cbor_decoder *dec, size_t length)
+{
+  uint64_t value = 0;
+  if (dec->offset + length > dec->length) {
+    dec->error = true;
+    return 0;
+  }
+
+  for (size_t i = 0; i < length; i++)
+    value = (value << 8) | dec->data[dec->offset++];
+  return value;
+}
+
+static uint8_t test_cbor_read_head(struct test_cbor_decoder *dec, uint8_t *info, uint64_t *value)
+{
+  uint8_t initial = test_cbor_read(dec, 1);
+  *info = initial & 31;
+  if (*info < 24)
+    *value = *info;
+  else if (*info <= 27)
+    *value = test_cbor_read(dec, 1 << (*info - 24));
+  else
+    *value = 0;
+  return initial >> 5;
+}
+
+/**
+ * Returns whether a string of the given length is added to a stringref
+ * table with the given number of strings, as specified for decoders.
+ */
+static bool test_cbor_stringref_added(size_t count, uint64_t length)
+{
+  if (count < 24)
+    return length >= 3;
+  else if (count < 256)
+    return length >= 4;
+  else if (count < 65536)
+    return length >= 5;
+  else if (count < 4294967296ULL)
+    return length >= 7;
+  return length >= 11;
+}
+
+static json_object *test_cbor_decode(struct test_cbor_decoder *dec)
+{
+  uint8_t info;
+  uint64_t value;
+  uint8_t major = test_cbor_read_head(dec, &info, &value);
+  if (dec->error)
+    return NULL;
+
+  switch (major) {
+    case CBOR_UNSIGNED: return json_object_new_int64(value);
+    case CBOR_NEGATIVE: return json_object_new_int64(-1 - (int64_t) value);
+    case CBOR_TEXT: {
+      if (dec->offset + value > dec->length) {
+        dec->error = true;
+        return NULL;
+      }
+
+      json_object *string = json_object_new_string_len((const char*) dec->data + dec->offset, value);
+      dec->offset += value;
+      if (dec->strings && test_cbor_stringref_added(json_object_array_length(dec->strings), value))
+        json_object_array_add(dec->strings, json_object_get(string));
+      return string;
+    }
+    case CBOR_ARRAY: {
+      json_object *array = json_object_new_array();
+      for (uint64_t i = 0; i < value && !dec->error; i++)
+        json_object_array_add(array, test_cbor_decode(dec));
+      return array;
+    }
+    case CBOR_MAP: {
+      json_object *map = json_object_new_object();
+      if (info != 31) {
+        dec->error = true;
+        return map;
+      }
+
+      while (!dec->error) {
+        if (dec->offset < dec->length && dec->data[dec->offset] == CBOR_BREAK) {
+          dec->offset++;
+          break;
+        }
+
+        json_object *key = test_cbor_decode(dec);
+        json_object *item = test_cbor_decode(dec);
+        if (!json_object_is_type(key, json_type_string))
+          dec->error = true;
+        else
+          json_object_object_add(map, json_object_get_string(key), item);
+        json_object_put(key);
+      }
+      return map;
+    }
+    case CBOR_TAG: {
+      if (value == CBOR_TAG_STRINGREF) {
+        json_object *index = test_cbor_decode(dec);
+        json_object *string = dec->strings ? json_object_array_get_idx(dec->strings, json_object_get_int64(index)) : NULL;
+        json_object_put(index);
+        if (!string) {
+          dec->error = true;
+          return NULL;
+        }
+        return json_object_new_string(json_object_get_string(string));
+      } else if (value == CBOR_TAG_STRINGREF_NAMESPACE) {
+        json_object *outer = dec->strings;
+        dec->strings = json_object_new_array();
+        json_object *item = test_cbor_decode(dec);
+        json_object_put(dec->strings);
+        dec->strings = outer;
+        return item;
+      }
+
+      return test_cbor_decode(dec);
+    }
+    default: {
+      switch ((major << 5) | info) {
+        case CBOR_FALSE: return json_object_new_boolean(false);
+        case CBOR_TRUE: return json_object_new_boolean(true);
+        case CBOR_NULL: return NULL;
+        case CBOR_FLOAT32: {
+          uint32_t bits = value;
+          float single;
+          memcpy(&single, &bits, sizeof(single));
+          return json_object_new_double(single);
+        }
+        case CBOR_FLOAT64: {
+          double number;
+          memcpy(&number, &value, sizeof(number));
+          return json_object_new_double(number);
+        }
+        default: dec->error = true; return NULL;
+      }
+    }
+  }
+}
+
+/**
+ * Compares two JSON object trees, ignoring the order of object members.
+ */
+static bool test_cbor_equal(json_object *a, json_object *b)
+{
+  if (!a || !b)
+    return a == b;
+  if (json_object_get_type(a) != json_object_get_type(b))
+    return false;
+
+  switch (json_object_get_type(a)) {
+    case json_type_boolean: return json_object_get_boolean(a) == json_object_get_boolean(b);
+    case json_type_int: return json_object_get_int64(a) == json_object_get_int64(b);
+    case json_type_double: return json_object_get_double(a) == json_object_get_double(b);
+    case json_type_string: return !strcmp(json_object_get_string(a), json_object_get_string(b));
+    case json_type_array: {
+      int length = json_object_array_length(a);
+      if (length != json_object_array_length(b))
+        return false;
+      for (int i = 0; i < length; i++) {
+        if (!test_cbor_equal(json_object_array_get_idx(a, i), json_object_array_get_idx(b, i)))
+          return false;
+      }
+      return true;
+    }
+    case json_type_object: {
+      int members = 0;
+      json_object_object_foreach(a, key, value) {
+        json_object *other;
+        if (!json_object_object_get_ex(b, key, &other) || !test_cbor_equal(value, other))
+          return false;
+        members++;
+      }
+      json_object_object_foreach(b, other_key, other_value) {
+        (void) other_key;
+        (void) other_value;
+        members--;
+      }
+      return members == 0;
+    }
+    default: return true;
+  }
+}
+
+/**
+ * Encodes an object, decodes the result and checks that it matches.
+ */
+static void test_cbor_round_trip(json_object *object, struct nw_cbor_buffer *buffer)
+{
+  NW_TEST_CHECK_INT(nw_cbor_encode(object, buffer), 0);
+
+  struct test_cbor_decoder dec = { .data = buffer->data, .length = buffer->length, };
+  json_object *decoded = test_cbor_decode(&dec);
+  NW_TEST_CHECK(!dec.error);
+  NW_TEST_CHECK_INT(dec.offset, buffer->length);
+  NW_TEST_CHECK(test_cbor_equal(object, decoded));
+  json_object_put(decoded);
+}
+
+int main(int argc, char **argv)
+{
+  struct nw_cbor_buffer buffer = { NULL, };
+
+  /* Minimum string lengths at the boundaries of stringref index sizes. */
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(0), 3);
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(23), 3);
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(24), 4);
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(255), 4);
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(256), 5);
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(65535), 5);
+  NW_TEST_CHECK_INT(nw_cbor_stringref_min_length(65536), 7);
+
+  /* Repeated strings are replaced by references, short ones are not. */
+  json_object *object = json_object_new_object();
+  json_object_object_add(object, "abc", json_object_new_string("abc"));
+  json_object_object_add(object, "ab", json_object_new_string("ab"));
+  const uint8_t expected[] = {
+    0xd9, 0xd9, 0xf7, 0xd9, 0x01, 0x00, 0xbf,
+    0x63, 'a', 'b', 'c', 0xd8, 0x19, 0x00,
+    0x62, 'a', 'b', 0x62, 'a', 'b',
+    0xff,
+  };
+  NW_TEST_CHECK_INT(nw_cbor_encode(object, &buffer), 0);
+  NW_TEST_CHECK_INT(buffer.length, sizeof(expected));
+  NW_TEST_CHECK(buffer.length == sizeof(expected) && !memcmp(buffer.data, expected, sizeof(expected)));
+  test_cbor_round_trip(object, &buffer);
+  json_object_put(object);
+
+  /* Strings of all lengths around the thresholds, so the table passes each index size. */
+  object = json_object_new_array();
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 70000; i++) {
+      char string[16];
+      snprintf(string, sizeof(string), "%0*d", 3 + i % 6, i);
+      json_object_array_add(object, json_object_new_string(string));
+    }
+  }
+  test_cbor_round_trip(object, &buffer);
+  json_object_put(object);
+
+  /* A recorded feed, with all value types. */
+  char *data = nw_test_read_fixture("feed.json", NULL);
+  object = json_tokener_parse(data);
+  NW_TEST_CHECK(object != NULL);
+  json_object_object_add(object, "null", NULL);
+  json_object_object_add(object, "negative", json_object_new_int64(-1234567890123LL));
+  json_object_object_add(object, "large", json_object_new_int64(INT64_MAX));
+  test_cbor_round_trip(object, &buffer);
+  json_object_put(object);
+  free(data);
+
+  nw_cbor_buffer_free(&buffer);
+  return nw_test_result();
+}
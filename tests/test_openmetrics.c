@@ -0,0 +1,138 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include <nodewatcher-agent/openmetrics.h>
+
+/* Maximum number of metric families in the rendered feed */
+#define TEST_OPENMETRICS_MAX_FAMILIES 64
+
+/**
+ * Returns the metric name of a sample line, which ends at the label set
+ * or at the value.
+ */
+static size_t test_openmetrics_name_length(const char *line)
+{
+  return strcspn(line, "{ \n");
+}
+
+/**
+ * Checks that every family is declared once, that its samples directly
+ * follow its header and that only counter samples carry a _total suffix.
+ *
+ * @return Number of families
+ */
+static int test_openmetrics_check_families(const char *data)
+{
+  char families[TEST_OPENMETRICS_MAX_FAMILIES][128];
+  int count = 0;
+  char family[128] = { 0, };
+  bool counter = false;
+
+  for (const char *line = data; *line; line = strchr(line, '\n') + 1) {
+    size_t length = strcspn(line, "\n");
+    NW_TEST_CHECK(line[length] == '\n');
+    if (!line[length])
+      break;
+
+    char type[16];
+    if (strncmp(line, "# TYPE ", 7) == 0) {
+      NW_TEST_CHECK_INT(sscanf(line, "# TYPE %127s %15s", family, type), 2);
+      counter = strcmp(type, "counter") == 0;
+      NW_TEST_CHECK(counter || strcmp(type, "gauge") == 0);
+      NW_TEST_CHECK(strlen(family) < 6 || strcmp(family + strlen(family) - 6, "_total") != 0);
+
+      for (int i = 0; i < count; i++) {
+        if (strcmp(families[i], family) == 0) {
+          fprintf(stderr, "Family '%s' is declared more than once.\n", family);
+          NW_TEST_CHECK(false);
+        }
+      }
+      NW_TEST_CHECK(count < TEST_OPENMETRICS_MAX_FAMILIES);
+      if (count < TEST_OPENMETRICS_MAX_FAMILIES)
+        snprintf(families[count++], sizeof(families[0]), "%s", family);
+    } else if (strncmp(line, "# HELP ", 7) == 0) {
+      NW_TEST_CHECK(strncmp(line + 7, family, strlen(family)) == 0 && line[7 + strlen(family)] == ' ');
+    } else if (strncmp(line, "# EOF", 5) == 0) {
+      NW_TEST_CHECK_STR(line, "# EOF\n");
+    } else {
+      /* Samples belong to the most recently declared family. */
+      char expected[136];
+      snprintf(expected, sizeof(expected), "%s%s", family, counter ? "_total" : "");
+      size_t name_length = test_openmetrics_name_length(line);
+      if (name_length != strlen(expected) || strncmp(line, expected, name_length) != 0) {
+        fprintf(stderr, "Sample '%.*s' does not belong to family '%s'.\n", (int) length, line, family);
+        NW_TEST_CHECK(false);
+      }
+    }
+  }
+
+  return count;
+}
+
+int main(int argc, char **argv)
+{
+  char *fixture = nw_test_read_fixture("feed.json", NULL);
+  json_object *feed = json_tokener_parse(fixture);
+  free(fixture);
+  NW_TEST_CHECK(feed != NULL);
+
+  /* Label values with characters that must be escaped. */
+  json_object *interfaces, *wireless, *device = json_object_new_object();
+  json_object_object_add(device, "up", json_object_new_boolean(true));
+  NW_TEST_CHECK(json_object_object_get_ex(feed, "core.interfaces", &interfaces));
+  json_object_object_add(interfaces, "we\"ird\\if\n", device);
+
+  /* Stations of a delta encoded interface are only counted. */
+  json_object *wireless_interfaces, *delta, *unchanged = json_object_new_array();
+  json_object_array_add(unchanged, json_object_new_string("Ry2rZ0q1T1a8Yq0Tg3TbAQ"));
+  NW_TEST_CHECK(json_object_object_get_ex(feed, "core.wireless", &wireless));
+  NW_TEST_CHECK(json_object_object_get_ex(wireless, "interfaces", &wireless_interfaces));
+  NW_TEST_CHECK(json_object_object_get_ex(wireless_interfaces, "wlan0-1", &delta));
+  json_object_object_add(delta, "stations_unchanged", unchanged);
+
+  struct nw_openmetrics_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  NW_TEST_CHECK_INT(nw_openmetrics_render(feed, &buffer), 0);
+  NW_TEST_CHECK(buffer.data && strlen(buffer.data) == buffer.length);
+  if (!buffer.data)
+    return nw_test_result();
+
+  NW_TEST_CHECK(test_openmetrics_check_families(buffer.data) > 20);
+
+  /* Output is terminated by a single EOF marker. */
+  NW_TEST_CHECK(buffer.length >= 6 && strcmp(buffer.data + buffer.length - 6, "# EOF\n") == 0);
+  NW_TEST_CHECK(strstr(buffer.data, "# EOF") == buffer.data + buffer.length - 6);
+
+  /* Counter samples carry the _total suffix, their family does not. */
+  NW_TEST_CHECK(strstr(buffer.data, "# TYPE nodewatcher_interface_receive_bytes counter\n"));
+  NW_TEST_CHECK(strstr(buffer.data, "\nnodewatcher_interface_receive_bytes_total{interface=\"wlan0\"} 3874158451\n"));
+  NW_TEST_CHECK(strstr(buffer.data, "# TYPE nodewatcher_memory_bytes gauge\n"));
+  NW_TEST_CHECK(strstr(buffer.data, "\nnodewatcher_memory_bytes{type=\"total\"} 29544448\n"));
+
+  NW_TEST_CHECK(strstr(buffer.data, "\nnodewatcher_interface_up{interface=\"we\\\"ird\\\\if\\n\"} 1\n"));
+
+  NW_TEST_CHECK(strstr(buffer.data, "\nnodewatcher_wireless_stations{interface=\"wlan0-1\"} 7\n"));
+  NW_TEST_CHECK(strstr(buffer.data, "{interface=\"wlan0\",client_id="));
+  NW_TEST_CHECK(!strstr(buffer.data, "{interface=\"wlan0-1\",client_id="));
+
+  nw_openmetrics_buffer_free(&buffer);
+  json_object_put(feed);
+  return nw_test_result();
+}
@@ -0,0 +1,221 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include <nodewatcher-agent/cbor.h>
+#include <nodewatcher-agent/module.h>
+
+/* Feed handed to new stream subscribers in place of the module registry */
+static json_object *test_output_feed;
+/* Number of CBOR encodings performed by the output code */
+static int test_output_encodings;
+
+static json_object *test_output_get_output(void)
+{
+  return json_object_get(test_output_feed);
+}
+
+static int test_output_cbor_encode(json_object *object, struct nw_cbor_buffer *buffer)
+{
+  test_output_encodings++;
+  return nw_cbor_encode(object, buffer);
+}
+
+/* The output code is redirected to the test feed and its encodings counted */
+#define nw_module_get_output test_output_get_output
+#define nw_cbor_encode test_output_cbor_encode
+#include "../common/output.c"
+
+/**
+ * Reads a whole file into a buffer, which must be freed by the caller.
+ *
+ * @param path File path
+ * @param length Destination for the data length
+ * @return File data or NULL when the file can not be read
+ */
+static char *test_output_read_file(const char *path, size_t *length)
+{
+  *length = 0;
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  size_t size = 4096;
+  char *data = malloc(size);
+  while (data) {
+    *length += fread(data + *length, 1, size - *length, file);
+    if (*length < size)
+      break;
+
+    size *= 2;
+    data = realloc(data, size);
+  }
+
+  fclose(file);
+  return data;
+}
+
+/**
+ * Checks that a file contains exactly the given data.
+ */
+static void test_output_check_file(const char *path, const char *expected, size_t expected_length)
+{
+  size_t length;
+  char *data = test_output_read_file(path, &length);
+  NW_TEST_CHECK(data != NULL);
+  NW_TEST_CHECK_INT(length, expected_length);
+  NW_TEST_CHECK(data && length == expected_length && memcmp(data, expected, length) == 0);
+  free(data);
+}
+
+static struct nw_output_sink *test_output_register(struct nw_output_sink *sink,
+                                                   const char *name,
+                                                   enum nw_output_format format)
+{
+  if (!sink) {
+    fprintf(stderr, "Unable to create output sink '%s'.\n", name);
+    exit(EXIT_FAILURE);
+  }
+
+  snprintf(sink->name, sizeof(sink->name), "%s", name);
+  sink->format = format;
+  nw_output_register_sink(sink);
+  return sink;
+}
+
+static struct nw_output_stream_sink *test_output_stream;
+static int test_output_polls;
+
+static void test_output_poll(struct uloop_timeout *timeout)
+{
+  /* Stop once the subscriber has been accepted or after five seconds. */
+  if (test_output_stream->num_clients > 0 || ++test_output_polls > 500) {
+    uloop_end();
+    return;
+  }
+
+  uloop_timeout_set(timeout, 10);
+}
+
+int main(int argc, char **argv)
+{
+  char *fixture = nw_test_read_fixture("feed.json", NULL);
+  test_output_feed = json_tokener_parse(fixture);
+  free(fixture);
+  NW_TEST_CHECK(test_output_feed != NULL);
+
+  const char *json = json_object_to_json_string(test_output_feed);
+  size_t json_length = strlen(json);
+  struct nw_cbor_buffer cbor;
+  memset(&cbor, 0, sizeof(cbor));
+  NW_TEST_CHECK_INT(nw_cbor_encode(test_output_feed, &cbor), 0);
+
+  char directory[64], json_path[128], json_temporary[128], cbor_path[128], copy_path[128], stream_path[128];
+  nw_test_temp_dir(directory, sizeof(directory));
+  snprintf(json_path, sizeof(json_path), "%s/feed.json", directory);
+  snprintf(json_temporary, sizeof(json_temporary), "%s/feed.json.tmp", directory);
+  snprintf(cbor_path, sizeof(cbor_path), "%s/feed.cbor", directory);
+  snprintf(copy_path, sizeof(copy_path), "%s/copy.cbor", directory);
+  snprintf(stream_path, sizeof(stream_path), "%s/feed.sock", directory);
+
+  /* A previous feed is replaced by renaming, not by rewriting it in place. */
+  FILE *stale = fopen(json_path, "w");
+  NW_TEST_CHECK(stale != NULL);
+  if (stale)
+    fclose(stale);
+  struct stat before, after;
+  NW_TEST_CHECK_INT(stat(json_path, &before), 0);
+
+  uloop_init();
+  test_output_register(nw_output_file_create(json_path), "json", NW_OUTPUT_FORMAT_JSON);
+  test_output_register(nw_output_file_create(cbor_path), "cbor", NW_OUTPUT_FORMAT_CBOR);
+  test_output_register(nw_output_file_create(copy_path), "copy", NW_OUTPUT_FORMAT_CBOR);
+  struct nw_output_sink *sink = test_output_register(nw_output_stream_create(stream_path), "stream",
+                                                     NW_OUTPUT_FORMAT_JSON);
+  test_output_stream = container_of(sink, struct nw_output_stream_sink, sink);
+  NW_TEST_CHECK(!nw_output_stream_is_active(sink));
+
+  /* A new subscriber immediately receives the current feed and a newline. */
+  int subscriber = usock(USOCK_UNIX, stream_path, NULL);
+  NW_TEST_CHECK(subscriber >= 0);
+  struct uloop_timeout poll = { .cb = test_output_poll };
+  uloop_timeout_set(&poll, 10);
+  uloop_run();
+  uloop_timeout_cancel(&poll);
+  NW_TEST_CHECK_INT(test_output_stream->num_clients, 1);
+  NW_TEST_CHECK(nw_output_stream_is_active(sink));
+
+  char *received = malloc(json_length + 1);
+  size_t received_length = 0;
+  while (received_length < json_length + 1) {
+    ssize_t result = read(subscriber, received + received_length, json_length + 1 - received_length);
+    if (result <= 0)
+      break;
+    received_length += result;
+  }
+  NW_TEST_CHECK_INT(received_length, json_length + 1);
+  NW_TEST_CHECK(received_length == json_length + 1 && memcmp(received, json, json_length) == 0);
+  NW_TEST_CHECK(received_length == json_length + 1 && received[json_length] == '\n');
+  free(received);
+
+  /* Sinks of the same format share one serialization. */
+  test_output_encodings = 0;
+  nw_output_export(test_output_feed);
+  NW_TEST_CHECK_INT(test_output_encodings, 1);
+
+  /* Files are replaced atomically, JSON ends with a newline, CBOR is raw. */
+  NW_TEST_CHECK_INT(stat(json_path, &after), 0);
+  NW_TEST_CHECK(before.st_ino != after.st_ino);
+  NW_TEST_CHECK(access(json_temporary, F_OK) != 0);
+  char *json_line = malloc(json_length + 1);
+  memcpy(json_line, json, json_length);
+  json_line[json_length] = '\n';
+  test_output_check_file(json_path, json_line, json_length + 1);
+  free(json_line);
+  test_output_check_file(cbor_path, (const char*) cbor.data, cbor.length);
+  test_output_check_file(copy_path, (const char*) cbor.data, cbor.length);
+
+  /* A subscriber that stops reading is dropped once its backlog is full. */
+  for (int i = 0; i < 256 && test_output_stream->num_clients > 0; i++)
+    nw_output_export(test_output_feed);
+  NW_TEST_CHECK_INT(test_output_stream->num_clients, 0);
+  NW_TEST_CHECK(!nw_output_stream_is_active(sink));
+
+  /* The dropped subscriber sees the end of the stream after the sent data. */
+  if (!test_output_stream->num_clients) {
+    char buffer[4096];
+    ssize_t result;
+    while ((result = read(subscriber, buffer, sizeof(buffer))) > 0);
+    NW_TEST_CHECK_INT(result, 0);
+  }
+  close(subscriber);
+
+  uloop_fd_delete(&test_output_stream->server);
+  close(test_output_stream->server.fd);
+  uloop_done();
+  unlink(json_path);
+  unlink(cbor_path);
+  unlink(copy_path);
+  unlink(stream_path);
+  rmdir(directory);
+
+  nw_cbor_buffer_free(&cbor);
+  json_object_put(test_output_feed);
+  return nw_test_result();
+}
@@ -0,0 +1,134 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../modules/routing_babel.c"
+
+/**
+ * Returns the per-neighbour route summary for the given next hop.
+ */
+static json_object *test_babel_neighbour(json_object *summary, const char *address)
+{
+  json_object *neighbours;
+  if (!json_object_object_get_ex(summary, "neighbours", &neighbours))
+    return NULL;
+
+  for (size_t i = 0; i < json_object_array_length(neighbours); i++) {
+    json_object *neighbour = json_object_array_get_idx(neighbours, i), *value;
+    if (json_object_object_get_ex(neighbour, "address", &value) &&
+        !strcmp(json_object_get_string(value), address))
+      return neighbour;
+  }
+
+  return NULL;
+}
+
+static int test_babel_get_int(json_object *object, const char *key)
+{
+  json_object *value;
+  if (!object || !json_object_object_get_ex(object, key, &value))
+    return -1;
+  return json_object_get_int(value);
+}
+
+static const char *test_babel_get_string(json_object *object, const char *key)
+{
+  json_object *value;
+  if (!object || !json_object_object_get_ex(object, key, &value))
+    return NULL;
+  return json_object_get_string(value);
+}
+
+int main(int argc, char **argv)
+{
+  struct babel_client bc;
+  memset(&bc, 0, sizeof(bc));
+  bc.reconnect_delay = BABEL_RECONNECT_MAX;
+  bc.max_routes = BABEL_MAX_ROUTES;
+  bc.routes_top = 2;
+  avl_init(&bc.neighbours, avl_strcmp, false, NULL);
+  avl_init(&bc.exported_routes, avl_strcmp, false, NULL);
+  avl_init(&bc.routes, avl_strcmp, false, NULL);
+
+  /* Feed the recorded dump line by line. */
+  char *dump = nw_test_read_fixture("babel_dump.txt", NULL);
+  char *line = dump;
+  while (*line) {
+    char *newline = strchr(line, '\n');
+    if (newline)
+      *newline = 0;
+
+    /* The backoff is only reset by the reply that follows the dump. */
+    if (!strcmp(line, "ok") && !bc.replies)
+      NW_TEST_CHECK_INT(bc.reconnect_delay, BABEL_RECONNECT_MAX);
+
+    nw_routing_babel_parse_line(&bc, line);
+    if (!newline)
+      break;
+    line = newline + 1;
+  }
+  free(dump);
+
+  NW_TEST_CHECK_INT(bc.reconnect_delay, BABEL_RECONNECT_MIN);
+  NW_TEST_CHECK_STR(bc.router_id, "02:0c:42:ff:fe:00:00:01");
+  NW_TEST_CHECK_INT(bc.neighbours.count, 2);
+  NW_TEST_CHECK_INT(bc.exported_routes.count, 1);
+  NW_TEST_CHECK_INT(bc.routes.count, 6);
+  NW_TEST_CHECK_INT(bc.num_prefixes, 5);
+
+  json_object *summary = nw_routing_babel_summarize_routes(&bc);
+  NW_TEST_CHECK_INT(test_babel_get_int(summary, "total"), 6);
+  NW_TEST_CHECK_INT(test_babel_get_int(summary, "installed"), 4);
+
+  /* Routes are counted per next hop, which requires the via key to be parsed. */
+  json_object *wlan = test_babel_neighbour(summary, "fe80::c:42ff:fe00:101");
+  NW_TEST_CHECK_STR(test_babel_get_string(wlan, "interface"), "wlan0");
+  NW_TEST_CHECK_INT(test_babel_get_int(wlan, "routes"), 3);
+  NW_TEST_CHECK_INT(test_babel_get_int(wlan, "installed"), 3);
+
+  json_object *eth = test_babel_neighbour(summary, "fe80::c:42ff:fe00:102");
+  NW_TEST_CHECK_STR(test_babel_get_string(eth, "interface"), "eth0");
+  NW_TEST_CHECK_INT(test_babel_get_int(eth, "routes"), 3);
+  NW_TEST_CHECK_INT(test_babel_get_int(eth, "installed"), 1);
+  NW_TEST_CHECK(!test_babel_neighbour(summary, "::"));
+
+  /* Installed routes with the highest metrics. */
+  json_object *top;
+  NW_TEST_CHECK(json_object_object_get_ex(summary, "top", &top));
+  NW_TEST_CHECK_INT(json_object_array_length(top), 2);
+  json_object *first = json_object_array_get_idx(top, 0);
+  NW_TEST_CHECK_STR(test_babel_get_string(first, "dst_prefix"), "10.4.0.0/16");
+  NW_TEST_CHECK_INT(test_babel_get_int(first, "metric"), 1280);
+  NW_TEST_CHECK_STR(test_babel_get_string(first, "via"), "fe80::c:42ff:fe00:102");
+  json_object *second = json_object_array_get_idx(top, 1);
+  NW_TEST_CHECK_STR(test_babel_get_string(second, "dst_prefix"), "10.3.0.0/24");
+  NW_TEST_CHECK_STR(test_babel_get_string(second, "via"), "fe80::c:42ff:fe00:101");
+  json_object_put(summary);
+
+  /* Flushing a route releases its prefix. */
+  char flush[] = "flush route 55d2f0";
+  nw_routing_babel_parse_line(&bc, flush);
+  NW_TEST_CHECK_INT(bc.routes.count, 5);
+  NW_TEST_CHECK_INT(bc.num_prefixes, 4);
+
+  nw_routing_babel_clear_entries(&bc.neighbours);
+  nw_routing_babel_clear_entries(&bc.exported_routes);
+  nw_routing_babel_clear_routes(&bc);
+  return nw_test_result();
+}
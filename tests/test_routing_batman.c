@@ -0,0 +1,120 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../modules/routing_batman.c"
+
+/* Generic netlink message as received from batman-adv */
+struct test_batman_message {
+  struct nlmsghdr hdr;
+  struct genlmsghdr genl;
+  char attrs[128];
+};
+
+static const uint8_t neighbour_a[ETH_ALEN] = { 0x02, 0xca, 0xfe, 0x00, 0x00, 0x01 };
+static const uint8_t neighbour_b[ETH_ALEN] = { 0x02, 0xca, 0xfe, 0x00, 0x00, 0x02 };
+static const uint8_t originator_c[ETH_ALEN] = { 0x02, 0xca, 0xfe, 0x00, 0x00, 0x03 };
+
+static void test_batman_prepare(struct test_batman_message *msg, uint8_t cmd)
+{
+  memset(msg, 0, sizeof(*msg));
+  msg->hdr.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+  msg->genl.cmd = cmd;
+  msg->genl.version = 1;
+}
+
+static void test_batman_neighbour(struct batman_mesh *mesh, const uint8_t *address, uint32_t hard_ifindex)
+{
+  struct test_batman_message msg;
+  test_batman_prepare(&msg, BATADV_CMD_GET_NEIGHBORS);
+  nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_NEIGH_ADDRESS, address, ETH_ALEN);
+  nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_HARD_IFINDEX, &hard_ifindex, sizeof(hard_ifindex));
+  nw_routing_batman_parse_neighbour(&msg.hdr, mesh);
+}
+
+/**
+ * Feeds an originator entry to the parser. Attributes are only included
+ * when the corresponding argument is set.
+ */
+static void test_batman_originator(struct batman_mesh *mesh,
+                                   const uint8_t *orig,
+                                   const uint8_t *neigh,
+                                   uint32_t hard_ifindex,
+                                   uint8_t tq,
+                                   bool best)
+{
+  struct test_batman_message msg;
+  test_batman_prepare(&msg, BATADV_CMD_GET_ORIGINATORS);
+  if (orig)
+    NW_TEST_CHECK(nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_ORIG_ADDRESS, orig, ETH_ALEN) == 0);
+  if (neigh)
+    NW_TEST_CHECK(nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_NEIGH_ADDRESS, neigh, ETH_ALEN) == 0);
+  if (hard_ifindex)
+    NW_TEST_CHECK(nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_HARD_IFINDEX, &hard_ifindex, sizeof(hard_ifindex)) == 0);
+  if (tq)
+    NW_TEST_CHECK(nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_TQ, &tq, sizeof(tq)) == 0);
+  if (best)
+    NW_TEST_CHECK(nw_netlink_put_attr(&msg.hdr, sizeof(msg), BATADV_ATTR_FLAG_BEST, NULL, 0) == 0);
+  nw_routing_batman_parse_originator(&msg.hdr, mesh);
+}
+
+static int test_batman_lq(json_object *neighbour)
+{
+  json_object *value;
+  if (!json_object_object_get_ex(neighbour, "lq", &value))
+    return -1;
+  return json_object_get_int(value);
+}
+
+int main(int argc, char **argv)
+{
+  struct batman_mesh *mesh = calloc(1, sizeof(struct batman_mesh));
+  mesh->object = json_object_new_object();
+  mesh->neighbours = json_object_new_array();
+  json_object_object_add(mesh->object, "neighbours", mesh->neighbours);
+
+  test_batman_neighbour(mesh, neighbour_a, 3);
+  test_batman_neighbour(mesh, neighbour_b, 4);
+  NW_TEST_CHECK_INT(mesh->num_entries, 2);
+
+  /* Best route towards a direct neighbour carries its link quality. */
+  test_batman_originator(mesh, neighbour_a, neighbour_a, 3, 243, true);
+  /* Routes that are not the best ones are not counted. */
+  test_batman_originator(mesh, neighbour_b, neighbour_b, 4, 120, false);
+  /* Originators behind a neighbour are counted without link quality. */
+  test_batman_originator(mesh, originator_c, neighbour_b, 4, 180, true);
+  /* Link quality is only matched on the same hard interface. */
+  test_batman_originator(mesh, neighbour_b, neighbour_b, 5, 90, true);
+  /* Incomplete entries are ignored. */
+  test_batman_originator(mesh, originator_c, NULL, 4, 180, true);
+  test_batman_originator(mesh, NULL, neighbour_a, 3, 180, true);
+
+  NW_TEST_CHECK_INT(mesh->originators, 3);
+  NW_TEST_CHECK_INT(test_batman_lq(mesh->entries[0].object), 243);
+  NW_TEST_CHECK_INT(test_batman_lq(mesh->entries[1].object), -1);
+
+  /* Entries without a hard interface match any neighbour with that address. */
+  test_batman_originator(mesh, neighbour_b, neighbour_b, 0, 77, true);
+  NW_TEST_CHECK_INT(mesh->originators, 4);
+  NW_TEST_CHECK_INT(test_batman_lq(mesh->entries[1].object), 77);
+
+  json_object_put(mesh->object);
+  free(mesh);
+  return nw_test_result();
+}
@@ -0,0 +1,239 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../modules/routing_olsr.c"
+
+#include <libubox/usock.h>
+
+static const char *test_olsr_get_string(json_object *object, const char *key)
+{
+  json_object *value;
+  if (!object || !json_object_object_get_ex(object, key, &value))
+    return NULL;
+  return json_object_get_string(value);
+}
+
+static double test_olsr_get_double(json_object *object, const char *key)
+{
+  json_object *value;
+  if (!object || !json_object_object_get_ex(object, key, &value))
+    return -1;
+  return json_object_get_double(value);
+}
+
+/**
+ * Parses a jsoninfo response fed in chunks of the given size and resolves
+ * the neighbour interfaces.
+ */
+static json_object *test_olsr_parse(const char *data, size_t length, size_t chunk)
+{
+  struct olsr_client oc;
+  memset(&oc, 0, sizeof(oc));
+  oc.object = json_object_new_object();
+  oc.link_local = json_object_new_array();
+  json_object_object_add(oc.object, "link_local", oc.link_local);
+  oc.neighbours = json_object_new_array();
+  json_object_object_add(oc.object, "neighbours", oc.neighbours);
+  nw_json_stream_init(&oc.session.parser, nw_routing_olsr_parse, &oc);
+
+  int result = 0;
+  for (size_t offset = 0; offset < length; offset += chunk) {
+    NW_TEST_CHECK(result >= 0);
+    result = nw_json_stream_parse(&oc.session.parser, data + offset, length - offset < chunk ? length - offset : chunk);
+  }
+  NW_TEST_CHECK_INT(result, 1);
+
+  nw_routing_olsr_resolve_links(&oc);
+  free(oc.interfaces);
+  free(oc.links);
+  return oc.object;
+}
+
+/* Local jsoninfo server answering a single request. */
+static struct {
+  struct uloop_fd listener;
+  struct uloop_fd connection;
+  const char *response;
+  size_t length;
+  char request[64];
+  size_t request_length;
+} server;
+
+static void test_olsr_server_read(struct uloop_fd *fd, unsigned int events)
+{
+  ssize_t result = read(fd->fd, server.request + server.request_length,
+                        sizeof(server.request) - server.request_length - 1);
+  if (result > 0) {
+    server.request_length += result;
+    server.request[server.request_length] = 0;
+    if (!strchr(server.request, '\n') && server.request_length < sizeof(server.request) - 1)
+      return;
+
+    /* Respond in small writes, so the response arrives in several reads. */
+    for (size_t offset = 0; offset < server.length; offset += 512) {
+      size_t chunk = server.length - offset < 512 ? server.length - offset : 512;
+      if (write(fd->fd, server.response + offset, chunk) != (ssize_t) chunk)
+        break;
+    }
+  }
+
+  uloop_fd_delete(fd);
+  close(fd->fd);
+}
+
+static void test_olsr_server_accept(struct uloop_fd *fd, unsigned int events)
+{
+  int connection = accept(fd->fd, NULL, NULL);
+  if (connection < 0)
+    return;
+
+  server.connection.fd = connection;
+  server.connection.cb = test_olsr_server_read;
+  uloop_fd_add(&server.connection, ULOOP_READ);
+}
+
+static int test_olsr_polls;
+
+static void test_olsr_poll(struct uloop_timeout *timeout)
+{
+  /* Stop once all instances are done or after five seconds. */
+  if (!ol.pending || ++test_olsr_polls > 500) {
+    uloop_end();
+    return;
+  }
+
+  uloop_timeout_set(timeout, 10);
+}
+
+/**
+ * Serves a jsoninfo response over a unix socket and acquires module data
+ * from it under uloop.
+ */
+static void test_olsr_acquire(const char *data, size_t length)
+{
+  /* Configure a single instance like the module does for a routing_olsr
+     section with a path option. */
+  struct nw_endpoint endpoint;
+  char directory[64];
+  memset(&endpoint, 0, sizeof(endpoint));
+  nw_test_temp_dir(directory, sizeof(directory));
+  snprintf(endpoint.name, sizeof(endpoint.name), "test");
+  snprintf(endpoint.path, sizeof(endpoint.path), "%s/jsoninfo.sock", directory);
+  endpoint.timeout = OLSR_TIMEOUT;
+
+  uloop_init();
+  server.response = data;
+  server.length = length;
+  server.listener.fd = usock(USOCK_UNIX | USOCK_SERVER | USOCK_NONBLOCK, endpoint.path, NULL);
+  NW_TEST_CHECK(server.listener.fd >= 0);
+  server.listener.cb = test_olsr_server_accept;
+  uloop_fd_add(&server.listener, ULOOP_READ);
+
+  ol.module = &nw_module;
+  ol.num_instances = 1;
+  ol.instances = calloc(1, sizeof(struct olsr_client));
+  nw_stream_client_init(&ol.instances[0].session, &endpoint, NW_STREAM_CLIENT_JSON);
+  ol.instances[0].session.max_bytes = OLSR_MAX_RESPONSE;
+  ol.instances[0].session.request = "/config/interfaces/links\n";
+  ol.instances[0].session.closed = nw_routing_olsr_session_closed;
+
+  NW_TEST_CHECK_INT(nw_routing_olsr_start_acquire_data(&nw_module, NULL, NULL), 0);
+  NW_TEST_CHECK_INT(ol.pending, 1);
+
+  struct uloop_timeout poll = { .cb = test_olsr_poll };
+  uloop_timeout_set(&poll, 10);
+  uloop_run();
+  uloop_timeout_cancel(&poll);
+  uloop_timeout_cancel(&nw_module.sched_timeout);
+
+  NW_TEST_CHECK_INT(ol.pending, 0);
+  NW_TEST_CHECK_STR(server.request, "/config/interfaces/links\n");
+
+  json_object *object = nw_module.data, *neighbours, *session;
+  NW_TEST_CHECK_STR(test_olsr_get_string(object, "router_id"), "10.254.1.1");
+  NW_TEST_CHECK(json_object_object_get_ex(object, "neighbours", &neighbours));
+  NW_TEST_CHECK_INT(json_object_array_length(neighbours), 3);
+  NW_TEST_CHECK_STR(test_olsr_get_string(json_object_array_get_idx(neighbours, 0), "interface"), "wlan0");
+  NW_TEST_CHECK_STR(test_olsr_get_string(json_object_array_get_idx(neighbours, 1), "interface"), "eth0");
+  NW_TEST_CHECK(json_object_object_get_ex(object, "session", &session));
+  NW_TEST_CHECK(test_olsr_get_double(session, "bytes") > 0);
+
+  uloop_fd_delete(&server.listener);
+  close(server.listener.fd);
+  uloop_done();
+  unlink(endpoint.path);
+  rmdir(directory);
+
+  json_object_put(nw_module.data);
+  nw_module.data = NULL;
+  free(ol.instances);
+  ol.instances = NULL;
+}
+
+int main(int argc, char **argv)
+{
+  size_t length;
+  char *data = nw_test_read_fixture("olsr_jsoninfo.json", &length);
+
+  /* Links are reported before interfaces in the recorded response. */
+  const size_t chunks[] = { 1, 7, 100, 4096 };
+  for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+    json_object *object = test_olsr_parse(data, length, chunks[c]);
+    json_object *neighbours, *link_local, *exported_routes;
+
+    NW_TEST_CHECK_STR(test_olsr_get_string(object, "router_id"), "10.254.1.1");
+
+    NW_TEST_CHECK(json_object_object_get_ex(object, "link_local", &link_local));
+    NW_TEST_CHECK_INT(json_object_array_length(link_local), 2);
+    NW_TEST_CHECK_STR(json_object_get_string(json_object_array_get_idx(link_local, 0)), "10.254.1.1%wlan0");
+    NW_TEST_CHECK_STR(json_object_get_string(json_object_array_get_idx(link_local, 1)), "10.254.1.2%eth0");
+
+    NW_TEST_CHECK(json_object_object_get_ex(object, "exported_routes", &exported_routes));
+    NW_TEST_CHECK_INT(json_object_array_length(exported_routes), 2);
+    NW_TEST_CHECK_STR(test_olsr_get_string(json_object_array_get_idx(exported_routes, 0), "dst_prefix"), "10.20.0.0/24");
+    NW_TEST_CHECK_STR(test_olsr_get_string(json_object_array_get_idx(exported_routes, 1), "dst_prefix"), "0.0.0.0/0");
+
+    NW_TEST_CHECK(json_object_object_get_ex(object, "neighbours", &neighbours));
+    NW_TEST_CHECK_INT(json_object_array_length(neighbours), 3);
+
+    json_object *neighbour = json_object_array_get_idx(neighbours, 0);
+    NW_TEST_CHECK_STR(test_olsr_get_string(neighbour, "address"), "10.254.2.1");
+    NW_TEST_CHECK_STR(test_olsr_get_string(neighbour, "interface"), "wlan0");
+    NW_TEST_CHECK(test_olsr_get_double(neighbour, "lq") == 0.949);
+    NW_TEST_CHECK(test_olsr_get_double(neighbour, "ilq") == 0.961);
+    NW_TEST_CHECK(test_olsr_get_double(neighbour, "cost") == 1.096);
+
+    neighbour = json_object_array_get_idx(neighbours, 1);
+    NW_TEST_CHECK_STR(test_olsr_get_string(neighbour, "address"), "10.254.3.1");
+    NW_TEST_CHECK_STR(test_olsr_get_string(neighbour, "interface"), "eth0");
+
+    /* Links over unknown local addresses are reported without an interface. */
+    neighbour = json_object_array_get_idx(neighbours, 2);
+    NW_TEST_CHECK_STR(test_olsr_get_string(neighbour, "address"), "10.254.4.1");
+    NW_TEST_CHECK(!test_olsr_get_string(neighbour, "interface"));
+
+    json_object_put(object);
+  }
+
+  test_olsr_acquire(data, length);
+
+  free(data);
+  return nw_test_result();
+}
@@ -0,0 +1,107 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../modules/routing_olsr2.c"
+
+static const char *test_olsr2_get_string(json_object *object, const char *key)
+{
+  json_object *value;
+  if (!object || !json_object_object_get_ex(object, key, &value))
+    return NULL;
+  return json_object_get_string(value);
+}
+
+static int test_olsr2_get_int(json_object *object, const char *key)
+{
+  json_object *value;
+  if (!object || !json_object_object_get_ex(object, key, &value))
+    return -1;
+  return json_object_get_int(value);
+}
+
+/**
+ * Parses the concatenated telnet responses fed in chunks of the given size.
+ */
+static json_object *test_olsr2_parse(const char *data, size_t length, size_t chunk)
+{
+  struct olsr2_client oc;
+  memset(&oc, 0, sizeof(oc));
+  oc.object = json_object_new_object();
+  oc.exported_routes = json_object_new_array();
+  json_object_object_add(oc.object, "exported_routes", oc.exported_routes);
+  oc.neighbours = json_object_new_array();
+  json_object_object_add(oc.object, "neighbours", oc.neighbours);
+  nw_json_stream_init(&oc.session.parser, nw_routing_olsr2_parse, &oc);
+  oc.session.parser.sequence = true;
+
+  int result = 0;
+  for (size_t offset = 0; offset < length; offset += chunk) {
+    result = nw_json_stream_parse(&oc.session.parser, data + offset, length - offset < chunk ? length - offset : chunk);
+    NW_TEST_CHECK(result >= 0);
+  }
+
+  /* The last document is complete once all responses have been received. */
+  NW_TEST_CHECK_INT(result, 1);
+  json_object_put(oc.lan_metric);
+  return oc.object;
+}
+
+int main(int argc, char **argv)
+{
+  size_t length;
+  char *data = nw_test_read_fixture("olsr2_telnet.json", &length);
+
+  const size_t chunks[] = { 1, 13, 256, 65536 };
+  for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+    json_object *object = test_olsr2_parse(data, length, chunks[c]);
+    json_object *neighbours, *exported_routes;
+
+    NW_TEST_CHECK_STR(test_olsr2_get_string(object, "router_id"), "fd25:fc6f:1::1");
+
+    /* Attached networks of other routers are not exported routes. */
+    NW_TEST_CHECK(json_object_object_get_ex(object, "exported_routes", &exported_routes));
+    NW_TEST_CHECK_INT(json_object_array_length(exported_routes), 2);
+    json_object *route = json_object_array_get_idx(exported_routes, 0);
+    NW_TEST_CHECK_STR(test_olsr2_get_string(route, "dst_prefix"), "fd25:fc6f:1:10::/64");
+    NW_TEST_CHECK_INT(test_olsr2_get_int(route, "metric"), 1);
+    route = json_object_array_get_idx(exported_routes, 1);
+    NW_TEST_CHECK_STR(test_olsr2_get_string(route, "dst_prefix"), "::/0");
+    NW_TEST_CHECK_INT(test_olsr2_get_int(route, "metric"), 8);
+
+    NW_TEST_CHECK(json_object_object_get_ex(object, "neighbours", &neighbours));
+    NW_TEST_CHECK_INT(json_object_array_length(neighbours), 2);
+
+    json_object *neighbour = json_object_array_get_idx(neighbours, 0);
+    NW_TEST_CHECK_STR(test_olsr2_get_string(neighbour, "address"), "fd25:fc6f:2::1");
+    NW_TEST_CHECK_STR(test_olsr2_get_string(neighbour, "link_address"), "fe80::c:42ff:fe00:101");
+    NW_TEST_CHECK_STR(test_olsr2_get_string(neighbour, "interface"), "wlan0");
+    NW_TEST_CHECK_STR(test_olsr2_get_string(neighbour, "status"), "symmetric");
+    NW_TEST_CHECK_INT(test_olsr2_get_int(neighbour, "cost"), 2105088);
+
+    neighbour = json_object_array_get_idx(neighbours, 1);
+    NW_TEST_CHECK_STR(test_olsr2_get_string(neighbour, "address"), "fd25:fc6f:3::1");
+    NW_TEST_CHECK_STR(test_olsr2_get_string(neighbour, "status"), "heard");
+
+    json_object_put(object);
+  }
+
+  free(data);
+  return nw_test_result();
+}
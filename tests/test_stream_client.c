@@ -0,0 +1,119 @@
+/*
+ * nodewatcher-agent - remote monitoring daemon
+ *
+ * Copyright (C) 2015 Jernej Kos <jernej@kos.mx>
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Affero General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Affero General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "test.h"
+
+#include "../common/stream_client.c"
+
+/* Lines received from the client */
+static char lines[8][NW_STREAM_CLIENT_MAX_LINE];
+static int num_lines;
+
+static void test_line(struct nw_stream_client *client, char *line)
+{
+  if (num_lines < 8)
+    snprintf(lines[num_lines], sizeof(lines[num_lines]), "%s", line);
+  num_lines++;
+}
+
+static void test_client_init(struct nw_stream_client *client)
+{
+  struct nw_endpoint endpoint = { .name = "test", };
+  nw_stream_client_init(client, &endpoint, NW_STREAM_CLIENT_LINES);
+  client->line = test_line;
+  client->active = true;
+  num_lines = 0;
+}
+
+/**
+ * Feeds data to the line assembler in chunks of the given sizes, repeating
+ * the last size until all data has been consumed.
+ */
+static void test_feed(struct nw_stream_client *client, const char *data, const int *sizes, int num_sizes)
+{
+  char chunk[4096];
+  int offset = 0, length = strlen(data);
+  for (int i = 0; offset < length; i++) {
+    int size = sizes[i < num_sizes ? i : num_sizes - 1];
+    if (size > length - offset)
+      size = length - offset;
+
+    /* Stream buffers are not NULL-terminated at line boundaries. */
+    memcpy(chunk, data + offset, size);
+    chunk[size] = 'X';
+    nw_stream_client_read_lines(client, chunk, size);
+    offset += size;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  struct nw_stream_client client;
+  const char *dump =
+    "BABEL 1.0\n"
+    "add neighbour 1a2b3c address fe80::1 if wlan0 reach ffff rxcost 96 txcost 96 cost 96\n"
+    "ok\n";
+
+  /* Every split position of a single read into two reads. */
+  for (size_t split = 0; split <= strlen(dump); split++) {
+    int sizes[] = { split, 4096 };
+    test_client_init(&client);
+    test_feed(&client, dump, sizes, 2);
+
+    NW_TEST_CHECK_INT(num_lines, 3);
+    NW_TEST_CHECK_STR(lines[0], "BABEL 1.0");
+    NW_TEST_CHECK_STR(lines[1], "add neighbour 1a2b3c address fe80::1 if wlan0 reach ffff rxcost 96 txcost 96 cost 96");
+    NW_TEST_CHECK_STR(lines[2], "ok");
+  }
+
+  /* Byte-by-byte reads. */
+  int single[] = { 1 };
+  test_client_init(&client);
+  test_feed(&client, dump, single, 1);
+  NW_TEST_CHECK_INT(num_lines, 3);
+  NW_TEST_CHECK_STR(lines[2], "ok");
+
+  /* Partial lines are kept until the newline arrives. */
+  test_client_init(&client);
+  nw_stream_client_read_lines(&client, "add self", 8);
+  NW_TEST_CHECK_INT(num_lines, 0);
+  nw_stream_client_read_lines(&client, " abc id abc\nd", 13);
+  NW_TEST_CHECK_INT(num_lines, 1);
+  NW_TEST_CHECK_STR(lines[0], "add self abc id abc");
+  nw_stream_client_read_lines(&client, "one\n", 4);
+  NW_TEST_CHECK_INT(num_lines, 2);
+  NW_TEST_CHECK_STR(lines[1], "done");
+
+  /* Overly long lines are dropped as a whole, split or not. */
+  static char data[3 * NW_STREAM_CLIENT_MAX_LINE];
+  memset(data, 'a', 2 * NW_STREAM_CLIENT_MAX_LINE);
+  strcpy(data + 2 * NW_STREAM_CLIENT_MAX_LINE, "\nok\n");
+  int sizes[] = { 700 };
+  test_client_init(&client);
+  test_feed(&client, data, sizes, 1);
+  NW_TEST_CHECK_INT(num_lines, 1);
+  NW_TEST_CHECK_STR(lines[0], "ok");
+
+  /* No more lines are reported once the session is closed by a callback. */
+  test_client_init(&client);
+  client.active = false;
+  nw_stream_client_read_lines(&client, "ok\nok\n", 6);
+  NW_TEST_CHECK_INT(num_lines, 0);
+
+  return nw_test_result();
+}